@@ -4,34 +4,130 @@
 * Assignment 7: Balance the MiP!
 *******************************************************************************/
 
-#include <usefulincludes.h>
-#include <roboticscape.h>
+#include <signal.h>
+#include "mip_hal.h"
+#include "periodic_task.h"
+#include "seqlock.h"
+#include "mip_trace.h"
+#include "daniel_filter.h"
+#include "biquad.h"
+#include "q31_filter.h"
+#include "mip_config.h"
+#include "c2d.h"
+#include "tilt_estimator.h"
+#include "mip_imu.h"
+#include "mip_safety.h"
+#include "mip_watchdog.h"
+#include "mip_reactor.h"
+#include "state_bus.h"
+#include "mip_rt.h"
+#include "mip_io.h"
+#include "mip_recorder.h"
 #include "./balance_by_daniel.h"
 
+// the simulator steps everything itself in virtual time
+#if REACTOR_RUNTIME && !defined(MIP_SIM)
+#define ON_REACTOR  1
+#else
+#define ON_REACTOR  0
+#endif
+
 // function declarations
 int on_pause_pressed();
 int on_pause_released();
-int imu_callback();
-void* inner_loop();
-void* outer_loop();
+int imu_callback(const mip_imu_sample_t* samples, int n);
+int inner_loop_step();
+int outer_loop_step();
+int supervise_mip(const mip_state_t* state, float u);
+int initialize_supervisor();
+int print_supervisor_stats();
+int initialize_watchdog();
+int watchdog_step();
+int on_watchdog_trip(watchdog_beat_t* beat);
+int main_step();
+int start_task(periodic_task_t* task);
+int notify_reload();
+int on_state_change();
+void on_sigint(int signo);
+#if ON_REACTOR
+int initialize_reactor();
+int state_step();
+int imu_arrived(const mip_imu_sample_t* samples, int n);
+int imu_event_step();
+#endif
 int initialize_angle_filters();
+int initialize_controllers();
 int reset_controllers();
-int disarm_mip();
+int disarm_mip(int writer);
 int arm_mip();
-int zero_filter();
-daniel_filter_t create_daniel_filter(int order, float dt, float* num, float* den, float gain, float sat);
-float step_filter(daniel_filter_t* filter, float new_input);
+int print_latency_stats();
+int initialize_io();
+int initialize_recorder();
+int record_tick(const mip_state_t* state, const mip_refs_t* refs, float u);
+balance_config_t default_config();
+mip_imu_config_t imu_settings(const balance_config_t* c);
+int load_config(const char* name, balance_config_t* c);
+int load_roots(mip_config_t* file, const char* key, float* pairs, int* npairs);
+int discretize_controllers(balance_config_t* c);
+int build_controller(controller_slot_t* slot, int order, float dt, float* num,\
+                     float* den, float gain, float sat);
+int publish_controller(controller_slot_t* slot, int carry_over);
+float step_controller(controller_slot_t* slot, float input);
+float controller_sat(controller_slot_t* slot);
+int reload_controllers();
+void on_sighup(int signo);
+#ifdef MIP_SIM
+int run_simulation(int argc, char* argv[], double reload_at, double stall_at);
+#define MIP_SIM_USAGE " [-r reload time] [-s IMU stall time] [seconds] "\
+                      "[initial theta] [gyro bias]"
+#else
+#define MIP_SIM_USAGE ""
+#endif
 
 // variable declarations
-imu_data_t data;
-float g_angle;
+float g_angle;              // imu_callback's own, published in mip_state
 float a_angle;
 mip_state_t mip_state;
 mip_refs_t  mip_refs;
-daniel_filter_t lpass;
-daniel_filter_t hpass;
-daniel_filter_t iloop;
-daniel_filter_t oloop;
+seqlock_t   state_lock;
+seqlock_t   refs_lock;
+#ifdef MIP_FIXED
+angle_filter_t lpass;
+angle_filter_t hpass;
+#else
+tilt_estimator_t estimator;
+#endif
+controller_slot_t iloop;
+controller_slot_t oloop;
+balance_config_t config;
+const char* config_name = NULL;
+volatile sig_atomic_t reload_requested = 0;
+periodic_task_t inner_task;
+periodic_task_t outer_task;
+periodic_subtask_t outer_subtask;
+supervisor_t supervisor;
+mip_watchdog_t watchdog;
+watchdog_beat_t* imu_beat;
+watchdog_beat_t* inner_beat;
+watchdog_beat_t* outer_beat;
+periodic_task_t watchdog_task;
+state_sub_t main_sub;
+rt_usage_t rt_start;
+rt_usage_t rt_end;
+atomic_ulong watchdog_disarms;
+latency_stats_t latency;
+mip_recorder_t recorder;
+const char* recorder_fields[] = {"theta", "a_angle", "g_angle", "phi", "u",\
+                                 "theta_r", "armed", "imu_age_ms"};
+#if ON_REACTOR
+mip_reactor_t reactor;
+reactor_source_t* imu_event;
+reactor_source_t* state_event;
+periodic_task_t main_task;
+periodic_task_t imu_drain_task;
+seqlock_t imu_mailbox_lock;
+mip_imu_sample_t imu_mailbox;
+#endif
 
 /*******************************************************************************
 * int main() 
@@ -41,13 +137,43 @@ daniel_filter_t oloop;
 * - main while loop that checks for EXITING condition
 * - cleanup_cape() at the end
 *******************************************************************************/
-int main()
+int main(int argc, char* argv[])
 {
+  int c;
+#ifdef MIP_SIM
+  double reload_at = -1;
+  double stall_at = -1;
+#endif
+
+  // defaults from balance_by_daniel.h, then the config file if there is one
+  config = default_config();
+  while((c = getopt(argc, argv, "+c:r:s:")) != -1)
+  {
+    switch(c)
+    {
+      case 'c': config_name = optarg; break;
+#ifdef MIP_SIM
+      case 'r': reload_at = atof(optarg); break;
+      case 's': stall_at = atof(optarg); break;
+#endif
+      default:
+        printf("usage: %s [-c config]%s\n", argv[0], MIP_SIM_USAGE);
+        return -1;
+    }
+  }
+  if(config_name != NULL && load_config(config_name, &config)) return -1;
+  if(discretize_controllers(&config)) return -1;
+
 	// always initialize cape library first
 	initialize_cape();
   
+  // shared state is published through seqlocks, see balance_by_daniel.h
+  seqlock_init(&state_lock, STATE_WRITERS);
+  seqlock_init(&refs_lock, REFS_WRITERS);
+
   // Initialize the mip as disarmed
-  disarm_mip();
+  if(initialize_io()) return -1;
+  disarm_mip(STATE_WRITER_SUPERVISOR);
 	
   // do your own initialization here
   printf("\n");
@@ -59,18 +185,24 @@ int main()
   set_pause_pressed_func(&on_pause_pressed);
   set_pause_released_func(&on_pause_released);
 
-  // Initialize DMP Mode on IMU
-  imu_config_t imu_config = get_default_imu_config();
-  imu_config.enable_magnetometer=1;
-  imu_config.dmp_sample_rate=SAMPLE_FREQUENCY;
-  
-  if(initialize_imu_dmp(&data,imu_config))
+  if(initialize_angle_filters() < 0 || initialize_controllers() < 0)
   {
-    printf("Could not initialize IMU\n");
+    printf("Could not create filters\n");
     return -1;
   }
-
-  initialize_angle_filters();
+  if(initialize_supervisor() || initialize_watchdog()\
+     || initialize_recorder())
+  {
+    return -1;
+  }
+#if OUTER_LOOP_PHASE_LOCKED
+  if(periodic_subtask_init(&outer_subtask, "outer_loop", &outer_loop_step,\
+                           config.inner_loop_frequency\
+                           /config.outer_loop_frequency, OUTER_LOOP_PHASE))
+  {
+    return -1;
+  }
+#endif
   
   // Initialize gyro angle to 0
   g_angle   = 0.0;
@@ -78,78 +210,148 @@ int main()
   mip_state.phi_right = 0.0;
   mip_state.phi_left  = 0.0;
   mip_state.theta     = 0.0;
+  mip_state.a_angle   = 0.0;
+  mip_state.g_angle   = 0.0;
   mip_state.phi       = 0.0;
   mip_state.u         = 0.0;
   mip_refs.theta_r    = 0.0;
-  mip_refs.phi_r      = PHI_REF;
+  mip_refs.phi_r      = config.phi_ref;
   
-  set_imu_interrupt_func(&imu_callback);
+  // Start the IMU, DMP or FIFO, handing its samples to imu_callback, or
+  // with the DMP on the reactor to imu_arrived to pass on
+#if ON_REACTOR
+  if(initialize_reactor()) return -1;
+  if(mip_imu_start(imu_settings(&config), config.imu_mode == MIP_IMU_DMP\
+                   ? &imu_arrived : &imu_callback))
+#else
+  if(mip_imu_start(imu_settings(&config), &imu_callback))
+#endif
+  {
+    printf("Could not initialize IMU\n");
+    return -1;
+  }
+  signal(SIGHUP, on_sighup);
+  signal(SIGINT, on_sigint);
   
+#ifndef MIP_SIM
+  // nothing the loops touch from here on should fault
+  rt_set_cpu(NULL, MAIN_CPU);
+  if(RT_LOCK_MEMORY) rt_lock_memory(RT_HEAP_PREFAULT, RT_STACK_PREFAULT);
+#endif
+
   // done initializing so set state to RUNNING
-  set_state(RUNNING);
+  state_bus_subscribe(&main_sub, "main");
+  state_bus_set(RUNNING);
+  TRACE_START();
 
+#ifdef MIP_SIM
+  // free-running closed loop against the plant model, no threads or sleeps
+  run_simulation(argc-optind, argv+optind, reload_at, stall_at);
+#else
   // pause to let some important initialization to occur
   usleep(100000);
   
+#if !INNER_LOOP_EVENT_DRIVEN
   // start inner loop
-  pthread_t inner_loop_thread;
-  pthread_create(&inner_loop_thread, NULL, inner_loop, (void*) NULL);
+  periodic_task_init(&inner_task, "inner_loop", &inner_loop_step,\
+                     config.inner_loop_frequency, INNER_LOOP_PRIORITY,\
+                     INNER_LOOP_OVERRUN);
+  inner_task.cpu = INNER_LOOP_CPU;
+  inner_task.on_state = &on_state_change;
+  start_task(&inner_task);
+#endif
 
+#if !OUTER_LOOP_PHASE_LOCKED
   // start outer loop
-  pthread_t outer_loop_thread;
-  pthread_create(&outer_loop_thread, NULL, outer_loop, (void*) NULL);
-  
-  usleep(1000000*START_DELAY);
+  periodic_task_init(&outer_task, "outer_loop", &outer_loop_step,\
+                     config.outer_loop_frequency, OUTER_LOOP_PRIORITY,\
+                     OUTER_LOOP_OVERRUN);
+  outer_task.cpu = OUTER_LOOP_CPU;
+  start_task(&outer_task);
+#endif
+
+  // watch them, from above all of their priorities and, on the reactor, from
+  // outside it so it can't stall the watchdog along with them
+  periodic_task_init(&watchdog_task, "watchdog", &watchdog_step,\
+                     config.watchdog_frequency, WATCHDOG_PRIORITY,\
+                     OVERRUN_SKIP);
+  watchdog_task.cpu = WATCHDOG_CPU;
+  periodic_task_start(&watchdog_task);
   printf("\n\n");
-  //printf(" %7.3f |", hpass.num[0]);
-  //printf(" %7.3f |", hpass.num[1]);
-  //printf(" %7.3f |", hpass.num[2]);
-  //printf(" %7.3f |", hpass.num[3]);
-  //printf("\n");
-  //printf(" %7.3f |", hpass.den[0]);
-  //printf(" %7.3f |", hpass.den[1]);
-  //printf(" %7.3f |", hpass.den[2]);
-  //printf(" %7.3f |", hpass.den[3]);
-  //printf("\n");
-
-
-  // Keep looping until state changes to EXITING
-	while(get_state()!=EXITING)
-  {
-    /*
-    printf("\r");
-    printf(" %7.2f |", mip_state.theta);
-    printf(" %7.2f |", a_angle);
-    printf(" %10.5f |", lpass.outputs[0]);
-    printf(" %10.5f |", lpass.outputs[1]);
-    printf(" %10.5f |", lpass.outputs[2]);
-    printf(" %10.5f |", lpass.outputs[3]);
-    //printf(" %7.2f |", iloop.num[2]);
-    //printf(" %7.2f |", iloop.num[3]);
-    //printf(" %d |", mip_state.armed);
-    //printf(" %d |", get_state());
-    fflush(stdout);
-    // */
 
-    if(mip_state.armed)
-    {
-      //printf("armed\n");
-      if(fabs(mip_state.theta)>TIP_ANGLE || get_state()==PAUSED) disarm_mip();
-    }
-    else
-    {
-      if(fabs(mip_state.theta)<START_ANGLE && get_state()==RUNNING) arm_mip();
-    }
+  // faults and switches count from here, with every thread started
+  rt_usage_snapshot(&rt_start);
+
+  // Keep looping until state changes to EXITING.  Arming and disarming are
+  // up to supervise_mip in the inner loop, this thread only reloads.
+#if ON_REACTOR
+  // this thread is the reactor from here on, main_step stops it
+  reactor_run(&reactor);
+#else
+  while(get_state()!=EXITING)
+  {
+    main_step();
       
-    // We'll deal with everything in different threads, so just chill.
-		usleep(100000);
-	}
+    // We'll deal with everything in different threads, so just chill,
+    // until the next check or a state change
+    state_bus_sleep(&main_sub, NSEC_PER_SEC/config.supervisor_frequency);
+  }
+#endif
+
+  // while the threads are still there to read
+  rt_usage_snapshot(&rt_end);
+
+  // the watchdog first, it would take the others stopping for a stall
+  periodic_task_stop(&watchdog_task);
+  periodic_task_stop(&inner_task);
+  periodic_task_stop(&outer_task);
+#if !INNER_LOOP_EVENT_DRIVEN
+  print_periodic_stats(&inner_task);
+#endif
+#if OUTER_LOOP_PHASE_LOCKED
+  print_subtask_stats(&outer_subtask, config.inner_loop_frequency);
+#else
+  print_periodic_stats(&outer_task);
+#endif
+  print_seqlock_stats("mip_state", &state_lock);
+  print_seqlock_stats("mip_refs", &refs_lock);
+  print_periodic_stats(&watchdog_task);
+#if ON_REACTOR
+  print_reactor_stats(&reactor);
+#endif
+  print_state_bus_stats();
+  print_rt_usage(&rt_start, &rt_end);
+#endif
+  // the loops have stopped, so this writes any dump still waiting
+  recorder_close(&recorder);
+  print_latency_stats();
+  print_supervisor_stats();
+  print_mip_io_stats();
+  print_recorder_stats(&recorder);
+  print_watchdog_stats(&watchdog);
+  printf("watchdog disarms: %lu\n", atomic_load(&watchdog_disarms));
+  print_mip_imu_stats();
+  TRACE_STOP();
 
   // Say goodbye
   printf("Goodbye Cruel World\n");
   
   // exit cleanly
-  power_off_imu();
+  mip_imu_stop();
+#if ON_REACTOR
+  reactor_close(&reactor);
+#endif
+#ifdef MIP_FIXED
+  destroy_angle_filter(&lpass);
+  destroy_angle_filter(&hpass);
+#else
+  destroy_tilt_estimator(&estimator);
+#endif
+  for(c=0; c<2; c++)
+  {
+    destroy_controller_filter(&iloop.filters[c]);
+    destroy_controller_filter(&oloop.filters[c]);
+  }
   cleanup_cape();
   return 0;
 }
@@ -165,12 +367,12 @@ int on_pause_released()
   // toggle betewen paused and running modes
   if(get_state()==RUNNING)
   {
-    set_state(PAUSED);
+    state_bus_set(PAUSED);
     set_led(RED,ON);
   }
   else if(get_state()==PAUSED)
   {
-    set_state(RUNNING);
+    state_bus_set(RUNNING);
     set_led(RED,OFF);
   }
   return 0;
@@ -195,7 +397,7 @@ int on_pause_pressed()
 		if(get_pause_button() == RELEASED) return 0;
 	}
 	printf("\nlong press detected, shutting down\n");
-	set_state(EXITING);
+	state_bus_set(EXITING);
 	return 0;
 }
 
@@ -206,21 +408,24 @@ int on_pause_pressed()
  ******************************************************************************/
 int reset_controllers()
  {
-  zero_filter(&iloop);
-  zero_filter(&oloop);
+  // each loop zeroes its own filter at the start of its next tick
+  atomic_store_explicit(&iloop.reset, 1, memory_order_relaxed);
+  atomic_store_explicit(&oloop.reset, 1, memory_order_relaxed);
   return 0;
  }
 
 /*******************************************************************************
- * int disarm_mip()
+ * int disarm_mip(int writer)
  *
- * Disarm the controllers, disable motors
+ * Disarm the controllers, disable motors.  writer is the calling thread's
+ * mip_state writer, STATE_WRITER_SUPERVISOR or STATE_WRITER_WATCHDOG.
  ******************************************************************************/
-int disarm_mip()
+int disarm_mip(int writer)
  {
-  disable_motors();
-  //set_motor_all(0);
+  mip_io_disable();
+  seqlock_write_begin(&state_lock, writer);
   mip_state.armed = 0;
+  seqlock_write_end(&state_lock, writer);
   return 0;
  }
  
@@ -232,202 +437,1218 @@ int disarm_mip()
 int arm_mip()
  {
   reset_controllers();
-  set_encoder_pos(ENCODER_CHANNEL_L,0);
-  set_encoder_pos(ENCODER_CHANNEL_R,0);
+  mip_io_zero_encoders();
+  seqlock_write_begin(&state_lock, STATE_WRITER_SUPERVISOR);
   mip_state.armed = 1;
-  enable_motors();
+  seqlock_write_end(&state_lock, STATE_WRITER_SUPERVISOR);
+  mip_io_enable();
   return 0;
  }
 
 /*******************************************************************************
- * void* inner_loop()
+ * int supervise_mip(const mip_state_t* state, float u)
  *
- * Inner loop controller
+ * The safety supervisor, once per inner loop tick with the state that tick
+ * used and the command it computed.  Disarms on a tripped limit or a pause
+ * before the command goes out, arms again once upright and running.
+ * Returns 1 if the motors should get u.
  ******************************************************************************/
-void* inner_loop(void* ptr)
+int supervise_mip(const mip_state_t* state, float u)
 {
-  // Initialize shit
-  float dt = 1.0/INNER_LOOP_FREQUENCY;
-  float iloop_num[] = D1_NUM;
-  float iloop_den[] = D1_DEN;
-  iloop = create_daniel_filter(D1_ORDER,dt,iloop_num,iloop_den,D1_GAIN,D1_SAT);
-  
-  float theta_error;
-  
-  while(get_state()!=EXITING)
+  supervisor_t* s = &supervisor;
+  float sat = controller_sat(&iloop);
+  float age = (mip_imu_time_ns() - state->imu_ns)/1e9;
+  int64_t delay;
+  int i, trip = 0;
+
+  s->ticks++;
+  if(state->armed)
   {
-    // Run balance filter
-    theta_error = mip_refs.theta_r - mip_state.theta;
-    mip_state.u = step_filter(&iloop,theta_error);
-    if(mip_state.armed)
+    // check every limit so each keeps its own hold count
+    trip |= safety_limit_check(&s->limits[SAFETY_TIP], state->theta);
+    trip |= safety_limit_check(&s->limits[SAFETY_SATURATION],\
+                               sat > 0 ? u/sat : 0);
+    trip |= safety_limit_check(&s->limits[SAFETY_RUNAWAY],\
+                               state->phi - mip_refs.phi_r);
+    trip |= safety_limit_check(&s->limits[SAFETY_IMU_STALL], age);
+    if(get_state()==PAUSED)
     {
-      set_motor(MOTOR_CHANNEL_L, MOTOR_POLARITY_L * mip_state.u); 
-      set_motor(MOTOR_CHANNEL_R, MOTOR_POLARITY_R * mip_state.u);
+      s->pauses++;
+      recorder_trigger(&recorder, "pause");
+      disarm_mip(STATE_WRITER_SUPERVISOR);
+      return 0;
     }
-    // always sleep at some point
-    usleep(1000000/INNER_LOOP_FREQUENCY);
+    if(!trip) return 1;
+    for(i=0; i<SAFETY_LIMITS && s->limits[i].count < s->limits[i].hold; i++);
+    recorder_trigger(&recorder, i<SAFETY_LIMITS ? s->limits[i].name : "trip");
+    disarm_mip(STATE_WRITER_SUPERVISOR);
+    delay = mip_imu_time_ns() - state->imu_ns;
+    if(delay > s->disarm_ns_max) s->disarm_ns_max = delay;
+    return 0;
   }
-  //disarm_mip();
-  return NULL;
+
+  // upright, running and seeing fresh samples, after START_DELAY and with
+  // every loop keeping up
+  if(get_state()!=RUNNING || s->ticks <= s->start_ticks\
+     || !watchdog_ok(&watchdog) || fabs(state->theta) >= config.start_angle\
+     || state->imu_ns == 0\
+     || (config.imu_stall_time > 0 && age >= config.imu_stall_time))
+  {
+    return 0;
+  }
+  for(i=0; i<SAFETY_LIMITS; i++) safety_limit_reset(&s->limits[i]);
+  s->arms++;
+  arm_mip();
+
+  // the controllers start over on the next tick
+  return 0;
 }
 
 /*******************************************************************************
- * void* outer_loop()
+ * int initialize_supervisor()
  *
- * Outer loop controller
+ * Safety limits from the config, checked at the inner loop rate.  D1 counts
+ * as saturated within 0.1% of D1_SAT, which Q31 rounding never quite reaches.
  ******************************************************************************/
-void* outer_loop()
+int initialize_supervisor()
 {
-  // Initialize shit
-  float dt = 1.0/OUTER_LOOP_FREQUENCY;
-  float oloop_num[] = D2_NUM;
-  float oloop_den[] = D2_DEN;
-  oloop = create_daniel_filter(D2_ORDER,dt,oloop_num,oloop_den,D2_GAIN,D2_SAT);
-  
-  float phi_error;
+  double f = config.inner_loop_frequency;
+  memset(&supervisor, 0, sizeof(supervisor_t));
+  supervisor.start_ticks = config.start_delay*f;
+  if(safety_limit_init(&supervisor.limits[SAFETY_TIP], "tip",\
+                       config.tip_angle, 0, f)\
+     || safety_limit_init(&supervisor.limits[SAFETY_SATURATION], "saturation",\
+                          config.saturation_time > 0 ? 0.999 : 0,\
+                          config.saturation_time, f)\
+     || safety_limit_init(&supervisor.limits[SAFETY_RUNAWAY], "runaway",\
+                          config.runaway_angle, 0, f)\
+     || safety_limit_init(&supervisor.limits[SAFETY_IMU_STALL], "imu stall",\
+                          config.imu_stall_time, 0, f)) return -1;
+  return 0;
+}
 
-  while(get_state()!=EXITING)
+/*******************************************************************************
+ * int initialize_watchdog()
+ *
+ * Heartbeats for imu_callback, once per batch, and the two loops
+ ******************************************************************************/
+int initialize_watchdog()
+{
+  mip_imu_config_t imu = imu_settings(&config);
+  watchdog_init(&watchdog, &on_watchdog_trip);
+  imu_beat = watchdog_add(&watchdog, "imu", (double)imu.sample_rate/imu.batch,\
+                          config.watchdog_misses, config.watchdog_near_miss);
+  inner_beat = watchdog_add(&watchdog, "inner_loop",\
+                            config.inner_loop_frequency,\
+                            config.watchdog_misses, config.watchdog_near_miss);
+  outer_beat = watchdog_add(&watchdog, "outer_loop",\
+                            config.outer_loop_frequency,\
+                            config.watchdog_misses, config.watchdog_near_miss);
+  if(imu_beat == NULL || inner_beat == NULL || outer_beat == NULL) return -1;
+  return 0;
+}
+
+/*******************************************************************************
+ * int watchdog_step()
+ *
+ * One check, released by watchdog_task or every sample in the simulator
+ ******************************************************************************/
+int watchdog_step()
+{
+  watchdog_check(&watchdog, mip_imu_time_ns());
+  return 0;
+}
+
+/*******************************************************************************
+ * int on_watchdog_trip(watchdog_beat_t* beat)
+ *
+ * A loop has stopped.  Called on every check until it runs again, so an arm
+ * that raced the first disarm is undone on the next check.  This runs above
+ * every mip_state writer, so it may have preempted one mid-write; without a
+ * fresh snapshot it disarms anyway.
+ ******************************************************************************/
+int on_watchdog_trip(watchdog_beat_t* beat)
+{
+  mip_state_t state;
+  if(seqlock_read(&state_lock, &state, &mip_state, sizeof(mip_state_t)) == 0\
+     && !state.armed) return 0;
+  recorder_trigger(&recorder, "watchdog");
+  disarm_mip(STATE_WRITER_WATCHDOG);
+  atomic_fetch_add_explicit(&watchdog_disarms, 1, memory_order_relaxed);
+  return 0;
+}
+
+/*******************************************************************************
+ * int main_step()
+ *
+ * The main thread's work between sleeps, or the reactor's main task and
+ * state event: reload when asked to, stop the reactor once EXITING
+ ******************************************************************************/
+int main_step()
+{
+  if(reload_requested)
   {
-    mip_state.phi_right = (get_encoder_pos(ENCODER_CHANNEL_R) * TWO_PI)\
-                          /(ENCODER_POLARITY_R * GEAR_RATIO * ENCODER_TICKS);
-    mip_state.phi_left  = (get_encoder_pos(ENCODER_CHANNEL_L) * TWO_PI)\
-                          /(ENCODER_POLARITY_L * GEAR_RATIO * ENCODER_TICKS);
-                          
-    mip_state.phi = (mip_state.phi_right + mip_state.phi_left)/2.0;
-    phi_error = mip_refs.phi_r - mip_state.phi - mip_state.theta;
-    mip_refs.theta_r = step_filter(&oloop,phi_error);
-    usleep(1000000/OUTER_LOOP_FREQUENCY);
+    reload_requested = 0;
+    reload_controllers();
   }
-  return NULL;
+#if ON_REACTOR
+  if(get_state()==EXITING) reactor_stop(&reactor);
+#endif
+  return 0;
 }
 
 /*******************************************************************************
- * int imu_callback()
- * 
- * Called when a new IMU DMP value is received
+ * int start_task(periodic_task_t* task)
+ *
+ * Start a loop in its own thread, or on the reactor with REACTOR_RUNTIME
  ******************************************************************************/
-int imu_callback()
+int start_task(periodic_task_t* task)
 {
-  // Do something?
-  g_angle += data.gyro[0]/SAMPLE_FREQUENCY*DEG_TO_RAD;
-  a_angle = atan2(-data.accel[2],data.accel[1]);
-  mip_state.theta = step_filter(&hpass,g_angle) + step_filter(&lpass,a_angle)\
-                    + CAPE_MOUNT_ANGLE;
+#if ON_REACTOR
+  return reactor_add_task(&reactor, task) == NULL ? -1 : 0;
+#else
+  return periodic_task_start(task);
+#endif
+}
+
+/*******************************************************************************
+ * int notify_reload()
+ *
+ * Wake the reactor's state event after a reload request, rather than leave
+ * it to the next main task release.  State changes wake it through the state
+ * bus.  Signal safe.
+ ******************************************************************************/
+int notify_reload()
+{
+#if ON_REACTOR
+  if(state_event != NULL) return reactor_notify(state_event);
+#endif
   return 0;
 }
 
 /*******************************************************************************
- * int initialize_angle_filters()
+ * int on_state_change()
  *
- * Initialize the filters that work on the angle stuff
+ * A state change seen by the inner loop's thread between ticks.  A pause or
+ * an exit disarms right away instead of at the next tick, from the same
+ * thread supervise_mip runs in.
  ******************************************************************************/
-int initialize_angle_filters()
+int on_state_change()
 {
-  // Initialize filters
-  float dt = 1.0/(float)SAMPLE_FREQUENCY;
-  float lpass_num[] = {dt/TIME_CONSTANT,0};
-  float lpass_den[] = {1, dt/TIME_CONSTANT-1};
-  lpass = create_daniel_filter(1,dt,lpass_num,lpass_den,1,0);
-  
-  float hpass_num[] = {1-dt/TIME_CONSTANT,dt/TIME_CONSTANT-1};
-  float hpass_den[] = {1,dt/TIME_CONSTANT-1};
-  hpass  = create_daniel_filter(1,dt,hpass_num,hpass_den,1,0);
-  
-  return 1;
+  static mip_state_t state; // the last snapshot if a writer is mid-write
+  seqlock_read(&state_lock, &state, &mip_state, sizeof(mip_state_t));
+  if(!state.armed || get_state()==RUNNING) return 0;
+  if(get_state()==PAUSED) supervisor.pauses++;
+  recorder_trigger(&recorder, get_state()==PAUSED ? "pause" : "exit");
+  disarm_mip(STATE_WRITER_SUPERVISOR);
+  return 0;
 }
 
+#if ON_REACTOR
 /*******************************************************************************
- * daniel_filter_t create_daniel_filter(int order, float dt, float* num, float* den, float gain, float sat)
+ * int state_step()
  *
- * Create a filter.  Yay!
+ * The reactor's state event: a state change, with the inner loop on the
+ * reactor, goes to on_state_change first, then main_step for the rest
  ******************************************************************************/
-daniel_filter_t create_daniel_filter(int order, float dt, float* num, float* den, float gain, float sat)
+int state_step()
 {
-  daniel_filter_t filter;
-  int i;
-  int n = 3-order;
-  filter.order = order;
-  filter.dt = dt;
-  filter.gain = gain;
-  for(i=0; i<n; i++)
+  if(state_bus_changed(&main_sub) && !INNER_LOOP_EVENT_DRIVEN)
+  {
+    on_state_change();
+  }
+  return main_step();
+}
+
+/*******************************************************************************
+ * int initialize_reactor()
+ *
+ * The reactor's own sources: state changes and the main task's reload and
+ * exit checks, then DMP arrivals or the FIFO drain.  The loops are added by
+ * start_task.
+ ******************************************************************************/
+int initialize_reactor()
+{
+  if(reactor_init(&reactor)) return -1;
+  seqlock_init(&imu_mailbox_lock, 1);
+  periodic_task_init(&main_task, "main", &main_step,\
+                     config.supervisor_frequency, 0, OVERRUN_SKIP);
+  state_event = reactor_add_event(&reactor, "state", &state_step,\
+                                  INNER_LOOP_PRIORITY);
+  if(state_event == NULL || reactor_add_task(&reactor, &main_task) == NULL\
+     || state_bus_subscribe_fd(state_event->fd))
   {
-    filter.num[i] = 0;
-    filter.den[i] = 0;
-    filter.inputs[i]  = 0;
-    filter.outputs[i]  = 0;
+    return -1;
   }
-  for(i=n; i<4; i++)
+  if(config.imu_mode == MIP_IMU_DMP)
   {
-    filter.num[i] = num[i-n];
-    filter.den[i] = den[i-n];
-    filter.inputs[i]  = 0;
-    filter.outputs[i] = 0;
+    imu_event = reactor_add_event(&reactor, "imu", &imu_event_step,\
+                                  IMU_DRAIN_PRIORITY);
+    return imu_event == NULL ? -1 : 0;
   }
-  filter.sat = sat;
-  filter.step = 0;
-  filter.initialized = 1;
-  return filter;
+  periodic_task_init(&imu_drain_task, "imu_fifo", &mip_imu_drain,\
+                     (double)config.sample_frequency/config.imu_batch,\
+                     IMU_DRAIN_PRIORITY, OVERRUN_SKIP);
+  return reactor_add_task(&reactor, &imu_drain_task) == NULL ? -1 : 0;
+}
+
+/*******************************************************************************
+ * int imu_arrived(const mip_imu_sample_t* samples, int n)
+ *
+ * The DMP consumer on the reactor, in the cape library's interrupt thread.
+ * Leaves the newest sample for imu_event_step and wakes the reactor; if it
+ * falls behind, the imu event shows more events than runs.
+ ******************************************************************************/
+int imu_arrived(const mip_imu_sample_t* samples, int n)
+{
+  if(n <= 0) return 0;
+  seqlock_write_begin(&imu_mailbox_lock, 0);
+  imu_mailbox = samples[n-1];
+  seqlock_write_end(&imu_mailbox_lock, 0);
+  return reactor_notify(imu_event);
+}
+
+/*******************************************************************************
+ * int imu_event_step()
+ ******************************************************************************/
+int imu_event_step()
+{
+  mip_imu_sample_t sample;
+  // preempted the writer mid-write, its next sample wakes us again
+  if(seqlock_read(&imu_mailbox_lock, &sample, &imu_mailbox,\
+                  sizeof(mip_imu_sample_t))) return 0;
+  return imu_callback(&sample, 1);
+}
+#endif
+
+/*******************************************************************************
+ * int print_supervisor_stats()
+ ******************************************************************************/
+int print_supervisor_stats()
+{
+  printf("safety supervisor: %llu arms, %llu pauses, slowest disarm %.1f us "\
+         "after its IMU sample\n", (unsigned long long)supervisor.arms,\
+         (unsigned long long)supervisor.pauses, supervisor.disarm_ns_max/1e3);
+  print_safety_limits(supervisor.limits, SAFETY_LIMITS);
+  return 0;
+}
+
+/*******************************************************************************
+ * int initialize_controllers()
+ *
+ * Create the inner and outer loop controllers
+ ******************************************************************************/
+int initialize_controllers()
+{
+  if(build_controller(&iloop, config.d1_order, 1.0/config.inner_loop_frequency,\
+                      config.d1_num, config.d1_den, config.d1_gain,\
+                      config.d1_sat)) return -1;
+  if(build_controller(&oloop, config.d2_order, 1.0/config.outer_loop_frequency,\
+                      config.d2_num, config.d2_den, config.d2_gain,\
+                      config.d2_sat)) return -1;
+  publish_controller(&iloop, 0);
+  publish_controller(&oloop, 0);
+  return 0;
+}
+
+/*******************************************************************************
+ * int build_controller(controller_slot_t* slot, int order, float dt,
+ *                      float* num, float* den, float gain, float sat)
+ *
+ * Create a controller in the slot's spare filter, off the control loop.  The
+ * loop doesn't see it until publish_controller.  Returns -1 if the filter
+ * can't be created or the loop hasn't taken the previous replacement yet.
+ ******************************************************************************/
+int build_controller(controller_slot_t* slot, int order, float dt, float* num,\
+                     float* den, float gain, float sat)
+{
+  controller_filter_t* active;
+  controller_filter_t* spare;
+
+  // pending clears only after the loop is done with the old filter
+  if(atomic_load_explicit(&slot->pending, memory_order_acquire) != NULL)
+  {
+    printf("previous controller swap still pending\n");
+    return -1;
+  }
+  active = atomic_load_explicit(&slot->active, memory_order_relaxed);
+  spare = (active == &slot->filters[0]) ? &slot->filters[1] : &slot->filters[0];
+  destroy_controller_filter(spare);
+  *spare = create_controller_filter(order,dt,num,den,gain,sat);
+  if(!spare->initialized) return -1;
+  slot->sat[spare - slot->filters] = sat;
+  return 0;
 }
 
 /*******************************************************************************
- * float step_filter(daniel_filter_t* filter, float new_input)
+ * int publish_controller(controller_slot_t* slot, int carry_over)
  *
- * Move forward one step in the filter
+ * Hand the controller build_controller made to the loop.  The first one
+ * becomes active right away, later ones go through pending.
  ******************************************************************************/
-float step_filter(daniel_filter_t* filter, float new_input)
+int publish_controller(controller_slot_t* slot, int carry_over)
 {
-  float gain = filter->gain;
-  float new_output = 0;
+  controller_filter_t* active;
+  controller_filter_t* spare;
+
+  active = atomic_load_explicit(&slot->active, memory_order_relaxed);
+  spare = (active == &slot->filters[0]) ? &slot->filters[1] : &slot->filters[0];
+  if(active == NULL)
+  {
+    atomic_store_explicit(&slot->active, spare, memory_order_relaxed);
+    return 0;
+  }
+  atomic_store_explicit(&slot->carry_over, carry_over, memory_order_relaxed);
+  atomic_store_explicit(&slot->pending, spare, memory_order_release);
+  return 0;
+}
+
+/*******************************************************************************
+ * float step_controller(controller_slot_t* slot, float input)
+ *
+ * Step whichever controller the slot holds, first adopting a replacement if
+ * one is pending or zeroing it if the supervisor asked.  Only the slot's own
+ * loop calls this, and it never blocks: one acquire load per tick when
+ * nothing changes.
+ ******************************************************************************/
+float step_controller(controller_slot_t* slot, float input)
+{
+  controller_filter_t* next;
+  controller_filter_t* filter;
+  float output;
   int i;
-  int n = 3 - filter->order;
-  
-  // Advance inputs and outputs
-  for(i=3; i>n; i--)
+
+  next = atomic_load_explicit(&slot->pending, memory_order_acquire);
+  if(next != NULL)
   {
-    filter->inputs[i] = filter->inputs[i-1];
-    filter->outputs[i] = filter->outputs[i-1];
+    if(atomic_load_explicit(&slot->carry_over, memory_order_relaxed))
+    {
+      set_controller_history(next, slot->inputs, slot->outputs,\
+                             CONFIG_MAX_ORDER);
+    }
+    atomic_store_explicit(&slot->active, next, memory_order_relaxed);
+    atomic_store_explicit(&slot->pending, NULL, memory_order_release);
+    slot->swaps++;
   }
-  filter->inputs[n] = new_input;
-  
-  // Calculate output
-  for(i=n; i<4; i++)
+  filter = atomic_load_explicit(&slot->active, memory_order_relaxed);
+
+  if(atomic_load_explicit(&slot->reset, memory_order_relaxed)\
+     && atomic_exchange_explicit(&slot->reset, 0, memory_order_relaxed))
   {
-    new_output += gain*filter->num[i]*filter->inputs[i];
+    zero_controller_filter(filter);
+    memset(slot->inputs, 0, sizeof(slot->inputs));
+    memset(slot->outputs, 0, sizeof(slot->outputs));
   }
-  for(i=n+1; i<4; i++)
+
+  output = step_controller_filter(filter,input);
+  for(i=CONFIG_MAX_ORDER-1; i>0; i--)
   {
-    new_output -= filter->den[i]*filter->outputs[i];
+    slot->inputs[i] = slot->inputs[i-1];
+    slot->outputs[i] = slot->outputs[i-1];
   }
-  
-  // Divide out a0
-  new_output = new_output/filter->den[n];
-  
-  if(filter->sat > 0)
+  slot->inputs[0] = input;
+  slot->outputs[0] = output;
+  return output;
+}
+
+/*******************************************************************************
+ * float controller_sat(controller_slot_t* slot)
+ *
+ * Output saturation of the controller the slot's loop is running, from that
+ * loop only
+ ******************************************************************************/
+float controller_sat(controller_slot_t* slot)
+{
+  controller_filter_t* filter;
+  filter = atomic_load_explicit(&slot->active, memory_order_relaxed);
+  return slot->sat[filter - slot->filters];
+}
+
+/*******************************************************************************
+ * int reload_controllers()
+ *
+ * Read D1, D2 and SWAP_CARRY_OVER from the config file again and swap the new
+ * controllers in.  Everything else in the file needs a restart.
+ ******************************************************************************/
+int reload_controllers()
+{
+  balance_config_t c = config;
+
+  if(config_name == NULL)
   {
-    if(new_output > filter->sat) new_output = filter->sat;
-    else if(new_output < -1*filter->sat) new_output = -1*filter->sat;
+    printf("no config file to reload, start with -c\n");
+    return -1;
   }
-  
-  filter->outputs[n] = new_output;
-  
-  //printf("%8.4f\n",new_output);
+  if(load_config(config_name, &c)) return -1;
 
-  filter->step++;
-  return new_output;
+  // the loops keep running at the rates they started with
+  c.inner_loop_frequency = config.inner_loop_frequency;
+  c.outer_loop_frequency = config.outer_loop_frequency;
+  if(discretize_controllers(&c)) return -1;
+
+  // both or neither, the robot never runs a new D1 with the old D2
+  if(build_controller(&iloop, c.d1_order, 1.0/config.inner_loop_frequency,\
+                      c.d1_num, c.d1_den, c.d1_gain, c.d1_sat)) return -1;
+  if(build_controller(&oloop, c.d2_order, 1.0/config.outer_loop_frequency,\
+                      c.d2_num, c.d2_den, c.d2_gain, c.d2_sat)) return -1;
+  publish_controller(&iloop, c.swap_carry_over);
+  publish_controller(&oloop, c.swap_carry_over);
+
+  memcpy(config.d1_num, c.d1_num, sizeof(c.d1_num));
+  memcpy(config.d1_den, c.d1_den, sizeof(c.d1_den));
+  memcpy(config.d2_num, c.d2_num, sizeof(c.d2_num));
+  memcpy(config.d2_den, c.d2_den, sizeof(c.d2_den));
+  config.d1_gain = c.d1_gain;
+  config.d1_order = c.d1_order;
+  config.d1_sat = c.d1_sat;
+  config.d2_gain = c.d2_gain;
+  config.d2_order = c.d2_order;
+  config.d2_sat = c.d2_sat;
+  config.d1_c2d = c.d1_c2d;
+  config.d1_s = c.d1_s;
+  config.d2_c2d = c.d2_c2d;
+  config.d2_s = c.d2_s;
+  config.swap_carry_over = c.swap_carry_over;
+  printf("reloaded D1 and D2 from %s%s\n", config_name,\
+         c.swap_carry_over ? ", carrying state over" : "");
+  return 0;
 }
 
 /*******************************************************************************
- * int zero_filter(daniel_filter_t* filter)
+ * void on_sighup(int signo)
  *
- * Zero out all the values in a filter
+ * Ask the main thread to reload the controllers, kill -HUP to retune live
  ******************************************************************************/
-int zero_filter(daniel_filter_t* filter)
+void on_sighup(int signo)
 {
+  reload_requested = 1;
+  notify_reload();
+}
+
+/*******************************************************************************
+ * void on_sigint(int signo)
+ *
+ * ^C, as the cape library's own handler does it but through the state bus,
+ * so every thread leaves at once
+ ******************************************************************************/
+void on_sigint(int signo)
+{
+  state_bus_set(EXITING);
+}
+
+/*******************************************************************************
+ * balance_config_t default_config()
+ *
+ * Everything as compiled in from balance_by_daniel.h
+ ******************************************************************************/
+balance_config_t default_config()
+{
+  balance_config_t c;
+  float d1_num[] = D1_NUM;
+  float d1_den[] = D1_DEN;
+  float d2_num[] = D2_NUM;
+  float d2_den[] = D2_DEN;
+  float d1_zeros[] = D1_S_ZEROS;
+  float d1_poles[] = D1_S_POLES;
+  float d2_zeros[] = D2_S_ZEROS;
+  float d2_poles[] = D2_S_POLES;
+
+  memset(&c, 0, sizeof(balance_config_t));
+  c.sample_frequency     = SAMPLE_FREQUENCY;
+  c.inner_loop_frequency = INNER_LOOP_FREQUENCY;
+  c.outer_loop_frequency = OUTER_LOOP_FREQUENCY;
+  c.supervisor_frequency = SUPERVISOR_FREQUENCY;
+  c.time_constant        = TIME_CONSTANT;
+  c.estimator            = ESTIMATOR;
+  c.kalman_q_angle       = KALMAN_Q_ANGLE;
+  c.kalman_q_bias        = KALMAN_Q_BIAS;
+  c.kalman_r_accel       = KALMAN_R_ACCEL;
+  c.imu_mode             = IMU_MODE;
+  c.imu_batch            = IMU_BATCH;
+  c.cape_mount_angle     = CAPE_MOUNT_ANGLE;
+  c.gear_ratio           = GEAR_RATIO;
+  c.encoder_ticks        = ENCODER_TICKS;
+  c.wheel_radius         = WHEEL_RADIUS;
+  c.d1_c2d               = D1_C2D;
+  c.d1_s.gain            = D1_S_GAIN;
+  c.d1_s.nzeros          = sizeof(d1_zeros)/sizeof(float)/2;
+  c.d1_s.npoles          = sizeof(d1_poles)/sizeof(float)/2;
+  c.d1_s.prewarp         = D1_S_PREWARP;
+  memcpy(c.d1_s.zeros, d1_zeros, sizeof(d1_zeros));
+  memcpy(c.d1_s.poles, d1_poles, sizeof(d1_poles));
+  c.d2_c2d               = D2_C2D;
+  c.d2_s.gain            = D2_S_GAIN;
+  c.d2_s.nzeros          = sizeof(d2_zeros)/sizeof(float)/2;
+  c.d2_s.npoles          = sizeof(d2_poles)/sizeof(float)/2;
+  c.d2_s.prewarp         = D2_S_PREWARP;
+  memcpy(c.d2_s.zeros, d2_zeros, sizeof(d2_zeros));
+  memcpy(c.d2_s.poles, d2_poles, sizeof(d2_poles));
+  c.d1_gain              = D1_GAIN;
+  c.d1_order             = D1_ORDER;
+  memcpy(c.d1_num, d1_num, sizeof(d1_num));
+  memcpy(c.d1_den, d1_den, sizeof(d1_den));
+  c.d1_sat               = D1_SAT;
+  c.d2_gain              = D2_GAIN;
+  c.d2_order             = D2_ORDER;
+  memcpy(c.d2_num, d2_num, sizeof(d2_num));
+  memcpy(c.d2_den, d2_den, sizeof(d2_den));
+  c.d2_sat               = D2_SAT;
+  c.swap_carry_over      = SWAP_CARRY_OVER;
+  c.motor_channel_l      = MOTOR_CHANNEL_L;
+  c.motor_channel_r      = MOTOR_CHANNEL_R;
+  c.motor_polarity_l     = MOTOR_POLARITY_L;
+  c.motor_polarity_r     = MOTOR_POLARITY_R;
+  c.encoder_channel_l    = ENCODER_CHANNEL_L;
+  c.encoder_channel_r    = ENCODER_CHANNEL_R;
+  c.encoder_polarity_l   = ENCODER_POLARITY_L;
+  c.encoder_polarity_r   = ENCODER_POLARITY_R;
+  c.tip_angle            = TIP_ANGLE;
+  c.start_angle          = START_ANGLE;
+  c.start_delay          = START_DELAY;
+  c.phi_ref              = PHI_REF;
+  c.saturation_time      = SATURATION_TIME;
+  c.runaway_angle        = RUNAWAY_ANGLE;
+  c.imu_stall_time       = IMU_STALL_TIME;
+  c.watchdog_frequency   = WATCHDOG_FREQUENCY;
+  c.watchdog_misses      = WATCHDOG_MISSES;
+  c.watchdog_near_miss   = WATCHDOG_NEAR_MISS;
+  return c;
+}
+
+/*******************************************************************************
+ * mip_imu_config_t imu_settings(const balance_config_t* c)
+ *
+ * What mip_imu_start gets.  Nothing here reads the magnetometer, so it stays
+ * off.
+ ******************************************************************************/
+mip_imu_config_t imu_settings(const balance_config_t* c)
+{
+  mip_imu_config_t imu = mip_imu_default_config();
+  imu.mode           = c->imu_mode;
+  imu.sample_rate    = c->sample_frequency;
+  imu.batch          = c->imu_mode == MIP_IMU_FIFO ? c->imu_batch : 1;
+  imu.drain_thread   = !ON_REACTOR;
+  imu.drain_priority = IMU_DRAIN_PRIORITY;
+  imu.drain_cpu      = IMU_DRAIN_CPU;
+  return imu;
+}
+
+/*******************************************************************************
+ * int load_config(const char* name, balance_config_t* c)
+ *
+ * Override c with whatever the file sets and check the result still makes a
+ * working robot.  c is left as it was if anything is wrong.
+ ******************************************************************************/
+int load_config(const char* name, balance_config_t* c)
+{
+  mip_config_t file;
+  balance_config_t n = *c;
+  int bad = 0;
+
+  if(mip_config_load(name, &file)) return -1;
+
+  // discrete coefficients and no method, like tuned_gains.h, are meant as is
+  if(!mip_config_has(&file, "D1_C2D") && (mip_config_has(&file, "D1_GAIN")\
+     || mip_config_has(&file, "D1_ORDER") || mip_config_has(&file, "D1_NUM")\
+     || mip_config_has(&file, "D1_DEN"))) n.d1_c2d = C2D_DISCRETE;
+  if(!mip_config_has(&file, "D2_C2D") && (mip_config_has(&file, "D2_GAIN")\
+     || mip_config_has(&file, "D2_ORDER") || mip_config_has(&file, "D2_NUM")\
+     || mip_config_has(&file, "D2_DEN"))) n.d2_c2d = C2D_DISCRETE;
+
+  // the loops need the order before the coefficients
+  bad |= mip_config_int(&file, "D1_ORDER", &n.d1_order) < 0;
+  bad |= mip_config_int(&file, "D2_ORDER", &n.d2_order) < 0;
+  if(n.d1_order < CONTROLLER_MIN_ORDER || n.d1_order > CONTROLLER_MAX_ORDER\
+     || n.d2_order < CONTROLLER_MIN_ORDER || n.d2_order > CONTROLLER_MAX_ORDER)
+  {
+    printf("ERROR: this build's controllers take orders %d to %d\n",\
+           CONTROLLER_MIN_ORDER, CONTROLLER_MAX_ORDER);
+    return -1;
+  }
+  // a new order without new coefficients would use stale ones
+  if((n.d1_order != c->d1_order\
+      && (mip_config_floats(&file, "D1_NUM", n.d1_num, n.d1_order+1) != 1\
+       || mip_config_floats(&file, "D1_DEN", n.d1_den, n.d1_order+1) != 1))\
+     || (n.d2_order != c->d2_order\
+      && (mip_config_floats(&file, "D2_NUM", n.d2_num, n.d2_order+1) != 1\
+       || mip_config_floats(&file, "D2_DEN", n.d2_den, n.d2_order+1) != 1)))
+  {
+    printf("ERROR: changing a controller order needs its NUM and DEN too\n");
+    return -1;
+  }
+
+  bad |= mip_config_int(&file, "SAMPLE_FREQUENCY", &n.sample_frequency) < 0;
+  bad |= mip_config_int(&file, "INNER_LOOP_FREQUENCY",\
+                        &n.inner_loop_frequency) < 0;
+  bad |= mip_config_int(&file, "OUTER_LOOP_FREQUENCY",\
+                        &n.outer_loop_frequency) < 0;
+  bad |= mip_config_int(&file, "SUPERVISOR_FREQUENCY",\
+                        &n.supervisor_frequency) < 0;
+  bad |= mip_config_float(&file, "TIME_CONSTANT", &n.time_constant) < 0;
+  bad |= mip_config_int(&file, "ESTIMATOR", &n.estimator) < 0;
+  bad |= mip_config_float(&file, "KALMAN_Q_ANGLE", &n.kalman_q_angle) < 0;
+  bad |= mip_config_float(&file, "KALMAN_Q_BIAS", &n.kalman_q_bias) < 0;
+  bad |= mip_config_float(&file, "KALMAN_R_ACCEL", &n.kalman_r_accel) < 0;
+  bad |= mip_config_int(&file, "IMU_MODE", &n.imu_mode) < 0;
+  bad |= mip_config_int(&file, "IMU_BATCH", &n.imu_batch) < 0;
+  bad |= mip_config_float(&file, "CAPE_MOUNT_ANGLE", &n.cape_mount_angle) < 0;
+  bad |= mip_config_float(&file, "GEAR_RATIO", &n.gear_ratio) < 0;
+  bad |= mip_config_int(&file, "ENCODER_TICKS", &n.encoder_ticks) < 0;
+  bad |= mip_config_float(&file, "WHEEL_RADIUS", &n.wheel_radius) < 0;
+  bad |= mip_config_int(&file, "D1_C2D", &n.d1_c2d) < 0;
+  bad |= mip_config_float(&file, "D1_S_GAIN", &n.d1_s.gain) < 0;
+  bad |= load_roots(&file, "D1_S_ZEROS", n.d1_s.zeros, &n.d1_s.nzeros) < 0;
+  bad |= load_roots(&file, "D1_S_POLES", n.d1_s.poles, &n.d1_s.npoles) < 0;
+  bad |= mip_config_float(&file, "D1_S_PREWARP", &n.d1_s.prewarp) < 0;
+  bad |= mip_config_float(&file, "D1_GAIN", &n.d1_gain) < 0;
+  bad |= mip_config_floats(&file, "D1_NUM", n.d1_num, n.d1_order+1) < 0;
+  bad |= mip_config_floats(&file, "D1_DEN", n.d1_den, n.d1_order+1) < 0;
+  bad |= mip_config_float(&file, "D1_SAT", &n.d1_sat) < 0;
+  bad |= mip_config_int(&file, "D2_C2D", &n.d2_c2d) < 0;
+  bad |= mip_config_float(&file, "D2_S_GAIN", &n.d2_s.gain) < 0;
+  bad |= load_roots(&file, "D2_S_ZEROS", n.d2_s.zeros, &n.d2_s.nzeros) < 0;
+  bad |= load_roots(&file, "D2_S_POLES", n.d2_s.poles, &n.d2_s.npoles) < 0;
+  bad |= mip_config_float(&file, "D2_S_PREWARP", &n.d2_s.prewarp) < 0;
+  bad |= mip_config_float(&file, "D2_GAIN", &n.d2_gain) < 0;
+  bad |= mip_config_floats(&file, "D2_NUM", n.d2_num, n.d2_order+1) < 0;
+  bad |= mip_config_floats(&file, "D2_DEN", n.d2_den, n.d2_order+1) < 0;
+  bad |= mip_config_float(&file, "D2_SAT", &n.d2_sat) < 0;
+  bad |= mip_config_int(&file, "SWAP_CARRY_OVER", &n.swap_carry_over) < 0;
+  bad |= mip_config_int(&file, "MOTOR_CHANNEL_L", &n.motor_channel_l) < 0;
+  bad |= mip_config_int(&file, "MOTOR_CHANNEL_R", &n.motor_channel_r) < 0;
+  bad |= mip_config_int(&file, "MOTOR_POLARITY_L", &n.motor_polarity_l) < 0;
+  bad |= mip_config_int(&file, "MOTOR_POLARITY_R", &n.motor_polarity_r) < 0;
+  bad |= mip_config_int(&file, "ENCODER_CHANNEL_L", &n.encoder_channel_l) < 0;
+  bad |= mip_config_int(&file, "ENCODER_CHANNEL_R", &n.encoder_channel_r) < 0;
+  bad |= mip_config_int(&file, "ENCODER_POLARITY_L",\
+                        &n.encoder_polarity_l) < 0;
+  bad |= mip_config_int(&file, "ENCODER_POLARITY_R",\
+                        &n.encoder_polarity_r) < 0;
+  bad |= mip_config_float(&file, "TIP_ANGLE", &n.tip_angle) < 0;
+  bad |= mip_config_float(&file, "START_ANGLE", &n.start_angle) < 0;
+  bad |= mip_config_float(&file, "START_DELAY", &n.start_delay) < 0;
+  bad |= mip_config_float(&file, "PHI_REF", &n.phi_ref) < 0;
+  bad |= mip_config_float(&file, "SATURATION_TIME", &n.saturation_time) < 0;
+  bad |= mip_config_float(&file, "RUNAWAY_ANGLE", &n.runaway_angle) < 0;
+  bad |= mip_config_float(&file, "IMU_STALL_TIME", &n.imu_stall_time) < 0;
+  bad |= mip_config_int(&file, "WATCHDOG_FREQUENCY",\
+                        &n.watchdog_frequency) < 0;
+  bad |= mip_config_float(&file, "WATCHDOG_MISSES", &n.watchdog_misses) < 0;
+  bad |= mip_config_float(&file, "WATCHDOG_NEAR_MISS",\
+                          &n.watchdog_near_miss) < 0;
+  mip_config_report_unused(&file, name);
+  if(bad) return -1;
+
+  if(n.sample_frequency <= 0 || n.inner_loop_frequency <= 0\
+     || n.outer_loop_frequency <= 0 || n.supervisor_frequency <= 0)
+  {
+    printf("ERROR: %s: loop frequencies must be positive\n", name);
+    return -1;
+  }
+  if(mip_imu_check_config(imu_settings(&n)))
+  {
+    printf("ERROR: %s: bad IMU_MODE, IMU_BATCH or SAMPLE_FREQUENCY\n", name);
+    return -1;
+  }
+  if(INNER_LOOP_EVENT_DRIVEN && n.inner_loop_frequency\
+     *imu_settings(&n).batch != n.sample_frequency)
+  {
+    printf("ERROR: %s: event driven inner loop runs once per IMU batch, "\
+           "D1 must match it\n", name);
+    return -1;
+  }
+  if(OUTER_LOOP_PHASE_LOCKED && (n.inner_loop_frequency\
+     % n.outer_loop_frequency || OUTER_LOOP_PHASE\
+     >= n.inner_loop_frequency/n.outer_loop_frequency))
+  {
+    printf("ERROR: %s: phase locked outer loop needs INNER_LOOP_FREQUENCY "\
+           "a multiple of OUTER_LOOP_FREQUENCY\n", name);
+    return -1;
+  }
+  if(n.time_constant <= 0 || n.gear_ratio == 0 || n.encoder_ticks == 0\
+     || n.d1_den[0] == 0 || n.d2_den[0] == 0)
+  {
+    printf("ERROR: %s: TIME_CONSTANT, GEAR_RATIO, ENCODER_TICKS and the "\
+           "leading DEN coefficients can't be zero\n", name);
+    return -1;
+  }
+#ifdef MIP_FIXED
+  if(n.estimator != TILT_COMPLEMENTARY)
+#else
+  if(n.estimator != TILT_COMPLEMENTARY && n.estimator != TILT_KALMAN)
+#endif
+  {
+    printf("ERROR: %s: ESTIMATOR must be %d (complementary) or %d (kalman, "\
+           "not with make FIXED=1)\n", name, TILT_COMPLEMENTARY, TILT_KALMAN);
+    return -1;
+  }
+  if(n.tip_angle <= 0 || n.start_angle <= 0 || n.start_delay < 0\
+     || n.saturation_time < 0 || n.runaway_angle < 0 || n.imu_stall_time < 0)
+  {
+    printf("ERROR: %s: TIP_ANGLE and START_ANGLE must be positive, the "\
+           "other safety parameters can't be negative\n", name);
+    return -1;
+  }
+  if(n.watchdog_frequency <= 0 || n.watchdog_misses < 1\
+     || n.watchdog_near_miss <= 0 || n.watchdog_near_miss > n.watchdog_misses)
+  {
+    printf("ERROR: %s: WATCHDOG_FREQUENCY must be positive and 0 < "\
+           "WATCHDOG_NEAR_MISS <= WATCHDOG_MISSES, at least 1\n", name);
+    return -1;
+  }
+  if(n.d1_c2d < C2D_DISCRETE || n.d1_c2d > C2D_MATCHED\
+     || n.d2_c2d < C2D_DISCRETE || n.d2_c2d > C2D_MATCHED)
+  {
+    printf("ERROR: %s: D1_C2D and D2_C2D must be %d (as given) to %d\n", name,\
+           C2D_DISCRETE, C2D_MATCHED);
+    return -1;
+  }
+  if(abs(n.motor_polarity_l) != 1 || abs(n.motor_polarity_r) != 1\
+     || abs(n.encoder_polarity_l) != 1 || abs(n.encoder_polarity_r) != 1)
+  {
+    printf("ERROR: %s: polarities must be 1 or -1\n", name);
+    return -1;
+  }
+
+  *c = n;
+  return 0;
+}
+
+/*******************************************************************************
+ * int load_roots(mip_config_t* file, const char* key, float* pairs,
+ *                int* npairs)
+ *
+ * A list of real, imaginary pairs for c2d_tf_t.  Same returns as the
+ * mip_config getters.
+ ******************************************************************************/
+int load_roots(mip_config_t* file, const char* key, float* pairs, int* npairs)
+{
+  int count, ret;
+  ret = mip_config_list(file, key, pairs, 2*C2D_MAX_ORDER, &count);
+  if(ret != 1) return ret;
+  if(count % 2)
+  {
+    printf("ERROR: %s needs real, imaginary pairs\n", key);
+    return -1;
+  }
+  *npairs = count/2;
+  return 1;
+}
+
+/*******************************************************************************
+ * int discretize_controllers(balance_config_t* c)
+ *
+ * Fill in the discrete D1 and D2 for the loop rates in c from their
+ * continuous designs, leaving any that are C2D_DISCRETE alone
+ ******************************************************************************/
+int discretize_controllers(balance_config_t* c)
+{
+  int order;
+  if(c->d1_c2d != C2D_DISCRETE)
+  {
+    order = c2d(c->d1_c2d, &c->d1_s, 1.0/c->inner_loop_frequency,\
+                CONTROLLER_MIN_ORDER, CONTROLLER_MAX_ORDER, c->d1_num,\
+                c->d1_den, &c->d1_gain);
+    if(order < 0)
+    {
+      printf("ERROR: can't use D1_S_GAIN, D1_S_ZEROS and D1_S_POLES\n");
+      return -1;
+    }
+    c->d1_order = order;
+  }
+  if(c->d2_c2d != C2D_DISCRETE)
+  {
+    order = c2d(c->d2_c2d, &c->d2_s, 1.0/c->outer_loop_frequency,\
+                CONTROLLER_MIN_ORDER, CONTROLLER_MAX_ORDER, c->d2_num,\
+                c->d2_den, &c->d2_gain);
+    if(order < 0)
+    {
+      printf("ERROR: can't use D2_S_GAIN, D2_S_ZEROS and D2_S_POLES\n");
+      return -1;
+    }
+    c->d2_order = order;
+  }
+  printf("D1 %s at %d Hz, D2 %s at %d Hz\n", c2d_method_name(c->d1_c2d),\
+         c->inner_loop_frequency, c2d_method_name(c->d2_c2d),\
+         c->outer_loop_frequency);
+  return 0;
+}
+
+/*******************************************************************************
+ * int inner_loop_step()
+ *
+ * One tick of the inner loop controller, released by inner_task or called at
+ * the end of imu_callback when INNER_LOOP_EVENT_DRIVEN.  Runs the safety
+ * supervisor, and the outer loop when OUTER_LOOP_PHASE_LOCKED.
+ ******************************************************************************/
+int inner_loop_step()
+{
+  float theta_error, u;
+  int64_t delay;
+  // kept across ticks, a read that preempted a writer mid-write returns
+  // last tick's snapshot
+  static mip_state_t state;
+  static mip_refs_t refs;
+  watchdog_beat(inner_beat, mip_imu_time_ns());
+  seqlock_read(&state_lock, &state, &mip_state, sizeof(mip_state_t));
+  seqlock_read(&refs_lock, &refs, &mip_refs, sizeof(mip_refs_t));
+  TRACE_STAMP(TRACE_INNER_START);
+
+  // Run balance filter
+  theta_error = refs.theta_r - state.theta;
+  u = step_controller(&iloop,theta_error);
+  TRACE_STAMP(TRACE_INNER_DONE);
+  seqlock_write_begin(&state_lock, STATE_WRITER_INNER);
+  mip_state.u = u;
+  seqlock_write_end(&state_lock, STATE_WRITER_INNER);
+  record_tick(&state, &refs, u);
+
+  // disarm here, before u goes out, if anything is wrong
+  if(supervise_mip(&state, u))
+  {
+    mip_io_write_motors(u, u);
+    TRACE_STAMP(TRACE_MOTOR_WRITTEN);
+
+    // time from the IMU sample behind theta to the motor command
+    delay = mip_imu_time_ns() - state.imu_ns;
+    if(latency.count == 0 || delay < latency.min_ns) latency.min_ns = delay;
+    if(delay > latency.max_ns) latency.max_ns = delay;
+    latency.sum_ns += delay;
+    latency.count++;
+  }
+
+#if OUTER_LOOP_PHASE_LOCKED
+  // after the motors, so D2 never delays the command it follows
+  periodic_subtask_tick(&outer_subtask);
+#endif
+  return 0;
+}
+
+/*******************************************************************************
+ * int outer_loop_step()
+ *
+ * One tick of the outer loop controller, released by outer_task or every
+ * Nth inner loop tick when OUTER_LOOP_PHASE_LOCKED
+ ******************************************************************************/
+int outer_loop_step()
+{
+  float phi_error, phi_right, phi_left, phi, theta_r;
+  static mip_state_t state; // the last snapshot if a writer is mid-write
+  mip_encoders_t enc;
+  watchdog_beat(outer_beat, mip_imu_time_ns());
+  seqlock_read(&state_lock, &state, &mip_state, sizeof(mip_state_t));
+  TRACE_STAMP(TRACE_OUTER_START);
+
+  // both wheels from the same instant
+  mip_io_read_encoders(&enc, mip_imu_time_ns());
+  phi_right = (enc.ticks[MIP_IO_RIGHT] * TWO_PI)\
+              /(config.gear_ratio*config.encoder_ticks);
+  phi_left  = (enc.ticks[MIP_IO_LEFT] * TWO_PI)\
+              /(config.gear_ratio*config.encoder_ticks);
+  phi = (phi_right + phi_left)/2.0;
+  TRACE_STAMP(TRACE_ENCODERS_READ);
+
+  seqlock_write_begin(&state_lock, STATE_WRITER_OUTER);
+  mip_state.phi_right = phi_right;
+  mip_state.phi_left  = phi_left;
+  mip_state.phi       = phi;
+  mip_state.encoder_ns = enc.t_ns;
+  seqlock_write_end(&state_lock, STATE_WRITER_OUTER);
+
+  // phi_r only changes at startup, so the writer's own copy is current
+  phi_error = mip_refs.phi_r - phi - state.theta;
+  theta_r = step_controller(&oloop,phi_error);
+  TRACE_STAMP(TRACE_OUTER_DONE);
+  seqlock_write_begin(&refs_lock, REFS_WRITER_OUTER);
+  mip_refs.theta_r = theta_r;
+  seqlock_write_end(&refs_lock, REFS_WRITER_OUTER);
+  return 0;
+}
+
+/*******************************************************************************
+ * int print_latency_stats()
+ *
+ * Report sensor to actuator latency for the inner loop mode in use
+ ******************************************************************************/
+int print_latency_stats()
+{
+  double n = latency.count > 0 ? latency.count : 1;
+  printf("sensor to motor latency (%s): mean %.1f us  min %.1f us  "\
+         "max %.1f us  over %llu commands\n",
+         INNER_LOOP_EVENT_DRIVEN ? "event driven" : "inner_loop thread",
+         latency.sum_ns/n/1e3, latency.min_ns/1e3, latency.max_ns/1e3,
+         (unsigned long long)latency.count);
+  return 0;
+}
+
+/*******************************************************************************
+ * int initialize_io()
+ *
+ * The wheels' wiring from the config, for mip_io
+ ******************************************************************************/
+int initialize_io()
+{
+  mip_io_config_t io;
+  io.motor_channel[MIP_IO_LEFT]     = config.motor_channel_l;
+  io.motor_channel[MIP_IO_RIGHT]    = config.motor_channel_r;
+  io.motor_polarity[MIP_IO_LEFT]    = config.motor_polarity_l;
+  io.motor_polarity[MIP_IO_RIGHT]   = config.motor_polarity_r;
+  io.encoder_channel[MIP_IO_LEFT]   = config.encoder_channel_l;
+  io.encoder_channel[MIP_IO_RIGHT]  = config.encoder_channel_r;
+  io.encoder_polarity[MIP_IO_LEFT]  = config.encoder_polarity_l;
+  io.encoder_polarity[MIP_IO_RIGHT] = config.encoder_polarity_r;
+  return mip_io_init(io);
+}
+
+/*******************************************************************************
+ * int initialize_recorder()
+ *
+ * RECORDER_SECONDS of inner loop ticks, dumped from a thread of its own on
+ * the robot and between samples in the simulator
+ ******************************************************************************/
+int initialize_recorder()
+{
+#ifdef MIP_SIM
+  int thread = 0;
+#else
+  int thread = 1;
+#endif
+  return recorder_open(&recorder, RECORDER_PREFIX,\
+                       RECORDER_SECONDS*config.inner_loop_frequency,\
+                       sizeof(recorder_fields)/sizeof(recorder_fields[0]),\
+                       recorder_fields, mip_imu_time_ns(), thread);
+}
+
+/*******************************************************************************
+ * int record_tick(const mip_state_t* state, const mip_refs_t* refs, float u)
+ *
+ * One inner loop tick into the flight recorder, what it used and what it
+ * computed
+ ******************************************************************************/
+int record_tick(const mip_state_t* state, const mip_refs_t* refs, float u)
+{
+  int64_t now = mip_imu_time_ns();
+  float v[MIP_LOG_MAX_FIELDS];
+  v[0] = state->theta;
+  v[1] = state->a_angle;
+  v[2] = state->g_angle;
+  v[3] = state->phi;
+  v[4] = u;
+  v[5] = refs->theta_r;
+  v[6] = state->armed;
+  v[7] = (now - state->imu_ns)/1e6;
+  return recorder_push(&recorder, now, v);
+}
+
+/*******************************************************************************
+ * int imu_callback(const mip_imu_sample_t* samples, int n)
+ * 
+ * Called with each batch of new IMU samples, one from the DMP or a burst
+ * from the FIFO.  Every sample steps the estimator, the newest sets theta.
+ ******************************************************************************/
+int imu_callback(const mip_imu_sample_t* samples, int n)
+{
+  const mip_imu_sample_t* s;
+  float theta = 0;
   int i;
-  for(i=0; i<4; i++)
+#ifdef MIP_FIXED
+  q31_t g_step, a_q;
+#else
+  float g_step;
+#endif
+  TRACE_STAMP(TRACE_IMU_ARRIVAL);
+  watchdog_beat(imu_beat, mip_imu_time_ns());
+
+  // Do something?
+  for(i=0; i<n; i++)
+  {
+    s = &samples[i];
+#ifdef MIP_FIXED
+    // integer from the sensor readings on, hpass runs on the gyro increments
+    // so the ever growing g_angle never has to fit in Q31
+    g_step = q31_from_float(s->gyro[0]/config.sample_frequency*DEG_TO_RAD);
+    a_q = q31_atan2_float(-s->accel[2],s->accel[1]);
+    g_angle += q31_to_float(g_step);
+    a_angle = q31_to_float(a_q);
+    theta = q31_to_float(q31_add(step_q31_filter(&hpass,g_step),\
+                                 step_q31_filter(&lpass,a_q)))\
+            + config.cape_mount_angle;
+#else
+    g_step = s->gyro[0]/config.sample_frequency*DEG_TO_RAD;
+    g_angle += g_step;
+    a_angle = atan2(-s->accel[2],s->accel[1]);
+    theta = tilt_estimator_update(&estimator,g_step,a_angle)\
+            + config.cape_mount_angle;
+#endif
+  }
+  TRACE_STAMP(TRACE_ESTIMATOR_DONE);
+  if(n <= 0) return 0;
+
+  seqlock_write_begin(&state_lock, STATE_WRITER_IMU);
+  mip_state.theta = theta;
+  mip_state.a_angle = a_angle;
+  mip_state.g_angle = g_angle;
+  mip_state.imu_ns = samples[n-1].t_ns;
+  seqlock_write_end(&state_lock, STATE_WRITER_IMU);
+
+#if INNER_LOOP_EVENT_DRIVEN
+  // act on this batch right away rather than on the next inner_task release
+  inner_loop_step();
+#endif
+  return 0;
+}
+
+/*******************************************************************************
+ * int initialize_angle_filters()
+ *
+ * Initialize the filters that work on the angle stuff
+ ******************************************************************************/
+int initialize_angle_filters()
+{
+  // Initialize filters
+  float dt = 1.0/(float)config.sample_frequency;
+  float tau = config.time_constant;
+#ifdef MIP_FIXED
+  float lpass_num[] = {dt/tau,0};
+  float lpass_den[] = {1, dt/tau-1};
+  float hpass_num[] = {1-dt/tau,dt/tau-1};
+  float hpass_den[] = {1,dt/tau-1};
+  // same high pass with its zero at z=1 taken out, fed gyro increments
+  float hpass_step_num[] = {0,0};
+  if(remove_differentiator(1,hpass_num,hpass_step_num)) return -1;
+  lpass = create_q31_filter(1,dt,lpass_num,lpass_den,1,0);
+  hpass = create_q31_filter(1,dt,hpass_step_num,hpass_den,1,0);
+  if(!lpass.initialized || !hpass.initialized) return -1;
+#else
+  tilt_params_t params;
+  params.time_constant = tau;
+  params.q_angle = config.kalman_q_angle;
+  params.q_bias = config.kalman_q_bias;
+  params.r_accel = config.kalman_r_accel;
+  estimator = create_tilt_estimator(config.estimator,dt,params);
+  if(!estimator.initialized) return -1;
+#endif
+  return 1;
+}
+
+#ifdef MIP_SIM
+/*******************************************************************************
+ * int run_simulation(int argc, char* argv[], double reload_at,
+ *                    double stall_at)
+ *
+ * Free-running closed loop against the plant model.  Virtual time advances one
+ * IMU sample per sim_step(), which fires imu_callback, or with MIP_IMU_FIFO
+ * fills the simulated FIFO that is drained every IMU_BATCH samples; the
+ * inner loop, with the supervisor, and the outer loop run on the samples
+ * where their own period elapses, so no thread ever sleeps.  argv holds only
+ * the arguments after the options.
+ *
+ * With reload_at >= 0 the controllers are reloaded from the config file at
+ * that simulated time, as a SIGHUP would on the robot.  With stall_at >= 0
+ * the IMU stops delivering samples from then on, for the watchdog.
+ *
+ * usage: balance_by_daniel_sim [-c config] [-r reload time]
+ *                              [-s IMU stall time] [seconds]
+ *                              [initial theta] [gyro bias, deg/s]
+ ******************************************************************************/
+int run_simulation(int argc, char* argv[], double reload_at, double stall_at)
+{
+  double seconds = argc > 0 ? atof(argv[0]) : 10.0;
+  float theta0   = argc > 1 ? atof(argv[1]) : 0.1;
+  float bias     = argc > 2 ? atof(argv[2]) : 0.0;
+  uint64_t samples = seconds*config.sample_frequency;
+  uint64_t i;
+  int disarms = 0;
+  int was_armed = 0;
+  int stalled = 0;
+  double err, err_sq = 0, err_max = 0;
+  uint64_t err_n = 0;
+  struct timespec start, end;
+  double wall;
+  int fs = config.sample_frequency;
+  mip_sim_config_t sim = sim_default_config();
+
+  sim.plant = mip_plant_default_params(config.gear_ratio, config.wheel_radius);
+  sim.cape_mount_angle   = config.cape_mount_angle;
+  sim.initial_theta      = theta0;
+  sim.gyro_bias          = bias;
+  sim.encoder_ticks      = config.encoder_ticks;
+  sim.motor_channel_l    = config.motor_channel_l;
+  sim.motor_channel_r    = config.motor_channel_r;
+  sim.motor_polarity_l   = config.motor_polarity_l;
+  sim.motor_polarity_r   = config.motor_polarity_r;
+  sim.encoder_channel_l  = config.encoder_channel_l;
+  sim.encoder_channel_r  = config.encoder_channel_r;
+  sim.encoder_polarity_l = config.encoder_polarity_l;
+  sim.encoder_polarity_r = config.encoder_polarity_r;
+  sim_configure(sim);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(i=0; i<samples && get_state()!=EXITING; i++)
   {
-    filter->inputs[i] = 0.0;
-    filter->outputs[i] = 0.0;
+    // a dead IMU interrupt or drain thread
+    if(stall_at >= 0 && sim_get_time() >= stall_at)
+    {
+      set_imu_interrupt_func(NULL);
+      stalled = 1;
+    }
+    sim_step();
+
+    // where the FIFO drain thread would be released
+    if(config.imu_mode == MIP_IMU_FIFO && (i+1) % config.imu_batch == 0\
+       && !stalled)
+    {
+      mip_imu_drain();
+    }
+
+    // run each loop on the samples where its period rolls over
+    if(!INNER_LOOP_EVENT_DRIVEN && (i*config.inner_loop_frequency)/fs \
+       != ((i+1)*config.inner_loop_frequency)/fs) inner_loop_step();
+    if(!OUTER_LOOP_PHASE_LOCKED && (i*config.outer_loop_frequency)/fs \
+       != ((i+1)*config.outer_loop_frequency)/fs) outer_loop_step();
+    if((i*config.watchdog_frequency)/fs\
+       != ((i+1)*config.watchdog_frequency)/fs) watchdog_step();
+
+    // where the recorder's dump thread would look
+    if((i*RECORDER_POLL_FREQUENCY)/fs != ((i+1)*RECORDER_POLL_FREQUENCY)/fs)
+    {
+      recorder_step(&recorder);
+    }
+
+    // between ticks, like the main thread answering a SIGHUP
+    if(reload_at >= 0 && sim_get_time() >= reload_at)
+    {
+      reload_controllers();
+      reload_at = -1;
+    }
+
+    if(was_armed && !mip_state.armed) disarms++;
+    was_armed = mip_state.armed;
+
+    // estimator against the plant, while it matters
+    if(mip_state.armed)
+    {
+      err = fabs(mip_state.theta - sim_get_plant()->theta);
+      err_sq += err*err;
+      if(err > err_max) err_max = err;
+      err_n++;
+    }
   }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  wall = (end.tv_sec-start.tv_sec) + (end.tv_nsec-start.tv_nsec)/1e9;
+
+  printf("simulated:  %10.3f s\n", sim_get_time());
+  printf("wall clock: %10.6f s (%.0fx real time)\n", wall, sim_get_time()/wall);
+  printf("disarms:    %10d\n", disarms);
+  printf("theta:      %10.4f rad (estimated %.4f)\n",\
+         sim_get_plant()->theta, mip_state.theta);
+  printf("phi:        %10.4f rad\n", mip_state.phi);
+  printf("estimator:  %10s rms %.4f max %.4f rad while armed\n",\
+         tilt_estimator_name(config.estimator),\
+         sqrt(err_sq/(err_n > 0 ? err_n : 1)), err_max);
+  printf("armed:      %10d\n", mip_state.armed);
+  printf("swaps:      %10llu (D1) %llu (D2)\n", (unsigned long long)iloop.swaps,
+         (unsigned long long)oloop.swaps);
   return 0;
 }
+#endif
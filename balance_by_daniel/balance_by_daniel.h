@@ -9,6 +9,63 @@
 #define INNER_LOOP_FREQUENCY   200
 #define OUTER_LOOP_FREQUENCY   20
 #define TIME_CONSTANT          1.0
+#define SUPERVISOR_FREQUENCY   10     // main thread: reloads and exit
+
+// Tilt Estimator (tilt_estimator.h).  TILT_COMPLEMENTARY hands the gyro over
+// to the accelerometer at TIME_CONSTANT; TILT_KALMAN also learns the gyro
+// bias, weighing the two by the noise below.  make FIXED=1 always runs its
+// own Q31 complementary filter.
+#define ESTIMATOR        TILT_COMPLEMENTARY
+#define KALMAN_Q_ANGLE   1e-3     // rad^2/s
+#define KALMAN_Q_BIAS    1e-3     // (rad/s)^2/s
+#define KALMAN_R_ACCEL   0.03     // rad^2
+
+// IMU acquisition (mip_imu.h).  MIP_IMU_DMP gets one DMP sample per interrupt
+// at SAMPLE_FREQUENCY, up to 200 Hz.  MIP_IMU_FIFO reads raw accel and gyro
+// out of the IMU's FIFO at SAMPLE_FREQUENCY, up to 1000 Hz, in bursts of
+// about IMU_BATCH samples, and runs the estimator on every one of them.
+#define IMU_MODE            MIP_IMU_DMP
+#define IMU_BATCH           4
+
+// Run the inner loop at the end of imu_callback instead of in its own thread,
+// locking the controller to SAMPLE_FREQUENCY, or SAMPLE_FREQUENCY/IMU_BATCH
+// with MIP_IMU_FIFO
+#define INNER_LOOP_EVENT_DRIVEN  0
+
+// Run the outer loop inside the inner loop's tick, once every
+// INNER_LOOP_FREQUENCY/OUTER_LOOP_FREQUENCY ticks and right after the motors
+// are written on tick OUTER_LOOP_PHASE of each group, instead of in its own
+// thread.  theta_r then always reaches D1 exactly one inner tick after D2
+// computed it, from the theta of the same sample.
+#define OUTER_LOOP_PHASE_LOCKED  1
+#define OUTER_LOOP_PHASE         0
+
+// Run the loops below the watchdog on the main thread, each task on a
+// timerfd and IMU arrivals and state changes on eventfds under one epoll
+// loop (mip_reactor.h), instead of a thread each.  The DMP interrupt and the
+// pause button stay in the cape library's threads and only wake it.
+#define REACTOR_RUNTIME  0
+
+// Real-time scheduling (SCHED_FIFO priority, 0 for default scheduler)
+#define WATCHDOG_PRIORITY      90
+#define IMU_DRAIN_PRIORITY     85     // MIP_IMU_FIFO drain, DMP on the reactor
+#define INNER_LOOP_PRIORITY    80
+#define OUTER_LOOP_PRIORITY    70
+#define INNER_LOOP_OVERRUN     OVERRUN_SKIP
+#define OUTER_LOOP_OVERRUN     OVERRUN_SKIP
+
+// CPU affinity, -1 for any.  MAIN_CPU is the supervisor or the reactor.
+#define WATCHDOG_CPU           -1
+#define IMU_DRAIN_CPU          -1
+#define INNER_LOOP_CPU         -1
+#define OUTER_LOOP_CPU         -1
+#define MAIN_CPU               -1
+
+// Lock memory and fault in a heap reserve and the main thread's stack before
+// RUNNING (mip_rt.h); the loop threads fault in their own stacks
+#define RT_LOCK_MEMORY         1
+#define RT_HEAP_PREFAULT       (1024*1024)  // bytes
+#define RT_STACK_PREFAULT      (64*1024)    // bytes
 
 // MiP Physical Properties
 #define CAPE_MOUNT_ANGLE      0.40
@@ -17,20 +74,89 @@
 #define WHEEL_RADIUS          0.034
 #define WHEEL_TRACK           0.035
 
-// Inner Loop Controller
+// Inner Loop Controller, designed in continuous time and discretized for
+// INNER_LOOP_FREQUENCY at startup by D1_C2D (c2d.h).  C2D_DISCRETE uses
+// D1_GAIN to D1_DEN below as they are, the matched design at 200 Hz.
+#define D1_C2D        C2D_MATCHED
+#define D1_S_GAIN     -4.092806
+#define D1_S_ZEROS    { -5.340078, 3.544659 }         // re, im: a conjugate pair
+#define D1_S_POLES    { 0.0, 0.0, -20.008271, 0.0 }  // integrator and 20 rad/s
+#define D1_S_PREWARP  0.0                            // rad/s, Tustin only
 #define D1_GAIN    -4.0
 #define D1_ORDER   2
 #define D1_NUM     { 1.0000, -1.9470, 0.9480 }
 #define D1_DEN     { 1.0000, -1.9048, 0.9048 }
 #define D1_SAT     1
 
-// Outer Loop Controller
+// Outer Loop Controller, the same way at OUTER_LOOP_FREQUENCY, 20 Hz as given
+#define D2_C2D        C2D_MATCHED
+#define D2_S_GAIN     0.262329
+#define D2_S_ZEROS    { -0.237403, 0.0 }
+#define D2_S_POLES    { -10.001011, 0.0 }
+#define D2_S_PREWARP  0.0
 #define D2_GAIN    0.20766
 #define D2_ORDER   1
 #define D2_NUM     { 1.0000, -0.9882 }
 #define D2_DEN     { 1.0000, -0.6065 }
 #define D2_SAT     0.3
 
+// Run D1 and D2 as cascaded biquads (biquad.h) instead of the direct form,
+// which holds its precision as the loop rates go up
+#define CONTROLLER_BIQUADS  1
+
+// make FIXED=1 (-DMIP_FIXED) runs the estimator, D1 and D2 in Q31 fixed
+// point (q31_filter.h) instead, bit-exact between the cape and the simulator.
+// CONTROLLER_MIN_ORDER and CONTROLLER_MAX_ORDER are what the engine picked
+// here can build, a config or a design outside them is refused up front.
+#if defined(MIP_FIXED)
+typedef q31_filter_t controller_filter_t;
+#define CONTROLLER_MIN_ORDER        0
+#define CONTROLLER_MAX_ORDER        Q31_FILTER_MAX_ORDER
+#define create_controller_filter    create_q31_filter
+#define step_controller_filter      step_q31_filter_float
+#define zero_controller_filter      zero_q31_filter
+#define set_controller_history      set_q31_filter_history
+#define destroy_controller_filter   destroy_q31_filter
+#elif CONTROLLER_BIQUADS
+typedef biquad_filter_t controller_filter_t;
+#define CONTROLLER_MIN_ORDER        0
+#define CONTROLLER_MAX_ORDER        CONFIG_MAX_ORDER
+#define create_controller_filter    create_biquad_filter
+#define step_controller_filter      step_biquad_filter
+#define zero_controller_filter      zero_biquad_filter
+#define set_controller_history      set_biquad_filter_history
+#define destroy_controller_filter   destroy_biquad_filter
+#else
+typedef daniel_filter_t controller_filter_t;
+#define CONTROLLER_MIN_ORDER        0
+#define CONTROLLER_MAX_ORDER        CONFIG_MAX_ORDER
+#define create_controller_filter    create_daniel_filter
+#define step_controller_filter      step_filter
+#define zero_controller_filter      zero_filter
+#define set_controller_history      set_filter_history
+#define destroy_controller_filter   destroy_daniel_filter
+#endif
+
+#if defined(MIP_FIXED)
+typedef q31_filter_t angle_filter_t;
+#define destroy_angle_filter        destroy_q31_filter
+#if ESTIMATOR != TILT_COMPLEMENTARY
+#error "make FIXED=1 only has the complementary estimator"
+#endif
+#endif
+
+#if INNER_LOOP_EVENT_DRIVEN && INNER_LOOP_FREQUENCY\
+    *(IMU_MODE == MIP_IMU_FIFO ? IMU_BATCH : 1) != SAMPLE_FREQUENCY
+#error "event driven inner loop runs once per IMU batch, D1 must match it"
+#endif
+#if IMU_MODE == MIP_IMU_DMP && SAMPLE_FREQUENCY > MIP_IMU_DMP_MAX_RATE
+#error "the DMP tops out at 200 Hz, use MIP_IMU_FIFO to sample faster"
+#endif
+#if OUTER_LOOP_PHASE_LOCKED && (INNER_LOOP_FREQUENCY % OUTER_LOOP_FREQUENCY\
+    || OUTER_LOOP_PHASE >= INNER_LOOP_FREQUENCY/OUTER_LOOP_FREQUENCY)
+#error "phase locked outer loop needs a whole number of inner ticks per step"
+#endif
+
 // Wiring Parameters
 #define MOTOR_CHANNEL_L       3
 #define MOTOR_CHANNEL_R       2
@@ -41,30 +167,123 @@
 #define ENCODER_POLARITY_L    1
 #define ENCODER_POLARITY_R    -1
 
-// Safety Parameters
+// Safety Parameters, checked by supervise_mip on every inner loop tick.
+// SATURATION_TIME, RUNAWAY_ANGLE and IMU_STALL_TIME disarm too, 0 for never.
 #define TIP_ANGLE        0.75
 #define START_ANGLE      0.3
 #define START_DELAY      0.5
 #define PHI_REF          0.0
+#define SATURATION_TIME  0.5      // s with D1 pinned at D1_SAT
+#define RUNAWAY_ANGLE    60.0     // rad of wheel travel away from PHI_REF
+#define IMU_STALL_TIME   0.05     // s since the newest IMU sample
+
+// Watchdog (mip_watchdog.h) on imu_callback, inner_loop_step and
+// outer_loop_step.  One that hasn't run for WATCHDOG_MISSES of its periods
+// is disarmed from the watchdog thread, checked at WATCHDOG_FREQUENCY, so
+// within one more check period.  Gaps over WATCHDOG_NEAR_MISS periods that
+// stay short of that are counted as near misses.
+#define WATCHDOG_FREQUENCY  500
+#define WATCHDOG_MISSES     3.0
+#define WATCHDOG_NEAR_MISS  1.5
+
+// Flight recorder (mip_recorder.h): the last RECORDER_SECONDS of inner loop
+// ticks in memory, written to RECORDER_PREFIX_<n>_<reason>.log on a disarm,
+// a pause or a watchdog trip
+#define RECORDER_SECONDS  5
+#define RECORDER_PREFIX   "flight"
+
+// Runtime configuration.  Everything above from Timing to here, except the
+// scheduling, INNER_LOOP_EVENT_DRIVEN, OUTER_LOOP_PHASE* and REACTOR_RUNTIME,
+// is only the default: a config file given with -c overrides any of it by
+// macro name, and SIGHUP reloads D1 and D2 from the same file while running.
+#define CONFIG_MAX_ORDER      4
+#if CONTROLLER_MAX_ORDER > CONFIG_MAX_ORDER
+#error "the config holds at most CONFIG_MAX_ORDER coefficients per controller"
+#endif
+#define SWAP_CARRY_OVER       1     // new controllers start from the old I/O
+
+typedef struct balance_config_t
+{
+  // Timing
+  int   sample_frequency;
+  int   inner_loop_frequency;
+  int   outer_loop_frequency;
+  int   supervisor_frequency;
+  float time_constant;
+  int   estimator;
+  float kalman_q_angle;
+  float kalman_q_bias;
+  float kalman_r_accel;
+  int   imu_mode;
+  int   imu_batch;
+
+  // MiP Physical Properties
+  float cape_mount_angle;
+  float gear_ratio;
+  int   encoder_ticks;
+  float wheel_radius;
+
+  // Inner and Outer Loop Controllers, d1_gain to d1_den discretized from
+  // d1_s unless d1_c2d is C2D_DISCRETE
+  int   d1_c2d;
+  c2d_tf_t d1_s;
+  int   d2_c2d;
+  c2d_tf_t d2_s;
+  float d1_gain;
+  int   d1_order;
+  float d1_num[CONFIG_MAX_ORDER+1];
+  float d1_den[CONFIG_MAX_ORDER+1];
+  float d1_sat;
+  float d2_gain;
+  int   d2_order;
+  float d2_num[CONFIG_MAX_ORDER+1];
+  float d2_den[CONFIG_MAX_ORDER+1];
+  float d2_sat;
+  int   swap_carry_over;
+
+  // Wiring Parameters
+  int motor_channel_l;
+  int motor_channel_r;
+  int motor_polarity_l;
+  int motor_polarity_r;
+  int encoder_channel_l;
+  int encoder_channel_r;
+  int encoder_polarity_l;
+  int encoder_polarity_r;
 
+  // Safety Parameters
+  float tip_angle;
+  float start_angle;
+  float start_delay;
+  float phi_ref;
+  float saturation_time;
+  float runaway_angle;
+  float imu_stall_time;
+  int   watchdog_frequency;
+  float watchdog_misses;
+  float watchdog_near_miss;
 
-// Implement custom filter struct up to 3th order
-typedef struct daniel_filter_t
+} balance_config_t;
+
+// A controller its loop can trade for a new one between ticks.  The loader
+// builds the replacement in whichever of the two filters isn't active and
+// publishes it in pending; the loop adopts it at the start of its next tick
+// and clears pending, which hands the old one back.  The loop never blocks,
+// allocates or frees.
+typedef struct controller_slot_t
 {
-  // basic stuff
-  int order;
-  float dt;
-  float gain;
-  float sat;
-  uint64_t step;
-  int initialized;
-
-  // Filter values
-  float num[4];
-  float den[4];
-  float inputs[4];
-  float outputs[4];
-} daniel_filter_t;
+  controller_filter_t filters[2];
+  controller_filter_t* _Atomic active;
+  controller_filter_t* _Atomic pending;
+  atomic_int carry_over;
+  atomic_int reset;               // zero the active filter on the next tick
+  float inputs[CONFIG_MAX_ORDER]; // last inputs and outputs, newest first,
+  float outputs[CONFIG_MAX_ORDER];// written by the loop only
+  float sat[2];                   // each filter's saturation, for the supervisor
+  uint64_t swaps;
+
+} controller_slot_t;
+
 
 // Robot state
 typedef struct mip_state_t
@@ -73,12 +292,58 @@ typedef struct mip_state_t
   float phi_left;
   float phi_right;
   float theta;
+  float a_angle;            // accelerometer angle theta came from
+  float g_angle;            // integrated gyro, the same sample
   float phi;
   float u;
   int   armed;
+  int64_t imu_ns;           // CLOCK_MONOTONIC time theta was sampled
+  int64_t encoder_ns;       // the same clock, when phi was read
   
 } mip_state_t;
 
+// mip_state writers, each owns its own fields and seqlock counter
+#define STATE_WRITER_IMU          0     // theta, a_angle, g_angle, imu_ns
+#define STATE_WRITER_INNER        1     // u
+#define STATE_WRITER_OUTER        2     // phi_left, phi_right, phi,
+                                        // encoder_ns
+#define STATE_WRITER_SUPERVISOR   3     // armed, from the inner loop thread
+#define STATE_WRITER_WATCHDOG     4     // armed, only ever cleared
+#define STATE_WRITERS             5
+
+// mip_refs writers
+#define REFS_WRITER_OUTER         0     // theta_r
+#define REFS_WRITERS              1
+
+// Safety supervisor, run by the inner loop on every tick so a trip turns the
+// motors off before the next command goes out
+#define SAFETY_TIP                0     // theta
+#define SAFETY_SATURATION         1     // u as a fraction of D1_SAT
+#define SAFETY_RUNAWAY            2     // phi from phi_r
+#define SAFETY_IMU_STALL          3     // age of the newest IMU sample
+#define SAFETY_LIMITS             4
+
+typedef struct supervisor_t
+{
+  safety_limit_t limits[SAFETY_LIMITS];
+  uint64_t ticks;
+  uint64_t start_ticks;     // none armed before this, START_DELAY
+  uint64_t arms;
+  uint64_t pauses;
+  int64_t  disarm_ns_max;   // tripping IMU sample to motors off
+
+} supervisor_t;
+
+// IMU sample to motor command latency
+typedef struct latency_stats_t
+{
+  uint64_t count;
+  int64_t  min_ns;
+  int64_t  max_ns;
+  double   sum_ns;
+
+} latency_stats_t;
+
 // Robot reference values
 typedef struct mip_refs_t
 {
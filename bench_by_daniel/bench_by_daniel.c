@@ -0,0 +1,855 @@
+/*******************************************************************************
+* bench_by_daniel.c
+*
+* Microbenchmarks for the hot paths of balance_by_daniel and
+* filters_by_daniel: step_filter, the biquad engine, atan2 and the
+* complementary filter in imu_callback, and one full controller tick (IMU
+* update, inner loop and outer loop with their seqlock traffic), built from
+* the same headers and D1/D2 configuration as balance_by_daniel.
+*
+* Each benchmark is warmed up, then timed over BENCH_SAMPLES samples of
+* BENCH_ITERATIONS calls.  Prints ns/op and cycles/op with spread and writes
+* the same numbers to BENCH_FILENAME for comparing commits.
+*
+* -r runs balance_by_daniel's task set for real, once with a thread per task
+* and once on the reactor (REACTOR_RUNTIME, common/mip_reactor.c), and
+* compares their context switches per second and release jitter, and how
+* long every thread takes to notice the pause button (common/state_bus.c),
+* with memory locked as balance_by_daniel locks it and each thread's page
+* faults counted (common/mip_rt.c).
+*
+* usage: bench_by_daniel [name ...]    run only benchmarks containing a name
+*        bench_by_daniel -r [seconds]  threads against the reactor
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "daniel_filter.h"
+#include "biquad.h"
+#include "q31_filter.h"
+#include "c2d.h"
+#include "tilt_estimator.h"
+#include "mip_imu.h"
+#include "mip_safety.h"
+#include "seqlock.h"
+#include "periodic_task.h"
+#include "mip_reactor.h"
+#include "state_bus.h"
+#include "mip_rt.h"
+#include "mip_hal.h"
+#include "balance_by_daniel.h"
+#include "./bench_by_daniel.h"
+
+#ifndef TWO_PI
+#define TWO_PI       (2.0*M_PI)
+#endif
+#ifndef DEG_TO_RAD
+#define DEG_TO_RAD   (M_PI/180.0)
+#endif
+#define INPUT_MASK   (BENCH_INPUTS-1)
+
+// function declarations
+int open_cycle_counter();
+uint64_t read_cycles();
+int64_t now_ns();
+bench_result_t run_bench(bench_t* b);
+int compare_double(const void* a, const void* b);
+void setup_inputs();
+void setup_filters();
+void bench_lpass_direct(long iters);
+void bench_lpass_generic(long iters);
+void bench_d1_direct(long iters);
+void bench_d1_generic(long iters);
+void bench_d1_biquad(long iters);
+void bench_d1_biquad_generic(long iters);
+void bench_atan2(long iters);
+void bench_complementary(long iters);
+void bench_d1_q31(long iters);
+void bench_q31_atan2(long iters);
+void bench_complementary_q31(long iters);
+void bench_tilt_complementary(long iters);
+void bench_tilt_kalman(long iters);
+void bench_controller_tick(long iters);
+int run_runtime(int on_reactor, double seconds);
+int rt_dmp_step();
+int rt_imu_step();
+int rt_inner_step();
+int rt_outer_step();
+int rt_watchdog_step();
+int rt_main_step();
+int rt_state_step();
+void* rt_button(void* ptr);
+
+// variable declarations
+static cycle_source_t cycle_source = CYCLES_NONE;
+static int perf_fd = -1;
+static volatile float sink;
+
+static float accel_y[BENCH_INPUTS];
+static float accel_z[BENCH_INPUTS];
+static float gyro_x[BENCH_INPUTS];
+static float angle[BENCH_INPUTS];
+static int   encoder[BENCH_INPUTS];
+
+static daniel_filter_t lpass, hpass, d1_direct;
+static daniel_filter_t lpass_generic, d1_generic;
+static biquad_filter_t d1_biquad, d1_biquad_generic;
+static q31_filter_t lpass_q31, hpass_q31, d1_q31;
+static controller_filter_t iloop, oloop;
+static tilt_estimator_t tilt_complementary, tilt_kalman;
+static mip_state_t mip_state;
+static mip_refs_t mip_refs;
+static seqlock_t state_lock, refs_lock;
+static float g_angle;
+
+// runtime comparison
+static periodic_task_t rt_dmp, rt_inner, rt_outer, rt_watchdog, rt_main;
+static periodic_subtask_t rt_outer_sub;
+static mip_reactor_t rt_reactor;
+static reactor_source_t* rt_imu_event;
+static reactor_source_t* rt_state_event;
+static state_sub_t rt_main_sub;
+static int rt_on_reactor;
+static int64_t rt_end_ns;
+static _Atomic int64_t rt_dmp_ns;
+static long rt_k;
+static uint64_t rt_handoffs;
+static int64_t rt_handoff_max;
+static double rt_handoff_sum;
+
+static bench_t benches[] =
+{
+  {"step_filter_order1",   setup_filters,  bench_lpass_direct},
+  {"step_filter_order1_generic", setup_filters, bench_lpass_generic},
+  {"step_filter_d1",       setup_filters,  bench_d1_direct},
+  {"step_filter_d1_generic", setup_filters, bench_d1_generic},
+  {"step_biquad_d1",       setup_filters,  bench_d1_biquad},
+  {"step_biquad_d1_generic", setup_filters, bench_d1_biquad_generic},
+  {"atan2",                NULL,           bench_atan2},
+  {"complementary_filter", setup_filters,  bench_complementary},
+  {"step_q31_d1",          setup_filters,  bench_d1_q31},
+  {"q31_atan2",            NULL,           bench_q31_atan2},
+  {"complementary_q31",    setup_filters,  bench_complementary_q31},
+  {"tilt_complementary",   setup_filters,  bench_tilt_complementary},
+  {"tilt_kalman",          setup_filters,  bench_tilt_kalman},
+  {"controller_tick",      setup_filters,  bench_controller_tick},
+};
+#define BENCHES  (int)(sizeof(benches)/sizeof(bench_t))
+
+/*******************************************************************************
+ * int main()
+ ******************************************************************************/
+int main(int argc, char* argv[])
+{
+  bench_result_t r;
+  struct utsname host;
+  FILE* csv;
+  int i, j, selected;
+  const char* sources[] = {"none", "perf", "tsc"};
+
+  uname(&host);
+  setup_inputs();
+  if(argc > 1 && strcmp(argv[1], "-r") == 0)
+  {
+    if(RT_LOCK_MEMORY) rt_lock_memory(RT_HEAP_PREFAULT, RT_STACK_PREFAULT);
+    run_runtime(0, argc > 2 ? atof(argv[2]) : RUNTIME_SECONDS);
+    run_runtime(1, argc > 2 ? atof(argv[2]) : RUNTIME_SECONDS);
+    return 0;
+  }
+  open_cycle_counter();
+
+  csv = fopen(BENCH_FILENAME,"w");
+  if(csv == NULL)
+  {
+    printf("Could not open %s\n", BENCH_FILENAME);
+    return -1;
+  }
+  fprintf(csv,"rev,machine,benchmark,iterations,samples,ns_mean,ns_stddev,"\
+              "ns_min,ns_median,cycles_mean,cycle_source\n");
+
+  printf("bench_by_daniel %s on %s, cycles from %s\n", BENCH_REV,
+         host.machine, sources[cycle_source]);
+  printf("%-26s %9s %9s %9s %9s %11s\n", "benchmark", "ns/op", "stddev",
+         "min", "median", "cycles/op");
+  for(i=0; i<BENCHES; i++)
+  {
+    selected = argc < 2;
+    for(j=1; j<argc; j++) if(strstr(benches[i].name, argv[j])) selected = 1;
+    if(!selected) continue;
+
+    r = run_bench(&benches[i]);
+    printf("%-26s %9.2f %9.2f %9.2f %9.2f %11.1f\n", benches[i].name,
+           r.ns_mean, r.ns_stddev, r.ns_min, r.ns_median, r.cycles_mean);
+    fprintf(csv,"%s,%s,%s,%d,%d,%.3f,%.3f,%.3f,%.3f,%.1f,%s\n", BENCH_REV,
+            host.machine, benches[i].name, BENCH_ITERATIONS, BENCH_SAMPLES,
+            r.ns_mean, r.ns_stddev, r.ns_min, r.ns_median, r.cycles_mean,
+            sources[cycle_source]);
+  }
+  fclose(csv);
+  if(perf_fd >= 0) close(perf_fd);
+  return 0;
+}
+
+/*******************************************************************************
+ * bench_result_t run_bench(bench_t* b)
+ *
+ * Warm up, then time BENCH_SAMPLES samples and summarize them per call
+ ******************************************************************************/
+bench_result_t run_bench(bench_t* b)
+{
+  bench_result_t r;
+  double ns[BENCH_SAMPLES];
+  double cycles = 0, sum = 0, sq = 0;
+  int64_t t0;
+  uint64_t c0;
+  int i;
+
+  if(b->setup != NULL) b->setup();
+  for(i=0; i<BENCH_WARMUP; i++) b->run(BENCH_ITERATIONS);
+
+  for(i=0; i<BENCH_SAMPLES; i++)
+  {
+    c0 = read_cycles();
+    t0 = now_ns();
+    b->run(BENCH_ITERATIONS);
+    ns[i] = (double)(now_ns() - t0)/BENCH_ITERATIONS;
+    cycles += (double)(read_cycles() - c0)/BENCH_ITERATIONS;
+    sum += ns[i];
+  }
+
+  r.ns_mean = sum/BENCH_SAMPLES;
+  for(i=0; i<BENCH_SAMPLES; i++) sq += (ns[i]-r.ns_mean)*(ns[i]-r.ns_mean);
+  r.ns_stddev = sqrt(sq/(BENCH_SAMPLES-1));
+  qsort(ns, BENCH_SAMPLES, sizeof(double), compare_double);
+  r.ns_min = ns[0];
+  r.ns_median = ns[BENCH_SAMPLES/2];
+  r.cycles_mean = cycle_source == CYCLES_NONE ? NAN : cycles/BENCH_SAMPLES;
+  return r;
+}
+
+/*******************************************************************************
+ * int open_cycle_counter()
+ *
+ * Prefer the hardware cycle counter through perf, which works on the
+ * BeagleBone and x86 alike, then the x86 TSC.  Returns -1 if neither.
+ ******************************************************************************/
+int open_cycle_counter()
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CPU_CYCLES;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  perf_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  if(perf_fd >= 0)
+  {
+    ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    cycle_source = CYCLES_PERF;
+    return 0;
+  }
+#if defined(__x86_64__) || defined(__i386__)
+  cycle_source = CYCLES_TSC;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/*******************************************************************************
+ * uint64_t read_cycles()
+ ******************************************************************************/
+uint64_t read_cycles()
+{
+  uint64_t c = 0;
+  if(cycle_source == CYCLES_PERF)
+  {
+    if(read(perf_fd, &c, sizeof(c)) != sizeof(c)) c = 0;
+    return c;
+  }
+#if defined(__x86_64__) || defined(__i386__)
+  if(cycle_source == CYCLES_TSC) return __rdtsc();
+#endif
+  return c;
+}
+
+/*******************************************************************************
+ * int64_t now_ns()
+ ******************************************************************************/
+int64_t now_ns()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (int64_t)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+/*******************************************************************************
+ * int compare_double(const void* a, const void* b)
+ ******************************************************************************/
+int compare_double(const void* a, const void* b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+/*******************************************************************************
+ * void setup_inputs()
+ *
+ * A slow rocking motion with sensor noise, roughly what the MiP sees while
+ * balancing, so the filters and atan2 work on realistic values
+ ******************************************************************************/
+void setup_inputs()
+{
+  int i;
+  float t, noise;
+  srand(1);
+  for(i=0; i<BENCH_INPUTS; i++)
+  {
+    t = (float)i/SAMPLE_FREQUENCY;
+    noise = ((float)rand()/RAND_MAX - 0.5)*0.02;
+    angle[i]   = 0.1*sin(2*M_PI*0.5*t) + noise;
+    accel_y[i] = 9.81*cos(angle[i]) + noise;
+    accel_z[i] = -9.81*sin(angle[i]) + noise;
+    gyro_x[i]  = 0.1*2*M_PI*0.5*cos(2*M_PI*0.5*t)/DEG_TO_RAD + 10*noise;
+    encoder[i] = (int)(200*sin(2*M_PI*0.2*t));
+  }
+}
+
+/*******************************************************************************
+ * void setup_filters()
+ *
+ * Fresh filters configured exactly as balance_by_daniel configures them
+ ******************************************************************************/
+void setup_filters()
+{
+  float dt = 1.0/(float)SAMPLE_FREQUENCY;
+  float lpass_num[] = {dt/TIME_CONSTANT,0};
+  float lpass_den[] = {1, dt/TIME_CONSTANT-1};
+  float hpass_num[] = {1-dt/TIME_CONSTANT,dt/TIME_CONSTANT-1};
+  float hpass_den[] = {1,dt/TIME_CONSTANT-1};
+  float d1_num[] = D1_NUM;
+  float d1_den[] = D1_DEN;
+  float d2_num[] = D2_NUM;
+  float d2_den[] = D2_DEN;
+  float hpass_step[] = {0,0};
+  tilt_params_t tilt = {TIME_CONSTANT, KALMAN_Q_ANGLE, KALMAN_Q_BIAS,\
+                        KALMAN_R_ACCEL};
+
+  destroy_daniel_filter(&lpass);
+  destroy_daniel_filter(&hpass);
+  destroy_daniel_filter(&d1_direct);
+  destroy_daniel_filter(&lpass_generic);
+  destroy_daniel_filter(&d1_generic);
+  destroy_biquad_filter(&d1_biquad);
+  destroy_biquad_filter(&d1_biquad_generic);
+  destroy_controller_filter(&iloop);
+  destroy_controller_filter(&oloop);
+  destroy_q31_filter(&lpass_q31);
+  destroy_q31_filter(&hpass_q31);
+  destroy_q31_filter(&d1_q31);
+  destroy_tilt_estimator(&tilt_complementary);
+  destroy_tilt_estimator(&tilt_kalman);
+
+  lpass = create_daniel_filter(1,dt,lpass_num,lpass_den,1,0);
+  hpass = create_daniel_filter(1,dt,hpass_num,hpass_den,1,0);
+  d1_direct = create_daniel_filter(D1_ORDER,1.0/INNER_LOOP_FREQUENCY,d1_num,\
+                                   d1_den,D1_GAIN,D1_SAT);
+  d1_biquad = create_biquad_filter(D1_ORDER,1.0/INNER_LOOP_FREQUENCY,d1_num,\
+                                   d1_den,D1_GAIN,D1_SAT);
+
+  // the same filters forced onto the generic kernels, fresh state is valid
+  // for either history layout
+  lpass_generic = create_daniel_filter(1,dt,lpass_num,lpass_den,1,0);
+  lpass_generic.kernel = step_filter_generic;
+  d1_generic = create_daniel_filter(D1_ORDER,1.0/INNER_LOOP_FREQUENCY,d1_num,\
+                                    d1_den,D1_GAIN,D1_SAT);
+  d1_generic.kernel = step_filter_generic;
+  d1_biquad_generic = create_biquad_filter(D1_ORDER,1.0/INNER_LOOP_FREQUENCY,\
+                                           d1_num,d1_den,D1_GAIN,D1_SAT);
+  d1_biquad_generic.kernel = step_biquad_filter_generic;
+
+  // fixed point, the high pass runs on gyro increments as in balance FIXED=1
+  remove_differentiator(1,hpass_num,hpass_step);
+  lpass_q31 = create_q31_filter(1,dt,lpass_num,lpass_den,1,0);
+  hpass_q31 = create_q31_filter(1,dt,hpass_step,hpass_den,1,0);
+  d1_q31 = create_q31_filter(D1_ORDER,1.0/INNER_LOOP_FREQUENCY,d1_num,\
+                             d1_den,D1_GAIN,D1_SAT);
+  iloop = create_controller_filter(D1_ORDER,1.0/INNER_LOOP_FREQUENCY,\
+                                   d1_num,d1_den,D1_GAIN,D1_SAT);
+  oloop = create_controller_filter(D2_ORDER,1.0/OUTER_LOOP_FREQUENCY,\
+                                   d2_num,d2_den,D2_GAIN,D2_SAT);
+
+  // the estimators alone, fed the same gyro step and accelerometer angle
+  tilt_complementary = create_tilt_estimator(TILT_COMPLEMENTARY,dt,tilt);
+  tilt_kalman = create_tilt_estimator(TILT_KALMAN,dt,tilt);
+  seqlock_init(&state_lock, STATE_WRITERS);
+  seqlock_init(&refs_lock, REFS_WRITERS);
+  memset(&mip_state, 0, sizeof(mip_state_t));
+  memset(&mip_refs, 0, sizeof(mip_refs_t));
+  mip_state.armed = 1;
+  g_angle = 0;
+}
+
+/*******************************************************************************
+ * Benchmarks, each calls its path iters times over the input tables
+ ******************************************************************************/
+void bench_lpass_direct(long iters)
+{
+  long i;
+  float y = 0;
+  for(i=0; i<iters; i++) y += step_filter(&lpass, angle[i & INPUT_MASK]);
+  sink = y;
+}
+
+void bench_lpass_generic(long iters)
+{
+  long i;
+  float y = 0;
+  for(i=0; i<iters; i++) y += step_filter(&lpass_generic, angle[i & INPUT_MASK]);
+  sink = y;
+}
+
+void bench_d1_direct(long iters)
+{
+  long i;
+  float y = 0;
+  for(i=0; i<iters; i++) y += step_filter(&d1_direct, angle[i & INPUT_MASK]);
+  sink = y;
+}
+
+void bench_d1_biquad(long iters)
+{
+  long i;
+  float y = 0;
+  for(i=0; i<iters; i++)
+  {
+    y += step_biquad_filter(&d1_biquad, angle[i & INPUT_MASK]);
+  }
+  sink = y;
+}
+
+void bench_d1_generic(long iters)
+{
+  long i;
+  float y = 0;
+  for(i=0; i<iters; i++) y += step_filter(&d1_generic, angle[i & INPUT_MASK]);
+  sink = y;
+}
+
+void bench_d1_biquad_generic(long iters)
+{
+  long i;
+  float y = 0;
+  for(i=0; i<iters; i++)
+  {
+    y += step_biquad_filter(&d1_biquad_generic, angle[i & INPUT_MASK]);
+  }
+  sink = y;
+}
+
+void bench_atan2(long iters)
+{
+  long i;
+  float y = 0;
+  for(i=0; i<iters; i++)
+  {
+    y += atan2(-accel_z[i & INPUT_MASK], accel_y[i & INPUT_MASK]);
+  }
+  sink = y;
+}
+
+void bench_complementary(long iters)
+{
+  long i;
+  float a_angle, theta = 0;
+  for(i=0; i<iters; i++)
+  {
+    g_angle += gyro_x[i & INPUT_MASK]/SAMPLE_FREQUENCY*DEG_TO_RAD;
+    a_angle = atan2(-accel_z[i & INPUT_MASK], accel_y[i & INPUT_MASK]);
+    theta += step_filter(&hpass,g_angle) + step_filter(&lpass,a_angle)\
+             + CAPE_MOUNT_ANGLE;
+  }
+  sink = theta;
+}
+
+void bench_d1_q31(long iters)
+{
+  long i;
+  float y = 0;
+  for(i=0; i<iters; i++)
+  {
+    y += step_q31_filter_float(&d1_q31, angle[i & INPUT_MASK]);
+  }
+  sink = y;
+}
+
+void bench_q31_atan2(long iters)
+{
+  long i;
+  q31_t y = 0;
+  for(i=0; i<iters; i++)
+  {
+    y += q31_atan2_float(-accel_z[i & INPUT_MASK], accel_y[i & INPUT_MASK]);
+  }
+  sink = q31_to_float(y);
+}
+
+void bench_complementary_q31(long iters)
+{
+  long i;
+  q31_t g_step, a_angle;
+  float theta = 0;
+  for(i=0; i<iters; i++)
+  {
+    g_step = q31_from_float(gyro_x[i & INPUT_MASK]/SAMPLE_FREQUENCY*DEG_TO_RAD);
+    a_angle = q31_atan2_float(-accel_z[i & INPUT_MASK], accel_y[i & INPUT_MASK]);
+    theta += q31_to_float(q31_add(step_q31_filter(&hpass_q31,g_step),\
+                                  step_q31_filter(&lpass_q31,a_angle)))\
+             + CAPE_MOUNT_ANGLE;
+  }
+  sink = theta;
+}
+
+void bench_tilt_complementary(long iters)
+{
+  long i;
+  float theta = 0;
+  for(i=0; i<iters; i++)
+  {
+    theta += tilt_estimator_update(&tilt_complementary,\
+               gyro_x[i & INPUT_MASK]/SAMPLE_FREQUENCY*DEG_TO_RAD,\
+               angle[i & INPUT_MASK]);
+  }
+  sink = theta;
+}
+
+void bench_tilt_kalman(long iters)
+{
+  long i;
+  float theta = 0;
+  for(i=0; i<iters; i++)
+  {
+    theta += tilt_estimator_update(&tilt_kalman,\
+               gyro_x[i & INPUT_MASK]/SAMPLE_FREQUENCY*DEG_TO_RAD,\
+               angle[i & INPUT_MASK]);
+  }
+  sink = theta;
+}
+
+/*******************************************************************************
+ * void bench_controller_tick(long iters)
+ *
+ * imu_callback, inner_loop_step and outer_loop_step back to back, minus the
+ * cape calls: the worst case tick where all three run together
+ ******************************************************************************/
+void bench_controller_tick(long iters)
+{
+  long i;
+  int k;
+  float a_angle, theta, theta_error, u, phi_right, phi_left, phi, theta_r;
+  mip_state_t state;
+  mip_refs_t refs;
+
+  for(i=0; i<iters; i++)
+  {
+    k = i & INPUT_MASK;
+
+    // imu_callback
+    g_angle += gyro_x[k]/SAMPLE_FREQUENCY*DEG_TO_RAD;
+    a_angle = atan2(-accel_z[k], accel_y[k]);
+    theta = step_filter(&hpass,g_angle) + step_filter(&lpass,a_angle)\
+            + CAPE_MOUNT_ANGLE;
+    seqlock_write_begin(&state_lock, STATE_WRITER_IMU);
+    mip_state.theta = theta;
+    mip_state.imu_ns = i;
+    seqlock_write_end(&state_lock, STATE_WRITER_IMU);
+
+    // inner_loop_step
+    seqlock_read(&state_lock, &state, &mip_state, sizeof(mip_state_t));
+    seqlock_read(&refs_lock, &refs, &mip_refs, sizeof(mip_refs_t));
+    theta_error = refs.theta_r - state.theta;
+    u = step_controller_filter(&iloop,theta_error);
+    seqlock_write_begin(&state_lock, STATE_WRITER_INNER);
+    mip_state.u = u;
+    seqlock_write_end(&state_lock, STATE_WRITER_INNER);
+
+    // outer_loop_step
+    seqlock_read(&state_lock, &state, &mip_state, sizeof(mip_state_t));
+    phi_right = (encoder[k] * TWO_PI)\
+                /(ENCODER_POLARITY_R * GEAR_RATIO * ENCODER_TICKS);
+    phi_left  = (encoder[k] * TWO_PI)\
+                /(ENCODER_POLARITY_L * GEAR_RATIO * ENCODER_TICKS);
+    phi = (phi_right + phi_left)/2.0;
+    seqlock_write_begin(&state_lock, STATE_WRITER_OUTER);
+    mip_state.phi_right = phi_right;
+    mip_state.phi_left  = phi_left;
+    mip_state.phi       = phi;
+    seqlock_write_end(&state_lock, STATE_WRITER_OUTER);
+    theta_r = step_controller_filter(&oloop,mip_refs.phi_r - phi - state.theta);
+    seqlock_write_begin(&refs_lock, REFS_WRITER_OUTER);
+    mip_refs.theta_r = theta_r;
+    seqlock_write_end(&refs_lock, REFS_WRITER_OUTER);
+  }
+  sink = mip_state.u;
+}
+
+/*******************************************************************************
+ * int run_runtime(int on_reactor, double seconds)
+ *
+ * balance_by_daniel's tasks at its rates and priorities for seconds, with
+ * the controller tick's work split into them: a stand-in for the cape
+ * library's DMP interrupt thread, the inner and outer loops as
+ * OUTER_LOOP_PHASE_LOCKED and INNER_LOOP_EVENT_DRIVEN place them, the
+ * watchdog and the main thread.  Either every task has its own thread or
+ * all but the interrupt and the watchdog share the reactor, which the
+ * interrupt wakes through an eventfd.  Prints context switches of the whole
+ * process per second, each task's timing, the interrupt to estimator
+ * handoff and every thread's page faults from its start.
+ ******************************************************************************/
+int run_runtime(int on_reactor, double seconds)
+{
+  struct rusage before, after;
+  rt_usage_t rt_start, rt_end;
+  pthread_t button;
+  int64_t start;
+  double elapsed, n;
+
+  setup_filters();
+  seqlock_init(&state_lock, STATE_WRITERS);
+  seqlock_init(&refs_lock, REFS_WRITERS);
+  set_state(RUNNING);
+  rt_on_reactor = on_reactor;
+  rt_handoffs = 0;
+  rt_handoff_max = 0;
+  rt_handoff_sum = 0;
+
+  periodic_task_init(&rt_dmp, "dmp_irq", &rt_dmp_step, SAMPLE_FREQUENCY,\
+                     IMU_DRAIN_PRIORITY, OVERRUN_SKIP);
+  periodic_task_init(&rt_inner, "inner_loop", &rt_inner_step,\
+                     INNER_LOOP_FREQUENCY, INNER_LOOP_PRIORITY,\
+                     INNER_LOOP_OVERRUN);
+  periodic_task_init(&rt_outer, "outer_loop", &rt_outer_step,\
+                     OUTER_LOOP_FREQUENCY, OUTER_LOOP_PRIORITY,\
+                     OUTER_LOOP_OVERRUN);
+  periodic_subtask_init(&rt_outer_sub, "outer_loop", &rt_outer_step,\
+                        INNER_LOOP_FREQUENCY/OUTER_LOOP_FREQUENCY,\
+                        OUTER_LOOP_PHASE);
+  periodic_task_init(&rt_watchdog, "watchdog", &rt_watchdog_step,\
+                     WATCHDOG_FREQUENCY, WATCHDOG_PRIORITY, OVERRUN_SKIP);
+  periodic_task_init(&rt_main, "main", &rt_main_step, SUPERVISOR_FREQUENCY,\
+                     0, OVERRUN_SKIP);
+
+  getrusage(RUSAGE_SELF, &before);
+  start = now_ns();
+  rt_end_ns = start + (int64_t)(seconds*1e9);
+  state_bus_subscribe(&rt_main_sub, "main");
+  clear_state_bus_stats();
+  rt_usage_snapshot(&rt_start);
+  periodic_task_start(&rt_watchdog);
+  pthread_create(&button, NULL, rt_button, NULL);
+  if(on_reactor)
+  {
+    if(reactor_init(&rt_reactor)) return -1;
+    rt_imu_event = reactor_add_event(&rt_reactor, "imu", &rt_imu_step,\
+                                     IMU_DRAIN_PRIORITY);
+    rt_state_event = reactor_add_event(&rt_reactor, "state", &rt_state_step,\
+                                       INNER_LOOP_PRIORITY);
+    state_bus_subscribe_fd(rt_state_event->fd);
+    if(!INNER_LOOP_EVENT_DRIVEN) reactor_add_task(&rt_reactor, &rt_inner);
+    if(!OUTER_LOOP_PHASE_LOCKED) reactor_add_task(&rt_reactor, &rt_outer);
+    reactor_add_task(&rt_reactor, &rt_main);
+    periodic_task_start(&rt_dmp);
+    reactor_run(&rt_reactor);
+  }
+  else
+  {
+    periodic_task_start(&rt_dmp);
+    if(!INNER_LOOP_EVENT_DRIVEN) periodic_task_start(&rt_inner);
+    if(!OUTER_LOOP_PHASE_LOCKED) periodic_task_start(&rt_outer);
+    while(now_ns() < rt_end_ns)
+    {
+      state_bus_sleep(&rt_main_sub, NSEC_PER_SEC/SUPERVISOR_FREQUENCY);
+    }
+  }
+  rt_usage_snapshot(&rt_end);
+  pthread_join(button, NULL);
+  periodic_task_stop(&rt_dmp);
+  periodic_task_stop(&rt_inner);
+  periodic_task_stop(&rt_outer);
+  periodic_task_stop(&rt_watchdog);
+  elapsed = (now_ns() - start)/1e9;
+  getrusage(RUSAGE_SELF, &after);
+
+  n = rt_handoffs > 0 ? rt_handoffs : 1;
+  printf("%s: %.1f s, %.1f context switches/s (%.1f voluntary, %.1f "\
+         "involuntary), dmp_irq to estimator mean %.1f max %.1f us\n",\
+         on_reactor ? "one reactor" : "thread per task", elapsed,\
+         (after.ru_nvcsw + after.ru_nivcsw - before.ru_nvcsw\
+          - before.ru_nivcsw)/elapsed,\
+         (after.ru_nvcsw - before.ru_nvcsw)/elapsed,\
+         (after.ru_nivcsw - before.ru_nivcsw)/elapsed,\
+         rt_handoff_sum/n/1e3, rt_handoff_max/1e3);
+  print_periodic_stats(&rt_dmp);
+  if(on_reactor)
+  {
+    print_reactor_stats(&rt_reactor);
+    reactor_close(&rt_reactor);
+  }
+  else
+  {
+    if(!INNER_LOOP_EVENT_DRIVEN) print_periodic_stats(&rt_inner);
+    if(!OUTER_LOOP_PHASE_LOCKED) print_periodic_stats(&rt_outer);
+  }
+  if(OUTER_LOOP_PHASE_LOCKED)
+  {
+    print_subtask_stats(&rt_outer_sub, INNER_LOOP_FREQUENCY);
+  }
+  print_periodic_stats(&rt_watchdog);
+  print_state_bus_stats();
+  print_rt_usage(&rt_start, &rt_end);
+  state_bus_unsubscribe(&rt_main_sub);
+  printf("\n");
+  return 0;
+}
+
+/*******************************************************************************
+ * int rt_dmp_step()
+ *
+ * The DMP interrupt: run imu_callback's work here, or wake the reactor for it
+ ******************************************************************************/
+int rt_dmp_step()
+{
+  atomic_store_explicit(&rt_dmp_ns, now_ns(), memory_order_relaxed);
+  if(rt_on_reactor) return reactor_notify(rt_imu_event);
+  return rt_imu_step();
+}
+
+/*******************************************************************************
+ * int rt_imu_step()
+ ******************************************************************************/
+int rt_imu_step()
+{
+  int64_t delay;
+  float a_angle, theta;
+  int k = rt_k++ & INPUT_MASK;
+
+  delay = now_ns() - atomic_load_explicit(&rt_dmp_ns, memory_order_relaxed);
+  if(delay > rt_handoff_max) rt_handoff_max = delay;
+  rt_handoff_sum += delay;
+  rt_handoffs++;
+
+  g_angle += gyro_x[k]/SAMPLE_FREQUENCY*DEG_TO_RAD;
+  a_angle = atan2(-accel_z[k], accel_y[k]);
+  theta = step_filter(&hpass,g_angle) + step_filter(&lpass,a_angle)\
+          + CAPE_MOUNT_ANGLE;
+  seqlock_write_begin(&state_lock, STATE_WRITER_IMU);
+  mip_state.theta = theta;
+  mip_state.imu_ns = k;
+  seqlock_write_end(&state_lock, STATE_WRITER_IMU);
+  if(INNER_LOOP_EVENT_DRIVEN) rt_inner_step();
+  return 0;
+}
+
+/*******************************************************************************
+ * int rt_inner_step()
+ ******************************************************************************/
+int rt_inner_step()
+{
+  mip_state_t state;
+  mip_refs_t refs;
+  float u;
+
+  seqlock_read(&state_lock, &state, &mip_state, sizeof(mip_state_t));
+  seqlock_read(&refs_lock, &refs, &mip_refs, sizeof(mip_refs_t));
+  u = step_controller_filter(&iloop,refs.theta_r - state.theta);
+  seqlock_write_begin(&state_lock, STATE_WRITER_INNER);
+  mip_state.u = u;
+  seqlock_write_end(&state_lock, STATE_WRITER_INNER);
+  if(OUTER_LOOP_PHASE_LOCKED) periodic_subtask_tick(&rt_outer_sub);
+  return 0;
+}
+
+/*******************************************************************************
+ * int rt_outer_step()
+ ******************************************************************************/
+int rt_outer_step()
+{
+  mip_state_t state;
+  float phi, theta_r;
+  int k = rt_k & INPUT_MASK;
+
+  seqlock_read(&state_lock, &state, &mip_state, sizeof(mip_state_t));
+  phi = (encoder[k] * TWO_PI)/(ENCODER_POLARITY_R*GEAR_RATIO*ENCODER_TICKS);
+  seqlock_write_begin(&state_lock, STATE_WRITER_OUTER);
+  mip_state.phi = phi;
+  seqlock_write_end(&state_lock, STATE_WRITER_OUTER);
+  theta_r = step_controller_filter(&oloop,mip_refs.phi_r - phi - state.theta);
+  seqlock_write_begin(&refs_lock, REFS_WRITER_OUTER);
+  mip_refs.theta_r = theta_r;
+  seqlock_write_end(&refs_lock, REFS_WRITER_OUTER);
+  return 0;
+}
+
+/*******************************************************************************
+ * int rt_watchdog_step()
+ ******************************************************************************/
+int rt_watchdog_step()
+{
+  sink = atomic_load_explicit(&rt_dmp_ns, memory_order_relaxed);
+  return 0;
+}
+
+/*******************************************************************************
+ * int rt_main_step()
+ *
+ * The reactor's main task, stops it once the time is up
+ ******************************************************************************/
+int rt_main_step()
+{
+  if(now_ns() >= rt_end_ns) reactor_stop(&rt_reactor);
+  return 0;
+}
+
+/*******************************************************************************
+ * int rt_state_step()
+ *
+ * The reactor's state event
+ ******************************************************************************/
+int rt_state_step()
+{
+  state_bus_changed(&rt_main_sub);
+  return 0;
+}
+
+/*******************************************************************************
+ * void* rt_button(void* ptr)
+ *
+ * The cape library's button thread, toggling pause every RUNTIME_PAUSE_US
+ * and leaving it running at the end
+ ******************************************************************************/
+void* rt_button(void* ptr)
+{
+  rt_name_thread("button");
+  while(now_ns() + RUNTIME_PAUSE_US*1000LL < rt_end_ns)
+  {
+    usleep(RUNTIME_PAUSE_US);
+    state_bus_set(get_state()==RUNNING ? PAUSED : RUNNING);
+  }
+  state_bus_set(RUNNING);
+  return NULL;
+}
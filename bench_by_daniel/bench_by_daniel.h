@@ -0,0 +1,48 @@
+/*******************************************************************************
+ * bench_by_daniel.h
+ *
+ * Configurations and definitions and stuff for "bench_by_daniel.c"
+ ******************************************************************************/
+
+// Measurement
+#define BENCH_ITERATIONS     200000   // calls per sample
+#define BENCH_SAMPLES        31       // timed samples per benchmark
+#define BENCH_WARMUP         2        // untimed samples first
+#define BENCH_INPUTS         4096     // recorded-like inputs, power of two
+#define BENCH_FILENAME       "bench_results.csv"
+
+// Runtime comparison, bench_by_daniel -r
+#define RUNTIME_SECONDS      10       // per model
+#define RUNTIME_PAUSE_US     250000   // pause button toggled this often
+
+#ifndef BENCH_REV
+#define BENCH_REV            "unknown"
+#endif
+
+// Where cycles/op came from
+typedef enum cycle_source_t
+{
+  CYCLES_NONE,
+  CYCLES_PERF,          // perf_event_open hardware cycle counter
+  CYCLES_TSC            // x86 time stamp counter, nominal not core cycles
+} cycle_source_t;
+
+// One benchmark, run iters times per call
+typedef struct bench_t
+{
+  const char* name;
+  void (*setup)();
+  void (*run)(long iters);
+
+} bench_t;
+
+// Summary over BENCH_SAMPLES samples
+typedef struct bench_result_t
+{
+  double ns_mean;
+  double ns_stddev;
+  double ns_min;
+  double ns_median;
+  double cycles_mean;
+
+} bench_result_t;
@@ -0,0 +1,471 @@
+/*******************************************************************************
+ * biquad.c
+ *
+ * Second order section cascades.  See biquad.h.
+ *
+ * tf_to_biquads works in double: roots of the numerator and denominator (in
+ * closed form up to second order, Durand-Kerner above that), conjugate pairs
+ * and real pairs become sections, and sections are ordered with the poles
+ * closest to the unit circle last, each taking the closest remaining zeros.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include "biquad.h"
+
+// only compiled into the saturating kernels.  Plain compares rather than
+// min/max: saturation is rare while balancing, and a predicted branch keeps
+// the clamp off the y[k-1] recurrence (faster in bench_by_daniel either way)
+#define SATURATE(y, sat)          \
+  if(y > sat) y = sat;            \
+  else if(y < -sat) y = -sat;
+
+/*******************************************************************************
+ * DEFINE_SECTION_KERNEL(name, SAT)
+ *
+ * One section, unrolled, saturated if SAT
+ ******************************************************************************/
+#define DEFINE_SECTION_KERNEL(name, SAT)                                      \
+static float name(biquad_filter_t* filter, float new_input)                   \
+{                                                                             \
+  biquad_t* s = filter->sections;                                             \
+  float y = s->b0*new_input + s->s1;                                          \
+  if(SAT) { SATURATE(y, filter->sat) }                                        \
+  s->s1 = s->b1*new_input - s->a1*y + s->s2;                                  \
+  s->s2 = s->b2*new_input - s->a2*y;                                          \
+  filter->step++;                                                             \
+  return y;                                                                   \
+}
+
+DEFINE_SECTION_KERNEL(step_section, 0)
+DEFINE_SECTION_KERNEL(step_section_sat, 1)
+
+/*******************************************************************************
+ * DEFINE_GAIN_KERNEL(name, SAT)
+ *
+ * Order 0, no sections, just the gain, saturated if SAT
+ ******************************************************************************/
+#define DEFINE_GAIN_KERNEL(name, SAT)                                         \
+static float name(biquad_filter_t* filter, float new_input)                   \
+{                                                                             \
+  float y = filter->k0*new_input;                                             \
+  if(SAT) { SATURATE(y, filter->sat) }                                        \
+  filter->step++;                                                             \
+  return y;                                                                   \
+}
+
+DEFINE_GAIN_KERNEL(step_gain, 0)
+DEFINE_GAIN_KERNEL(step_gain_sat, 1)
+
+#define ROOT_ITERATIONS   2000
+#define ROOT_TOLERANCE    1e-14
+#define REAL_TOLERANCE    1e-9
+
+// A first or second order factor, prod (1 - r z^-1), in double
+typedef struct factor_t
+{
+  double c[3];          // 1, c1, c2 or for a zero at infinity 0, 1, 0
+  double complex root;  // for pairing, one representative root
+  int order;
+  int used;
+
+} factor_t;
+
+/*******************************************************************************
+ * static int poly_roots(int m, const double* c, double complex* roots)
+ *
+ * Roots of c[0] z^m + c[1] z^(m-1) + ... + c[m], c[0] != 0
+ ******************************************************************************/
+static int poly_roots(int m, const double* c, double complex* roots)
+{
+  double complex z, p, q, d;
+  int i, j, k;
+  double change;
+
+  if(m == 1)
+  {
+    roots[0] = -c[1]/c[0];
+    return 0;
+  }
+  if(m == 2)
+  {
+    d = csqrt(c[1]*c[1] - 4*c[0]*c[2]);
+    // avoid cancellation, then Vieta for the other root
+    q = -0.5*(c[1] + (creal(d)*c[1] >= 0 ? d : -d));
+    if(cabs(q) == 0)
+    {
+      roots[0] = roots[1] = 0;
+      return 0;
+    }
+    roots[0] = q/c[0];
+    roots[1] = c[2]/q;
+    return 0;
+  }
+
+  // Durand-Kerner
+  for(i=0; i<m; i++) roots[i] = cpow(0.4 + 0.9*I, i);
+  for(k=0; k<ROOT_ITERATIONS; k++)
+  {
+    change = 0;
+    for(i=0; i<m; i++)
+    {
+      z = roots[i];
+      p = c[0];
+      for(j=1; j<=m; j++) p = p*z + c[j];
+      q = c[0];
+      for(j=0; j<m; j++) if(j != i) q *= z - roots[j];
+      if(cabs(q) == 0) continue;
+      roots[i] = z - p/q;
+      change += cabs(p/q);
+    }
+    if(change < ROOT_TOLERANCE) break;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * static int group_roots(int order, const float* coefs, double* lead,
+ *                        factor_t* factors)
+ *
+ * Factor order+1 newest-first coefficients into lead*prod(factors), with
+ * conjugate pairs and pairs of real roots combined into second order
+ * factors.  Returns the number of factors, -1 if every coefficient is zero.
+ ******************************************************************************/
+static int group_roots(int order, const float* coefs, double* lead,\
+                       factor_t* factors)
+{
+  double c[order+1];
+  double complex roots[order+1];
+  double reals[order+1];
+  int paired[order+1];
+  int delay = 0, m, i, j, best, n = 0, nr = 0;
+  double complex r;
+  double t;
+
+  while(delay <= order && coefs[delay] == 0) delay++;
+  if(delay > order) return -1;
+  *lead = coefs[delay];
+  m = order - delay;
+  for(i=0; i<=m; i++) c[i] = coefs[delay+i];
+  if(m > 0) poly_roots(m, c, roots);
+
+  // leading zero coefficients are zeros at infinity, pure z^-1 factors
+  for(i=0; i<delay; i++) reals[nr++] = INFINITY;
+
+  // match each upper half plane root with the nearest conjugate, repeated
+  // roots only converge to ~eps^(1/k) so the pair is averaged
+  for(i=0; i<m; i++) paired[i] = 0;
+  for(i=0; i<m; i++)
+  {
+    if(paired[i]) continue;
+    best = -1;
+    if(cimag(roots[i]) > REAL_TOLERANCE*(1+cabs(roots[i])))
+    {
+      for(j=0; j<m; j++)
+      {
+        if(paired[j] || j == i || cimag(roots[j]) >= 0) continue;
+        if(best < 0 || cabs(roots[j]-conj(roots[i]))\
+                       < cabs(roots[best]-conj(roots[i]))) best = j;
+      }
+    }
+    paired[i] = 1;
+    if(best < 0)
+    {
+      // real, or an unmatched lower half root which then must be real
+      if(cimag(roots[i]) < -REAL_TOLERANCE*(1+cabs(roots[i])))
+      {
+        paired[i] = 0;
+        continue;
+      }
+      reals[nr++] = creal(roots[i]);
+      continue;
+    }
+    paired[best] = 1;
+    r = 0.5*(roots[i] + conj(roots[best]));
+    factors[n].c[0] = 1;
+    factors[n].c[1] = -2*creal(r);
+    factors[n].c[2] = creal(r)*creal(r) + cimag(r)*cimag(r);
+    factors[n].root = r;
+    factors[n].order = 2;
+    factors[n].used = 0;
+    n++;
+  }
+  for(i=0; i<m; i++) if(!paired[i]) reals[nr++] = creal(roots[i]);
+
+  // sort the real roots and pair neighbours
+  for(i=1; i<nr; i++)
+  {
+    t = reals[i];
+    for(j=i; j>0 && reals[j-1] > t; j--) reals[j] = reals[j-1];
+    reals[j] = t;
+  }
+  for(i=0; i<nr; i+=2)
+  {
+    factors[n].order = (i+1 < nr) ? 2 : 1;
+    factors[n].used = 0;
+    factors[n].root = reals[i];
+    if(isinf(reals[i]))
+    {
+      factors[n].c[0] = 0; factors[n].c[1] = 1; factors[n].c[2] = 0;
+    }
+    else
+    {
+      factors[n].c[0] = 1; factors[n].c[1] = -reals[i]; factors[n].c[2] = 0;
+    }
+    if(factors[n].order == 2)
+    {
+      // multiply in (1 - r z^-1) or z^-1
+      if(isinf(reals[i+1]))
+      {
+        factors[n].c[2] = factors[n].c[1];
+        factors[n].c[1] = factors[n].c[0];
+        factors[n].c[0] = 0;
+      }
+      else
+      {
+        factors[n].c[2] = -reals[i+1]*factors[n].c[1];
+        factors[n].c[1] = factors[n].c[1] - reals[i+1]*factors[n].c[0];
+      }
+      if(fabs(reals[i+1]) > fabs(reals[i])) factors[n].root = reals[i+1];
+    }
+    n++;
+  }
+  return n;
+}
+
+/*******************************************************************************
+ * static double root_distance(double complex a, double complex b)
+ ******************************************************************************/
+static double root_distance(double complex a, double complex b)
+{
+  if(isinf(creal(a)) || isinf(creal(b))) return INFINITY;
+  return cabs(a-b);
+}
+
+/*******************************************************************************
+ * int tf_to_biquads(int order, float* num, float* den, float gain,
+ *                   biquad_t* sections)
+ *
+ * Factor gain*num/den (order+1 newest-first coefficients each, as for
+ * create_daniel_filter) into (order+1)/2 sections with zeroed state.
+ * Returns the number of sections, -1 if the transfer function is unusable.
+ * Order 0 has nothing to factor and gives no sections; its gain is left to
+ * the caller.
+ ******************************************************************************/
+int tf_to_biquads(int order, float* num, float* den, float gain,\
+                  biquad_t* sections)
+{
+  factor_t zeros[order+1], poles[order+1];
+  int nz, np, i, j, best, count = 0;
+  double num_lead, den_lead, d, best_d;
+  factor_t* p;
+  factor_t* z;
+
+  if(order < 0 || den[0] == 0) return -1;
+  if(order == 0) return 0;
+  nz = group_roots(order, num, &num_lead, zeros);
+  np = group_roots(order, den, &den_lead, poles);
+  if(nz < 0 || np < 0) return -1;
+
+  // poles furthest from the unit circle first, the sharpest last
+  for(i=1; i<np; i++)
+  {
+    factor_t t = poles[i];
+    for(j=i; j>0 && cabs(poles[j-1].root) > cabs(t.root); j--)
+    {
+      poles[j] = poles[j-1];
+    }
+    poles[j] = t;
+  }
+
+  // the sharpest poles choose their zeros first
+  for(i=np-1; i>=0; i--)
+  {
+    p = &poles[i];
+    best = -1;
+    best_d = INFINITY;
+    for(j=0; j<nz; j++)
+    {
+      if(zeros[j].used || zeros[j].order != p->order) continue;
+      d = root_distance(zeros[j].root, p->root);
+      if(best < 0 || d < best_d)
+      {
+        best = j;
+        best_d = d;
+      }
+    }
+    if(best < 0) return -1;
+    z = &zeros[best];
+    z->used = 1;
+
+    sections[i].b0 = z->c[0];
+    sections[i].b1 = z->c[1];
+    sections[i].b2 = z->c[2];
+    sections[i].a1 = p->c[1];
+    sections[i].a2 = p->c[2];
+    sections[i].s1 = 0;
+    sections[i].s2 = 0;
+    sections[i].pad = 0;
+    count++;
+  }
+
+  // overall gain rides on the first section
+  d = gain*num_lead/den_lead;
+  sections[0].b0 *= d;
+  sections[0].b1 *= d;
+  sections[0].b2 *= d;
+  return count;
+}
+
+/*******************************************************************************
+ * biquad_filter_t create_biquad_filter(int order, float dt, float* num,
+ *                                      float* den, float gain, float sat)
+ *
+ * Same arguments as create_daniel_filter.  Order 0 is a plain saturated gain
+ * with no sections.  Returns a filter with initialized = 0 if the transfer
+ * function can't be factored.
+ ******************************************************************************/
+biquad_filter_t create_biquad_filter(int order, float dt, float* num,\
+                                     float* den, float gain, float sat)
+{
+  biquad_filter_t filter;
+  int n = (order+1)/2;
+  size_t size = n*sizeof(biquad_t);
+
+  memset(&filter, 0, sizeof(biquad_filter_t));
+  filter.order = order;
+  filter.dt = dt;
+  filter.gain = gain;
+  filter.sat = sat;
+  if(order < 0 || den[0] == 0)
+  {
+    printf("ERROR: bad biquad filter, order %d a0 %f\n", order, den[0]);
+    return filter;
+  }
+  if(order == 0)
+  {
+    filter.k0 = gain*num[0]/den[0];
+    filter.kernel = sat > 0 ? step_gain_sat : step_gain;
+    filter.initialized = 1;
+    return filter;
+  }
+
+  size = (size + BIQUAD_CACHE_LINE-1) & ~(size_t)(BIQUAD_CACHE_LINE-1);
+  filter.sections = aligned_alloc(BIQUAD_CACHE_LINE, size);
+  if(filter.sections == NULL)
+  {
+    printf("ERROR: failed to allocate order %d biquad filter\n", order);
+    return filter;
+  }
+  memset(filter.sections, 0, size);
+  filter.n_sections = tf_to_biquads(order, num, den, gain, filter.sections);
+  if(filter.n_sections != n)
+  {
+    printf("ERROR: could not factor order %d filter into biquads\n", order);
+    free(filter.sections);
+    filter.sections = NULL;
+    return filter;
+  }
+  if(n == 1) filter.kernel = sat > 0 ? step_section_sat : step_section;
+  else       filter.kernel = step_biquad_filter_generic;
+  filter.initialized = 1;
+  return filter;
+}
+
+/*******************************************************************************
+ * float step_biquad_filter_generic(biquad_filter_t* filter, float new_input)
+ *
+ * Move forward one step through any number of sections.  Saturation clips
+ * the last section's output before it goes into that section's state, as the
+ * direct form clips its history.
+ ******************************************************************************/
+float step_biquad_filter_generic(biquad_filter_t* filter, float new_input)
+{
+  biquad_t* s = filter->sections;
+  biquad_t* last = s + filter->n_sections-1;
+  float x = new_input;
+  float y;
+
+  for(; s<last; s++)
+  {
+    y = s->b0*x + s->s1;
+    s->s1 = s->b1*x - s->a1*y + s->s2;
+    s->s2 = s->b2*x - s->a2*y;
+    x = y;
+  }
+
+  y = s->b0*x + s->s1;
+  if(filter->sat > 0)
+  {
+    if(y > filter->sat) y = filter->sat;
+    else if(y < -1*filter->sat) y = -1*filter->sat;
+  }
+  s->s1 = s->b1*x - s->a1*y + s->s2;
+  s->s2 = s->b2*x - s->a2*y;
+
+  filter->step++;
+  return y;
+}
+
+/*******************************************************************************
+ * int zero_biquad_filter(biquad_filter_t* filter)
+ *
+ * Zero out the state of every section
+ ******************************************************************************/
+int zero_biquad_filter(biquad_filter_t* filter)
+{
+  int i;
+  if(!filter->initialized) return -1;
+  for(i=0; i<filter->n_sections; i++)
+  {
+    filter->sections[i].s1 = 0;
+    filter->sections[i].s2 = 0;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * int set_biquad_filter_history(biquad_filter_t* filter, const float* inputs,
+ *                               const float* outputs, int n)
+ *
+ * Load the state a filter would have after seeing these inputs and outputs,
+ * newest first, n of each (missing ones are taken as zero).  Exact for a
+ * single section, where the state follows from the last two samples, and
+ * for order 0, which has no state.  The signals between sections of a
+ * cascade aren't recoverable from the ends, so longer filters are zeroed
+ * instead and -1 returned.
+ ******************************************************************************/
+int set_biquad_filter_history(biquad_filter_t* filter, const float* inputs,\
+                              const float* outputs, int n)
+{
+  biquad_t* s = filter->sections;
+  float x1 = n > 0 ? inputs[0] : 0;
+  float x2 = n > 1 ? inputs[1] : 0;
+  float y1 = n > 0 ? outputs[0] : 0;
+  float y2 = n > 1 ? outputs[1] : 0;
+
+  if(!filter->initialized) return -1;
+  if(filter->n_sections == 0) return 0;
+  if(filter->n_sections != 1)
+  {
+    zero_biquad_filter(filter);
+    return -1;
+  }
+  s->s2 = s->b2*x1 - s->a2*y1;
+  s->s1 = s->b1*x1 - s->a1*y1 + s->b2*x2 - s->a2*y2;
+  return 0;
+}
+
+/*******************************************************************************
+ * int destroy_biquad_filter(biquad_filter_t* filter)
+ ******************************************************************************/
+int destroy_biquad_filter(biquad_filter_t* filter)
+{
+  if(!filter->initialized) return -1;
+  free(filter->sections);
+  memset(filter, 0, sizeof(biquad_filter_t));
+  return 0;
+}
@@ -0,0 +1,73 @@
+/*******************************************************************************
+ * biquad.h
+ *
+ * Cascaded second order sections in transposed direct form II.  The same
+ * num/den/gain/sat transfer functions create_daniel_filter takes (D1_NUM,
+ * D1_DEN, ...) are factored into poles and zeros and regrouped into biquads,
+ * each pole pair with its nearest zeros, so poles crowding toward z=1 at
+ * high loop rates don't cost the precision the expanded polynomial does.
+ *
+ * Per section and step: 5 multiplies, 4 adds and two state words, the same
+ * work the direct form does for a second order filter.  Single section
+ * filters (D1, D2 and anything up to second order) get an unrolled kernel
+ * with the saturation policy fixed at creation.
+ ******************************************************************************/
+
+#ifndef BIQUAD_H
+#define BIQUAD_H
+
+#include <stdint.h>
+
+#define BIQUAD_CACHE_LINE   64
+
+// One section, y = (b0 + b1 z^-1 + b2 z^-2)/(1 + a1 z^-1 + a2 z^-2) x
+// first order sections have b2 = a2 = 0.  Padded to two per cache line.
+typedef struct biquad_t
+{
+  float b0, b1, b2;
+  float a1, a2;
+  float s1, s2;         // transposed direct form II state
+  float pad;
+
+} biquad_t;
+
+typedef struct biquad_filter_t
+{
+  _Alignas(BIQUAD_CACHE_LINE)
+  float (*kernel)(struct biquad_filter_t* filter, float new_input);
+  biquad_t* sections;
+  int n_sections;       // 0 for order 0
+  float k0;             // order 0 only, gain*num[0]/den[0]
+  float sat;            // output saturation, 0 for none
+  uint64_t step;
+
+  // basic stuff
+  int order;
+  float dt;
+  float gain;
+  int initialized;
+
+} biquad_filter_t;
+
+int tf_to_biquads(int order, float* num, float* den, float gain,\
+                  biquad_t* sections);
+biquad_filter_t create_biquad_filter(int order, float dt, float* num,\
+                                     float* den, float gain, float sat);
+float step_biquad_filter_generic(biquad_filter_t* filter, float new_input);
+int zero_biquad_filter(biquad_filter_t* filter);
+int set_biquad_filter_history(biquad_filter_t* filter, const float* inputs,\
+                              const float* outputs, int n);
+int destroy_biquad_filter(biquad_filter_t* filter);
+
+/*******************************************************************************
+ * float step_biquad_filter(biquad_filter_t* filter, float new_input)
+ *
+ * Move forward one step
+ ******************************************************************************/
+static inline float step_biquad_filter(biquad_filter_t* filter,\
+                                       float new_input)
+{
+  return filter->kernel(filter, new_input);
+}
+
+#endif // BIQUAD_H
@@ -0,0 +1,327 @@
+/*******************************************************************************
+ * c2d.c
+ *
+ * Continuous to discrete controller synthesis.  See c2d.h.
+ *
+ * Tustin and matched map each root on its own and multiply the polynomials
+ * back out.  ZOH goes through controller canonical form: the exponential of
+ * [A B; 0 0] dt gives Phi and Gamma, the discrete denominator is the
+ * characteristic polynomial of Phi and, by the matrix determinant lemma,
+ * C (zI - Phi)^-1 Gamma has numerator det(zI - Phi + Gamma C) - det(zI - Phi).
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include "c2d.h"
+
+#define C2D_N             (C2D_MAX_ORDER+1)   // augmented state for ZOH
+#define C2D_TAYLOR_TERMS  16
+
+/*******************************************************************************
+ * static int c2d_expand(const float* pairs, int npairs, double complex* roots)
+ *
+ * Pairs to roots, adding the conjugate of every complex one.  Returns the
+ * number of roots or -1 if there are more than C2D_MAX_ORDER.
+ ******************************************************************************/
+static int c2d_expand(const float* pairs, int npairs, double complex* roots)
+{
+  int i, n = 0;
+  for(i=0; i<npairs; i++)
+  {
+    if(n == C2D_MAX_ORDER) return -1;
+    roots[n++] = pairs[2*i] + I*pairs[2*i+1];
+    if(pairs[2*i+1] == 0) continue;
+    if(n == C2D_MAX_ORDER) return -1;
+    roots[n++] = pairs[2*i] - I*pairs[2*i+1];
+  }
+  return n;
+}
+
+/*******************************************************************************
+ * static void c2d_poly(const double complex* roots, int n, double* p)
+ *
+ * Monic polynomial with these roots, highest power first, n+1 coefficients.
+ * The roots come in conjugate pairs so the imaginary parts cancel.
+ ******************************************************************************/
+static void c2d_poly(const double complex* roots, int n, double* p)
+{
+  double complex c[C2D_N];
+  int i, j;
+  c[0] = 1;
+  for(i=0; i<n; i++)
+  {
+    c[i+1] = 0;
+    for(j=i+1; j>0; j--) c[j] -= roots[i]*c[j-1];
+  }
+  for(i=0; i<=n; i++) p[i] = creal(c[i]);
+}
+
+/*******************************************************************************
+ * static void c2d_matmul(int n, double a[][C2D_N], double b[][C2D_N],
+ *                        double out[][C2D_N])
+ ******************************************************************************/
+static void c2d_matmul(int n, double a[][C2D_N], double b[][C2D_N],\
+                       double out[][C2D_N])
+{
+  double t[C2D_N][C2D_N];
+  int i, j, k;
+  for(i=0; i<n; i++)
+  {
+    for(j=0; j<n; j++)
+    {
+      t[i][j] = 0;
+      for(k=0; k<n; k++) t[i][j] += a[i][k]*b[k][j];
+    }
+  }
+  memcpy(out, t, sizeof(t));
+}
+
+/*******************************************************************************
+ * static void c2d_expm(int n, double m[][C2D_N], double out[][C2D_N])
+ *
+ * Matrix exponential by scaling and squaring a Taylor series.  The matrices
+ * here are small and well scaled (poles times dt), so this is plenty.
+ ******************************************************************************/
+static void c2d_expm(int n, double m[][C2D_N], double out[][C2D_N])
+{
+  double a[C2D_N][C2D_N], term[C2D_N][C2D_N];
+  double norm = 0, row;
+  int i, j, k, squarings = 0;
+
+  for(i=0; i<n; i++)
+  {
+    row = 0;
+    for(j=0; j<n; j++) row += fabs(m[i][j]);
+    if(row > norm) norm = row;
+  }
+  while(norm > 0.5)
+  {
+    norm /= 2;
+    squarings++;
+  }
+  for(i=0; i<n; i++)
+  {
+    for(j=0; j<n; j++)
+    {
+      a[i][j] = ldexp(m[i][j], -squarings);
+      out[i][j] = term[i][j] = (i == j);
+    }
+  }
+  for(k=1; k<=C2D_TAYLOR_TERMS; k++)
+  {
+    c2d_matmul(n, term, a, term);
+    for(i=0; i<n; i++)
+    {
+      for(j=0; j<n; j++)
+      {
+        term[i][j] /= k;
+        out[i][j] += term[i][j];
+      }
+    }
+  }
+  for(k=0; k<squarings; k++) c2d_matmul(n, out, out, out);
+}
+
+/*******************************************************************************
+ * static void c2d_charpoly(int n, double a[][C2D_N], double* p)
+ *
+ * det(zI - a), highest power first, by Faddeev-LeVerrier
+ ******************************************************************************/
+static void c2d_charpoly(int n, double a[][C2D_N], double* p)
+{
+  double m[C2D_N][C2D_N], am[C2D_N][C2D_N];
+  double trace;
+  int i, j, k;
+
+  memset(m, 0, sizeof(m));
+  p[0] = 1;
+  for(k=1; k<=n; k++)
+  {
+    // m = a m_prev + p[k-1] I, then p[k] = -trace(a m)/k
+    c2d_matmul(n, a, m, m);
+    for(i=0; i<n; i++) m[i][i] += p[k-1];
+    c2d_matmul(n, a, m, am);
+    trace = 0;
+    for(i=0; i<n; i++) trace += am[i][i];
+    p[k] = -trace/k;
+  }
+  for(j=n+1; j<C2D_N; j++) p[j] = 0;
+}
+
+/*******************************************************************************
+ * static void c2d_zoh(int n, const double* num_s, const double* den_s,
+ *                     double dt, double* num, double* den)
+ *
+ * num_s (n+1 coefficients, leading ones may be zero) over monic den_s
+ ******************************************************************************/
+static void c2d_zoh(int n, const double* num_s, const double* den_s,\
+                    double dt, double* num, double* den)
+{
+  double m[C2D_N][C2D_N], e[C2D_N][C2D_N], closed[C2D_N][C2D_N];
+  double c[C2D_MAX_ORDER], p[C2D_N];
+  double d = num_s[0];
+  int i, j;
+
+  // controller canonical form, B = e1
+  memset(m, 0, sizeof(m));
+  for(j=0; j<n; j++)
+  {
+    m[0][j] = -den_s[j+1]*dt;
+    c[j] = num_s[j+1] - d*den_s[j+1];
+  }
+  for(i=1; i<n; i++) m[i][i-1] = dt;
+  m[0][n] = dt;
+  c2d_expm(n+1, m, e);
+
+  // e is [Phi Gamma; 0 1]
+  c2d_charpoly(n, e, den);
+  for(i=0; i<n; i++)
+  {
+    for(j=0; j<n; j++) closed[i][j] = e[i][j] - e[i][n]*c[j];
+  }
+  c2d_charpoly(n, closed, p);
+  for(i=0; i<=n; i++) num[i] = p[i] + (d-1)*den[i];
+}
+
+/*******************************************************************************
+ * int c2d(int method, const c2d_tf_t* tf, float dt, int min_order,
+ *         int max_order, float* num, float* den, float* gain)
+ *
+ * Discretize tf for a filter stepped every dt.  Fills max_order+1 entries of
+ * num and den (unused ones zero) so *gain * num/den is the discrete transfer
+ * function, with den[0] and the first non zero num coefficient 1 as the
+ * hand written coefficients are.  Returns the order, the number of poles, or
+ * -1 if the design can't be discretized or its order isn't min_order to
+ * max_order, what the filter it is for can run.
+ ******************************************************************************/
+int c2d(int method, const c2d_tf_t* tf, float dt, int min_order,\
+        int max_order, float* num, float* den, float* gain)
+{
+  double complex zeros[C2D_MAX_ORDER], poles[C2D_MAX_ORDER];
+  double complex zd[C2D_MAX_ORDER], pd[C2D_MAX_ORDER];
+  double complex k;
+  double num_d[C2D_N], den_d[C2D_N], num_s[C2D_N], den_s[C2D_N];
+  double c, big = 0, lead = 0;
+  int nz, np, i, origin = 0;
+
+  nz = c2d_expand(tf->zeros, tf->nzeros, zeros);
+  np = c2d_expand(tf->poles, tf->npoles, poles);
+  if(nz < 0 || np < 0 || nz > np || dt <= 0)
+  {
+    printf("ERROR: can't discretize %d zeros over %d poles\n", nz, np);
+    return -1;
+  }
+  if(np < min_order || np > max_order)
+  {
+    printf("ERROR: %d poles, the filter takes order %d to %d\n", np,\
+           min_order, max_order);
+    return -1;
+  }
+
+  k = tf->gain;
+  switch(method)
+  {
+    case C2D_TUSTIN:
+      c = 2/(double)dt;
+      if(tf->prewarp > 0)
+      {
+        if(tf->prewarp*dt >= M_PI)
+        {
+          printf("ERROR: prewarp %g rad/s is past Nyquist\n", tf->prewarp);
+          return -1;
+        }
+        c = tf->prewarp/tan(tf->prewarp*dt/2);
+      }
+      // (s - r) = (c - r)(z - (c + r)/(c - r))/(z + 1)
+      for(i=0; i<nz; i++)
+      {
+        k *= c - zeros[i];
+        zd[i] = (c + zeros[i])/(c - zeros[i]);
+      }
+      for(i=0; i<np; i++)
+      {
+        if(cabs(c - poles[i]) < 1e-12*c)
+        {
+          printf("ERROR: pole at s = %g maps to infinity\n", c);
+          return -1;
+        }
+        k /= c - poles[i];
+        pd[i] = (c + poles[i])/(c - poles[i]);
+      }
+      for(i=nz; i<np; i++) zd[i] = -1;
+      break;
+
+    case C2D_MATCHED:
+      // low frequency gain: H(s) ~ s^(zeros at 0 - poles at 0) times the
+      // rest at s = 0, and z - 1 ~ s dt
+      for(i=0; i<nz; i++)
+      {
+        zd[i] = cexp(zeros[i]*dt);
+        if(zeros[i] == 0) origin--;
+        else k *= -zeros[i]/(1 - zd[i]);
+      }
+      for(i=nz; i<np; i++)
+      {
+        zd[i] = -1;
+        k /= 2;
+      }
+      for(i=0; i<np; i++)
+      {
+        pd[i] = cexp(poles[i]*dt);
+        if(poles[i] == 0) origin++;
+        else k *= (1 - pd[i])/-poles[i];
+      }
+      k *= pow(dt, origin);
+      break;
+
+    case C2D_ZOH:
+      c2d_poly(zeros, nz, num_s + (np - nz));
+      for(i=0; i<np-nz; i++) num_s[i] = 0;
+      for(i=0; i<=np; i++) num_s[i] *= tf->gain;
+      c2d_poly(poles, np, den_s);
+      c2d_zoh(np, num_s, den_s, dt, num_d, den_d);
+      k = 1;
+      break;
+
+    default:
+      printf("ERROR: unknown discretization method %d\n", method);
+      return -1;
+  }
+  if(method != C2D_ZOH)
+  {
+    c2d_poly(zd, np, num_d);
+    c2d_poly(pd, np, den_d);
+  }
+
+  // scale so the first non zero numerator coefficient is 1
+  for(i=0; i<=np; i++) if(fabs(num_d[i]) > big) big = fabs(num_d[i]);
+  for(i=0; i<=np && lead == 0; i++)
+  {
+    if(fabs(num_d[i]) > 1e-12*big) lead = num_d[i];
+  }
+  if(lead == 0) lead = 1;
+  *gain = creal(k)*lead;
+  for(i=0; i<=max_order; i++)
+  {
+    num[i] = i <= np ? num_d[i]/lead : 0;
+    den[i] = i <= np ? den_d[i] : 0;
+  }
+  return np;
+}
+
+/*******************************************************************************
+ * const char* c2d_method_name(int method)
+ ******************************************************************************/
+const char* c2d_method_name(int method)
+{
+  switch(method)
+  {
+    case C2D_DISCRETE: return "discrete";
+    case C2D_TUSTIN:   return "tustin";
+    case C2D_ZOH:      return "zoh";
+    case C2D_MATCHED:  return "matched";
+  }
+  return "unknown";
+}
@@ -0,0 +1,55 @@
+/*******************************************************************************
+ * c2d.h
+ *
+ * Continuous to discrete controller synthesis.  A design is given in s as
+ * gain, zeros and poles,
+ *
+ *            (s - z1)(s - z2) ... (s - zm)
+ *   H(s) = k -----------------------------      m <= n
+ *            (s - p1)(s - p2) ... (s - pn)
+ *
+ * and c2d turns it into the num, den and gain that create_daniel_filter and
+ * friends take, for whatever dt the loop runs at:
+ *
+ *   C2D_TUSTIN   bilinear, s = c (z-1)/(z+1).  c = 2/dt, or w/tan(w dt/2) to
+ *                prewarp so the response is exact at w rad/s (a crossover
+ *                or notch frequency).
+ *   C2D_ZOH      step invariant: H(z) is exactly H(s) behind a zero order
+ *                hold, through the matrix exponential of a state space form.
+ *   C2D_MATCHED  z = e^(s dt) for every pole and zero, zeros at infinity
+ *                to z = -1, gain matched at low frequency (at DC, or on the
+ *                s^k asymptote when there are poles or zeros at s = 0).
+ *
+ * Roots are listed as real, imaginary pairs.  A pair with a non zero
+ * imaginary part stands for the root and its conjugate, so
+ * { 0, 0, -20, 0 } is two real poles and { -5, 6 } two complex ones.
+ * Everything is done in double and only run at startup or on a reload.
+ ******************************************************************************/
+
+#ifndef C2D_H
+#define C2D_H
+
+#define C2D_MAX_ORDER     8
+
+// methods, as numbers so they can go in a config file
+#define C2D_DISCRETE      0     // no synthesis, coefficients given as is
+#define C2D_TUSTIN        1
+#define C2D_ZOH           2
+#define C2D_MATCHED       3
+
+typedef struct c2d_tf_t
+{
+  float gain;
+  float zeros[2*C2D_MAX_ORDER];   // re, im pairs
+  int nzeros;                     // pairs in zeros
+  float poles[2*C2D_MAX_ORDER];
+  int npoles;
+  float prewarp;                  // rad/s, C2D_TUSTIN only, 0 for none
+
+} c2d_tf_t;
+
+int c2d(int method, const c2d_tf_t* tf, float dt, int min_order,\
+        int max_order, float* num, float* den, float* gain);
+const char* c2d_method_name(int method);
+
+#endif // C2D_H
@@ -0,0 +1,221 @@
+/*******************************************************************************
+ * daniel_filter.c
+ *
+ * Arbitrary order discrete filters.  See daniel_filter.h.
+ *
+ * The specialized kernels keep their history in fixed slots, x[k-1] and
+ * y[k-1] in inputs[0] and outputs[0], x[k-2] and y[k-2] in inputs[1] and
+ * outputs[1], instead of the generic kernel's circular buffer.  A filter
+ * keeps the kernel it was created with, so the two layouts never mix.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "daniel_filter.h"
+
+// only compiled into the saturating kernels.  Plain compares rather than
+// min/max: saturation is rare while balancing, and a predicted branch keeps
+// the clamp off the y[k-1] recurrence (faster in bench_by_daniel either way)
+#define SATURATE(y, sat)          \
+  if(y > sat) y = sat;            \
+  else if(y < -sat) y = -sat;
+
+/*******************************************************************************
+ * DEFINE_ORDER1_KERNEL(name, SAT)
+ *
+ * y = b0 x[k] + b1 x[k-1] - a1 y[k-1], saturated if SAT
+ ******************************************************************************/
+#define DEFINE_ORDER1_KERNEL(name, SAT)                                       \
+static float name(daniel_filter_t* filter, float new_input)                   \
+{                                                                             \
+  float y = filter->num[0]*new_input + filter->num[1]*filter->inputs[0]      \
+            - filter->den[1]*filter->outputs[0];                             \
+  if(SAT) { SATURATE(y, filter->sat) }                                        \
+  filter->inputs[0] = new_input;                                              \
+  filter->outputs[0] = y;                                                     \
+  filter->step++;                                                             \
+  return y;                                                                   \
+}
+
+/*******************************************************************************
+ * DEFINE_ORDER2_KERNEL(name, SAT)
+ *
+ * y = b0 x[k] + b1 x[k-1] + b2 x[k-2] - a1 y[k-1] - a2 y[k-2]
+ ******************************************************************************/
+#define DEFINE_ORDER2_KERNEL(name, SAT)                                       \
+static float name(daniel_filter_t* filter, float new_input)                   \
+{                                                                             \
+  float x1 = filter->inputs[0];                                               \
+  float y1 = filter->outputs[0];                                              \
+  float y = filter->num[0]*new_input + filter->num[1]*x1                      \
+            + filter->num[2]*filter->inputs[1]                                \
+            - filter->den[1]*y1 - filter->den[2]*filter->outputs[1];          \
+  if(SAT) { SATURATE(y, filter->sat) }                                        \
+  filter->inputs[1] = x1;                                                     \
+  filter->inputs[0] = new_input;                                              \
+  filter->outputs[1] = y1;                                                    \
+  filter->outputs[0] = y;                                                     \
+  filter->step++;                                                             \
+  return y;                                                                   \
+}
+
+DEFINE_ORDER1_KERNEL(step_order1, 0)
+DEFINE_ORDER1_KERNEL(step_order1_sat, 1)
+DEFINE_ORDER2_KERNEL(step_order2, 0)
+DEFINE_ORDER2_KERNEL(step_order2_sat, 1)
+
+/*******************************************************************************
+ * daniel_filter_t create_daniel_filter(int order, float dt, float* num,
+ *                                      float* den, float gain, float sat)
+ *
+ * Create a filter.  Yay!  num and den hold order+1 coefficients each, sat is
+ * the output saturation (0 for none).  Returns a filter with initialized = 0
+ * if the order or den[0] is unusable or the history can't be allocated.
+ ******************************************************************************/
+daniel_filter_t create_daniel_filter(int order, float dt, float* num,\
+                                     float* den, float gain, float sat)
+{
+  daniel_filter_t filter;
+  int i;
+  int len = order+1;
+  size_t size = 6*len*sizeof(float);
+  float* block;
+
+  memset(&filter, 0, sizeof(daniel_filter_t));
+  filter.order = order;
+  filter.dt = dt;
+  filter.gain = gain;
+  filter.sat = sat;
+  if(order < 0 || den[0] == 0)
+  {
+    printf("ERROR: bad filter, order %d a0 %f\n", order, den[0]);
+    return filter;
+  }
+
+  // coefficients and both histories in one block of whole cache lines
+  size = (size + DANIEL_FILTER_CACHE_LINE-1) & ~(size_t)(DANIEL_FILTER_CACHE_LINE-1);
+  block = aligned_alloc(DANIEL_FILTER_CACHE_LINE, size);
+  if(block == NULL)
+  {
+    printf("ERROR: failed to allocate order %d filter\n", order);
+    return filter;
+  }
+  memset(block, 0, size);
+  filter.num     = block;
+  filter.den     = block + len;
+  filter.inputs  = block + 2*len;
+  filter.outputs = block + 4*len;
+
+  // fold the gain and a0 in now so step_filter never divides
+  for(i=0; i<len; i++)
+  {
+    filter.num[i] = gain*num[i]/den[0];
+    filter.den[i] = den[i]/den[0];
+  }
+  filter.newest = 0;
+  filter.step = 0;
+
+  // pick the kernel once so step_filter never checks order or sat
+  if(order == 1)      filter.kernel = sat > 0 ? step_order1_sat : step_order1;
+  else if(order == 2) filter.kernel = sat > 0 ? step_order2_sat : step_order2;
+  else                filter.kernel = step_filter_generic;
+  filter.initialized = 1;
+  return filter;
+}
+
+/*******************************************************************************
+ * float step_filter_generic(daniel_filter_t* filter, float new_input)
+ *
+ * Move forward one step in a filter of any order, the kernel for everything
+ * without a specialized one
+ ******************************************************************************/
+float step_filter_generic(daniel_filter_t* filter, float new_input)
+{
+  int len = filter->order+1;
+  int k = filter->newest;
+  float* x;
+  float* y;
+  float new_output;
+  int i;
+
+  // step the circular index back, x[k-i] and y[k-i] now sit at k+i
+  k = (k == 0) ? len-1 : k-1;
+  filter->newest = k;
+  x = filter->inputs + k;
+  y = filter->outputs + k;
+  x[0] = new_input;
+  x[len] = new_input;
+
+  // Calculate output
+  new_output = filter->num[0]*x[0];
+  for(i=1; i<len; i++)
+  {
+    new_output += filter->num[i]*x[i] - filter->den[i]*y[i];
+  }
+
+  if(filter->sat > 0)
+  {
+    if(new_output > filter->sat) new_output = filter->sat;
+    else if(new_output < -1*filter->sat) new_output = -1*filter->sat;
+  }
+
+  y[0] = new_output;
+  y[len] = new_output;
+  filter->step++;
+  return new_output;
+}
+
+/*******************************************************************************
+ * int zero_filter(daniel_filter_t* filter)
+ *
+ * Zero out all the values in a filter
+ ******************************************************************************/
+int zero_filter(daniel_filter_t* filter)
+{
+  int len = filter->order+1;
+  if(!filter->initialized) return -1;
+  memset(filter->inputs, 0, 2*len*sizeof(float));
+  memset(filter->outputs, 0, 2*len*sizeof(float));
+  filter->newest = 0;
+  return 0;
+}
+
+/*******************************************************************************
+ * int set_filter_history(daniel_filter_t* filter, const float* inputs,
+ *                        const float* outputs, int n)
+ *
+ * Load past inputs and outputs, newest first, n of each (missing ones are
+ * taken as zero), as if the filter had produced them.  Laid out for the
+ * generic kernel with newest = 0, which puts x[k-1] and x[k-2] in the same
+ * slots the specialized kernels use.
+ ******************************************************************************/
+int set_filter_history(daniel_filter_t* filter, const float* inputs,\
+                       const float* outputs, int n)
+{
+  int len = filter->order+1;
+  int i;
+  if(!filter->initialized) return -1;
+  zero_filter(filter);
+  for(i=0; i<filter->order && i<n; i++)
+  {
+    filter->inputs[i]      = inputs[i];
+    filter->inputs[i+len]  = inputs[i];
+    filter->outputs[i]     = outputs[i];
+    filter->outputs[i+len] = outputs[i];
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * int destroy_daniel_filter(daniel_filter_t* filter)
+ *
+ * Free the coefficients and history
+ ******************************************************************************/
+int destroy_daniel_filter(daniel_filter_t* filter)
+{
+  if(!filter->initialized) return -1;
+  free(filter->num);
+  memset(filter, 0, sizeof(daniel_filter_t));
+  return 0;
+}
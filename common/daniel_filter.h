@@ -0,0 +1,70 @@
+/*******************************************************************************
+ * daniel_filter.h
+ *
+ * Discrete IIR filters of any order, shared by balance_by_daniel,
+ * filters_by_daniel and the replay tool.
+ *
+ *            b0 + b1 z^-1 + ... + bn z^-n
+ *   H(z) = k ----------------------------
+ *            a0 + a1 z^-1 + ... + an z^-n
+ *
+ * num and den are given newest coefficient first, as above.  The gain and a0
+ * are folded into the coefficients when the filter is created so a step is
+ * just the two dot products.  The history is a circular buffer stored twice
+ * back to back, so the newest order+1 samples are always contiguous and a
+ * step never shifts or wraps.
+ *
+ * create_daniel_filter also picks the step kernel: first and second order
+ * filters, with and without saturation, get their own fully unrolled kernel
+ * with no order loop or saturation check (generated in daniel_filter.c),
+ * everything else runs the generic loop.  step_filter is just the indirect
+ * call.
+ ******************************************************************************/
+
+#ifndef DANIEL_FILTER_H
+#define DANIEL_FILTER_H
+
+#include <stdint.h>
+
+#define DANIEL_FILTER_CACHE_LINE  64
+
+typedef struct daniel_filter_t
+{
+  // everything step_filter touches, one cache line
+  _Alignas(DANIEL_FILTER_CACHE_LINE)
+  float (*kernel)(struct daniel_filter_t* filter, float new_input);
+  float* num;           // gain*b/a0, order+1
+  float* den;           // a/a0, den[0] unused
+  float* inputs;        // x history, 2*(order+1)
+  float* outputs;       // y history, 2*(order+1)
+  int order;
+  int newest;           // index of x[k] in inputs
+  float sat;            // output saturation, 0 for none
+  uint64_t step;
+
+  // basic stuff
+  float dt;
+  float gain;
+  int initialized;
+
+} daniel_filter_t;
+
+daniel_filter_t create_daniel_filter(int order, float dt, float* num,\
+                                     float* den, float gain, float sat);
+float step_filter_generic(daniel_filter_t* filter, float new_input);
+int zero_filter(daniel_filter_t* filter);
+int set_filter_history(daniel_filter_t* filter, const float* inputs,\
+                       const float* outputs, int n);
+int destroy_daniel_filter(daniel_filter_t* filter);
+
+/*******************************************************************************
+ * float step_filter(daniel_filter_t* filter, float new_input)
+ *
+ * Move forward one step in the filter
+ ******************************************************************************/
+static inline float step_filter(daniel_filter_t* filter, float new_input)
+{
+  return filter->kernel(filter, new_input);
+}
+
+#endif // DANIEL_FILTER_H
@@ -0,0 +1,225 @@
+/*******************************************************************************
+ * mip_config.c
+ *
+ * Configuration file parser.  See mip_config.h.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "mip_config.h"
+
+/*******************************************************************************
+ * static mip_config_entry_t* mip_config_find(mip_config_t* config,
+ *                                            const char* key)
+ ******************************************************************************/
+static mip_config_entry_t* mip_config_find(mip_config_t* config,\
+                                           const char* key)
+{
+  int i;
+  for(i=0; i<config->n; i++)
+  {
+    if(strcmp(config->entries[i].key, key) == 0) return &config->entries[i];
+  }
+  return NULL;
+}
+
+/*******************************************************************************
+ * static int mip_config_parse(char* line, mip_config_entry_t* entry)
+ *
+ * One line into entry.  Returns 1 for a setting, 0 for a blank or comment
+ * line and -1 if it can't be read.
+ ******************************************************************************/
+static int mip_config_parse(char* line, mip_config_entry_t* entry)
+{
+  char* p = line;
+  char* end;
+  int len = 0, list = 0;
+
+  while(isspace((unsigned char)*p)) p++;
+  if(strncmp(p, "#define", 7) == 0 && isspace((unsigned char)p[7])) p += 7;
+  if((end = strstr(p, "//")) != NULL) *end = '\0';
+  if((end = strchr(p, '#')) != NULL) *end = '\0';
+  while(isspace((unsigned char)*p)) p++;
+  if(*p == '\0') return 0;
+
+  memset(entry, 0, sizeof(mip_config_entry_t));
+  while(isalnum((unsigned char)*p) || *p == '_')
+  {
+    if(len == MIP_CONFIG_KEY_LEN-1) return -1;
+    entry->key[len++] = *p++;
+  }
+  if(len == 0) return -1;
+
+  // the rest is numbers, separated by anything number-free
+  while(*p != '\0')
+  {
+    if(*p == '=' || *p == ',' || *p == '{' || *p == '}' || isspace((unsigned char)*p))
+    {
+      list |= *p == '{';
+      p++;
+      continue;
+    }
+    if(entry->n == MIP_CONFIG_MAX_VALUES) return -1;
+    entry->values[entry->n] = strtod(p, &end);
+    if(end == p) return -1;
+    entry->n++;
+    p = end;
+  }
+  // only a list can be empty, { }
+  return entry->n > 0 || list ? 1 : -1;
+}
+
+/*******************************************************************************
+ * int mip_config_load(const char* name, mip_config_t* config)
+ *
+ * Read every setting in the file.  A key given twice keeps its last value.
+ * Returns -1 if the file can't be opened or has a line that doesn't parse.
+ ******************************************************************************/
+int mip_config_load(const char* name, mip_config_t* config)
+{
+  FILE* f;
+  char line[MIP_CONFIG_LINE_LEN];
+  mip_config_entry_t entry;
+  mip_config_entry_t* e;
+  int n = 0, ret = 0;
+
+  memset(config, 0, sizeof(mip_config_t));
+  f = fopen(name, "r");
+  if(f == NULL)
+  {
+    printf("ERROR: can't open config %s\n", name);
+    return -1;
+  }
+
+  while(fgets(line, sizeof(line), f) != NULL)
+  {
+    n++;
+    switch(mip_config_parse(line, &entry))
+    {
+      case 0:
+        break;
+      case 1:
+        e = mip_config_find(config, entry.key);
+        if(e == NULL)
+        {
+          if(config->n == MIP_CONFIG_MAX_KEYS)
+          {
+            printf("ERROR: %s:%d too many settings\n", name, n);
+            ret = -1;
+            break;
+          }
+          e = &config->entries[config->n++];
+        }
+        *e = entry;
+        break;
+      default:
+        printf("ERROR: %s:%d can't read setting\n", name, n);
+        ret = -1;
+    }
+  }
+  fclose(f);
+  return ret;
+}
+
+/*******************************************************************************
+ * int mip_config_float(mip_config_t* config, const char* key, float* value)
+ * int mip_config_int(mip_config_t* config, const char* key, int* value)
+ *
+ * Overwrite value if the key was set.  Returns 1 if it was, 0 if not and -1
+ * if it was set to the wrong number of values.
+ ******************************************************************************/
+int mip_config_float(mip_config_t* config, const char* key, float* value)
+{
+  return mip_config_floats(config, key, value, 1);
+}
+
+int mip_config_int(mip_config_t* config, const char* key, int* value)
+{
+  mip_config_entry_t* e = mip_config_find(config, key);
+  if(e == NULL) return 0;
+  e->used = 1;
+  if(e->n != 1 || e->values[0] != (int)e->values[0])
+  {
+    printf("ERROR: %s needs one integer\n", key);
+    return -1;
+  }
+  *value = (int)e->values[0];
+  return 1;
+}
+
+/*******************************************************************************
+ * int mip_config_floats(mip_config_t* config, const char* key, float* values,
+ *                       int count)
+ *
+ * The same for a key holding exactly count values
+ ******************************************************************************/
+int mip_config_floats(mip_config_t* config, const char* key, float* values,\
+                      int count)
+{
+  mip_config_entry_t* e = mip_config_find(config, key);
+  int i;
+  if(e == NULL) return 0;
+  e->used = 1;
+  if(e->n != count)
+  {
+    printf("ERROR: %s needs %d value%s, got %d\n", key, count,
+           count == 1 ? "" : "s", e->n);
+    return -1;
+  }
+  for(i=0; i<count; i++) values[i] = e->values[i];
+  return 1;
+}
+
+/*******************************************************************************
+ * int mip_config_list(mip_config_t* config, const char* key, float* values,
+ *                     int max, int* count)
+ *
+ * The same for a key holding up to max values, which may be none.  count is
+ * set to how many there were.
+ ******************************************************************************/
+int mip_config_list(mip_config_t* config, const char* key, float* values,\
+                    int max, int* count)
+{
+  mip_config_entry_t* e = mip_config_find(config, key);
+  int i;
+  if(e == NULL) return 0;
+  e->used = 1;
+  if(e->n > max)
+  {
+    printf("ERROR: %s takes at most %d values, got %d\n", key, max, e->n);
+    return -1;
+  }
+  for(i=0; i<e->n; i++) values[i] = e->values[i];
+  *count = e->n;
+  return 1;
+}
+
+/*******************************************************************************
+ * int mip_config_has(mip_config_t* config, const char* key)
+ *
+ * 1 if the file sets key, without counting as a use
+ ******************************************************************************/
+int mip_config_has(mip_config_t* config, const char* key)
+{
+  return mip_config_find(config, key) != NULL;
+}
+
+/*******************************************************************************
+ * int mip_config_report_unused(mip_config_t* config, const char* name)
+ *
+ * Warn about settings nothing asked for, usually a misspelled key.  Returns
+ * how many there were.
+ ******************************************************************************/
+int mip_config_report_unused(mip_config_t* config, const char* name)
+{
+  int i, n = 0;
+  for(i=0; i<config->n; i++)
+  {
+    if(config->entries[i].used) continue;
+    printf("WARNING: %s: unknown setting %s\n", name, config->entries[i].key);
+    n++;
+  }
+  return n;
+}
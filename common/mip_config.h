@@ -0,0 +1,51 @@
+/*******************************************************************************
+ * mip_config.h
+ *
+ * Plain text configuration files, one setting per line:
+ *
+ *   SAMPLE_FREQUENCY = 200
+ *   D1_NUM = { 1.0000, -1.9470, 0.9480 }     # braces and commas optional
+ *   #define D1_GAIN -4.0                     // header lines work too
+ *   D1_S_ZEROS = { }                         # an empty list
+ *
+ * Keys are the macro names from the program's header, values one or more
+ * numbers.  Everything after a '#' that doesn't start "#define", or after
+ * "//", is a comment.  The file is only ever read from setup or reload
+ * paths, never from a control loop.
+ ******************************************************************************/
+
+#ifndef MIP_CONFIG_H
+#define MIP_CONFIG_H
+
+#define MIP_CONFIG_MAX_KEYS     64
+#define MIP_CONFIG_KEY_LEN      32
+#define MIP_CONFIG_MAX_VALUES   8
+#define MIP_CONFIG_LINE_LEN     256
+
+typedef struct mip_config_entry_t
+{
+  char key[MIP_CONFIG_KEY_LEN];
+  double values[MIP_CONFIG_MAX_VALUES];
+  int n;
+  int used;             // looked up at least once
+
+} mip_config_entry_t;
+
+typedef struct mip_config_t
+{
+  mip_config_entry_t entries[MIP_CONFIG_MAX_KEYS];
+  int n;
+
+} mip_config_t;
+
+int mip_config_load(const char* name, mip_config_t* config);
+int mip_config_float(mip_config_t* config, const char* key, float* value);
+int mip_config_int(mip_config_t* config, const char* key, int* value);
+int mip_config_floats(mip_config_t* config, const char* key, float* values,\
+                      int count);
+int mip_config_list(mip_config_t* config, const char* key, float* values,\
+                    int max, int* count);
+int mip_config_has(mip_config_t* config, const char* key);
+int mip_config_report_unused(mip_config_t* config, const char* name);
+
+#endif // MIP_CONFIG_H
@@ -0,0 +1,21 @@
+/*******************************************************************************
+ * mip_hal.h
+ *
+ * Hardware abstraction layer for the MiP projects.  Programs include this
+ * instead of <usefulincludes.h> and <roboticscape.h> directly.  Building with
+ * -DMIP_SIM swaps the robotics cape library for the simulated backend in
+ * mip_sim.c, which implements the same subset of the cape API on top of the
+ * plant model in mip_plant.c.
+ ******************************************************************************/
+
+#ifndef MIP_HAL_H
+#define MIP_HAL_H
+
+#ifdef MIP_SIM
+#include "mip_sim.h"
+#else
+#include <usefulincludes.h>
+#include <roboticscape.h>
+#endif
+
+#endif // MIP_HAL_H
@@ -0,0 +1,364 @@
+/*******************************************************************************
+ * mip_imu.c
+ *
+ * IMU acquisition, DMP or raw FIFO.  See mip_imu.h.
+ *
+ * The cape library has no FIFO calls of its own, so the FIFO path sets the
+ * MPU-9250 up and reads it over the library's i2c_* functions: gyro and
+ * accelerometer at 1 kHz through the 184 Hz DLPF, divided down by SMPLRT_DIV,
+ * 12 byte frames into the FIFO, which stops when full rather than wrap so
+ * frames never split.  A drain reads FIFO_COUNT and then whole frames in
+ * transfers of up to 252 bytes; an overflow resets the FIFO and drops what
+ * was in it instead of handing over samples with a gap in their times.
+ ******************************************************************************/
+
+#include "mip_hal.h"
+#include "periodic_task.h"
+#include "mip_imu.h"
+
+#define MIP_IMU_MAX_TRANSFER  (21*MPU_FIFO_FRAME)   // i2c lengths are 8 bit
+
+// variable declarations
+static mip_imu_config_t   imu_conf;
+static mip_imu_consumer_t imu_consumer;
+static mip_imu_stats_t    imu_stats;
+static mip_imu_sample_t   imu_batch[MIP_IMU_MAX_BATCH];
+static imu_data_t         imu_dmp_data;
+static int64_t            imu_period_ns;
+static int64_t            imu_last_ns;
+static int                imu_running;
+#ifndef MIP_SIM
+static periodic_task_t    imu_drain_task;
+#endif
+
+/*******************************************************************************
+ * static int mip_imu_dmp_callback()
+ *
+ * The DMP interrupt, as a batch of one
+ ******************************************************************************/
+static int mip_imu_dmp_callback()
+{
+  mip_imu_sample_t* s = &imu_batch[0];
+  s->t_ns = mip_imu_time_ns();
+  memcpy(s->accel, imu_dmp_data.accel, sizeof(s->accel));
+  memcpy(s->gyro, imu_dmp_data.gyro, sizeof(s->gyro));
+  memcpy(s->mag, imu_dmp_data.mag, sizeof(s->mag));
+  imu_stats.drains++;
+  imu_stats.samples++;
+  imu_stats.max_batch = 1;
+  return imu_consumer(imu_batch, 1);
+}
+
+/*******************************************************************************
+ * static int mip_imu_write(uint8_t reg, uint8_t value)
+ ******************************************************************************/
+static int mip_imu_write(uint8_t reg, uint8_t value)
+{
+  if(i2c_write_byte(MIP_IMU_BUS, reg, value))
+  {
+    printf("ERROR: IMU register 0x%02x write failed\n", reg);
+    return -1;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * static int mip_imu_fifo_setup(int rate)
+ *
+ * Reset the MPU-9250 and start it filling the FIFO at rate
+ ******************************************************************************/
+static int mip_imu_fifo_setup(int rate)
+{
+  int ret = 0;
+
+  if(i2c_init(MIP_IMU_BUS, MIP_IMU_ADDR))
+  {
+    printf("ERROR: can't open i2c bus %d\n", MIP_IMU_BUS);
+    return -1;
+  }
+  i2c_claim_bus(MIP_IMU_BUS);
+  ret |= mip_imu_write(MPU_PWR_MGMT_1, MPU_PWR_RESET);
+  usleep(100000);
+  ret |= mip_imu_write(MPU_PWR_MGMT_1, MPU_PWR_PLL);
+  ret |= mip_imu_write(MPU_USER_CTRL, 0);
+  ret |= mip_imu_write(MPU_FIFO_EN, 0);
+  ret |= mip_imu_write(MPU_SMPLRT_DIV, MIP_IMU_FIFO_MAX_RATE/rate - 1);
+  ret |= mip_imu_write(MPU_CONFIG, MPU_CONFIG_FIFO_STOP | MPU_DLPF_184HZ);
+  ret |= mip_imu_write(MPU_GYRO_CONFIG, MPU_GYRO_FS);
+  ret |= mip_imu_write(MPU_ACCEL_CONFIG, MPU_ACCEL_FS);
+  ret |= mip_imu_write(MPU_ACCEL_CONFIG2, MPU_DLPF_184HZ);
+  ret |= mip_imu_write(MPU_INT_ENABLE, MPU_INT_FIFO_OFLOW);
+  ret |= mip_imu_write(MPU_USER_CTRL, MPU_USER_FIFO_RST);
+  ret |= mip_imu_write(MPU_FIFO_EN, MPU_FIFO_ACCEL_GYRO);
+  ret |= mip_imu_write(MPU_USER_CTRL, MPU_USER_FIFO_EN);
+  i2c_release_bus(MIP_IMU_BUS);
+  return ret;
+}
+
+/*******************************************************************************
+ * static float mip_imu_word(const uint8_t* p)
+ ******************************************************************************/
+static float mip_imu_word(const uint8_t* p)
+{
+  return (float)(int16_t)((p[0] << 8) | p[1]);
+}
+
+/*******************************************************************************
+ * mip_imu_config_t mip_imu_default_config()
+ *
+ * DMP at 200 Hz without the magnetometer
+ ******************************************************************************/
+mip_imu_config_t mip_imu_default_config()
+{
+  mip_imu_config_t c;
+  c.mode                = MIP_IMU_DMP;
+  c.sample_rate         = MIP_IMU_DMP_MAX_RATE;
+  c.batch               = 1;
+  c.drain_thread        = 1;
+  c.drain_priority      = 0;
+  c.drain_cpu           = -1;
+  c.enable_magnetometer = 0;
+  return c;
+}
+
+/*******************************************************************************
+ * int mip_imu_check_config(mip_imu_config_t conf)
+ *
+ * Returns -1, after saying why, if mip_imu_start would refuse conf
+ ******************************************************************************/
+int mip_imu_check_config(mip_imu_config_t conf)
+{
+  switch(conf.mode)
+  {
+    case MIP_IMU_DMP:
+      if(conf.sample_rate <= 0 || conf.sample_rate > MIP_IMU_DMP_MAX_RATE)
+      {
+        printf("ERROR: DMP sample rate must be 1 to %d Hz\n",\
+               MIP_IMU_DMP_MAX_RATE);
+        return -1;
+      }
+      return 0;
+
+    case MIP_IMU_FIFO:
+      if(conf.sample_rate <= 0 || conf.sample_rate > MIP_IMU_FIFO_MAX_RATE\
+         || MIP_IMU_FIFO_MAX_RATE % conf.sample_rate)
+      {
+        printf("ERROR: FIFO sample rate must divide %d Hz\n",\
+               MIP_IMU_FIFO_MAX_RATE);
+        return -1;
+      }
+      if(conf.batch < 1 || conf.batch > MIP_IMU_MAX_BATCH)
+      {
+        printf("ERROR: FIFO batch must be 1 to %d samples\n",\
+               MIP_IMU_MAX_BATCH);
+        return -1;
+      }
+      if(conf.enable_magnetometer)
+      {
+        printf("ERROR: the FIFO path can't read the magnetometer, use DMP\n");
+        return -1;
+      }
+      return 0;
+  }
+  printf("ERROR: unknown IMU mode %d\n", conf.mode);
+  return -1;
+}
+
+/*******************************************************************************
+ * int mip_imu_start(mip_imu_config_t conf, mip_imu_consumer_t consumer)
+ *
+ * Power up the IMU and start handing samples to consumer
+ ******************************************************************************/
+int mip_imu_start(mip_imu_config_t conf, mip_imu_consumer_t consumer)
+{
+  imu_config_t dmp_conf;
+
+  if(imu_running || consumer == NULL || mip_imu_check_config(conf)) return -1;
+  imu_conf = conf;
+  imu_consumer = consumer;
+  memset(&imu_stats, 0, sizeof(mip_imu_stats_t));
+  imu_period_ns = NSEC_PER_SEC/conf.sample_rate;
+  imu_last_ns = 0;
+
+  if(conf.mode == MIP_IMU_DMP)
+  {
+    dmp_conf = get_default_imu_config();
+    dmp_conf.enable_magnetometer = conf.enable_magnetometer;
+    dmp_conf.dmp_sample_rate = conf.sample_rate;
+    if(initialize_imu_dmp(&imu_dmp_data, dmp_conf)) return -1;
+    set_imu_interrupt_func(&mip_imu_dmp_callback);
+    imu_running = 1;
+    return 0;
+  }
+
+  if(mip_imu_fifo_setup(conf.sample_rate)) return -1;
+  imu_running = 1;
+#ifndef MIP_SIM
+  if(!conf.drain_thread) return 0;
+  periodic_task_init(&imu_drain_task, "imu_fifo", &mip_imu_drain,\
+                     (double)conf.sample_rate/conf.batch, conf.drain_priority,\
+                     OVERRUN_SKIP);
+  imu_drain_task.cpu = conf.drain_cpu;
+  if(periodic_task_start(&imu_drain_task))
+  {
+    mip_imu_stop();
+    return -1;
+  }
+#endif
+  return 0;
+}
+
+/*******************************************************************************
+ * int mip_imu_drain()
+ *
+ * Read whatever the FIFO holds, up to MIP_IMU_MAX_BATCH samples, and hand it
+ * to the consumer.  The drain thread's step function; the simulator calls it
+ * directly.  Returns -1 on a bus error.
+ ******************************************************************************/
+int mip_imu_drain()
+{
+  uint8_t frames[MIP_IMU_MAX_BATCH*MPU_FIFO_FRAME];
+  uint8_t count_bytes[2], status;
+  const float accel_scale = MIP_IMU_ACCEL_FSR*MIP_IMU_GRAVITY/32768.0;
+  const float gyro_scale = MIP_IMU_GYRO_FSR/32768.0;
+  mip_imu_sample_t* s;
+  const uint8_t* f;
+  int64_t now;
+  int count, n, i, j, done, chunk;
+
+  if(!imu_running || imu_conf.mode != MIP_IMU_FIFO) return -1;
+
+  i2c_claim_bus(MIP_IMU_BUS);
+  if(i2c_read_byte(MIP_IMU_BUS, MPU_INT_STATUS, &status)\
+     || i2c_read_bytes(MIP_IMU_BUS, MPU_FIFO_COUNTH, 2, count_bytes))
+  {
+    i2c_release_bus(MIP_IMU_BUS);
+    imu_stats.errors++;
+    return -1;
+  }
+  now = mip_imu_time_ns();
+  imu_stats.drains++;
+  if(status & MPU_INT_FIFO_OFLOW)
+  {
+    mip_imu_write(MPU_USER_CTRL, MPU_USER_FIFO_EN | MPU_USER_FIFO_RST);
+    i2c_release_bus(MIP_IMU_BUS);
+    imu_stats.overflows++;
+    return 0;
+  }
+  count = (((count_bytes[0] & 0x1F) << 8) | count_bytes[1])/MPU_FIFO_FRAME;
+  n = count < MIP_IMU_MAX_BATCH ? count : MIP_IMU_MAX_BATCH;
+  for(done=0; done<n*MPU_FIFO_FRAME; done+=chunk)
+  {
+    chunk = n*MPU_FIFO_FRAME - done;
+    if(chunk > MIP_IMU_MAX_TRANSFER) chunk = MIP_IMU_MAX_TRANSFER;
+    if(i2c_read_bytes(MIP_IMU_BUS, MPU_FIFO_R_W, chunk, frames+done))
+    {
+      i2c_release_bus(MIP_IMU_BUS);
+      imu_stats.errors++;
+      return -1;
+    }
+  }
+  i2c_release_bus(MIP_IMU_BUS);
+  if(n == 0)
+  {
+    imu_stats.empty++;
+    return 0;
+  }
+
+  for(i=0; i<n; i++)
+  {
+    s = &imu_batch[i];
+    f = frames + i*MPU_FIFO_FRAME;
+    for(j=0; j<3; j++)
+    {
+      s->accel[j] = mip_imu_word(f+2*j)*accel_scale;
+      s->gyro[j] = mip_imu_word(f+6+2*j)*gyro_scale;
+      s->mag[j] = 0;
+    }
+    // the newest sample in the FIFO was taken at most a period before the
+    // count was read, anything still left in it after this batch later
+    s->t_ns = now - (count-1-i)*imu_period_ns;
+    if(s->t_ns < imu_last_ns) s->t_ns = imu_last_ns;
+    imu_last_ns = s->t_ns;
+  }
+  imu_stats.samples += n;
+  if(n > imu_stats.max_batch) imu_stats.max_batch = n;
+  return imu_consumer(imu_batch, n);
+}
+
+/*******************************************************************************
+ * int mip_imu_stop()
+ *
+ * Stop delivering samples and put the IMU to sleep
+ ******************************************************************************/
+int mip_imu_stop()
+{
+  if(!imu_running) return 0;
+  if(imu_conf.mode == MIP_IMU_DMP)
+  {
+    imu_running = 0;
+    return power_off_imu();
+  }
+#ifndef MIP_SIM
+  periodic_task_stop(&imu_drain_task);
+#endif
+  imu_running = 0;
+  i2c_claim_bus(MIP_IMU_BUS);
+  mip_imu_write(MPU_USER_CTRL, 0);
+  mip_imu_write(MPU_PWR_MGMT_1, MPU_PWR_SLEEP);
+  i2c_release_bus(MIP_IMU_BUS);
+  i2c_close(MIP_IMU_BUS);
+  return 0;
+}
+
+/*******************************************************************************
+ * int64_t mip_imu_time_ns()
+ *
+ * The clock sample times are on: CLOCK_MONOTONIC, or virtual time in the
+ * simulator
+ ******************************************************************************/
+int64_t mip_imu_time_ns()
+{
+#ifdef MIP_SIM
+  return (int64_t)(sim_get_time()*NSEC_PER_SEC + 0.5);
+#else
+  return monotonic_ns();
+#endif
+}
+
+/*******************************************************************************
+ * mip_imu_stats_t mip_imu_get_stats()
+ ******************************************************************************/
+mip_imu_stats_t mip_imu_get_stats()
+{
+  return imu_stats;
+}
+
+/*******************************************************************************
+ * int print_mip_imu_stats()
+ ******************************************************************************/
+int print_mip_imu_stats()
+{
+  printf("imu (%s, %d Hz): %llu samples in %llu batches, largest %d, "\
+         "%llu empty, %llu overflows, %llu bus errors\n",\
+         mip_imu_mode_name(imu_conf.mode), imu_conf.sample_rate,\
+         (unsigned long long)imu_stats.samples,\
+         (unsigned long long)imu_stats.drains, imu_stats.max_batch,\
+         (unsigned long long)imu_stats.empty,\
+         (unsigned long long)imu_stats.overflows,\
+         (unsigned long long)imu_stats.errors);
+  return 0;
+}
+
+/*******************************************************************************
+ * const char* mip_imu_mode_name(int mode)
+ ******************************************************************************/
+const char* mip_imu_mode_name(int mode)
+{
+  switch(mode)
+  {
+    case MIP_IMU_DMP:  return "dmp";
+    case MIP_IMU_FIFO: return "fifo";
+  }
+  return "unknown";
+}
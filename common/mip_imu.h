@@ -0,0 +1,116 @@
+/*******************************************************************************
+ * mip_imu.h
+ *
+ * IMU acquisition behind one interface.  Samples reach the program in
+ * batches, each sample with its own timestamp, through a consumer function
+ * given to mip_imu_start:
+ *
+ *   MIP_IMU_DMP   the cape library's DMP mode.  One sample per interrupt,
+ *                 up to 200 Hz, stamped on arrival.
+ *   MIP_IMU_FIFO  raw accelerometer and gyro written into the MPU-9250's
+ *                 own FIFO at up to 1 kHz and drained in bursts, about
+ *                 batch samples at a time, by a drain thread at
+ *                 sample_rate/batch.  The FIFO carries no times, so each
+ *                 sample is stamped back from the moment the FIFO count was
+ *                 read, one sample period apart.
+ *
+ * The magnetometer is only powered up when the config asks for it, and only
+ * the DMP path can read it.  In the simulator (MIP_SIM) mip_sim.c stands in
+ * for the MPU-9250 registers the FIFO path uses and the program calls
+ * mip_imu_drain itself in virtual time instead of running the thread, as a
+ * program with its own timer for it does on the robot with drain_thread 0.
+ ******************************************************************************/
+
+#ifndef MIP_IMU_H
+#define MIP_IMU_H
+
+#include <stdint.h>
+
+#define MIP_IMU_DMP           0
+#define MIP_IMU_FIFO          1
+
+#define MIP_IMU_DMP_MAX_RATE  200     // Hz
+#define MIP_IMU_FIFO_MAX_RATE 1000    // Hz, the gyro's internal rate with DLPF
+#define MIP_IMU_MAX_BATCH     32      // samples per drain
+
+// FIFO path setup
+#define MIP_IMU_BUS           2
+#define MIP_IMU_ADDR          0x68
+#define MIP_IMU_ACCEL_FSR     4       // g, must match MPU_ACCEL_FS below
+#define MIP_IMU_GYRO_FSR      1000    // deg/s, must match MPU_GYRO_FS below
+#define MIP_IMU_GRAVITY       9.80665 // m/s^2 per g
+
+// MPU-9250 registers the FIFO path uses, shared with the simulated stand-in
+#define MPU_SMPLRT_DIV        0x19
+#define MPU_CONFIG            0x1A
+#define MPU_GYRO_CONFIG       0x1B
+#define MPU_ACCEL_CONFIG      0x1C
+#define MPU_ACCEL_CONFIG2     0x1D
+#define MPU_FIFO_EN           0x23
+#define MPU_INT_ENABLE        0x38
+#define MPU_INT_STATUS        0x3A
+#define MPU_USER_CTRL         0x6A
+#define MPU_PWR_MGMT_1        0x6B
+#define MPU_FIFO_COUNTH       0x72
+#define MPU_FIFO_R_W          0x74
+
+#define MPU_FIFO_BYTES        512
+#define MPU_FIFO_FRAME        12      // accel xyz then gyro xyz, big endian
+#define MPU_FIFO_ACCEL_GYRO   0x78    // FIFO_EN: gyro x, y, z and accel
+#define MPU_CONFIG_FIFO_STOP  0x40    // CONFIG: keep the oldest when full
+#define MPU_DLPF_184HZ        0x01    // CONFIG and ACCEL_CONFIG2
+#define MPU_GYRO_FS           0x10    // GYRO_CONFIG: +-1000 deg/s
+#define MPU_ACCEL_FS          0x08    // ACCEL_CONFIG: +-4 g
+#define MPU_INT_FIFO_OFLOW    0x10
+#define MPU_USER_FIFO_EN      0x40
+#define MPU_USER_FIFO_RST     0x04
+#define MPU_PWR_RESET         0x80
+#define MPU_PWR_PLL           0x01
+#define MPU_PWR_SLEEP         0x40
+
+typedef struct mip_imu_sample_t
+{
+  int64_t t_ns;         // when it was sampled, on mip_imu_time_ns's clock
+  float accel[3];       // m/s^2
+  float gyro[3];        // deg/s
+  float mag[3];         // uT, DMP with enable_magnetometer only
+
+} mip_imu_sample_t;
+
+typedef struct mip_imu_config_t
+{
+  int mode;             // MIP_IMU_DMP or MIP_IMU_FIFO
+  int sample_rate;      // Hz, FIFO rates must divide 1000
+  int batch;            // FIFO samples per drain
+  int drain_thread;     // 0 if the caller runs mip_imu_drain itself
+  int drain_priority;   // FIFO drain thread SCHED_FIFO priority
+  int drain_cpu;        // FIFO drain thread CPU, -1 for any
+  int enable_magnetometer;
+
+} mip_imu_config_t;
+
+typedef struct mip_imu_stats_t
+{
+  uint64_t drains;
+  uint64_t samples;
+  uint64_t empty;       // drains that found nothing
+  uint64_t overflows;   // FIFO filled up and was reset
+  uint64_t errors;      // failed bus transfers
+  int      max_batch;
+
+} mip_imu_stats_t;
+
+// called from the IMU interrupt (DMP) or the drain thread (FIFO), oldest first
+typedef int (*mip_imu_consumer_t)(const mip_imu_sample_t* samples, int n);
+
+mip_imu_config_t mip_imu_default_config();
+int mip_imu_check_config(mip_imu_config_t conf);
+int mip_imu_start(mip_imu_config_t conf, mip_imu_consumer_t consumer);
+int mip_imu_drain();
+int mip_imu_stop();
+int64_t mip_imu_time_ns();
+mip_imu_stats_t mip_imu_get_stats();
+int print_mip_imu_stats();
+const char* mip_imu_mode_name(int mode);
+
+#endif // MIP_IMU_H
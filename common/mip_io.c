@@ -0,0 +1,191 @@
+/*******************************************************************************
+ * mip_io.c
+ *
+ * Batched wheel I/O with cost counters.  See mip_io.h.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "mip_hal.h"
+#include "mip_io.h"
+
+// variable declarations
+static mip_io_config_t io;
+static atomic_int      io_enabled;
+static atomic_int      io_stale;    // rewrite both channels on the next write
+static float           io_duty[2];  // last written, polarity applied
+static mip_io_cost_t   io_reads;
+static mip_io_cost_t   io_writes;
+static int64_t         io_skew_max;
+static double          io_skew_sum;
+
+/*******************************************************************************
+ * static int64_t mip_io_now()
+ ******************************************************************************/
+static int64_t mip_io_now()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (int64_t)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+/*******************************************************************************
+ * static void mip_io_count(mip_io_cost_t* c, int64_t start, int accesses)
+ ******************************************************************************/
+static void mip_io_count(mip_io_cost_t* c, int64_t start, int accesses)
+{
+  int64_t exec = mip_io_now() - start;
+  if(exec > c->exec_max) c->exec_max = exec;
+  c->exec_sum += exec;
+  c->accesses += accesses;
+  c->calls++;
+}
+
+/*******************************************************************************
+ * int mip_io_init(mip_io_config_t config)
+ *
+ * Wheel wiring, from the cape's motor and encoder channels 1 to 4.  Starts
+ * disabled with the counters cleared.
+ ******************************************************************************/
+int mip_io_init(mip_io_config_t config)
+{
+  int i;
+  for(i=0; i<2; i++)
+  {
+    if(config.motor_channel[i] < 1 || config.motor_channel[i] > 4\
+       || config.encoder_channel[i] < 1 || config.encoder_channel[i] > 4)
+    {
+      printf("ERROR: mip_io: motor and encoder channels are 1 to 4\n");
+      return -1;
+    }
+  }
+  io = config;
+  io_duty[MIP_IO_LEFT] = 0;
+  io_duty[MIP_IO_RIGHT] = 0;
+  atomic_store(&io_enabled, 0);
+  atomic_store(&io_stale, 1);
+  memset(&io_reads, 0, sizeof(io_reads));
+  memset(&io_writes, 0, sizeof(io_writes));
+  io_skew_max = 0;
+  io_skew_sum = 0;
+  return 0;
+}
+
+/*******************************************************************************
+ * int mip_io_read_encoders(mip_encoders_t* e, int64_t now)
+ *
+ * Both encoders as one snapshot taken at now
+ ******************************************************************************/
+int mip_io_read_encoders(mip_encoders_t* e, int64_t now)
+{
+  int64_t start = mip_io_now();
+  int64_t second;
+
+  e->t_ns = now;
+  e->ticks[MIP_IO_LEFT] = io.encoder_polarity[MIP_IO_LEFT]\
+                          * get_encoder_pos(io.encoder_channel[MIP_IO_LEFT]);
+  second = mip_io_now();
+  e->ticks[MIP_IO_RIGHT] = io.encoder_polarity[MIP_IO_RIGHT]\
+                           * get_encoder_pos(io.encoder_channel[MIP_IO_RIGHT]);
+  e->skew_ns = second - start;
+  if(e->skew_ns > io_skew_max) io_skew_max = e->skew_ns;
+  io_skew_sum += e->skew_ns;
+  mip_io_count(&io_reads, start, 2);
+  return 0;
+}
+
+/*******************************************************************************
+ * int mip_io_write_motors(float left, float right)
+ *
+ * Both wheels' duties, -1 to 1, forward positive.  Returns the number of
+ * channels actually written.
+ ******************************************************************************/
+int mip_io_write_motors(float left, float right)
+{
+  int64_t start = mip_io_now();
+  float duty[2];
+  int i, stale, written = 0;
+
+  if(!atomic_load_explicit(&io_enabled, memory_order_relaxed))
+  {
+    io_writes.skipped += 2;
+    mip_io_count(&io_writes, start, 0);
+    return 0;
+  }
+  stale = atomic_exchange(&io_stale, 0);
+  duty[MIP_IO_LEFT]  = io.motor_polarity[MIP_IO_LEFT]*left;
+  duty[MIP_IO_RIGHT] = io.motor_polarity[MIP_IO_RIGHT]*right;
+  for(i=0; i<2; i++)
+  {
+    if(!stale && duty[i] == io_duty[i])
+    {
+      io_writes.skipped++;
+      continue;
+    }
+    set_motor(io.motor_channel[i], duty[i]);
+    io_duty[i] = duty[i];
+    written++;
+  }
+  mip_io_count(&io_writes, start, written);
+  return written;
+}
+
+/*******************************************************************************
+ * int mip_io_enable()
+ *
+ * Enable the motor drivers; the next write goes out to both channels
+ ******************************************************************************/
+int mip_io_enable()
+{
+  atomic_store(&io_stale, 1);
+  atomic_store(&io_enabled, 1);
+  return enable_motors();
+}
+
+/*******************************************************************************
+ * int mip_io_disable()
+ *
+ * Disable the motor drivers and drop writes until mip_io_enable
+ ******************************************************************************/
+int mip_io_disable()
+{
+  atomic_store(&io_enabled, 0);
+  atomic_store(&io_stale, 1);
+  return disable_motors();
+}
+
+/*******************************************************************************
+ * int mip_io_zero_encoders()
+ ******************************************************************************/
+int mip_io_zero_encoders()
+{
+  set_encoder_pos(io.encoder_channel[MIP_IO_LEFT], 0);
+  set_encoder_pos(io.encoder_channel[MIP_IO_RIGHT], 0);
+  return 0;
+}
+
+/*******************************************************************************
+ * int print_mip_io_stats()
+ *
+ * Calls, register accesses and time per call each way, the writes skipped
+ * and how far apart the two encoder reads were
+ ******************************************************************************/
+int print_mip_io_stats()
+{
+  double r = io_reads.calls > 0 ? io_reads.calls : 1;
+  double w = io_writes.calls > 0 ? io_writes.calls : 1;
+
+  printf("encoder reads: %llu snapshots, %.2f accesses each, mean %.2f max "\
+         "%.2f us, left to right mean %.2f max %.2f us\n",\
+         (unsigned long long)io_reads.calls, io_reads.accesses/r,\
+         io_reads.exec_sum/r/1e3, io_reads.exec_max/1e3,\
+         io_skew_sum/r/1e3, io_skew_max/1e3);
+  printf("motor writes: %llu batches, %.2f accesses each, %llu of %llu "\
+         "channel writes skipped, mean %.2f max %.2f us\n",\
+         (unsigned long long)io_writes.calls, io_writes.accesses/w,\
+         (unsigned long long)io_writes.skipped,\
+         (unsigned long long)(io_writes.accesses + io_writes.skipped),\
+         io_writes.exec_sum/w/1e3, io_writes.exec_max/1e3);
+  return 0;
+}
@@ -0,0 +1,68 @@
+/*******************************************************************************
+ * mip_io.h
+ *
+ * Motor and encoder I/O for the two wheels, one call per direction per tick.
+ * mip_io_read_encoders reads both eQEP counters back to back into one
+ * snapshot, stamped with the caller's clock and with the time between the
+ * two reads kept as its skew, so the left and right wheel angles come from
+ * the same instant.  mip_io_write_motors takes both wheels' duties at once,
+ * applies polarity and only writes a channel whose duty changed since the
+ * last write, and none while the motors are disabled; after mip_io_enable
+ * the next one writes both again.
+ *
+ * The cape library has no call that writes two channels with different
+ * duties or reads both encoders, so a batch is still one set_motor or
+ * get_encoder_pos per channel, which the counters below count as register
+ * accesses next to the calls and the time they took.
+ *
+ * Reads come from one thread and writes from one thread; mip_io_disable is
+ * safe from any thread.
+ ******************************************************************************/
+
+#ifndef MIP_IO_H
+#define MIP_IO_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define MIP_IO_LEFT   0
+#define MIP_IO_RIGHT  1
+
+typedef struct mip_io_config_t
+{
+  int motor_channel[2];     // MIP_IO_LEFT, MIP_IO_RIGHT
+  int motor_polarity[2];
+  int encoder_channel[2];
+  int encoder_polarity[2];
+
+} mip_io_config_t;
+
+// Both encoders, polarity applied
+typedef struct mip_encoders_t
+{
+  int ticks[2];             // MIP_IO_LEFT, MIP_IO_RIGHT
+  int64_t t_ns;             // the caller's clock, just before the reads
+  int64_t skew_ns;          // CLOCK_MONOTONIC from the first read to the last
+
+} mip_encoders_t;
+
+// Per direction: calls, register accesses they made and their cost in ns
+typedef struct mip_io_cost_t
+{
+  uint64_t calls;
+  uint64_t accesses;
+  uint64_t skipped;         // writes only, channels left as they were
+  int64_t  exec_max;
+  double   exec_sum;
+
+} mip_io_cost_t;
+
+int mip_io_init(mip_io_config_t config);
+int mip_io_read_encoders(mip_encoders_t* e, int64_t now);
+int mip_io_write_motors(float left, float right);
+int mip_io_enable();
+int mip_io_disable();
+int mip_io_zero_encoders();
+int print_mip_io_stats();
+
+#endif // MIP_IO_H
@@ -0,0 +1,265 @@
+/*******************************************************************************
+ * mip_log.c
+ *
+ * SPSC ring telemetry logger.  See mip_log.h.
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "mip_log.h"
+
+#define MIP_LOG_RING_MASK   (MIP_LOG_RING_SIZE-1)
+
+/*******************************************************************************
+ * static int64_t mip_log_now()
+ ******************************************************************************/
+static int64_t mip_log_now()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (int64_t)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+/*******************************************************************************
+ * static void mip_log_drain(mip_log_t* log)
+ *
+ * Copy every record in the ring into the write buffer and hand the whole
+ * buffer to the file in one write
+ ******************************************************************************/
+static void mip_log_drain(mip_log_t* log)
+{
+  unsigned tail = atomic_load_explicit(&log->tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&log->head, memory_order_acquire);
+  size_t rec = sizeof(int64_t) + log->fields*sizeof(float);
+  size_t used = 0;
+  mip_log_record_t* r;
+
+  while(tail != head)
+  {
+    r = &log->ring[tail & MIP_LOG_RING_MASK];
+    memcpy(log->buf+used, &r->t_ns, sizeof(int64_t));
+    memcpy(log->buf+used+sizeof(int64_t), r->v, log->fields*sizeof(float));
+    used += rec;
+    tail++;
+
+    // release the slots before the buffer could overflow
+    if(used + rec > log->buf_size || tail == head)
+    {
+      atomic_store_explicit(&log->tail, tail, memory_order_release);
+      fwrite(log->buf, 1, used, log->file);
+      log->written += used/rec;
+      used = 0;
+    }
+  }
+}
+
+/*******************************************************************************
+ * static void* mip_log_writer(void* ptr)
+ *
+ * Background writer, runs at the default (non real-time) priority
+ ******************************************************************************/
+static void* mip_log_writer(void* ptr)
+{
+  mip_log_t* log = (mip_log_t*)ptr;
+  while(log->running)
+  {
+    mip_log_drain(log);
+    usleep(1000000/MIP_LOG_DRAIN_FREQUENCY);
+  }
+  return NULL;
+}
+
+/*******************************************************************************
+ * int mip_log_open(mip_log_t* log, const char* filename, int fields,
+ *                  const char** names)
+ *
+ * Create the file, write the header and start the writer thread
+ ******************************************************************************/
+int mip_log_open(mip_log_t* log, const char* filename, int fields,\
+                 const char** names)
+{
+  if(fields < 1 || fields > MIP_LOG_MAX_FIELDS) return -1;
+  memset(log, 0, sizeof(mip_log_t));
+  log->fields = fields;
+
+  // everything the producer touches is allocated up front
+  log->ring = calloc(MIP_LOG_RING_SIZE, sizeof(mip_log_record_t));
+  log->buf_size = MIP_LOG_RING_SIZE*sizeof(mip_log_record_t);
+  log->buf = malloc(log->buf_size);
+  log->file = fopen(filename,"wb");
+  if(log->ring == NULL || log->buf == NULL || log->file == NULL)
+  {
+    if(log->file != NULL) fclose(log->file);
+    free(log->ring);
+    free(log->buf);
+    return -1;
+  }
+
+  mip_log_write_header(log->file, fields, names);
+
+  atomic_init(&log->head, 0);
+  atomic_init(&log->tail, 0);
+  atomic_init(&log->dropped, 0);
+  log->t0_ns = mip_log_now();
+  log->running = 1;
+  if(pthread_create(&log->thread, NULL, mip_log_writer, log))
+  {
+    log->running = 0;
+    fclose(log->file);
+    free(log->ring);
+    free(log->buf);
+    return -1;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * int mip_log_write_header(FILE* out, int fields, const char** names)
+ *
+ * The magic, field count and names every log starts with, for writers of
+ * their own like mip_recorder
+ ******************************************************************************/
+int mip_log_write_header(FILE* out, int fields, const char** names)
+{
+  uint32_t n = fields;
+  char name[MIP_LOG_NAME_LEN];
+  int i;
+
+  fwrite(MIP_LOG_MAGIC, 1, 8, out);
+  fwrite(&n, sizeof(uint32_t), 1, out);
+  for(i=0; i<fields; i++)
+  {
+    memset(name, 0, MIP_LOG_NAME_LEN);
+    strncpy(name, names[i], MIP_LOG_NAME_LEN-1);
+    fwrite(name, 1, MIP_LOG_NAME_LEN, out);
+  }
+  return ferror(out) ? -1 : 0;
+}
+
+/*******************************************************************************
+ * int mip_log_push(mip_log_t* log, const float* values)
+ *
+ * Producer side: timestamp and enqueue one record.  Never blocks; returns -1
+ * and counts a drop if the writer has fallen a whole ring behind.
+ ******************************************************************************/
+int mip_log_push(mip_log_t* log, const float* values)
+{
+  unsigned head = atomic_load_explicit(&log->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&log->tail, memory_order_acquire);
+  mip_log_record_t* r;
+  int i;
+
+  if(head - tail >= MIP_LOG_RING_SIZE)
+  {
+    atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+    return -1;
+  }
+  r = &log->ring[head & MIP_LOG_RING_MASK];
+  r->t_ns = mip_log_now() - log->t0_ns;
+  for(i=0; i<log->fields; i++) r->v[i] = values[i];
+  atomic_store_explicit(&log->head, head+1, memory_order_release);
+  return 0;
+}
+
+/*******************************************************************************
+ * int mip_log_close(mip_log_t* log)
+ *
+ * Stop the writer, flush what is left and report the drop counter
+ ******************************************************************************/
+int mip_log_close(mip_log_t* log)
+{
+  if(log->file == NULL) return -1;
+  log->running = 0;
+  pthread_join(log->thread, NULL);
+  mip_log_drain(log);
+  fclose(log->file);
+  log->file = NULL;
+  free(log->ring);
+  free(log->buf);
+  printf("log: %llu records written, %lu dropped\n",
+         (unsigned long long)log->written, atomic_load(&log->dropped));
+  return 0;
+}
+
+/*******************************************************************************
+ * FILE* mip_log_read_open(const char* name, int* fields,
+ *                         char names[][MIP_LOG_NAME_LEN])
+ *
+ * Open a log and read its header, leaving the file at the first record.
+ * Returns NULL if it is not a mip_log file.
+ ******************************************************************************/
+FILE* mip_log_read_open(const char* name, int* fields,\
+                        char names[][MIP_LOG_NAME_LEN])
+{
+  FILE* in;
+  char magic[8];
+  uint32_t n;
+  int i;
+
+  in = fopen(name,"rb");
+  if(in == NULL) return NULL;
+  if(fread(magic, 1, 8, in) != 8 || memcmp(magic, MIP_LOG_MAGIC, 8) != 0\
+     || fread(&n, sizeof(uint32_t), 1, in) != 1\
+     || n < 1 || n > MIP_LOG_MAX_FIELDS\
+     || fread(names, MIP_LOG_NAME_LEN, n, in) != n)
+  {
+    fclose(in);
+    return NULL;
+  }
+  for(i=0; i<(int)n; i++) names[i][MIP_LOG_NAME_LEN-1] = 0;
+  *fields = n;
+  return in;
+}
+
+/*******************************************************************************
+ * int mip_log_read(FILE* in, int fields, int64_t* t_ns, float* values)
+ *
+ * Read the next record, returns -1 at the end of the log
+ ******************************************************************************/
+int mip_log_read(FILE* in, int fields, int64_t* t_ns, float* values)
+{
+  if(fread(t_ns, sizeof(int64_t), 1, in) != 1) return -1;
+  if(fread(values, sizeof(float), fields, in) != (size_t)fields) return -1;
+  return 0;
+}
+
+/*******************************************************************************
+ * int mip_log_to_csv(const char* in_name, const char* out_name)
+ *
+ * Convert a binary log to CSV: a time column in seconds then one column per
+ * field, e.g. time,a_angle,g_angle,bbb_angle
+ ******************************************************************************/
+int mip_log_to_csv(const char* in_name, const char* out_name)
+{
+  FILE *in, *out;
+  char names[MIP_LOG_MAX_FIELDS][MIP_LOG_NAME_LEN];
+  int fields, i;
+  int64_t t_ns;
+  float v[MIP_LOG_MAX_FIELDS];
+
+  in = mip_log_read_open(in_name, &fields, names);
+  if(in == NULL) return -1;
+
+  out = fopen(out_name,"w");
+  if(out == NULL)
+  {
+    fclose(in);
+    return -1;
+  }
+  fprintf(out,"time");
+  for(i=0; i<fields; i++) fprintf(out,",%s",names[i]);
+  fprintf(out,"\n");
+
+  while(mip_log_read(in, fields, &t_ns, v) == 0)
+  {
+    fprintf(out,"%f",t_ns/1e9);
+    for(i=0; i<fields; i++) fprintf(out,",%f",v[i]);
+    fprintf(out,"\n");
+  }
+
+  fclose(in);
+  fclose(out);
+  return 0;
+}
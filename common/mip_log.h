@@ -0,0 +1,76 @@
+/*******************************************************************************
+ * mip_log.h
+ *
+ * Lossless binary telemetry logging.  A single producer (normally
+ * imu_callback) pushes fixed-size timestamped records into a lock-free
+ * single-producer/single-consumer ring; a low priority writer thread drains
+ * it in large buffered writes.  If the ring ever fills, the record is dropped
+ * and counted rather than blocking the producer.
+ *
+ * File layout (native byte order, little endian on both the BeagleBone and
+ * x86 hosts):
+ *
+ *   char     magic[8]              "MIPLOG1\n"
+ *   uint32_t fields
+ *   char     names[fields][16]     column names, NUL padded
+ *   records: int64_t t_ns          CLOCK_MONOTONIC since mip_log_open
+ *            float   v[fields]
+ *
+ * log_to_csv turns a log back into the time,<names...> CSV layout.
+ ******************************************************************************/
+
+#ifndef MIP_LOG_H
+#define MIP_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define MIP_LOG_MAGIC             "MIPLOG1\n"
+#define MIP_LOG_MAX_FIELDS        8
+#define MIP_LOG_NAME_LEN          16
+#define MIP_LOG_RING_SIZE         8192      // records, power of two
+#define MIP_LOG_DRAIN_FREQUENCY   10        // Hz
+#define MIP_LOG_CACHE_LINE        64
+
+typedef struct mip_log_record_t
+{
+  int64_t t_ns;
+  float v[MIP_LOG_MAX_FIELDS];
+
+} mip_log_record_t;
+
+typedef struct mip_log_t
+{
+  // producer side
+  _Alignas(MIP_LOG_CACHE_LINE) atomic_uint head;
+  atomic_ulong dropped;
+
+  // consumer side
+  _Alignas(MIP_LOG_CACHE_LINE) atomic_uint tail;
+  uint64_t written;
+
+  // shared, read-only after open
+  _Alignas(MIP_LOG_CACHE_LINE) mip_log_record_t* ring;
+  int fields;
+  int64_t t0_ns;
+  FILE* file;
+  char* buf;
+  size_t buf_size;
+  pthread_t thread;
+  volatile int running;
+
+} mip_log_t;
+
+int mip_log_open(mip_log_t* log, const char* filename, int fields,\
+                 const char** names);
+int mip_log_write_header(FILE* out, int fields, const char** names);
+int mip_log_push(mip_log_t* log, const float* values);
+int mip_log_close(mip_log_t* log);
+FILE* mip_log_read_open(const char* name, int* fields,\
+                        char names[][MIP_LOG_NAME_LEN]);
+int mip_log_read(FILE* in, int fields, int64_t* t_ns, float* values);
+int mip_log_to_csv(const char* in_name, const char* out_name);
+
+#endif // MIP_LOG_H
@@ -0,0 +1,148 @@
+/*******************************************************************************
+ * mip_plant.c
+ *
+ * Nonlinear MiP dynamics integrated with semi-implicit Euler.
+ *
+ *   a*psi_ddot + b*cos(theta)*theta_ddot - b*theta_dot^2*sin(theta) =  tau
+ *   c*theta_ddot + b*cos(theta)*psi_ddot - m*g*L*sin(theta)         = -tau
+ *
+ * where tau is the combined motor torque on the wheels, reacted by the body.
+ ******************************************************************************/
+
+#include <math.h>
+#include "mip_plant.h"
+
+/*******************************************************************************
+ * mip_plant_params_t mip_plant_default_params(float gear_ratio, float wheel_radius)
+ *
+ * Default MiP parameters for the given drivetrain
+ ******************************************************************************/
+mip_plant_params_t mip_plant_default_params(float gear_ratio, float wheel_radius)
+{
+  mip_plant_params_t p;
+  p.gear_ratio    = gear_ratio;
+  p.wheel_radius  = wheel_radius;
+  p.stall_torque  = MIP_MOTOR_STALL_TORQUE;
+  p.free_speed    = MIP_MOTOR_FREE_SPEED;
+  p.motor_inertia = MIP_MOTOR_INERTIA;
+  p.body_mass     = MIP_BODY_MASS;
+  p.body_inertia  = MIP_BODY_INERTIA;
+  p.com_height    = MIP_BODY_COM_HEIGHT;
+  p.wheel_mass    = MIP_WHEEL_MASS;
+  p.friction      = MIP_WHEEL_FRICTION;
+  return p;
+}
+
+/*******************************************************************************
+ * int mip_plant_init(mip_plant_t* plant, mip_plant_params_t params, float theta)
+ *
+ * Precompute the model constants and start at rest at angle theta
+ ******************************************************************************/
+int mip_plant_init(mip_plant_t* plant, mip_plant_params_t params, float theta)
+{
+  double G = params.gear_ratio;
+  double R = params.wheel_radius;
+  double L = params.com_height;
+  double i_w;
+
+  plant->p = params;
+
+  // two wheels plus the reflected inertia of two motors
+  i_w = 2.0*(params.wheel_mass*R*R/2.0 + G*G*params.motor_inertia);
+  plant->a = i_w + (params.body_mass + 2.0*params.wheel_mass)*R*R;
+  plant->b = params.body_mass*R*L;
+  plant->c = params.body_inertia + params.body_mass*L*L;
+  plant->k_tau = 2.0*G*params.stall_torque;
+  plant->k_emf = 2.0*G*G*params.stall_torque/params.free_speed;
+
+  plant->theta      = theta;
+  plant->theta_dot  = 0.0;
+  plant->psi        = theta;    // wheels start with phi = 0
+  plant->psi_dot    = 0.0;
+  plant->theta_ddot = 0.0;
+  plant->fallen     = 0;
+  return 0;
+}
+
+/*******************************************************************************
+ * int mip_plant_step(mip_plant_t* plant, float duty, int enabled, double dt)
+ *
+ * Advance the plant by dt seconds with both motors at the given duty.  When
+ * the motors are disabled the bridge coasts and no torque is applied.
+ * Returns 1 if the body is lying on the ground.
+ ******************************************************************************/
+int mip_plant_step(mip_plant_t* plant, float duty, int enabled, double dt)
+{
+  double h, s, co, tau, det, r1, r2, psi_ddot, theta_ddot;
+  double mgl = plant->p.body_mass*MIP_GRAVITY*plant->p.com_height;
+  int steps = (int)ceil(dt/MIP_PLANT_DT);
+
+  if(steps < 1) steps = 1;
+  h = dt/steps;
+
+  if(duty > 1.0) duty = 1.0;
+  else if(duty < -1.0) duty = -1.0;
+
+  while(steps--)
+  {
+    s  = sin(plant->theta);
+    co = cos(plant->theta);
+
+    tau = -plant->p.friction*(plant->psi_dot - plant->theta_dot);
+    if(enabled)
+    {
+      tau += plant->k_tau*duty - plant->k_emf*(plant->psi_dot-plant->theta_dot);
+    }
+
+    r1 =  tau + plant->b*plant->theta_dot*plant->theta_dot*s;
+    r2 = -tau + mgl*s;
+    det = plant->a*plant->c - plant->b*plant->b*co*co;
+    psi_ddot   = (plant->c*r1 - plant->b*co*r2)/det;
+    theta_ddot = (plant->a*r2 - plant->b*co*r1)/det;
+
+    // lying on the ground only the wheels can move
+    if(plant->fallen && theta_ddot*plant->theta > 0)
+    {
+      theta_ddot = 0.0;
+      psi_ddot = tau/plant->a;
+    }
+
+    plant->psi_dot   += h*psi_ddot;
+    plant->theta_dot += h*theta_ddot;
+    plant->psi       += h*plant->psi_dot;
+    plant->theta     += h*plant->theta_dot;
+    plant->theta_ddot = theta_ddot;
+
+    // body hits the ground and stays there
+    if(fabs(plant->theta) >= MIP_PLANT_FALLEN_ANGLE)
+    {
+      plant->theta = plant->theta > 0 ? MIP_PLANT_FALLEN_ANGLE
+                                      : -MIP_PLANT_FALLEN_ANGLE;
+      plant->theta_dot  = 0.0;
+      plant->theta_ddot = 0.0;
+      plant->fallen = 1;
+    }
+    else plant->fallen = 0;
+  }
+  return plant->fallen;
+}
+
+/*******************************************************************************
+ * double mip_plant_phi(mip_plant_t* plant)
+ *
+ * Wheel angle relative to the body, as seen by the encoders
+ ******************************************************************************/
+double mip_plant_phi(mip_plant_t* plant)
+{
+  return plant->psi - plant->theta;
+}
+
+/*******************************************************************************
+ * double mip_plant_phi_dot(mip_plant_t* plant)
+ *
+ * Wheel speed relative to the body
+ ******************************************************************************/
+double mip_plant_phi_dot(mip_plant_t* plant)
+{
+  return plant->psi_dot - plant->theta_dot;
+}
@@ -0,0 +1,74 @@
+/*******************************************************************************
+ * mip_plant.h
+ *
+ * Planar model of the MiP: an inverted pendulum body on two wheels driven by
+ * geared DC motors.  theta is the body angle from vertical, psi the absolute
+ * wheel angle and phi = psi - theta the wheel angle the encoders measure.
+ ******************************************************************************/
+
+#ifndef MIP_PLANT_H
+#define MIP_PLANT_H
+
+// Motor model (per motor)
+#define MIP_MOTOR_STALL_TORQUE   0.003      // N*m at full duty
+#define MIP_MOTOR_FREE_SPEED     1760.0     // rad/s at full duty
+#define MIP_MOTOR_INERTIA        3.6e-8     // kg*m^2 armature
+
+// Body and wheel properties
+#define MIP_BODY_MASS            0.180      // kg
+#define MIP_BODY_INERTIA         0.000263   // kg*m^2 about the center of mass
+#define MIP_BODY_COM_HEIGHT      0.0477     // m from wheel axle
+#define MIP_WHEEL_MASS           0.027      // kg per wheel
+#define MIP_WHEEL_FRICTION       0.0002     // N*m*s/rad, viscous
+#define MIP_GRAVITY              9.81       // m/s^2
+
+// Integration and limits
+#define MIP_PLANT_DT             0.001      // s, maximum integration step
+#define MIP_PLANT_FALLEN_ANGLE   1.4        // rad, body rests on the ground
+
+// Plant parameters
+typedef struct mip_plant_params_t
+{
+  float gear_ratio;
+  float wheel_radius;
+  float stall_torque;
+  float free_speed;
+  float motor_inertia;
+  float body_mass;
+  float body_inertia;
+  float com_height;
+  float wheel_mass;
+  float friction;             // viscous wheel friction, N*m*s/rad
+
+} mip_plant_params_t;
+
+// Plant state
+typedef struct mip_plant_t
+{
+  mip_plant_params_t p;
+
+  // precomputed mass matrix terms
+  double a;                   // wheel inertia about the contact point
+  double b;                   // body/wheel coupling
+  double c;                   // body inertia about the axle
+  double k_tau;               // torque per unit duty, both motors
+  double k_emf;               // back-emf torque per rad/s of phi_dot
+
+  // physical state
+  double theta;
+  double theta_dot;
+  double psi;
+  double psi_dot;
+  double theta_ddot;          // last body angular acceleration
+
+  int fallen;
+
+} mip_plant_t;
+
+mip_plant_params_t mip_plant_default_params(float gear_ratio, float wheel_radius);
+int mip_plant_init(mip_plant_t* plant, mip_plant_params_t params, float theta);
+int mip_plant_step(mip_plant_t* plant, float duty, int enabled, double dt);
+double mip_plant_phi(mip_plant_t* plant);
+double mip_plant_phi_dot(mip_plant_t* plant);
+
+#endif // MIP_PLANT_H
@@ -0,0 +1,343 @@
+/*******************************************************************************
+ * mip_reactor.c
+ *
+ * epoll, timerfd and eventfd runtime.  See mip_reactor.h.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include "mip_reactor.h"
+
+/*******************************************************************************
+ * static reactor_source_t* reactor_add_fd(mip_reactor_t* r, const char* name,
+ *                                         int fd, int (*step)(void),
+ *                                         int priority)
+ ******************************************************************************/
+static reactor_source_t* reactor_add_fd(mip_reactor_t* r, const char* name,\
+                                        int fd, int (*step)(void),\
+                                        int priority)
+{
+  reactor_source_t* src;
+  struct epoll_event ev;
+
+  if(fd < 0 || r->n == REACTOR_MAX_SOURCES)
+  {
+    printf("ERROR: %s: can't add to the reactor\n", name);
+    if(fd >= 0) close(fd);
+    return NULL;
+  }
+  src = &r->sources[r->n];
+  memset(src, 0, sizeof(reactor_source_t));
+  src->name = name;
+  src->fd = fd;
+  src->priority = priority;
+  src->step = step;
+  ev.events = EPOLLIN;
+  ev.data.ptr = src;
+  if(epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+  {
+    printf("ERROR: %s: epoll_ctl failed\n", name);
+    close(fd);
+    return NULL;
+  }
+  r->n++;
+  return src;
+}
+
+/*******************************************************************************
+ * static int reactor_run_timer(reactor_source_t* src, int64_t wake)
+ *
+ * Account for the releases since the last run and step the task, once or,
+ * with OVERRUN_CATCH_UP, once for every release
+ ******************************************************************************/
+static int reactor_run_timer(reactor_source_t* src, int64_t wake)
+{
+  periodic_task_t* task = src->task;
+  periodic_stats_t* s = &task->stats;
+  uint64_t releases, runs, i;
+  int64_t release, late, period, start, exec;
+
+  if(read(src->fd, &releases, sizeof(releases)) != sizeof(releases)) return 0;
+  runs = 1;
+  if(releases > 1)
+  {
+    s->overruns++;
+    if(task->policy == OVERRUN_SKIP)
+    {
+      s->skipped += releases - 1;
+      timespec_add_ns(&task->next, (releases-1)*task->period_ns);
+    }
+    else runs = releases;
+  }
+
+  for(i=0; i<runs; i++)
+  {
+    release = timespec_to_ns(&task->next);
+    late = wake - release;
+    if(late > s->jitter_max) s->jitter_max = late;
+    s->jitter_sum += late;
+    s->jitter_sq_sum += (double)late*late;
+    if(s->cycles > 0)
+    {
+      period = wake - src->last_wake;
+      if(s->cycles == 1 || period < s->period_min) s->period_min = period;
+      if(period > s->period_max) s->period_max = period;
+    }
+    src->last_wake = wake;
+
+    start = monotonic_ns();
+    task->step();
+    exec = monotonic_ns() - start;
+    if(exec > s->exec_max) s->exec_max = exec;
+    s->exec_sum += exec;
+    s->cycles++;
+    timespec_add_ns(&task->next, task->period_ns);
+    wake = monotonic_ns();
+  }
+  return runs;
+}
+
+/*******************************************************************************
+ * static int reactor_run_event(reactor_source_t* src)
+ *
+ * Step an event source once for however many notifications came in
+ ******************************************************************************/
+static int reactor_run_event(reactor_source_t* src)
+{
+  uint64_t count;
+  int64_t start, exec;
+
+  if(read(src->fd, &count, sizeof(count)) != sizeof(count)) return 0;
+  src->events += count;
+  start = monotonic_ns();
+  src->step();
+  exec = monotonic_ns() - start;
+  if(exec > src->exec_max) src->exec_max = exec;
+  src->exec_sum += exec;
+  src->runs++;
+  return 1;
+}
+
+/*******************************************************************************
+ * int reactor_init(mip_reactor_t* r)
+ ******************************************************************************/
+int reactor_init(mip_reactor_t* r)
+{
+  struct epoll_event ev;
+
+  memset(r, 0, sizeof(mip_reactor_t));
+  r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  r->stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if(r->epoll_fd < 0 || r->stop_fd < 0)
+  {
+    printf("ERROR: can't create the reactor's epoll and eventfd\n");
+    reactor_close(r);
+    return -1;
+  }
+  // the stop event is the only one without a source
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if(epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->stop_fd, &ev))
+  {
+    reactor_close(r);
+    return -1;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * reactor_source_t* reactor_add_task(mip_reactor_t* r, periodic_task_t* task)
+ *
+ * Run a task set up by periodic_task_init on a timerfd instead of a thread,
+ * at the task's priority.  Its grid starts when reactor_run does.
+ ******************************************************************************/
+reactor_source_t* reactor_add_task(mip_reactor_t* r, periodic_task_t* task)
+{
+  reactor_source_t* src;
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+
+  src = reactor_add_fd(r, task->name, fd, task->step, task->priority);
+  if(src != NULL) src->task = task;
+  return src;
+}
+
+/*******************************************************************************
+ * reactor_source_t* reactor_add_event(mip_reactor_t* r, const char* name,
+ *                                     int (*step)(void), int priority)
+ *
+ * An eventfd that runs step after reactor_notify
+ ******************************************************************************/
+reactor_source_t* reactor_add_event(mip_reactor_t* r, const char* name,\
+                                    int (*step)(void), int priority)
+{
+  int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  return reactor_add_fd(r, name, fd, step, priority);
+}
+
+/*******************************************************************************
+ * int reactor_notify(reactor_source_t* src)
+ *
+ * Wake the reactor for src.  Safe from any thread and from signal handlers.
+ ******************************************************************************/
+int reactor_notify(reactor_source_t* src)
+{
+  uint64_t one = 1;
+  if(write(src->fd, &one, sizeof(one)) != sizeof(one)) return -1;
+  return 0;
+}
+
+/*******************************************************************************
+ * int reactor_run(mip_reactor_t* r)
+ *
+ * Start the task timers and run sources in the calling thread, raised to
+ * SCHED_FIFO at the highest source priority, until reactor_stop
+ ******************************************************************************/
+int reactor_run(mip_reactor_t* r)
+{
+  struct epoll_event ready[REACTOR_MAX_SOURCES+1];
+  struct itimerspec timer;
+  struct sched_param param;
+  reactor_source_t* src;
+  reactor_source_t* best;
+  int64_t now;
+  int i, n;
+
+  param.sched_priority = 0;
+  for(i=0; i<r->n; i++)
+  {
+    if(r->sources[i].priority > param.sched_priority)
+    {
+      param.sched_priority = r->sources[i].priority;
+    }
+  }
+  if(param.sched_priority > 0\
+     && pthread_setschedparam(pthread_self(), SCHED_FIFO, &param))
+  {
+    printf("reactor: could not set SCHED_FIFO priority %d, using default\n",\
+           param.sched_priority);
+  }
+
+  // every task's first release one period from now, then on the grid
+  now = monotonic_ns();
+  for(i=0; i<r->n; i++)
+  {
+    src = &r->sources[i];
+    if(src->task == NULL) continue;
+    src->task->next.tv_sec = 0;
+    src->task->next.tv_nsec = 0;
+    timespec_add_ns(&src->task->next, now + src->task->period_ns);
+    timer.it_value = src->task->next;
+    timer.it_interval.tv_sec = src->task->period_ns/NSEC_PER_SEC;
+    timer.it_interval.tv_nsec = src->task->period_ns%NSEC_PER_SEC;
+    if(timerfd_settime(src->fd, TFD_TIMER_ABSTIME, &timer, NULL))
+    {
+      printf("ERROR: %s: can't start its timerfd\n", src->name);
+      return -1;
+    }
+  }
+
+  r->running = 1;
+  while(r->running)
+  {
+    n = epoll_wait(r->epoll_fd, ready, r->n+1, -1);
+    r->polls++;
+    if(n < 0)
+    {
+      if(errno == EINTR) continue;
+      printf("ERROR: reactor epoll_wait failed\n");
+      return -1;
+    }
+
+    // level triggered, so whatever isn't run now is still ready next poll
+    best = NULL;
+    for(i=0; i<n; i++)
+    {
+      src = ready[i].data.ptr;
+      if(src == NULL)
+      {
+        r->running = 0;
+        break;
+      }
+      if(best == NULL || src->priority > best->priority) best = src;
+    }
+    if(!r->running || best == NULL) break;
+    if(best->task != NULL) r->dispatches += reactor_run_timer(best,\
+                                                             monotonic_ns());
+    else r->dispatches += reactor_run_event(best);
+  }
+
+  // leave the task timers stopped
+  memset(&timer, 0, sizeof(timer));
+  for(i=0; i<r->n; i++)
+  {
+    if(r->sources[i].task != NULL)
+    {
+      timerfd_settime(r->sources[i].fd, 0, &timer, NULL);
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * int reactor_stop(mip_reactor_t* r)
+ *
+ * Make reactor_run return after the step in progress.  Safe from any thread
+ * and from signal handlers.
+ ******************************************************************************/
+int reactor_stop(mip_reactor_t* r)
+{
+  uint64_t one = 1;
+  if(write(r->stop_fd, &one, sizeof(one)) != sizeof(one)) return -1;
+  return 0;
+}
+
+/*******************************************************************************
+ * int reactor_close(mip_reactor_t* r)
+ ******************************************************************************/
+int reactor_close(mip_reactor_t* r)
+{
+  int i;
+  for(i=0; i<r->n; i++) close(r->sources[i].fd);
+  if(r->stop_fd >= 0) close(r->stop_fd);
+  if(r->epoll_fd >= 0) close(r->epoll_fd);
+  r->n = 0;
+  r->stop_fd = -1;
+  r->epoll_fd = -1;
+  return 0;
+}
+
+/*******************************************************************************
+ * int print_reactor_stats(mip_reactor_t* r)
+ *
+ * Every task's line from print_periodic_stats, then the events
+ ******************************************************************************/
+int print_reactor_stats(mip_reactor_t* r)
+{
+  reactor_source_t* src;
+  double n;
+  int i;
+
+  printf("reactor: %llu polls, %llu steps\n", (unsigned long long)r->polls,\
+         (unsigned long long)r->dispatches);
+  for(i=0; i<r->n; i++)
+  {
+    src = &r->sources[i];
+    if(src->task != NULL)
+    {
+      print_periodic_stats(src->task);
+      continue;
+    }
+    n = src->runs > 0 ? src->runs : 1;
+    printf("%-12s events %llu  runs %llu  exec mean %6.1f max %7.1f us\n",\
+           src->name, (unsigned long long)src->events,\
+           (unsigned long long)src->runs, src->exec_sum/n/1e3,\
+           src->exec_max/1e3);
+  }
+  return 0;
+}
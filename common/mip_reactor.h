@@ -0,0 +1,66 @@
+/*******************************************************************************
+ * mip_reactor.h
+ *
+ * Single threaded runtime for the MiP loops.  Instead of a thread per
+ * periodic_task_t, every task gets a timerfd on the absolute CLOCK_MONOTONIC
+ * grid and every event, an IMU sample arriving or the state changing, an
+ * eventfd, all waited on by one epoll loop in the thread that calls
+ * reactor_run.  Of the sources that are ready, only the highest priority one
+ * runs before the loop polls again, so a timer that fires during a slow step
+ * still goes ahead of everything below it, just as SCHED_FIFO would order
+ * the threads.  Nothing preempts a step once it has started.
+ *
+ * Tasks keep their periodic_task_t, set up with periodic_task_init as for a
+ * thread, and the same step functions, statistics and print_periodic_stats.
+ * A release missed because the loop was busy counts as an overrun; missed
+ * releases are skipped or run back to back by the task's overrun policy.
+ ******************************************************************************/
+
+#ifndef MIP_REACTOR_H
+#define MIP_REACTOR_H
+
+#include <stdint.h>
+#include "periodic_task.h"
+
+#define REACTOR_MAX_SOURCES  8
+
+typedef struct reactor_source_t
+{
+  const char* name;
+  int fd;                   // timerfd or eventfd
+  int priority;             // the highest ready one runs first
+  int (*step)(void);
+  periodic_task_t* task;    // timers only, their period, policy and stats
+  int64_t last_wake;
+
+  // events only
+  uint64_t events;          // reactor_notify calls
+  uint64_t runs;            // steps, fewer if notifications piled up
+  int64_t  exec_max;
+  double   exec_sum;
+
+} reactor_source_t;
+
+typedef struct mip_reactor_t
+{
+  int epoll_fd;
+  int stop_fd;
+  reactor_source_t sources[REACTOR_MAX_SOURCES];
+  int n;
+  volatile int running;
+  uint64_t polls;           // epoll_wait calls
+  uint64_t dispatches;      // steps run, of any source
+
+} mip_reactor_t;
+
+int reactor_init(mip_reactor_t* r);
+reactor_source_t* reactor_add_task(mip_reactor_t* r, periodic_task_t* task);
+reactor_source_t* reactor_add_event(mip_reactor_t* r, const char* name,\
+                                    int (*step)(void), int priority);
+int reactor_notify(reactor_source_t* src);
+int reactor_run(mip_reactor_t* r);
+int reactor_stop(mip_reactor_t* r);
+int reactor_close(mip_reactor_t* r);
+int print_reactor_stats(mip_reactor_t* r);
+
+#endif // MIP_REACTOR_H
@@ -0,0 +1,211 @@
+/*******************************************************************************
+ * mip_recorder.c
+ *
+ * Preallocated ring flight recorder.  See mip_recorder.h.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mip_recorder.h"
+
+// the periodic task's step takes no argument, so one recorder has the thread
+static mip_recorder_t* threaded;
+
+/*******************************************************************************
+ * static int recorder_task_step()
+ ******************************************************************************/
+static int recorder_task_step()
+{
+  return recorder_step(threaded);
+}
+
+/*******************************************************************************
+ * static int recorder_dump(mip_recorder_t* r, const char* name, unsigned head)
+ *
+ * Every record still in the ring before head, oldest first.  A push that
+ * passed its check just before the trigger may still be writing slot head,
+ * the oldest record once the ring has wrapped, so that one is left out.
+ ******************************************************************************/
+static int recorder_dump(mip_recorder_t* r, const char* name, unsigned head)
+{
+  unsigned i = head < r->size ? 0 : head - r->size + 1;
+  mip_log_record_t* rec;
+  FILE* out;
+  int ok;
+
+  out = fopen(name, "wb");
+  if(out == NULL) return -1;
+  ok = mip_log_write_header(out, r->fields, r->names) == 0;
+  for(; i != head && ok; i++)
+  {
+    rec = &r->ring[i & (r->size-1)];
+    ok = fwrite(&rec->t_ns, sizeof(int64_t), 1, out) == 1\
+         && fwrite(rec->v, sizeof(float), r->fields, out)\
+            == (size_t)r->fields;
+  }
+  return fclose(out) || !ok ? -1 : 0;
+}
+
+/*******************************************************************************
+ * int recorder_open(mip_recorder_t* r, const char* prefix, int records,
+ *                   int fields, const char** names, int64_t t0_ns,
+ *                   int thread)
+ *
+ * Allocate and fault in a ring of at least records records of fields
+ * values, named by names, which must outlive the recorder.  Times are the
+ * caller's clock, written relative to t0_ns.  With thread, start the dump
+ * thread, otherwise the caller runs recorder_step.
+ ******************************************************************************/
+int recorder_open(mip_recorder_t* r, const char* prefix, int records,\
+                  int fields, const char** names, int64_t t0_ns, int thread)
+{
+  if(fields < 1 || fields > MIP_LOG_MAX_FIELDS || records < 2)
+  {
+    printf("ERROR: recorder: 1 to %d fields and 2 or more records\n",\
+           MIP_LOG_MAX_FIELDS);
+    return -1;
+  }
+  if(thread && threaded != NULL)
+  {
+    printf("ERROR: recorder: only one can have the dump thread\n");
+    return -1;
+  }
+  memset(r, 0, sizeof(mip_recorder_t));
+  for(r->size = 2; r->size < (unsigned)records; r->size *= 2);
+  r->fields = fields;
+  r->names = names;
+  r->prefix = prefix;
+  r->t0_ns = t0_ns;
+
+  // calloc'd pages aren't there until touched, so touch them now
+  r->ring = calloc(r->size, sizeof(mip_log_record_t));
+  if(r->ring == NULL)
+  {
+    printf("ERROR: recorder: can't allocate %u records\n", r->size);
+    return -1;
+  }
+  memset(r->ring, 0, r->size*sizeof(mip_log_record_t));
+  atomic_init(&r->head, 0);
+  atomic_init(&r->reason, NULL);
+  atomic_init(&r->triggers, 0);
+  if(!thread) return 0;
+
+  threaded = r;
+  periodic_task_init(&r->task, "recorder", &recorder_task_step,\
+                     RECORDER_POLL_FREQUENCY, 0, OVERRUN_SKIP);
+  if(periodic_task_start(&r->task))
+  {
+    threaded = NULL;
+    free(r->ring);
+    r->ring = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * int recorder_push(mip_recorder_t* r, int64_t t_ns, const float* values)
+ *
+ * Producer side: one record.  Returns -1, without blocking, while a dump is
+ * pending.
+ ******************************************************************************/
+int recorder_push(mip_recorder_t* r, int64_t t_ns, const float* values)
+{
+  unsigned head;
+  mip_log_record_t* rec;
+  int i;
+
+  if(atomic_load_explicit(&r->reason, memory_order_acquire) != NULL)
+  {
+    r->held++;
+    return -1;
+  }
+  head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  rec = &r->ring[head & (r->size-1)];
+  rec->t_ns = t_ns - r->t0_ns;
+  for(i=0; i<r->fields; i++) rec->v[i] = values[i];
+  atomic_store_explicit(&r->head, head+1, memory_order_release);
+  return 0;
+}
+
+/*******************************************************************************
+ * int recorder_trigger(mip_recorder_t* r, const char* reason)
+ *
+ * Dump the ring as it is now, named after reason, a string that outlives the
+ * recorder.  Safe from any thread and from signal handlers.
+ ******************************************************************************/
+int recorder_trigger(mip_recorder_t* r, const char* reason)
+{
+  const char* none = NULL;
+  atomic_fetch_add_explicit(&r->triggers, 1, memory_order_relaxed);
+  if(!atomic_compare_exchange_strong(&r->reason, &none, reason)) return -1;
+  return 0;
+}
+
+/*******************************************************************************
+ * int recorder_step(mip_recorder_t* r)
+ *
+ * Write out a pending dump, then let pushes through again.  The dump
+ * thread's step.  Returns 1 if it dumped.
+ ******************************************************************************/
+int recorder_step(mip_recorder_t* r)
+{
+  const char* reason = atomic_load_explicit(&r->reason, memory_order_acquire);
+  unsigned head;
+  int64_t start, exec;
+  char* c;
+
+  if(reason == NULL) return 0;
+  head = atomic_load_explicit(&r->head, memory_order_acquire);
+  r->dumps++;
+  snprintf(r->last, RECORDER_NAME_LEN, "%s_%03llu_%s.log", r->prefix,\
+           (unsigned long long)r->dumps, reason);
+  for(c=r->last; *c; c++) if(*c == ' ' || *c == '/') *c = '_';
+
+  start = monotonic_ns();
+  if(recorder_dump(r, r->last, head))
+  {
+    printf("ERROR: recorder: can't write %s\n", r->last);
+    r->failed++;
+  }
+  exec = monotonic_ns() - start;
+  if(exec > r->dump_max) r->dump_max = exec;
+  r->dump_sum += exec;
+  atomic_store_explicit(&r->reason, NULL, memory_order_release);
+  return 1;
+}
+
+/*******************************************************************************
+ * int recorder_close(mip_recorder_t* r)
+ *
+ * Stop the dump thread, write a dump still pending and free the ring
+ ******************************************************************************/
+int recorder_close(mip_recorder_t* r)
+{
+  if(r->ring == NULL) return -1;
+  if(threaded == r)
+  {
+    periodic_task_stop(&r->task);
+    threaded = NULL;
+  }
+  recorder_step(r);
+  free(r->ring);
+  r->ring = NULL;
+  return 0;
+}
+
+/*******************************************************************************
+ * int print_recorder_stats(mip_recorder_t* r)
+ ******************************************************************************/
+int print_recorder_stats(mip_recorder_t* r)
+{
+  double n = r->dumps > 0 ? r->dumps : 1;
+  printf("recorder: %u records (%.1f KB), %lu triggers, %llu dumps (%llu "\
+         "failed) mean %.1f max %.1f ms, %llu pushes held, last %s\n",\
+         r->size, r->size*sizeof(mip_log_record_t)/1024.0,\
+         atomic_load(&r->triggers), (unsigned long long)r->dumps,\
+         (unsigned long long)r->failed, r->dump_sum/n/1e6, r->dump_max/1e6,\
+         (unsigned long long)r->held, r->dumps > 0 ? r->last : "none");
+  return 0;
+}
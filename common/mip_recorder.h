@@ -0,0 +1,67 @@
+/*******************************************************************************
+ * mip_recorder.h
+ *
+ * In-memory flight recorder.  The control loop pushes one record per tick
+ * into a preallocated ring that always holds the newest records and never
+ * fills, so nothing goes to the SD card while all is well.  recorder_trigger
+ * marks the ring for a dump, from any thread: a disarm, a pause or a
+ * watchdog trip.  A background thread, or the simulator calling
+ * recorder_step, then writes the ring oldest first to
+ * <prefix>_<n>_<reason>.log in the mip_log format, which log_to_csv and
+ * replay_by_daniel read.
+ *
+ * A push is an atomic load, the record's stores and a release store of the
+ * head.  It never blocks: from the trigger until the dump is written pushes
+ * are dropped instead, so the dump is exactly the records up to the trigger
+ * and the dump thread never races the producer for a slot.  A second
+ * trigger before the dump is written is counted but doesn't dump again.
+ ******************************************************************************/
+
+#ifndef MIP_RECORDER_H
+#define MIP_RECORDER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "mip_log.h"
+#include "periodic_task.h"
+
+#define RECORDER_POLL_FREQUENCY  10   // Hz, the dump thread looks for triggers
+#define RECORDER_NAME_LEN        64
+
+typedef struct mip_recorder_t
+{
+  // producer side
+  _Alignas(MIP_LOG_CACHE_LINE) atomic_uint head;
+  uint64_t held;                  // pushes dropped waiting for a dump
+
+  // any thread, the pending dump's reason or NULL
+  _Alignas(MIP_LOG_CACHE_LINE) _Atomic(const char*) reason;
+  atomic_ulong triggers;
+
+  // dump side
+  _Alignas(MIP_LOG_CACHE_LINE) uint64_t dumps;
+  uint64_t failed;
+  int64_t dump_max;               // ns to write one
+  double dump_sum;
+  char last[RECORDER_NAME_LEN];
+
+  // shared, read-only after open
+  _Alignas(MIP_LOG_CACHE_LINE) mip_log_record_t* ring;
+  unsigned size;                  // records, a power of two
+  int fields;
+  const char** names;
+  const char* prefix;
+  int64_t t0_ns;
+  periodic_task_t task;
+
+} mip_recorder_t;
+
+int recorder_open(mip_recorder_t* r, const char* prefix, int records,\
+                  int fields, const char** names, int64_t t0_ns, int thread);
+int recorder_push(mip_recorder_t* r, int64_t t_ns, const float* values);
+int recorder_trigger(mip_recorder_t* r, const char* reason);
+int recorder_step(mip_recorder_t* r);
+int recorder_close(mip_recorder_t* r);
+int print_recorder_stats(mip_recorder_t* r);
+
+#endif // MIP_RECORDER_H
@@ -0,0 +1,221 @@
+/*******************************************************************************
+ * mip_rt.c
+ *
+ * mlockall, prefaulting, CPU affinity and per thread fault counts.  See
+ * mip_rt.h.
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <alloca.h>
+#include <malloc.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "mip_rt.h"
+
+/*******************************************************************************
+ * static int rt_read_thread(rt_thread_usage_t* t)
+ *
+ * Fill in thread t->tid from /proc/self/task/<tid>/stat and status
+ ******************************************************************************/
+static int rt_read_thread(rt_thread_usage_t* t)
+{
+  char path[64], line[512];
+  char *lp, *rp;
+  FILE* f;
+  int n;
+
+  sprintf(path, "/proc/self/task/%d/stat", (int)t->tid);
+  f = fopen(path, "r");
+  if(f == NULL) return -1;
+  n = fgets(line, sizeof(line), f) != NULL;
+  fclose(f);
+  if(!n) return -1;
+
+  // the name is in parentheses and may hold spaces, the fields follow it:
+  // state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt
+  lp = strchr(line, '(');
+  rp = strrchr(line, ')');
+  if(lp == NULL || rp == NULL || rp < lp) return -1;
+  n = rp - lp - 1;
+  if(n > (int)sizeof(t->name) - 1) n = sizeof(t->name) - 1;
+  memcpy(t->name, lp + 1, n);
+  t->name[n] = '\0';
+  if(sscanf(rp + 1, " %*c %*d %*d %*d %*d %*d %*u %lu %*u %lu",\
+            &t->minflt, &t->majflt) != 2)
+  {
+    return -1;
+  }
+
+  sprintf(path, "/proc/self/task/%d/status", (int)t->tid);
+  f = fopen(path, "r");
+  if(f == NULL) return -1;
+  while(fgets(line, sizeof(line), f) != NULL)
+  {
+    sscanf(line, "voluntary_ctxt_switches: %lu", &t->nvcsw);
+    sscanf(line, "nonvoluntary_ctxt_switches: %lu", &t->nivcsw);
+  }
+  fclose(f);
+  return 0;
+}
+
+/*******************************************************************************
+ * int rt_lock_memory(size_t heap_bytes, size_t stack_bytes)
+ *
+ * Lock the process in memory, keep every thread's malloc in one arena that
+ * is never trimmed, then fault in heap_bytes of it and stack_bytes of the
+ * calling thread's stack.  Without the privilege to lock, warn and still
+ * prefault.  Returns -1 if memory isn't locked.
+ ******************************************************************************/
+int rt_lock_memory(size_t heap_bytes, size_t stack_bytes)
+{
+  long page = sysconf(_SC_PAGESIZE);
+  volatile char* heap;
+  size_t i;
+  int ret = 0;
+
+  if(mlockall(MCL_CURRENT | MCL_FUTURE))
+  {
+    printf("could not lock memory, page faults remain possible\n");
+    ret = -1;
+  }
+  // freed memory stays in the arena, and big blocks come from it too rather
+  // than from an mmap that would fault in on first touch
+  mallopt(M_TRIM_THRESHOLD, -1);
+  mallopt(M_MMAP_MAX, 0);
+  mallopt(M_ARENA_MAX, 1);
+
+  heap = malloc(heap_bytes);
+  if(heap == NULL)
+  {
+    printf("ERROR: can't prefault %lu bytes of heap\n",\
+           (unsigned long)heap_bytes);
+    return -1;
+  }
+  for(i=0; i<heap_bytes; i+=page) heap[i] = 0;
+  free((void*)heap);
+  rt_prefault_stack(stack_bytes);
+  return ret;
+}
+
+/*******************************************************************************
+ * int rt_prefault_stack(size_t bytes)
+ *
+ * Touch the next bytes of the calling thread's stack, a page at a time
+ ******************************************************************************/
+int rt_prefault_stack(size_t bytes)
+{
+  long page = sysconf(_SC_PAGESIZE);
+  volatile char* stack = alloca(bytes);
+  size_t i;
+
+  for(i=0; i<bytes; i+=page) stack[i] = 0;
+  return 0;
+}
+
+/*******************************************************************************
+ * int rt_set_cpu(pthread_attr_t* attr, int cpu)
+ *
+ * Pin threads created with attr, or the calling thread if attr is NULL, to
+ * one CPU.  -1 leaves them on any.  Returns -1 for a CPU this machine
+ * doesn't have.
+ ******************************************************************************/
+int rt_set_cpu(pthread_attr_t* attr, int cpu)
+{
+  cpu_set_t set;
+
+  if(cpu < 0) return 0;
+  if(cpu >= sysconf(_SC_NPROCESSORS_ONLN))
+  {
+    printf("ERROR: no CPU %d, this machine has %ld\n", cpu,\
+           sysconf(_SC_NPROCESSORS_ONLN));
+    return -1;
+  }
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if(attr != NULL) return pthread_attr_setaffinity_np(attr, sizeof(set), &set)\
+                          ? -1 : 0;
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) ? -1 : 0;
+}
+
+/*******************************************************************************
+ * int rt_name_thread(const char* name)
+ *
+ * Name the calling thread, as rt_usage_snapshot and top -H show it.  Names
+ * are cut to 15 characters.
+ ******************************************************************************/
+int rt_name_thread(const char* name)
+{
+  char cut[16];
+  strncpy(cut, name, sizeof(cut) - 1);
+  cut[sizeof(cut) - 1] = '\0';
+  return pthread_setname_np(pthread_self(), cut) ? -1 : 0;
+}
+
+/*******************************************************************************
+ * int rt_usage_snapshot(rt_usage_t* u)
+ *
+ * Every thread of the process now, up to RT_MAX_THREADS
+ ******************************************************************************/
+int rt_usage_snapshot(rt_usage_t* u)
+{
+  struct dirent* entry;
+  DIR* dir = opendir("/proc/self/task");
+
+  u->n = 0;
+  if(dir == NULL)
+  {
+    printf("ERROR: can't read /proc/self/task\n");
+    return -1;
+  }
+  while((entry = readdir(dir)) != NULL && u->n < RT_MAX_THREADS)
+  {
+    if(entry->d_name[0] == '.') continue;
+    memset(&u->threads[u->n], 0, sizeof(rt_thread_usage_t));
+    u->threads[u->n].tid = atoi(entry->d_name);
+    // a thread that has just exited is skipped
+    if(rt_read_thread(&u->threads[u->n]) == 0) u->n++;
+  }
+  closedir(dir);
+  return 0;
+}
+
+/*******************************************************************************
+ * int print_rt_usage(const rt_usage_t* start, const rt_usage_t* end)
+ *
+ * Page faults and context switches of every thread in end since start, from
+ * zero for threads that started in between
+ ******************************************************************************/
+int print_rt_usage(const rt_usage_t* start, const rt_usage_t* end)
+{
+  const rt_thread_usage_t* a;
+  const rt_thread_usage_t* b;
+  rt_thread_usage_t zero;
+  unsigned long minflt = 0, majflt = 0;
+  int i, j;
+
+  memset(&zero, 0, sizeof(zero));
+  printf("page faults and context switches per thread:\n");
+  for(i=0; i<end->n; i++)
+  {
+    b = &end->threads[i];
+    a = &zero;
+    for(j=0; j<start->n; j++)
+    {
+      if(start->threads[j].tid == b->tid) a = &start->threads[j];
+    }
+    minflt += b->minflt - a->minflt;
+    majflt += b->majflt - a->majflt;
+    printf("  %-15s %6d  faults minor %5lu major %3lu  switches voluntary "\
+           "%7lu involuntary %5lu\n", b->name, (int)b->tid,\
+           b->minflt - a->minflt, b->majflt - a->majflt,\
+           b->nvcsw - a->nvcsw, b->nivcsw - a->nivcsw);
+  }
+  printf("  %d threads, %lu minor and %lu major page faults\n", end->n,\
+         minflt, majflt);
+  return 0;
+}
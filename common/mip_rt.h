@@ -0,0 +1,53 @@
+/*******************************************************************************
+ * mip_rt.h
+ *
+ * Real-time process setup and page fault accounting.  rt_lock_memory locks
+ * everything the process has and will map with mlockall, stops malloc from
+ * handing memory back or using fresh mmaps, and touches a heap reserve and
+ * the calling thread's stack so none of it faults in later; periodic tasks
+ * touch their own stacks as they start.  Run it before set_state(RUNNING).
+ * rt_set_cpu pins a thread to one CPU, through its pthread_attr_t or from
+ * inside it, and rt_name_thread names it for the reports below.
+ *
+ * rt_usage_snapshot reads every thread of the process, the cape library's
+ * included, from /proc/self/task: name, minor and major page faults and
+ * voluntary and involuntary context switches.  print_rt_usage prints what
+ * each thread added between two snapshots, so one taken at RUNNING and one
+ * before the threads stop show whether the control loops ever fault.
+ ******************************************************************************/
+
+#ifndef MIP_RT_H
+#define MIP_RT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#define RT_MAX_THREADS  32
+
+typedef struct rt_thread_usage_t
+{
+  pid_t tid;
+  char name[16];
+  unsigned long minflt;
+  unsigned long majflt;
+  unsigned long nvcsw;
+  unsigned long nivcsw;
+
+} rt_thread_usage_t;
+
+typedef struct rt_usage_t
+{
+  rt_thread_usage_t threads[RT_MAX_THREADS];
+  int n;
+
+} rt_usage_t;
+
+int rt_lock_memory(size_t heap_bytes, size_t stack_bytes);
+int rt_prefault_stack(size_t bytes);
+int rt_set_cpu(pthread_attr_t* attr, int cpu);
+int rt_name_thread(const char* name);
+int rt_usage_snapshot(rt_usage_t* u);
+int print_rt_usage(const rt_usage_t* start, const rt_usage_t* end);
+
+#endif // MIP_RT_H
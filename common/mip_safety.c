@@ -0,0 +1,64 @@
+/*******************************************************************************
+ * mip_safety.c
+ *
+ * Safety limits.  See mip_safety.h.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include "mip_safety.h"
+
+/*******************************************************************************
+ * int safety_limit_init(safety_limit_t* l, const char* name, float limit,
+ *                       float hold_time, double check_frequency)
+ *
+ * A limit that trips after hold_time seconds of checks at check_frequency,
+ * or on the first one if hold_time is 0
+ ******************************************************************************/
+int safety_limit_init(safety_limit_t* l, const char* name, float limit,\
+                      float hold_time, double check_frequency)
+{
+  if(limit < 0 || hold_time < 0 || check_frequency <= 0)
+  {
+    printf("ERROR: bad %s safety limit\n", name);
+    return -1;
+  }
+  l->name = name;
+  l->limit = limit;
+  l->hold_time = hold_time;
+  l->hold = (int)ceil(hold_time*check_frequency);
+  if(l->hold < 1) l->hold = 1;
+  l->count = 0;
+  l->trips = 0;
+  return 0;
+}
+
+/*******************************************************************************
+ * int safety_limit_reset(safety_limit_t* l)
+ *
+ * Start counting over, keeping the trip count
+ ******************************************************************************/
+int safety_limit_reset(safety_limit_t* l)
+{
+  l->count = 0;
+  return 0;
+}
+
+/*******************************************************************************
+ * int print_safety_limits(safety_limit_t* limits, int n)
+ ******************************************************************************/
+int print_safety_limits(safety_limit_t* limits, int n)
+{
+  int i;
+  for(i=0; i<n; i++)
+  {
+    if(limits[i].limit <= 0)
+    {
+      printf("  %-12s off\n", limits[i].name);
+      continue;
+    }
+    printf("  %-12s %8g held %.3f s: %llu trips\n", limits[i].name,\
+           limits[i].limit, limits[i].hold_time,\
+           (unsigned long long)limits[i].trips);
+  }
+  return 0;
+}
@@ -0,0 +1,51 @@
+/*******************************************************************************
+ * mip_safety.h
+ *
+ * Safety limits for a supervisor that runs inside a control loop.  A limit
+ * trips once |value| reaches it for hold consecutive checks, so one noisy
+ * sample can be told apart from a motor pinned at saturation for half a
+ * second.  Checking is a compare and an increment, cheap enough for every
+ * tick; a limit of 0 turns it off.
+ ******************************************************************************/
+
+#ifndef MIP_SAFETY_H
+#define MIP_SAFETY_H
+
+#include <stdint.h>
+#include <math.h>
+
+typedef struct safety_limit_t
+{
+  const char* name;
+  float limit;          // |value| at or past this counts, 0 for never
+  float hold_time;      // s, as given
+  int hold;             // consecutive checks needed, at least 1
+  int count;            // consecutive checks at or past the limit so far
+  uint64_t trips;
+
+} safety_limit_t;
+
+int safety_limit_init(safety_limit_t* l, const char* name, float limit,\
+                      float hold_time, double check_frequency);
+int safety_limit_reset(safety_limit_t* l);
+int print_safety_limits(safety_limit_t* limits, int n);
+
+/*******************************************************************************
+ * int safety_limit_check(safety_limit_t* l, float value)
+ *
+ * Returns 1 on the check that trips the limit, and every one after that
+ * until the value comes back or the limit is reset
+ ******************************************************************************/
+static inline int safety_limit_check(safety_limit_t* l, float value)
+{
+  if(l->limit <= 0 || fabsf(value) < l->limit)
+  {
+    l->count = 0;
+    return 0;
+  }
+  if(++l->count < l->hold) return 0;
+  if(l->count == l->hold) l->trips++;
+  return 1;
+}
+
+#endif // MIP_SAFETY_H
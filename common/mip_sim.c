@@ -0,0 +1,491 @@
+/*******************************************************************************
+ * mip_sim.c
+ *
+ * Simulated robotics cape backend.  See mip_sim.h.
+ ******************************************************************************/
+
+#include "mip_sim.h"
+#include "mip_imu.h"
+
+// variable declarations
+static mip_sim_config_t sim_config;
+static mip_plant_t      sim_plant;
+static state_t          sim_state = UNINITIALIZED;
+static double           sim_time;
+static double           sim_period;
+static int              sim_motors_enabled;
+static int              sim_holding;
+static float            sim_duty[SIM_MOTOR_CHANNELS+1];
+static int              sim_encoder_offset[SIM_ENCODER_CHANNELS+1];
+static imu_data_t*      sim_imu_data;
+static int            (*sim_imu_func)(void);
+static uint32_t         sim_rng;
+static int              sim_i2c_open;
+static uint8_t          sim_mpu_reg[128];
+static uint8_t          sim_fifo[MPU_FIFO_BYTES];
+static int              sim_fifo_head;      // next byte out
+static int              sim_fifo_count;     // bytes in it
+
+/*******************************************************************************
+ * static float sim_noise(float rms)
+ *
+ * Gaussian noise from a seeded xorshift generator so runs are repeatable
+ ******************************************************************************/
+static float sim_noise(float rms)
+{
+  float u1, u2;
+  if(rms <= 0) return 0.0;
+
+  sim_rng ^= sim_rng << 13;
+  sim_rng ^= sim_rng >> 17;
+  sim_rng ^= sim_rng << 5;
+  u1 = ((sim_rng >> 8) + 1.0f)/16777217.0f;
+  sim_rng ^= sim_rng << 13;
+  sim_rng ^= sim_rng >> 17;
+  sim_rng ^= sim_rng << 5;
+  u2 = (sim_rng >> 8)/16777216.0f;
+  return rms*sqrtf(-2.0f*logf(u1))*cosf(TWO_PI*u2);
+}
+
+/*******************************************************************************
+ * static int sim_encoder_raw(int ch)
+ *
+ * Encoder count the wheel on channel ch would have accumulated since start
+ ******************************************************************************/
+static int sim_encoder_raw(int ch)
+{
+  double ticks = mip_plant_phi(&sim_plant)*sim_config.plant.gear_ratio\
+                 *sim_config.encoder_ticks/TWO_PI;
+  if(ch == sim_config.encoder_channel_l)
+  {
+    return (int)floor(ticks*sim_config.encoder_polarity_l);
+  }
+  if(ch == sim_config.encoder_channel_r)
+  {
+    return (int)floor(ticks*sim_config.encoder_polarity_r);
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * mip_sim_config_t sim_default_config()
+ *
+ * Default simulation setup, wiring matches balance_by_daniel
+ ******************************************************************************/
+mip_sim_config_t sim_default_config()
+{
+  mip_sim_config_t c;
+  c.plant = mip_plant_default_params(35.577, 0.034);
+  c.cape_mount_angle   = 0.0;
+  c.initial_theta      = 0.0;
+  c.hold_until_armed   = 1;
+  c.encoder_ticks      = 60;
+  c.motor_channel_l    = 3;
+  c.motor_channel_r    = 2;
+  c.motor_polarity_l   = 1;
+  c.motor_polarity_r   = -1;
+  c.encoder_channel_l  = 3;
+  c.encoder_channel_r  = 2;
+  c.encoder_polarity_l = 1;
+  c.encoder_polarity_r = -1;
+  c.gyro_noise         = 0.1;
+  c.gyro_bias          = 0.0;
+  c.accel_noise        = 0.05;
+  c.seed               = 1;
+  return c;
+}
+
+/*******************************************************************************
+ * int sim_configure(mip_sim_config_t config)
+ *
+ * Reset the plant and virtual clock with a new setup
+ ******************************************************************************/
+int sim_configure(mip_sim_config_t config)
+{
+  int i;
+  sim_config = config;
+  mip_plant_init(&sim_plant, config.plant, config.initial_theta);
+  sim_time = 0.0;
+  sim_holding = config.hold_until_armed;
+  sim_rng = config.seed ? config.seed : 1;
+  for(i=0; i<=SIM_MOTOR_CHANNELS; i++) sim_duty[i] = 0.0;
+  for(i=0; i<=SIM_ENCODER_CHANNELS; i++) sim_encoder_offset[i] = 0;
+  return 0;
+}
+
+/*******************************************************************************
+ * static int sim_fifo_on()
+ *
+ * True once the MPU-9250 is awake and writing accel and gyro frames
+ ******************************************************************************/
+static int sim_fifo_on()
+{
+  return sim_i2c_open && (sim_mpu_reg[MPU_USER_CTRL] & MPU_USER_FIFO_EN)\
+         && sim_mpu_reg[MPU_FIFO_EN] == MPU_FIFO_ACCEL_GYRO\
+         && !(sim_mpu_reg[MPU_PWR_MGMT_1] & MPU_PWR_SLEEP);
+}
+
+/*******************************************************************************
+ * static void sim_fifo_push(const imu_data_t* r)
+ *
+ * One reading into the FIFO as the sensor would write it, in counts at the
+ * full scale ranges the registers are set to.  Only the stop when full mode
+ * is modeled: a frame that doesn't fit is dropped and flags an overflow.
+ ******************************************************************************/
+static void sim_fifo_push(const imu_data_t* r)
+{
+  float accel_lsb, gyro_lsb, v;
+  int16_t word;
+  int i, at;
+
+  if(sim_fifo_count + MPU_FIFO_FRAME > MPU_FIFO_BYTES)
+  {
+    sim_mpu_reg[MPU_INT_STATUS] |= MPU_INT_FIFO_OFLOW;
+    return;
+  }
+  accel_lsb = 32768.0/(MIP_IMU_GRAVITY*(2 << ((sim_mpu_reg[MPU_ACCEL_CONFIG]\
+              >> 3) & 3)));
+  gyro_lsb = 32768.0/(250 << ((sim_mpu_reg[MPU_GYRO_CONFIG] >> 3) & 3));
+  for(i=0; i<6; i++)
+  {
+    v = i < 3 ? r->accel[i]*accel_lsb : r->gyro[i-3]*gyro_lsb;
+    if(v > 32767) v = 32767;
+    else if(v < -32768) v = -32768;
+    word = lrintf(v);
+    at = (sim_fifo_head + sim_fifo_count) % MPU_FIFO_BYTES;
+    sim_fifo[at] = (word >> 8) & 0xFF;
+    sim_fifo[(at+1) % MPU_FIFO_BYTES] = word & 0xFF;
+    sim_fifo_count += 2;
+  }
+}
+
+/*******************************************************************************
+ * int sim_step()
+ *
+ * Advance one IMU sample period: integrate the plant with the current motor
+ * duties, synthesize the IMU reading and call the IMU interrupt function, or
+ * push it into the FIFO.  Returns 1 if the MiP is lying on the ground.
+ ******************************************************************************/
+int sim_step()
+{
+  float duty, sensor_angle;
+  imu_data_t reading;
+  imu_data_t* d = sim_imu_data != NULL ? sim_imu_data : &reading;
+  int fifo = sim_fifo_on();
+
+  duty = 0.5*(sim_config.motor_polarity_l*sim_duty[sim_config.motor_channel_l]\
+            + sim_config.motor_polarity_r*sim_duty[sim_config.motor_channel_r]);
+  mip_plant_step(&sim_plant, duty, sim_motors_enabled, sim_period);
+
+  // like a hand holding the MiP upright until the controller takes over
+  if(sim_holding)
+  {
+    if(sim_motors_enabled) sim_holding = 0;
+    else
+    {
+      sim_plant.psi += sim_config.initial_theta - sim_plant.theta;
+      sim_plant.psi_dot -= sim_plant.theta_dot;
+      sim_plant.theta = sim_config.initial_theta;
+      sim_plant.theta_dot = 0.0;
+    }
+  }
+  sim_time += sim_period;
+
+  if(sim_imu_data != NULL || fifo)
+  {
+    // accelerometer sees gravity in the tilted sensor frame
+    sensor_angle = sim_plant.theta - sim_config.cape_mount_angle;
+    d->accel[0] = sim_noise(sim_config.accel_noise);
+    d->accel[1] = MIP_GRAVITY*cos(sensor_angle)+sim_noise(sim_config.accel_noise);
+    d->accel[2] = -MIP_GRAVITY*sin(sensor_angle)\
+                  + sim_noise(sim_config.accel_noise);
+    d->gyro[0] = sim_plant.theta_dot*RAD_TO_DEG + sim_config.gyro_bias\
+                 + sim_noise(sim_config.gyro_noise);
+    d->gyro[1] = sim_noise(sim_config.gyro_noise);
+    d->gyro[2] = sim_noise(sim_config.gyro_noise);
+    if(fifo) sim_fifo_push(d);
+    else if(sim_imu_func != NULL) sim_imu_func();
+  }
+  return sim_plant.fallen;
+}
+
+/*******************************************************************************
+ * int sim_run_realtime(double seconds)
+ *
+ * Step the simulation at the IMU's rate, or every SIM_IDLE_PERIOD without
+ * one, in real time for seconds of virtual time (0 for no limit) or until
+ * the state is EXITING.  For programs whose threads sleep on the wall clock,
+ * run from the main thread in place of its wait for EXITING.
+ ******************************************************************************/
+int sim_run_realtime(double seconds)
+{
+  struct timespec next;
+  double end = sim_time + seconds;
+  double period;
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while(sim_state != EXITING && (seconds <= 0 || sim_time < end))
+  {
+    period = sim_imu_data != NULL ? sim_period : SIM_IDLE_PERIOD;
+    next.tv_nsec += (long)(period*1e9);
+    while(next.tv_nsec >= 1000000000)
+    {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    if(sim_imu_data != NULL) sim_step();
+    else sim_time += period;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * double sim_get_time()
+ *
+ * Virtual seconds since sim_configure
+ ******************************************************************************/
+double sim_get_time()
+{
+  return sim_time;
+}
+
+/*******************************************************************************
+ * mip_plant_t* sim_get_plant()
+ *
+ * Ground truth for reporting
+ ******************************************************************************/
+mip_plant_t* sim_get_plant()
+{
+  return &sim_plant;
+}
+
+/*******************************************************************************
+ * Cape API
+ ******************************************************************************/
+int initialize_cape()
+{
+  sim_configure(sim_default_config());
+  sim_state = UNINITIALIZED;
+  sim_motors_enabled = 0;
+  return 0;
+}
+
+int cleanup_cape()
+{
+  sim_motors_enabled = 0;
+  sim_state = EXITING;
+  return 0;
+}
+
+state_t get_state()
+{
+  return sim_state;
+}
+
+int set_state(state_t new_state)
+{
+  sim_state = new_state;
+  return 0;
+}
+
+int set_led(led_t led, int state)
+{
+  return 0;
+}
+
+int set_pause_pressed_func(int (*func)(void))
+{
+  return 0;
+}
+
+int set_pause_released_func(int (*func)(void))
+{
+  return 0;
+}
+
+int set_mode_pressed_func(int (*func)(void))
+{
+  return 0;
+}
+
+int set_mode_released_func(int (*func)(void))
+{
+  return 0;
+}
+
+button_state_t get_pause_button()
+{
+  return RELEASED;
+}
+
+button_state_t get_mode_button()
+{
+  return RELEASED;
+}
+
+int enable_motors()
+{
+  sim_motors_enabled = 1;
+  return 0;
+}
+
+int disable_motors()
+{
+  sim_motors_enabled = 0;
+  return 0;
+}
+
+int set_motor(int motor, float duty)
+{
+  if(motor < 1 || motor > SIM_MOTOR_CHANNELS) return -1;
+  if(duty > 1.0) duty = 1.0;
+  else if(duty < -1.0) duty = -1.0;
+  sim_duty[motor] = duty;
+  return 0;
+}
+
+int set_motor_all(float duty)
+{
+  int i;
+  for(i=1; i<=SIM_MOTOR_CHANNELS; i++) set_motor(i, duty);
+  return 0;
+}
+
+int get_encoder_pos(int ch)
+{
+  if(ch < 1 || ch > SIM_ENCODER_CHANNELS) return -1;
+  return sim_encoder_raw(ch) - sim_encoder_offset[ch];
+}
+
+int set_encoder_pos(int ch, int value)
+{
+  if(ch < 1 || ch > SIM_ENCODER_CHANNELS) return -1;
+  sim_encoder_offset[ch] = sim_encoder_raw(ch) - value;
+  return 0;
+}
+
+imu_config_t get_default_imu_config()
+{
+  imu_config_t conf;
+  conf.enable_magnetometer = 0;
+  conf.dmp_sample_rate = 100;
+  return conf;
+}
+
+int initialize_imu_dmp(imu_data_t* data, imu_config_t conf)
+{
+  if(conf.dmp_sample_rate <= 0) return -1;
+  memset(data, 0, sizeof(imu_data_t));
+  sim_imu_data = data;
+  sim_period = 1.0/conf.dmp_sample_rate;
+  return 0;
+}
+
+int set_imu_interrupt_func(int (*func)(void))
+{
+  sim_imu_func = func;
+  return 0;
+}
+
+int power_off_imu()
+{
+  sim_imu_func = NULL;
+  sim_imu_data = NULL;
+  return 0;
+}
+
+/*******************************************************************************
+ * I2C, the MPU-9250 at MIP_IMU_ADDR on MIP_IMU_BUS and nothing else.  Bursts
+ * from FIFO_R_W keep reading the FIFO, any other burst walks the registers.
+ ******************************************************************************/
+static uint8_t sim_mpu_read(uint8_t reg)
+{
+  uint8_t value;
+  switch(reg)
+  {
+    case MPU_FIFO_COUNTH:
+      return sim_fifo_count >> 8;
+    case MPU_FIFO_COUNTH+1:
+      return sim_fifo_count & 0xFF;
+    case MPU_FIFO_R_W:
+      if(sim_fifo_count == 0) return 0xFF;
+      value = sim_fifo[sim_fifo_head];
+      sim_fifo_head = (sim_fifo_head + 1) % MPU_FIFO_BYTES;
+      sim_fifo_count--;
+      return value;
+    case MPU_INT_STATUS:
+      value = sim_mpu_reg[reg];
+      sim_mpu_reg[reg] = 0;
+      return value;
+  }
+  return sim_mpu_reg[reg & 0x7F];
+}
+
+int i2c_init(int bus, uint8_t devAddr)
+{
+  if(bus != MIP_IMU_BUS || devAddr != MIP_IMU_ADDR) return -1;
+  sim_i2c_open = 1;
+  return 0;
+}
+
+int i2c_close(int bus)
+{
+  sim_i2c_open = 0;
+  return 0;
+}
+
+int i2c_claim_bus(int bus)
+{
+  return 0;
+}
+
+int i2c_release_bus(int bus)
+{
+  return 0;
+}
+
+int i2c_read_byte(int bus, uint8_t regAddr, uint8_t* data)
+{
+  return i2c_read_bytes(bus, regAddr, 1, data);
+}
+
+int i2c_read_bytes(int bus, uint8_t regAddr, uint8_t length, uint8_t* data)
+{
+  int i;
+  if(!sim_i2c_open || bus != MIP_IMU_BUS) return -1;
+  for(i=0; i<length; i++)
+  {
+    data[i] = sim_mpu_read(regAddr == MPU_FIFO_R_W ? regAddr : regAddr+i);
+  }
+  return 0;
+}
+
+int i2c_write_byte(int bus, uint8_t regAddr, uint8_t data)
+{
+  if(!sim_i2c_open || bus != MIP_IMU_BUS || regAddr > 0x7F) return -1;
+  switch(regAddr)
+  {
+    case MPU_PWR_MGMT_1:
+      if(data & MPU_PWR_RESET)
+      {
+        memset(sim_mpu_reg, 0, sizeof(sim_mpu_reg));
+        sim_fifo_head = sim_fifo_count = 0;
+        return 0;
+      }
+      break;
+    case MPU_SMPLRT_DIV:
+      // internal rate with the DLPF on
+      sim_period = (1.0 + data)/MIP_IMU_FIFO_MAX_RATE;
+      break;
+    case MPU_USER_CTRL:
+      if(data & MPU_USER_FIFO_RST)
+      {
+        sim_fifo_head = sim_fifo_count = 0;
+        data &= ~MPU_USER_FIFO_RST;
+      }
+      break;
+  }
+  sim_mpu_reg[regAddr] = data;
+  return 0;
+}
@@ -0,0 +1,158 @@
+/*******************************************************************************
+ * mip_sim.h
+ *
+ * Simulated robotics cape.  Declares the subset of the roboticscape API the
+ * MiP programs use, backed by the plant model instead of hardware, plus the
+ * sim_* calls that advance virtual time.  Nothing here sleeps: each
+ * sim_step() integrates one IMU sample period, fills the buffer handed to
+ * initialize_imu_dmp() and fires the IMU interrupt function, so a driver loop
+ * runs as fast as the CPU allows.  The i2c_* calls stand in for the MPU-9250
+ * registers mip_imu.c's raw FIFO path uses: once that is set up, every
+ * sim_step() pushes a frame into a simulated FIFO instead, at the rate
+ * SMPLRT_DIV gives.  sim_run_realtime() is the driver loop for programs that
+ * only wait on their threads, paced to the wall clock so they look as they
+ * would on the cape.
+ ******************************************************************************/
+
+#ifndef MIP_SIM_H
+#define MIP_SIM_H
+
+// the headers usefulincludes.h pulls in on the target
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mip_plant.h"
+
+#ifndef DEG_TO_RAD
+#define DEG_TO_RAD    0.0174532925199
+#endif
+#ifndef RAD_TO_DEG
+#define RAD_TO_DEG    57.295779513
+#endif
+#ifndef TWO_PI
+#define TWO_PI        (M_PI*2.0)
+#endif
+
+#define SIM_MOTOR_CHANNELS    4
+#define SIM_ENCODER_CHANNELS  4
+#define SIM_IDLE_PERIOD       0.01  // s, sim_run_realtime without an IMU
+
+// program flow
+typedef enum state_t
+{
+  UNINITIALIZED,
+  RUNNING,
+  PAUSED,
+  EXITING
+} state_t;
+
+// LEDs and buttons
+typedef enum led_t
+{
+  GREEN,
+  RED
+} led_t;
+
+#define OFF  0
+#define ON   1
+
+typedef enum button_state_t
+{
+  RELEASED,
+  PRESSED
+} button_state_t;
+
+// IMU
+typedef struct imu_data_t
+{
+  float accel[3];             // m/s^2
+  float gyro[3];              // deg/s
+  float mag[3];               // uT
+  float temp;
+  float dmp_quat[4];
+  float dmp_TaitBryan[3];
+
+} imu_data_t;
+
+typedef struct imu_config_t
+{
+  int enable_magnetometer;
+  int dmp_sample_rate;
+
+} imu_config_t;
+
+// Simulation setup
+typedef struct mip_sim_config_t
+{
+  mip_plant_params_t plant;
+  float cape_mount_angle;     // body angle when the IMU reads level
+  float initial_theta;
+  int   hold_until_armed;     // body held at initial_theta until motors enable
+  int   encoder_ticks;
+
+  // wiring, as seen by the program
+  int motor_channel_l;
+  int motor_channel_r;
+  int motor_polarity_l;
+  int motor_polarity_r;
+  int encoder_channel_l;
+  int encoder_channel_r;
+  int encoder_polarity_l;
+  int encoder_polarity_r;
+
+  // synthetic sensor errors
+  float gyro_noise;           // deg/s rms
+  float gyro_bias;            // deg/s
+  float accel_noise;          // m/s^2 rms
+  unsigned int seed;
+
+} mip_sim_config_t;
+
+// cape API subset
+int initialize_cape();
+int cleanup_cape();
+state_t get_state();
+int set_state(state_t new_state);
+int set_led(led_t led, int state);
+int set_pause_pressed_func(int (*func)(void));
+int set_pause_released_func(int (*func)(void));
+int set_mode_pressed_func(int (*func)(void));
+int set_mode_released_func(int (*func)(void));
+button_state_t get_pause_button();
+button_state_t get_mode_button();
+
+int enable_motors();
+int disable_motors();
+int set_motor(int motor, float duty);
+int set_motor_all(float duty);
+int get_encoder_pos(int ch);
+int set_encoder_pos(int ch, int value);
+
+imu_config_t get_default_imu_config();
+int initialize_imu_dmp(imu_data_t* data, imu_config_t conf);
+int set_imu_interrupt_func(int (*func)(void));
+int power_off_imu();
+
+int i2c_init(int bus, uint8_t devAddr);
+int i2c_close(int bus);
+int i2c_claim_bus(int bus);
+int i2c_release_bus(int bus);
+int i2c_read_byte(int bus, uint8_t regAddr, uint8_t* data);
+int i2c_read_bytes(int bus, uint8_t regAddr, uint8_t length, uint8_t* data);
+int i2c_write_byte(int bus, uint8_t regAddr, uint8_t data);
+
+// simulation control
+mip_sim_config_t sim_default_config();
+int sim_configure(mip_sim_config_t config);
+int sim_step();
+int sim_run_realtime(double seconds);
+double sim_get_time();
+mip_plant_t* sim_get_plant();
+
+#endif // MIP_SIM_H
@@ -0,0 +1,306 @@
+/*******************************************************************************
+ * mip_trace.c
+ *
+ * Lock-free stage trace ring and histogram dump.  See mip_trace.h.
+ *
+ * Producers claim a slot with one atomic increment and publish it by storing
+ * the slot's sequence number last.  The ring overwrites the oldest events
+ * when the dump thread falls behind, and the dump thread counts what it
+ * missed instead of ever making a producer wait.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "periodic_task.h"
+#include "mip_trace.h"
+
+#define TRACE_RING_MASK   (TRACE_RING_SIZE-1)
+
+// One ring slot
+typedef struct trace_event_t
+{
+  atomic_uint seq;              // index+1 once published
+  int stage;
+  int64_t t_ns;
+
+} trace_event_t;
+
+// Time between two stages, start==end means between consecutive stamps
+typedef struct trace_span_t
+{
+  const char* name;
+  trace_stage_t start;
+  trace_stage_t end;
+
+} trace_span_t;
+
+// Log-linear histogram
+typedef struct trace_hist_t
+{
+  uint64_t count;
+  uint64_t buckets[TRACE_BUCKETS];
+  int64_t  max_ns;
+  double   sum_ns;
+
+} trace_hist_t;
+
+static const trace_span_t trace_spans[] =
+{
+  {"imu estimator",   TRACE_IMU_ARRIVAL,    TRACE_ESTIMATOR_DONE},
+  {"inner filter",    TRACE_INNER_START,    TRACE_INNER_DONE},
+  {"set_motor",       TRACE_INNER_DONE,     TRACE_MOTOR_WRITTEN},
+  {"sensor to motor", TRACE_IMU_ARRIVAL,    TRACE_MOTOR_WRITTEN},
+  {"encoder reads",   TRACE_OUTER_START,    TRACE_ENCODERS_READ},
+  {"outer filter",    TRACE_ENCODERS_READ,  TRACE_OUTER_DONE},
+  {"imu period",      TRACE_IMU_ARRIVAL,    TRACE_IMU_ARRIVAL},
+  {"inner period",    TRACE_INNER_START,    TRACE_INNER_START},
+  {"outer period",    TRACE_OUTER_START,    TRACE_OUTER_START},
+};
+#define TRACE_SPANS  (int)(sizeof(trace_spans)/sizeof(trace_span_t))
+
+// variable declarations
+static trace_event_t trace_ring[TRACE_RING_SIZE];
+static atomic_uint   trace_head;
+static unsigned      trace_tail;
+static uint64_t      trace_lost;
+static int64_t       trace_last[TRACE_STAGES];
+static trace_hist_t  trace_hist[TRACE_SPANS];
+static pthread_t     trace_thread;
+static volatile int  trace_running;
+
+/*******************************************************************************
+ * void trace_stamp_at(trace_stage_t stage, int64_t t_ns)
+ *
+ * Record that stage was reached at time t_ns.  Wait-free.
+ ******************************************************************************/
+void trace_stamp_at(trace_stage_t stage, int64_t t_ns)
+{
+  unsigned idx = atomic_fetch_add_explicit(&trace_head, 1, memory_order_relaxed);
+  trace_event_t* ev = &trace_ring[idx & TRACE_RING_MASK];
+
+  atomic_store_explicit(&ev->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  ev->stage = stage;
+  ev->t_ns  = t_ns;
+  atomic_store_explicit(&ev->seq, idx+1, memory_order_release);
+}
+
+/*******************************************************************************
+ * void trace_stamp(trace_stage_t stage)
+ *
+ * Record that stage was reached now
+ ******************************************************************************/
+void trace_stamp(trace_stage_t stage)
+{
+  trace_stamp_at(stage, monotonic_ns());
+}
+
+/*******************************************************************************
+ * static int trace_bucket(int64_t v)
+ *
+ * Histogram bucket: exact below TRACE_SUB_BUCKETS ns, then TRACE_SUB_BUCKETS
+ * linear steps per power of two, so every bucket is within ~6% of its value
+ ******************************************************************************/
+static int trace_bucket(int64_t v)
+{
+  int e, idx;
+  if(v < TRACE_SUB_BUCKETS) return v < 0 ? 0 : (int)v;
+  e = 63 - __builtin_clzll((unsigned long long)v);
+  idx = (e-3)*TRACE_SUB_BUCKETS + (int)(v >> (e-4)) - TRACE_SUB_BUCKETS;
+  return idx < TRACE_BUCKETS ? idx : TRACE_BUCKETS-1;
+}
+
+/*******************************************************************************
+ * static int64_t trace_bucket_upper(int idx)
+ *
+ * Largest value that lands in bucket idx
+ ******************************************************************************/
+static int64_t trace_bucket_upper(int idx)
+{
+  int e, sub;
+  if(idx < TRACE_SUB_BUCKETS) return idx;
+  e = idx/TRACE_SUB_BUCKETS + 3;
+  sub = idx%TRACE_SUB_BUCKETS;
+  return ((int64_t)(TRACE_SUB_BUCKETS+sub+1) << (e-4)) - 1;
+}
+
+/*******************************************************************************
+ * static void trace_record(trace_stage_t stage, int64_t t_ns)
+ *
+ * Close every span ending at this stage, then remember when it happened
+ ******************************************************************************/
+static void trace_record(int stage, int64_t t_ns)
+{
+  int i;
+  int64_t d;
+  trace_hist_t* h;
+
+  if(stage < 0 || stage >= TRACE_STAGES) return;
+  for(i=0; i<TRACE_SPANS; i++)
+  {
+    if(trace_spans[i].end != stage) continue;
+    if(trace_last[trace_spans[i].start] == 0) continue;
+    d = t_ns - trace_last[trace_spans[i].start];
+    if(d < 0) continue;
+    h = &trace_hist[i];
+    h->buckets[trace_bucket(d)]++;
+    h->count++;
+    h->sum_ns += d;
+    if(d > h->max_ns) h->max_ns = d;
+  }
+  trace_last[stage] = t_ns;
+}
+
+/*******************************************************************************
+ * static void trace_drain()
+ *
+ * Move every published event into the histograms
+ ******************************************************************************/
+static void trace_drain()
+{
+  unsigned head = atomic_load_explicit(&trace_head, memory_order_acquire);
+  unsigned seq;
+  trace_event_t* ev;
+  int stage;
+  int64_t t_ns;
+
+  // producers lapped us, the oldest events are gone
+  if(head - trace_tail > TRACE_RING_SIZE)
+  {
+    trace_lost += head - trace_tail - TRACE_RING_SIZE;
+    trace_tail = head - TRACE_RING_SIZE;
+    memset(trace_last, 0, sizeof(trace_last));
+  }
+
+  while(trace_tail != head)
+  {
+    ev = &trace_ring[trace_tail & TRACE_RING_MASK];
+    seq = atomic_load_explicit(&ev->seq, memory_order_acquire);
+    if(seq != trace_tail+1)
+    {
+      if((int)(seq - (trace_tail+1)) > 0)
+      {
+        // overwritten before we got to it
+        trace_lost++;
+        trace_tail++;
+        memset(trace_last, 0, sizeof(trace_last));
+        continue;
+      }
+      break;    // claimed but not yet published
+    }
+    stage = ev->stage;
+    t_ns  = ev->t_ns;
+    atomic_thread_fence(memory_order_acquire);
+    if(atomic_load_explicit(&ev->seq, memory_order_relaxed) != trace_tail+1)
+    {
+      trace_lost++;
+      trace_tail++;
+      continue;
+    }
+    trace_record(stage, t_ns);
+    trace_tail++;
+  }
+}
+
+/*******************************************************************************
+ * static double trace_percentile(trace_hist_t* h, double p)
+ *
+ * Upper bound of the bucket holding the p-th percentile, in ns
+ ******************************************************************************/
+static double trace_percentile(trace_hist_t* h, double p)
+{
+  uint64_t target = (uint64_t)(p/100.0*h->count);
+  uint64_t seen = 0;
+  int i;
+  for(i=0; i<TRACE_BUCKETS; i++)
+  {
+    seen += h->buckets[i];
+    if(seen > target) break;
+  }
+  if(i == TRACE_BUCKETS) return h->max_ns;
+  return trace_bucket_upper(i) < h->max_ns ? trace_bucket_upper(i) : h->max_ns;
+}
+
+/*******************************************************************************
+ * static void* trace_dump_loop(void* ptr)
+ *
+ * Background drain at TRACE_DUMP_FREQUENCY
+ ******************************************************************************/
+static void* trace_dump_loop(void* ptr)
+{
+  while(trace_running)
+  {
+    trace_drain();
+    usleep(1000000/TRACE_DUMP_FREQUENCY);
+  }
+  return NULL;
+}
+
+/*******************************************************************************
+ * int trace_start()
+ *
+ * Start the background dump thread at the default (non real-time) priority
+ ******************************************************************************/
+int trace_start()
+{
+  trace_running = 1;
+  if(pthread_create(&trace_thread, NULL, trace_dump_loop, NULL))
+  {
+    trace_running = 0;
+    return -1;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * int trace_stop()
+ *
+ * Drain what is left, print percentiles and write the histograms to
+ * TRACE_FILENAME as span,upper_ns,count rows
+ ******************************************************************************/
+int trace_stop()
+{
+  int i, j;
+  trace_hist_t* h;
+  FILE* csv;
+
+  if(trace_running)
+  {
+    trace_running = 0;
+    pthread_join(trace_thread, NULL);
+  }
+  trace_drain();
+
+  printf("\n%-16s %10s %9s %9s %9s %9s %9s %9s\n", "stage (us)", "count",
+         "mean", "p50", "p90", "p99", "p99.9", "max");
+  for(i=0; i<TRACE_SPANS; i++)
+  {
+    h = &trace_hist[i];
+    if(h->count == 0) continue;
+    printf("%-16s %10llu %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+           trace_spans[i].name, (unsigned long long)h->count,
+           h->sum_ns/h->count/1e3, trace_percentile(h,50)/1e3,
+           trace_percentile(h,90)/1e3, trace_percentile(h,99)/1e3,
+           trace_percentile(h,99.9)/1e3, h->max_ns/1e3);
+  }
+  printf("trace events lost: %llu\n", (unsigned long long)trace_lost);
+
+  csv = fopen(TRACE_FILENAME,"w");
+  if(csv == NULL) return -1;
+  fprintf(csv,"span,upper_ns,count\n");
+  for(i=0; i<TRACE_SPANS; i++)
+  {
+    for(j=0; j<TRACE_BUCKETS; j++)
+    {
+      if(trace_hist[i].buckets[j] == 0) continue;
+      fprintf(csv,"%s,%lld,%llu\n", trace_spans[i].name,
+              (long long)trace_bucket_upper(j),
+              (unsigned long long)trace_hist[i].buckets[j]);
+    }
+  }
+  fclose(csv);
+  return 0;
+}
@@ -0,0 +1,60 @@
+/*******************************************************************************
+ * mip_trace.h
+ *
+ * Hot path latency tracing.  Control code marks pipeline stages with
+ * TRACE_STAMP(stage); each stamp is a CLOCK_MONOTONIC read and a few stores
+ * into a preallocated lock-free ring.  A low priority background thread
+ * drains the ring into log-linear (HDR style) histograms of the time between
+ * stages and reports percentiles and worst cases at exit.
+ *
+ * Tracing only exists when built with -DMIP_TRACE (make TRACE=1).  Otherwise
+ * the macros compile to nothing and mip_trace.c is not linked.
+ ******************************************************************************/
+
+#ifndef MIP_TRACE_H
+#define MIP_TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_RING_SIZE         8192    // events, power of two
+#define TRACE_DUMP_FREQUENCY    5       // Hz, ring drain rate
+#define TRACE_SUB_BUCKETS       16      // linear buckets per power of two
+#define TRACE_BUCKETS           (40*TRACE_SUB_BUCKETS)
+#define TRACE_FILENAME          "trace_histograms.csv"
+
+// Pipeline stages
+typedef enum trace_stage_t
+{
+  TRACE_IMU_ARRIVAL,
+  TRACE_ESTIMATOR_DONE,
+  TRACE_INNER_START,
+  TRACE_INNER_DONE,
+  TRACE_MOTOR_WRITTEN,
+  TRACE_OUTER_START,
+  TRACE_ENCODERS_READ,
+  TRACE_OUTER_DONE,
+  TRACE_STAGES
+} trace_stage_t;
+
+#ifdef MIP_TRACE
+
+int trace_start();
+int trace_stop();
+void trace_stamp(trace_stage_t stage);
+void trace_stamp_at(trace_stage_t stage, int64_t t_ns);
+
+#define TRACE_START()             trace_start()
+#define TRACE_STOP()              trace_stop()
+#define TRACE_STAMP(stage)        trace_stamp(stage)
+#define TRACE_STAMP_AT(stage, t)  trace_stamp_at(stage, t)
+
+#else
+
+#define TRACE_START()             ((void)0)
+#define TRACE_STOP()              ((void)0)
+#define TRACE_STAMP(stage)        ((void)0)
+#define TRACE_STAMP_AT(stage, t)  ((void)0)
+
+#endif // MIP_TRACE
+
+#endif // MIP_TRACE_H
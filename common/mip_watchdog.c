@@ -0,0 +1,101 @@
+/*******************************************************************************
+ * mip_watchdog.c
+ *
+ * Heartbeat watchdog.  See mip_watchdog.h.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "mip_watchdog.h"
+
+/*******************************************************************************
+ * int watchdog_init(mip_watchdog_t* wd, int (*on_trip)(watchdog_beat_t* beat))
+ ******************************************************************************/
+int watchdog_init(mip_watchdog_t* wd, int (*on_trip)(watchdog_beat_t* beat))
+{
+  memset(wd, 0, sizeof(mip_watchdog_t));
+  wd->on_trip = on_trip;
+  atomic_init(&wd->stale, 0);
+  return 0;
+}
+
+/*******************************************************************************
+ * watchdog_beat_t* watchdog_add(mip_watchdog_t* wd, const char* name,
+ *                               double frequency, double misses, double near)
+ *
+ * Watch a loop expected to beat at frequency, stale after misses periods
+ * without one, near miss after near.  Returns NULL if it can't.
+ ******************************************************************************/
+watchdog_beat_t* watchdog_add(mip_watchdog_t* wd, const char* name,\
+                              double frequency, double misses, double near)
+{
+  watchdog_beat_t* b;
+  if(wd->n == WATCHDOG_MAX_BEATS || frequency <= 0 || misses < 1\
+     || near <= 0 || near > misses)
+  {
+    printf("ERROR: can't watch %s at %g Hz, %g misses, near %g\n", name,\
+           frequency, misses, near);
+    return NULL;
+  }
+  b = &wd->beats[wd->n++];
+  b->name = name;
+  b->period_ns = 1e9/frequency;
+  b->timeout_ns = misses*b->period_ns;
+  b->near_ns = near*b->period_ns;
+  atomic_init(&b->last_ns, 0);
+  return b;
+}
+
+/*******************************************************************************
+ * int watchdog_check(mip_watchdog_t* wd, int64_t now)
+ *
+ * Look at every beat, calling on_trip for the stale ones.  Returns how many
+ * are stale.
+ ******************************************************************************/
+int watchdog_check(mip_watchdog_t* wd, int64_t now)
+{
+  watchdog_beat_t* b;
+  int64_t last;
+  int i, stale = 0;
+
+  wd->checks++;
+  for(i=0; i<wd->n; i++)
+  {
+    b = &wd->beats[i];
+    last = atomic_load_explicit(&b->last_ns, memory_order_acquire);
+    if(last == 0 || now - last <= b->timeout_ns)
+    {
+      b->stale = 0;
+      continue;
+    }
+    if(!b->stale) b->trips++;
+    if(now - last > b->stale_max_ns) b->stale_max_ns = now - last;
+    b->stale = 1;
+    stale++;
+    if(wd->on_trip != NULL) wd->on_trip(b);
+  }
+  atomic_store_explicit(&wd->stale, stale, memory_order_relaxed);
+  return stale;
+}
+
+/*******************************************************************************
+ * int print_watchdog_stats(mip_watchdog_t* wd)
+ ******************************************************************************/
+int print_watchdog_stats(mip_watchdog_t* wd)
+{
+  watchdog_beat_t* b;
+  int64_t gap;
+  int i;
+  printf("watchdog: %llu checks\n", (unsigned long long)wd->checks);
+  for(i=0; i<wd->n; i++)
+  {
+    b = &wd->beats[i];
+    gap = b->gap_max_ns > b->stale_max_ns ? b->gap_max_ns : b->stale_max_ns;
+    printf("  %-12s %6.1f Hz: %llu beats, longest gap %.2f ms, %llu near "\
+           "misses (> %.2f ms), %llu trips (> %.2f ms)\n", b->name,\
+           1e9/b->period_ns, (unsigned long long)b->beats, gap/1e6,\
+           (unsigned long long)b->near_misses, b->near_ns/1e6,\
+           (unsigned long long)b->trips, b->timeout_ns/1e6);
+  }
+  return 0;
+}
@@ -0,0 +1,91 @@
+/*******************************************************************************
+ * mip_watchdog.h
+ *
+ * Heartbeat watchdog for the control loops.  Each watched loop calls
+ * watchdog_beat once per run; a checker, its own high priority thread on the
+ * robot, calls watchdog_check and fires on_trip for every beat whose last
+ * run is more than misses periods old, on every check until it comes back.
+ * A trip is seen at most one check period after the timeout.
+ *
+ * A beat is a load, a compare and two stores into counters only its own loop
+ * writes, published with one release store, so the hot path never takes a
+ * lock or waits for the checker.  Gaps longer than near periods that didn't
+ * trip are counted as near misses, to show how close the loops come.  A loop
+ * that never beats again has no gap of its own, so the checker keeps the age
+ * of a stale beat as well and the longest gap reported is the larger.
+ * Times are whatever clock the caller passes, the same one for both sides.
+ ******************************************************************************/
+
+#ifndef MIP_WATCHDOG_H
+#define MIP_WATCHDOG_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define WATCHDOG_MAX_BEATS  4
+
+typedef struct watchdog_beat_t
+{
+  const char* name;
+  int64_t period_ns;        // expected time between beats
+  int64_t timeout_ns;       // stale once the last beat is older than this
+  int64_t near_ns;          // gaps longer than this are near misses
+
+  // written by the watched loop only
+  _Atomic int64_t last_ns;  // 0 until the first beat, not checked before
+  uint64_t beats;
+  uint64_t near_misses;
+  int64_t  gap_max_ns;
+
+  // written by the checker only
+  int stale;
+  uint64_t trips;
+  int64_t  stale_max_ns;    // oldest last beat seen while stale
+
+} watchdog_beat_t;
+
+typedef struct mip_watchdog_t
+{
+  watchdog_beat_t beats[WATCHDOG_MAX_BEATS];
+  int n;
+  int (*on_trip)(watchdog_beat_t* beat);
+  atomic_int stale;         // beats stale at the last check
+  uint64_t checks;
+
+} mip_watchdog_t;
+
+int watchdog_init(mip_watchdog_t* wd, int (*on_trip)(watchdog_beat_t* beat));
+watchdog_beat_t* watchdog_add(mip_watchdog_t* wd, const char* name,\
+                              double frequency, double misses, double near);
+int watchdog_check(mip_watchdog_t* wd, int64_t now);
+int print_watchdog_stats(mip_watchdog_t* wd);
+
+/*******************************************************************************
+ * void watchdog_beat(watchdog_beat_t* b, int64_t now)
+ *
+ * The watched loop ran at now.  Only that loop may beat b.
+ ******************************************************************************/
+static inline void watchdog_beat(watchdog_beat_t* b, int64_t now)
+{
+  int64_t last = atomic_load_explicit(&b->last_ns, memory_order_relaxed);
+  int64_t gap = now - last;
+  if(last != 0)
+  {
+    if(gap > b->gap_max_ns) b->gap_max_ns = gap;
+    if(gap > b->near_ns && gap <= b->timeout_ns) b->near_misses++;
+  }
+  b->beats++;
+  atomic_store_explicit(&b->last_ns, now, memory_order_release);
+}
+
+/*******************************************************************************
+ * int watchdog_ok(mip_watchdog_t* wd)
+ *
+ * 1 if every beat was fresh at the last check
+ ******************************************************************************/
+static inline int watchdog_ok(mip_watchdog_t* wd)
+{
+  return atomic_load_explicit(&wd->stale, memory_order_relaxed) == 0;
+}
+
+#endif // MIP_WATCHDOG_H
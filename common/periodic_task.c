@@ -0,0 +1,276 @@
+/*******************************************************************************
+ * periodic_task.c
+ *
+ * Absolute-deadline periodic threads.  See periodic_task.h.
+ ******************************************************************************/
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include "mip_hal.h"
+#include "periodic_task.h"
+#include "mip_rt.h"
+
+/*******************************************************************************
+ * int64_t timespec_to_ns(struct timespec* t)
+ ******************************************************************************/
+int64_t timespec_to_ns(struct timespec* t)
+{
+  return (int64_t)t->tv_sec*NSEC_PER_SEC + t->tv_nsec;
+}
+
+/*******************************************************************************
+ * int64_t monotonic_ns()
+ *
+ * Current CLOCK_MONOTONIC time in nanoseconds
+ ******************************************************************************/
+int64_t monotonic_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return timespec_to_ns(&now);
+}
+
+/*******************************************************************************
+ * int64_t timespec_diff_ns(struct timespec* end, struct timespec* start)
+ ******************************************************************************/
+int64_t timespec_diff_ns(struct timespec* end, struct timespec* start)
+{
+  return timespec_to_ns(end) - timespec_to_ns(start);
+}
+
+/*******************************************************************************
+ * void timespec_add_ns(struct timespec* t, int64_t ns)
+ ******************************************************************************/
+void timespec_add_ns(struct timespec* t, int64_t ns)
+{
+  int64_t total = timespec_to_ns(t) + ns;
+  t->tv_sec  = total/NSEC_PER_SEC;
+  t->tv_nsec = total%NSEC_PER_SEC;
+}
+
+/*******************************************************************************
+ * static void* periodic_task_loop(void* ptr)
+ *
+ * Sleep until the next absolute release, run the step, account for timing
+ ******************************************************************************/
+static void* periodic_task_loop(void* ptr)
+{
+  periodic_task_t* task = (periodic_task_t*)ptr;
+  periodic_stats_t* s = &task->stats;
+  struct timespec wake, done, last_wake;
+  int64_t late, period, exec, behind, missed;
+
+  rt_name_thread(task->name);
+  rt_prefault_stack(PERIODIC_STACK_PREFAULT);
+  clock_gettime(CLOCK_MONOTONIC, &task->next);
+  last_wake = task->next;
+
+  while(task->running && get_state()!=EXITING)
+  {
+    // a state change wakes the thread early, the release stays where it is
+    if(state_bus_wait(&task->sub, &task->next))
+    {
+      if(task->on_state != NULL && get_state()!=EXITING) task->on_state();
+      continue;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &wake);
+
+    // release jitter and measured period
+    late = timespec_diff_ns(&wake, &task->next);
+    if(late > s->jitter_max) s->jitter_max = late;
+    s->jitter_sum += late;
+    s->jitter_sq_sum += (double)late*late;
+    if(s->cycles > 0)
+    {
+      period = timespec_diff_ns(&wake, &last_wake);
+      if(s->cycles == 1 || period < s->period_min) s->period_min = period;
+      if(period > s->period_max) s->period_max = period;
+    }
+    last_wake = wake;
+
+    task->step();
+
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    exec = timespec_diff_ns(&done, &wake);
+    if(exec > s->exec_max) s->exec_max = exec;
+    s->exec_sum += exec;
+    s->cycles++;
+
+    // next release stays on the absolute grid
+    timespec_add_ns(&task->next, task->period_ns);
+    behind = timespec_diff_ns(&done, &task->next);
+    if(behind > 0)
+    {
+      s->overruns++;
+      if(task->policy == OVERRUN_SKIP)
+      {
+        missed = behind/task->period_ns + 1;
+        timespec_add_ns(&task->next, missed*task->period_ns);
+        s->skipped += missed;
+      }
+    }
+  }
+  return NULL;
+}
+
+/*******************************************************************************
+ * int periodic_task_init(periodic_task_t* task, const char* name,
+ *      int (*step)(void), double frequency, int priority,
+ *      overrun_policy_t policy)
+ *
+ * Set up a task that calls step at frequency Hz
+ ******************************************************************************/
+int periodic_task_init(periodic_task_t* task, const char* name, int (*step)(void),
+                       double frequency, int priority, overrun_policy_t policy)
+{
+  if(frequency <= 0 || step == NULL) return -1;
+  memset(task, 0, sizeof(periodic_task_t));
+  task->name = name;
+  task->step = step;
+  task->period_ns = (int64_t)(NSEC_PER_SEC/frequency + 0.5);
+  task->priority = priority;
+  task->cpu = -1;
+  task->policy = policy;
+  return 0;
+}
+
+/*******************************************************************************
+ * int periodic_task_start(periodic_task_t* task)
+ *
+ * Start the task thread under SCHED_FIFO, on its CPU.  Without the privilege
+ * to do so, or without that CPU, warn and fall back to the default scheduler
+ * or to any CPU rather than not running.
+ ******************************************************************************/
+int periodic_task_start(periodic_task_t* task)
+{
+  pthread_attr_t attr;
+  struct sched_param param;
+  int ret;
+
+  if(state_bus_subscribe(&task->sub, task->name)) return -1;
+  task->running = 1;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, PERIODIC_STACK_SIZE);
+  if(rt_set_cpu(&attr, task->cpu))
+  {
+    printf("%s: could not pin to CPU %d, using any\n", task->name, task->cpu);
+  }
+  if(task->priority > 0)
+  {
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    param.sched_priority = task->priority;
+    pthread_attr_setschedparam(&attr, &param);
+    ret = pthread_create(&task->thread, &attr, periodic_task_loop, task);
+    if(ret == 0)
+    {
+      pthread_attr_destroy(&attr);
+      return 0;
+    }
+    printf("%s: could not set SCHED_FIFO priority %d, using default\n",\
+           task->name, task->priority);
+    pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+  }
+  ret = pthread_create(&task->thread, &attr, periodic_task_loop, task);
+  pthread_attr_destroy(&attr);
+  if(ret != 0)
+  {
+    task->running = 0;
+    return -1;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * int periodic_task_stop(periodic_task_t* task)
+ *
+ * Ask the task to finish its current cycle and wait for it
+ ******************************************************************************/
+int periodic_task_stop(periodic_task_t* task)
+{
+  if(!task->running) return 0;
+  task->running = 0;
+  pthread_join(task->thread, NULL);
+  state_bus_unsubscribe(&task->sub);
+  return 0;
+}
+
+/*******************************************************************************
+ * int print_periodic_stats(periodic_task_t* task)
+ *
+ * One line summary of a task's timing, times in microseconds
+ ******************************************************************************/
+int print_periodic_stats(periodic_task_t* task)
+{
+  periodic_stats_t* s = &task->stats;
+  double n = s->cycles > 0 ? s->cycles : 1;
+  double jitter_mean = s->jitter_sum/n;
+  double jitter_rms = sqrt(s->jitter_sq_sum/n);
+
+  printf("%-12s period %7.1f us [%7.1f, %7.1f]  jitter mean %6.1f rms %6.1f "\
+         "max %7.1f us  exec mean %6.1f max %7.1f us  cycles %llu "\
+         "overruns %llu skipped %llu\n",
+         task->name, task->period_ns/1e3, s->period_min/1e3, s->period_max/1e3,
+         jitter_mean/1e3, jitter_rms/1e3, s->jitter_max/1e3,
+         s->exec_sum/n/1e3, s->exec_max/1e3, (unsigned long long)s->cycles,
+         (unsigned long long)s->overruns, (unsigned long long)s->skipped);
+  return 0;
+}
+
+/*******************************************************************************
+ * int periodic_subtask_init(periodic_subtask_t* sub, const char* name,
+ *                           int (*step)(void), int divider, int phase)
+ ******************************************************************************/
+int periodic_subtask_init(periodic_subtask_t* sub, const char* name,\
+                          int (*step)(void), int divider, int phase)
+{
+  if(divider < 1 || phase < 0 || phase >= divider)
+  {
+    printf("ERROR: %s: bad divider %d phase %d\n", name, divider, phase);
+    return -1;
+  }
+  memset(sub, 0, sizeof(periodic_subtask_t));
+  sub->name = name;
+  sub->step = step;
+  sub->divider = divider;
+  sub->phase = phase;
+  return 0;
+}
+
+/*******************************************************************************
+ * int periodic_subtask_tick(periodic_subtask_t* sub)
+ *
+ * Call once per release of the parent, from its step.  Runs the subtask's
+ * step when its phase comes round and returns 1 if it did.
+ ******************************************************************************/
+int periodic_subtask_tick(periodic_subtask_t* sub)
+{
+  int64_t start, exec;
+  int due = sub->count == sub->phase;
+
+  if(++sub->count == sub->divider) sub->count = 0;
+  if(!due) return 0;
+
+  start = monotonic_ns();
+  sub->step();
+  exec = monotonic_ns() - start;
+  if(exec > sub->exec_max) sub->exec_max = exec;
+  sub->exec_sum += exec;
+  sub->cycles++;
+  return 1;
+}
+
+/*******************************************************************************
+ * int print_subtask_stats(periodic_subtask_t* sub, double parent_frequency)
+ ******************************************************************************/
+int print_subtask_stats(periodic_subtask_t* sub, double parent_frequency)
+{
+  double n = sub->cycles > 0 ? sub->cycles : 1;
+  printf("%-12s period %7.1f us (1 in %d, phase %d)  exec mean %6.1f max "\
+         "%7.1f us  cycles %llu\n", sub->name,\
+         1e6*sub->divider/parent_frequency, sub->divider, sub->phase,\
+         sub->exec_sum/n/1e3, sub->exec_max/1e3,\
+         (unsigned long long)sub->cycles);
+  return 0;
+}
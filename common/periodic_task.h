@@ -0,0 +1,105 @@
+/*******************************************************************************
+ * periodic_task.h
+ *
+ * Periodic real-time threads paced by absolute CLOCK_MONOTONIC deadlines.
+ * Each release is scheduled at start + k*period with clock_nanosleep
+ * TIMER_ABSTIME, so the work time and wakeup latency of one cycle never push
+ * the next one later.  Tasks run under SCHED_FIFO at a configurable priority
+ * and keep period, jitter and execution time statistics.  Between releases
+ * a task thread sleeps on the state bus (state_bus.h), so it leaves at once
+ * on EXITING and can act on a pause through on_state without waiting for
+ * its next release.  Each thread can be pinned to a CPU, gets a stack of
+ * PERIODIC_STACK_SIZE instead of the 8 MB default that mlockall would lock
+ * whole, and faults in PERIODIC_STACK_PREFAULT of it before its first
+ * release (mip_rt.h).
+ ******************************************************************************/
+
+#ifndef PERIODIC_TASK_H
+#define PERIODIC_TASK_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "state_bus.h"
+
+#define NSEC_PER_SEC  1000000000LL
+
+#define PERIODIC_STACK_SIZE      (256*1024)
+#define PERIODIC_STACK_PREFAULT  (64*1024)
+
+// What to do when a cycle finishes after its next release time
+typedef enum overrun_policy_t
+{
+  OVERRUN_CATCH_UP,     // run the missed releases back to back
+  OVERRUN_SKIP          // drop missed releases, stay on the original grid
+} overrun_policy_t;
+
+// Per-task timing statistics, all in nanoseconds
+typedef struct periodic_stats_t
+{
+  uint64_t cycles;
+  uint64_t overruns;    // cycles that ended after the next release
+  uint64_t skipped;     // releases dropped by OVERRUN_SKIP
+
+  int64_t  period_min;  // between consecutive wakeups
+  int64_t  period_max;
+  int64_t  jitter_max;  // wakeup time minus release time
+  double   jitter_sum;
+  double   jitter_sq_sum;
+  int64_t  exec_max;    // time spent in the step function
+  double   exec_sum;
+
+} periodic_stats_t;
+
+typedef struct periodic_task_t
+{
+  const char* name;
+  int (*step)(void);
+  int64_t period_ns;
+  int priority;         // SCHED_FIFO priority, 0 for the default scheduler
+  int cpu;              // CPU to pin the thread to, -1 for any
+  overrun_policy_t policy;
+
+  int (*on_state)(void); // NULL, or run on a state change between releases
+
+  pthread_t thread;
+  volatile int running;
+  struct timespec next;
+  state_sub_t sub;
+  periodic_stats_t stats;
+
+} periodic_task_t;
+
+// A step run from inside another task on every divider-th release, at a
+// fixed phase, so it shares that task's thread and its timing exactly
+typedef struct periodic_subtask_t
+{
+  const char* name;
+  int (*step)(void);
+  int divider;          // parent releases per run
+  int phase;            // which of them runs it, 0 to divider-1
+  int count;            // parent releases so far, mod divider
+
+  uint64_t cycles;
+  int64_t  exec_max;
+  double   exec_sum;
+
+} periodic_subtask_t;
+
+int periodic_task_init(periodic_task_t* task, const char* name, int (*step)(void),
+                       double frequency, int priority, overrun_policy_t policy);
+int periodic_task_start(periodic_task_t* task);
+int periodic_task_stop(periodic_task_t* task);
+int print_periodic_stats(periodic_task_t* task);
+int periodic_subtask_init(periodic_subtask_t* sub, const char* name,\
+                          int (*step)(void), int divider, int phase);
+int periodic_subtask_tick(periodic_subtask_t* sub);
+int print_subtask_stats(periodic_subtask_t* sub, double parent_frequency);
+
+// timespec helpers
+int64_t monotonic_ns();
+int64_t timespec_to_ns(struct timespec* t);
+int64_t timespec_diff_ns(struct timespec* end, struct timespec* start);
+void timespec_add_ns(struct timespec* t, int64_t ns);
+
+#endif // PERIODIC_TASK_H
@@ -0,0 +1,242 @@
+/*******************************************************************************
+ * q31_filter.c
+ *
+ * Fixed point filters and CORDIC atan2.  See q31_filter.h.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "q31_filter.h"
+
+#if Q31_SIGNAL_FRAC != 28
+#error "q31_atan_table is in Q28, regenerate it for another Q31_SIGNAL_FRAC"
+#endif
+
+#define Q31_PI_2          421657428     // pi/2 in Q28
+#define Q31_ATAN2_LIMIT   (1 << 29)     // keeps CORDIC growth inside int32
+
+// atan(2^-i) in Q28, fixed constants so no libm rounding leaks in
+static const q31_t q31_atan_table[Q31_CORDIC_ITERATIONS] =
+{
+  210828714, 124459457, 65760959, 33381290, 16755422, 8385879, 4193963,
+  2097109, 1048571, 524287, 262144, 131072, 65536, 32768, 16384, 8192,
+  4096, 2048, 1024, 512, 256, 128, 64, 32, 16, 8, 4, 2
+};
+
+/*******************************************************************************
+ * q31_filter_t create_q31_filter(int order, float dt, float* num, float* den,
+ *                                float gain, float sat)
+ *
+ * Same arguments as create_daniel_filter, up to Q31_FILTER_MAX_ORDER.
+ * Returns a filter with initialized = 0 if it can't be represented.
+ ******************************************************************************/
+q31_filter_t create_q31_filter(int order, float dt, float* num, float* den,\
+                               float gain, float sat)
+{
+  q31_filter_t filter;
+  double b[Q31_FILTER_MAX_ORDER+1], a[Q31_FILTER_MAX_ORDER+1];
+  double largest = 0;
+  int i, int_bits = 0, guard = Q31_COEF_GUARD;
+
+  memset(&filter, 0, sizeof(q31_filter_t));
+  filter.order = order;
+  filter.dt = dt;
+  filter.gain = gain;
+  if(order < 0 || order > Q31_FILTER_MAX_ORDER || den[0] == 0)
+  {
+    printf("ERROR: bad q31 filter, order %d a0 %f\n", order, den[0]);
+    return filter;
+  }
+
+  for(i=0; i<=order; i++)
+  {
+    b[i] = (double)gain*num[i]/den[0];
+    a[i] = (double)den[i]/den[0];
+    if(fabs(b[i]) > largest) largest = fabs(b[i]);
+    if(i > 0 && fabs(a[i]) > largest) largest = fabs(a[i]);
+  }
+
+  // as many fractional bits as the largest coefficient leaves room for,
+  // with enough guard bits for all 2*order+1 products to add up in int64
+  while(int_bits < 24 && largest >= (double)(1 << int_bits)) int_bits++;
+  while((1 << guard) < 2*order+1) guard++;
+  filter.coef_frac = 31 - guard - int_bits;
+  if(filter.coef_frac < 8)
+  {
+    printf("ERROR: q31 filter coefficient %f too large\n", largest);
+    return filter;
+  }
+  for(i=0; i<=order; i++)
+  {
+    filter.num[i] = (q31_t)llround(ldexp(b[i], filter.coef_frac));
+    filter.den[i] = (q31_t)llround(ldexp(a[i], filter.coef_frac));
+  }
+  filter.den[0] = 0;
+  filter.sat = sat > 0 ? q31_from_float(sat) : 0;
+  filter.initialized = 1;
+  return filter;
+}
+
+/*******************************************************************************
+ * q31_t step_q31_filter(q31_filter_t* filter, q31_t new_input)
+ *
+ * Move forward one step: 64 bit multiply-accumulate, one rounding shift,
+ * saturate
+ ******************************************************************************/
+q31_t step_q31_filter(q31_filter_t* filter, q31_t new_input)
+{
+  int64_t acc;
+  q31_t y;
+  int i;
+  int n = filter->order;
+
+  for(i=n; i>0; i--)
+  {
+    filter->inputs[i] = filter->inputs[i-1];
+    filter->outputs[i] = filter->outputs[i-1];
+  }
+  filter->inputs[0] = new_input;
+
+  acc = (int64_t)filter->num[0]*new_input;
+  for(i=1; i<=n; i++)
+  {
+    acc += (int64_t)filter->num[i]*filter->inputs[i];
+    acc -= (int64_t)filter->den[i]*filter->outputs[i];
+  }
+  y = q31_sat((acc + ((int64_t)1 << (filter->coef_frac-1))) >> filter->coef_frac);
+
+  if(filter->sat > 0)
+  {
+    if(y > filter->sat) y = filter->sat;
+    else if(y < -filter->sat) y = -filter->sat;
+  }
+  filter->outputs[0] = y;
+  filter->step++;
+  return y;
+}
+
+/*******************************************************************************
+ * float step_q31_filter_float(q31_filter_t* filter, float new_input)
+ *
+ * step_q31_filter for callers that keep their signals in float
+ ******************************************************************************/
+float step_q31_filter_float(q31_filter_t* filter, float new_input)
+{
+  return q31_to_float(step_q31_filter(filter, q31_from_float(new_input)));
+}
+
+/*******************************************************************************
+ * int zero_q31_filter(q31_filter_t* filter)
+ ******************************************************************************/
+int zero_q31_filter(q31_filter_t* filter)
+{
+  if(!filter->initialized) return -1;
+  memset(filter->inputs, 0, sizeof(filter->inputs));
+  memset(filter->outputs, 0, sizeof(filter->outputs));
+  return 0;
+}
+
+/*******************************************************************************
+ * int set_q31_filter_history(q31_filter_t* filter, const float* inputs,
+ *                            const float* outputs, int n)
+ *
+ * Load past inputs and outputs, newest first, n of each, missing ones zero
+ ******************************************************************************/
+int set_q31_filter_history(q31_filter_t* filter, const float* inputs,\
+                           const float* outputs, int n)
+{
+  int i;
+  if(zero_q31_filter(filter)) return -1;
+  for(i=0; i<filter->order && i<n; i++)
+  {
+    filter->inputs[i] = q31_from_float(inputs[i]);
+    filter->outputs[i] = q31_from_float(outputs[i]);
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * int destroy_q31_filter(q31_filter_t* filter)
+ *
+ * Nothing is allocated, kept so q31 filters drop in for the other engines
+ ******************************************************************************/
+int destroy_q31_filter(q31_filter_t* filter)
+{
+  if(!filter->initialized) return -1;
+  memset(filter, 0, sizeof(q31_filter_t));
+  return 0;
+}
+
+/*******************************************************************************
+ * int remove_differentiator(int order, const float* num, float* reduced)
+ *
+ * Divide (1 - z^-1) out of num, leaving order coefficients in reduced.  A
+ * high pass on an ever growing signal like the integrated gyro angle can
+ * then run on its per-sample increments instead, which stay in range.
+ * Returns -1 if num has no zero at z = 1.
+ ******************************************************************************/
+int remove_differentiator(int order, const float* num, float* reduced)
+{
+  double q = 0, scale = 0;
+  int i;
+
+  if(order < 1) return -1;
+  for(i=0; i<=order; i++) if(fabs(num[i]) > scale) scale = fabs(num[i]);
+  for(i=0; i<order; i++)
+  {
+    q = num[i] + q;
+    reduced[i] = q;
+  }
+  if(fabs(num[order] + q) > 1e-6*scale) return -1;
+  return 0;
+}
+
+/*******************************************************************************
+ * q31_t q31_atan2(int32_t y, int32_t x)
+ *
+ * CORDIC vectoring, angle in Q31_SIGNAL_FRAC radians.  x and y share any
+ * scale but must stay below Q31_ATAN2_LIMIT in magnitude.
+ ******************************************************************************/
+q31_t q31_atan2(int32_t y, int32_t x)
+{
+  int32_t t, m;
+  q31_t z = 0;
+  int i;
+
+  if(x == 0 && y == 0) return 0;
+
+  // rotate into the right half plane first
+  if(x < 0)
+  {
+    if(y >= 0) { t = x; x = y;  y = -t; z = Q31_PI_2; }
+    else       { t = x; x = -y; y = t;  z = -Q31_PI_2; }
+  }
+
+  // rotate toward y = 0, the direction as a sign mask instead of a branch
+  // since it flips unpredictably every iteration
+  for(i=0; i<Q31_CORDIC_ITERATIONS; i++)
+  {
+    m = y >> 31;
+    t = x + (((y >> i) ^ m) - m);
+    y = y - (((x >> i) ^ m) - m);
+    z += (q31_atan_table[i] ^ m) - m;
+    x = t;
+  }
+  return z;
+}
+
+/*******************************************************************************
+ * q31_t q31_atan2_float(float y, float x)
+ *
+ * q31_atan2 on raw float sensor values such as accelerometer readings
+ ******************************************************************************/
+q31_t q31_atan2_float(float y, float x)
+{
+  float s = (float)(1 << Q31_ATAN2_INPUT_FRAC);
+  float limit = (float)(Q31_ATAN2_LIMIT - 128);
+  float ys = y*s, xs = x*s;
+  if(ys > limit) ys = limit; else if(ys < -limit) ys = -limit;
+  if(xs > limit) xs = limit; else if(xs < -limit) xs = -limit;
+  return q31_atan2((int32_t)ys, (int32_t)xs);
+}
@@ -0,0 +1,95 @@
+/*******************************************************************************
+ * q31_filter.h
+ *
+ * Fixed point filters for the controller path.  Integer only, so a given
+ * input sequence produces bit-identical outputs on the BeagleBone, on an x86
+ * host and in the simulator, and the cost per step doesn't depend on the FPU.
+ *
+ * Signals are signed 32 bit with Q31_SIGNAL_FRAC fractional bits, so
+ * ±2^(31-Q31_SIGNAL_FRAC) full scale (±8, plenty for angles in radians and
+ * duty cycles).  Each filter stores its coefficients with Q31_COEF_GUARD
+ * guard bits, one more above third order, plus however many integer bits
+ * its largest coefficient needs, and accumulates in 64 bits before one
+ * rounding shift per step.  Every result saturates instead of wrapping.
+ *
+ * q31_atan2 is a CORDIC replacement for the atan2 in imu_callback so the
+ * whole estimator, not just the filters, stays integer.
+ ******************************************************************************/
+
+#ifndef Q31_FILTER_H
+#define Q31_FILTER_H
+
+#include <stdint.h>
+
+#define Q31_SIGNAL_FRAC       28      // signal LSB 2^-28, ~3.7e-9
+#define Q31_COEF_GUARD        2       // keeps 8 products inside int64
+#define Q31_FILTER_MAX_ORDER  4       // 9 products, one more guard bit
+#define Q31_CORDIC_ITERATIONS 28
+#define Q31_ATAN2_INPUT_FRAC  20      // q31_atan2_float input scaling
+
+typedef int32_t q31_t;
+
+typedef struct q31_filter_t
+{
+  q31_t num[Q31_FILTER_MAX_ORDER+1];  // gain*b/a0 in Q(coef_frac)
+  q31_t den[Q31_FILTER_MAX_ORDER+1];  // a/a0 in Q(coef_frac), den[0] unused
+  q31_t inputs[Q31_FILTER_MAX_ORDER+1];
+  q31_t outputs[Q31_FILTER_MAX_ORDER+1];
+  q31_t sat;            // output saturation, 0 for none
+  int coef_frac;
+  int order;
+  uint64_t step;
+
+  // basic stuff
+  float dt;
+  float gain;
+  int initialized;
+
+} q31_filter_t;
+
+/*******************************************************************************
+ * q31_t q31_from_float(float x) / float q31_to_float(q31_t x)
+ *
+ * Convert signals, saturating at full scale
+ ******************************************************************************/
+static inline q31_t q31_from_float(float x)
+{
+  float s = x * (float)(1 << Q31_SIGNAL_FRAC);
+  if(s >= 2147483520.0f) return INT32_MAX;    // largest float below 2^31
+  if(s <= -2147483648.0f) return INT32_MIN;
+  return (q31_t)(s >= 0 ? s + 0.5f : s - 0.5f);
+}
+
+static inline float q31_to_float(q31_t x)
+{
+  return (float)x * (1.0f/(float)(1 << Q31_SIGNAL_FRAC));
+}
+
+/*******************************************************************************
+ * q31_t q31_sat(int64_t x) / q31_t q31_add(q31_t a, q31_t b)
+ ******************************************************************************/
+static inline q31_t q31_sat(int64_t x)
+{
+  if(x > INT32_MAX) return INT32_MAX;
+  if(x < INT32_MIN) return INT32_MIN;
+  return (q31_t)x;
+}
+
+static inline q31_t q31_add(q31_t a, q31_t b)
+{
+  return q31_sat((int64_t)a + b);
+}
+
+q31_filter_t create_q31_filter(int order, float dt, float* num, float* den,\
+                               float gain, float sat);
+q31_t step_q31_filter(q31_filter_t* filter, q31_t new_input);
+float step_q31_filter_float(q31_filter_t* filter, float new_input);
+int zero_q31_filter(q31_filter_t* filter);
+int set_q31_filter_history(q31_filter_t* filter, const float* inputs,\
+                           const float* outputs, int n);
+int destroy_q31_filter(q31_filter_t* filter);
+int remove_differentiator(int order, const float* num, float* reduced);
+q31_t q31_atan2(int32_t y, int32_t x);
+q31_t q31_atan2_float(float y, float x);
+
+#endif // Q31_FILTER_H
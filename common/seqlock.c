@@ -0,0 +1,42 @@
+/*******************************************************************************
+ * seqlock.c
+ *
+ * Setup and reporting for seqlock.h
+ ******************************************************************************/
+
+#include <stdio.h>
+#include "seqlock.h"
+
+/*******************************************************************************
+ * int seqlock_init(seqlock_t* lock, int writers)
+ *
+ * Reset a seqlock shared by the given number of writers
+ ******************************************************************************/
+int seqlock_init(seqlock_t* lock, int writers)
+{
+  int i;
+  if(writers < 1 || writers > SEQLOCK_MAX_WRITERS) return -1;
+  for(i=0; i<SEQLOCK_MAX_WRITERS; i++) atomic_init(&lock->seq[i], 0);
+  lock->writers = writers;
+  atomic_init(&lock->writes, 0);
+  atomic_init(&lock->reads, 0);
+  atomic_init(&lock->retries, 0);
+  atomic_init(&lock->stale, 0);
+  return 0;
+}
+
+/*******************************************************************************
+ * int print_seqlock_stats(const char* name, seqlock_t* lock)
+ *
+ * Writes, reads, how often a reader had to retry and how often it gave up
+ ******************************************************************************/
+int print_seqlock_stats(const char* name, seqlock_t* lock)
+{
+  unsigned long reads   = atomic_load(&lock->reads);
+  unsigned long retries = atomic_load(&lock->retries);
+
+  printf("%-12s writes %lu  reads %lu  retries %lu (%.4f%%)  stale %lu\n",
+         name, atomic_load(&lock->writes), reads, retries,
+         reads ? 100.0*retries/reads : 0.0, atomic_load(&lock->stale));
+  return 0;
+}
@@ -0,0 +1,121 @@
+/*******************************************************************************
+ * seqlock.h
+ *
+ * Lock-free publication of small structs shared between the IMU callback and
+ * the control threads.  Every writer owns a sequence counter and the fields it
+ * writes; it bumps its counter to odd, stores, and bumps it back to even, so a
+ * writer never waits on anybody.  Readers copy the whole struct and retry if
+ * any writer was active or finished a write during the copy, which gives a
+ * consistent snapshot across all writers' fields.
+ *
+ * Giving each writer its own counter instead of sharing one matters under
+ * SCHED_FIFO on a single core: a high priority writer spinning for a shared
+ * counter held by a preempted low priority writer would never get it back.
+ * The same goes for readers.  A reader that preempts a writer between begin
+ * and end sees an odd counter until it gives the core back, so spinning on it
+ * would never end.  Readers therefore give up after SEQLOCK_MAX_RETRIES and
+ * leave their destination untouched.  A reader that keeps its snapshot from
+ * one call to the next gets its last consistent copy in that case, one
+ * period old.  Those reads are counted as stale.
+ ******************************************************************************/
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#define SEQLOCK_MAX_WRITERS  5
+#define SEQLOCK_MAX_RETRIES  64   // then a reader keeps its last snapshot
+
+typedef struct seqlock_t
+{
+  atomic_uint seq[SEQLOCK_MAX_WRITERS];
+  int writers;
+
+  // contention counters, relaxed
+  atomic_ulong writes;
+  atomic_ulong reads;
+  atomic_ulong retries;
+  atomic_ulong stale;
+
+} seqlock_t;
+
+int seqlock_init(seqlock_t* lock, int writers);
+int print_seqlock_stats(const char* name, seqlock_t* lock);
+
+/*******************************************************************************
+ * void seqlock_write_begin(seqlock_t* lock, int writer)
+ *
+ * Mark writer's fields as being updated.  Only one thread may use each writer
+ * index.
+ ******************************************************************************/
+static inline void seqlock_write_begin(seqlock_t* lock, int writer)
+{
+  unsigned s = atomic_load_explicit(&lock->seq[writer], memory_order_relaxed);
+  atomic_store_explicit(&lock->seq[writer], s+1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+/*******************************************************************************
+ * void seqlock_write_end(seqlock_t* lock, int writer)
+ *
+ * Publish the fields written since seqlock_write_begin
+ ******************************************************************************/
+static inline void seqlock_write_end(seqlock_t* lock, int writer)
+{
+  unsigned s = atomic_load_explicit(&lock->seq[writer], memory_order_relaxed);
+  atomic_store_explicit(&lock->seq[writer], s+1, memory_order_release);
+  atomic_fetch_add_explicit(&lock->writes, 1, memory_order_relaxed);
+}
+
+/*******************************************************************************
+ * int seqlock_read(seqlock_t* lock, void* dst, const void* src, size_t size)
+ *
+ * Copy a consistent snapshot of the shared struct src into dst.  Returns -1
+ * with dst unchanged if no consistent copy came within SEQLOCK_MAX_RETRIES,
+ * which is what a reader that preempted a writer mid-write gets.
+ ******************************************************************************/
+static inline int seqlock_read(seqlock_t* lock, void* dst, const void* src,\
+                               size_t size)
+{
+  unsigned start[SEQLOCK_MAX_WRITERS];
+  char copy[size];          // so a torn copy never reaches dst
+  int i, busy, tries;
+
+  atomic_fetch_add_explicit(&lock->reads, 1, memory_order_relaxed);
+  for(tries=0; tries<=SEQLOCK_MAX_RETRIES; tries++)
+  {
+    if(tries > 0)
+    {
+      atomic_fetch_add_explicit(&lock->retries, 1, memory_order_relaxed);
+    }
+    busy = 0;
+    for(i=0; i<lock->writers; i++)
+    {
+      start[i] = atomic_load_explicit(&lock->seq[i], memory_order_acquire);
+      busy |= start[i] & 1;
+    }
+    if(busy) continue;
+
+    memcpy(copy, src, size);
+    atomic_thread_fence(memory_order_acquire);
+    for(i=0; i<lock->writers; i++)
+    {
+      if(atomic_load_explicit(&lock->seq[i], memory_order_relaxed) != start[i])
+      {
+        break;
+      }
+    }
+    if(i == lock->writers)
+    {
+      memcpy(dst, copy, size);
+      return 0;
+    }
+  }
+  atomic_fetch_add_explicit(&lock->stale, 1, memory_order_relaxed);
+  return -1;
+}
+
+#endif // SEQLOCK_H
@@ -0,0 +1,237 @@
+/*******************************************************************************
+ * state_bus.c
+ *
+ * futex and eventfd state change notification.  See state_bus.h.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "state_bus.h"
+
+// variable declarations
+static _Atomic uint32_t generation;     // the futex word
+static _Atomic int64_t  changed_ns;     // when the newest change was set
+static atomic_int       reacted;        // subscribers that noticed it so far
+static state_sub_t*     subs[STATE_BUS_MAX_SUBS];  // kept for the stats
+static atomic_int       nsubs;
+static atomic_int       active;         // subscribers still counted
+static int              fds[STATE_BUS_MAX_FDS];
+static atomic_int       nfds;
+static _Atomic uint64_t changes;
+static uint64_t         all_count;      // changes every subscriber noticed
+static int64_t          all_max;
+static double           all_sum;
+
+/*******************************************************************************
+ * static int64_t state_bus_now()
+ ******************************************************************************/
+static int64_t state_bus_now()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (int64_t)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+/*******************************************************************************
+ * int state_bus_subscribe(state_sub_t* sub, const char* name)
+ *
+ * Start watching from the current state.  Returns -1 once the bus is full.
+ ******************************************************************************/
+int state_bus_subscribe(state_sub_t* sub, const char* name)
+{
+  int i, n = atomic_load(&nsubs);
+  memset(sub, 0, sizeof(state_sub_t));
+  sub->name = name;
+  sub->seen = atomic_load(&generation);
+  sub->active = 1;
+  atomic_fetch_add(&active, 1);
+
+  // the same sub subscribed again, a task restarted, keeps its place
+  for(i=0; i<n; i++) if(subs[i] == sub) return 0;
+  i = atomic_fetch_add(&nsubs, 1);
+  if(i >= STATE_BUS_MAX_SUBS)
+  {
+    atomic_fetch_sub(&nsubs, 1);
+    atomic_fetch_sub(&active, 1);
+    sub->active = 0;
+    printf("ERROR: %s: state bus full\n", name);
+    return -1;
+  }
+  subs[i] = sub;
+  return 0;
+}
+
+/*******************************************************************************
+ * int state_bus_unsubscribe(state_sub_t* sub)
+ *
+ * Stop counting sub, once its thread has finished, so later changes aren't
+ * left waiting on it.  Its times stay in the stats.
+ ******************************************************************************/
+int state_bus_unsubscribe(state_sub_t* sub)
+{
+  if(!sub->active) return -1;
+  sub->active = 0;
+  atomic_fetch_sub(&active, 1);
+  return 0;
+}
+
+/*******************************************************************************
+ * int state_bus_subscribe_fd(int fd)
+ *
+ * Also write 1 to eventfd fd on every change.  Its reader isn't counted in
+ * the latency unless it subscribes too.
+ ******************************************************************************/
+int state_bus_subscribe_fd(int fd)
+{
+  int i = atomic_fetch_add(&nfds, 1);
+  if(i >= STATE_BUS_MAX_FDS)
+  {
+    atomic_fetch_sub(&nfds, 1);
+    printf("ERROR: state bus has no room for another eventfd\n");
+    return -1;
+  }
+  fds[i] = fd;
+  return 0;
+}
+
+/*******************************************************************************
+ * int state_bus_set(state_t state)
+ *
+ * set_state, then wake every subscriber
+ ******************************************************************************/
+int state_bus_set(state_t state)
+{
+  uint64_t one = 1;
+  int i, n;
+
+  set_state(state);
+  atomic_store(&changed_ns, state_bus_now());
+  atomic_store(&reacted, 0);
+  atomic_fetch_add(&generation, 1);
+  atomic_fetch_add(&changes, 1);
+  syscall(SYS_futex, &generation, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+  n = atomic_load(&nfds);
+  for(i=0; i<n && i<STATE_BUS_MAX_FDS; i++)
+  {
+    if(write(fds[i], &one, sizeof(one)) != sizeof(one)) return -1;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * int state_bus_changed(state_sub_t* sub)
+ *
+ * 1, once, if the state has changed since sub last looked.  The last
+ * subscriber to notice a change records how long it took them all.
+ ******************************************************************************/
+int state_bus_changed(state_sub_t* sub)
+{
+  uint32_t g = atomic_load(&generation);
+  int64_t latency;
+
+  if(g == sub->seen) return 0;
+  sub->seen = g;
+  latency = state_bus_now() - atomic_load(&changed_ns);
+  if(latency > sub->latency_max) sub->latency_max = latency;
+  sub->latency_sum += latency;
+  sub->reactions++;
+  if(atomic_fetch_add(&reacted, 1) + 1 == atomic_load(&active))
+  {
+    if(latency > all_max) all_max = latency;
+    all_sum += latency;
+    all_count++;
+  }
+  return 1;
+}
+
+/*******************************************************************************
+ * int state_bus_wait(state_sub_t* sub, const struct timespec* until)
+ *
+ * Sleep until the absolute CLOCK_MONOTONIC time until, forever if NULL, or
+ * until the state changes.  Returns 1 on a change, 0 on the timeout.
+ ******************************************************************************/
+int state_bus_wait(state_sub_t* sub, const struct timespec* until)
+{
+  uint32_t g = atomic_load(&generation);
+  long ret;
+
+  while(g == sub->seen)
+  {
+    // FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout
+    ret = syscall(SYS_futex, &generation, FUTEX_WAIT_BITSET_PRIVATE, g,\
+                  until, NULL, FUTEX_BITSET_MATCH_ANY);
+    if(ret == -1 && errno == ETIMEDOUT) return 0;
+    g = atomic_load(&generation);
+  }
+  return state_bus_changed(sub);
+}
+
+/*******************************************************************************
+ * int state_bus_sleep(state_sub_t* sub, int64_t ns)
+ *
+ * usleep that a state change cuts short.  Returns 1 on a change.
+ ******************************************************************************/
+int state_bus_sleep(state_sub_t* sub, int64_t ns)
+{
+  struct timespec until;
+  int64_t t = state_bus_now() + ns;
+  until.tv_sec = t/1000000000LL;
+  until.tv_nsec = t%1000000000LL;
+  return state_bus_wait(sub, &until);
+}
+
+/*******************************************************************************
+ * int print_state_bus_stats()
+ *
+ * Times from state_bus_set to every subscriber, and to the last of them
+ ******************************************************************************/
+int print_state_bus_stats()
+{
+  state_sub_t* sub;
+  double n = all_count > 0 ? all_count : 1;
+  int i;
+
+  printf("state bus: %llu changes, all %d subscribers noticed %llu of them "\
+         "in mean %.1f max %.1f us\n", (unsigned long long)changes,\
+         atomic_load(&nsubs), (unsigned long long)all_count, all_sum/n/1e3,\
+         all_max/1e3);
+  for(i=0; i<atomic_load(&nsubs); i++)
+  {
+    sub = subs[i];
+    n = sub->reactions > 0 ? sub->reactions : 1;
+    printf("  %-12s %llu changes noticed, mean %.1f max %.1f us\n",\
+           sub->name, (unsigned long long)sub->reactions,\
+           sub->latency_sum/n/1e3, sub->latency_max/1e3);
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * int clear_state_bus_stats()
+ *
+ * Forget the changes so far, every subscriber's times and the subscribers
+ * that have left.  Only while nothing subscribes or unsubscribes.
+ ******************************************************************************/
+int clear_state_bus_stats()
+{
+  int i, n = 0;
+  atomic_store(&changes, 0);
+  all_count = 0;
+  all_max = 0;
+  all_sum = 0;
+  for(i=0; i<atomic_load(&nsubs); i++)
+  {
+    if(!subs[i]->active) continue;
+    subs[i]->reactions = 0;
+    subs[i]->latency_max = 0;
+    subs[i]->latency_sum = 0;
+    subs[n++] = subs[i];
+  }
+  atomic_store(&nsubs, n);
+  return 0;
+}
@@ -0,0 +1,52 @@
+/*******************************************************************************
+ * state_bus.h
+ *
+ * Program state changes pushed to every thread instead of polled.  The cape
+ * library's state is a plain variable each loop reads after its next sleep,
+ * so a pause or an exit waits on the slowest sleeper.  state_bus_set sets it
+ * and bumps a generation counter that threads sleep on with a futex, waking
+ * them all at once, and writes to any subscribed eventfds for a reactor.
+ *
+ * A subscriber sleeps in state_bus_wait or state_bus_sleep, which return 1
+ * as soon as the state has changed since it last looked, or polls
+ * state_bus_changed.  Either way the time from state_bus_set to each
+ * subscriber noticing is kept, and for every change the time until the last
+ * of them noticed, as the bus's latency.
+ *
+ * state_bus_set is safe from signal handlers.  A set_state that bypasses the
+ * bus, the cape library's own ^C handler, is still seen at the next timeout.
+ ******************************************************************************/
+
+#ifndef STATE_BUS_H
+#define STATE_BUS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "mip_hal.h"
+
+#define STATE_BUS_MAX_SUBS  8
+#define STATE_BUS_MAX_FDS   4
+
+typedef struct state_sub_t
+{
+  const char* name;
+  int active;               // subscribed, not yet unsubscribed
+  uint32_t seen;            // generation last noticed
+  uint64_t reactions;
+  int64_t  latency_max;     // ns from state_bus_set to noticing it
+  double   latency_sum;
+
+} state_sub_t;
+
+int state_bus_subscribe(state_sub_t* sub, const char* name);
+int state_bus_unsubscribe(state_sub_t* sub);
+int state_bus_subscribe_fd(int fd);
+int state_bus_set(state_t state);
+int state_bus_changed(state_sub_t* sub);
+int state_bus_wait(state_sub_t* sub, const struct timespec* until);
+int state_bus_sleep(state_sub_t* sub, int64_t ns);
+int print_state_bus_stats();
+int clear_state_bus_stats();
+
+#endif // STATE_BUS_H
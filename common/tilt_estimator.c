@@ -0,0 +1,169 @@
+/*******************************************************************************
+ * tilt_estimator.c
+ *
+ * Body angle estimators.  See tilt_estimator.h.
+ *
+ * The Kalman filter is the usual gyro bias one, written out for the 2x2
+ * symmetric covariance so an update is a couple of dozen flops and one
+ * divide, with no matrix code and no branches after the first sample:
+ *
+ *   predict   angle += gyro_step - bias*dt
+ *             P = F P F' + Q,  F = [1 -dt; 0 1],  Q = diag(q_angle, q_bias)
+ *   correct   y = accel_angle - angle,  S = p00 + r_accel,
+ *             K = [p00; p01]/S,  x += K y,  P -= K [p00 p01]
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "tilt_estimator.h"
+
+// first sample's bias uncertainty, (rad/s)^2: a few deg/s, a cheap MEMS gyro
+#define TILT_KALMAN_BIAS_VAR0   1e-3
+
+/*******************************************************************************
+ * static float update_complementary(tilt_estimator_t* e, float gyro_step,
+ *                                   float accel_angle)
+ ******************************************************************************/
+static float update_complementary(tilt_estimator_t* e, float gyro_step,\
+                                  float accel_angle)
+{
+  e->g_angle += gyro_step;
+  return step_filter(&e->hpass,e->g_angle) + step_filter(&e->lpass,accel_angle);
+}
+
+/*******************************************************************************
+ * static float update_kalman(tilt_estimator_t* e, float gyro_step,
+ *                            float accel_angle)
+ ******************************************************************************/
+static float update_kalman(tilt_estimator_t* e, float gyro_step,\
+                           float accel_angle)
+{
+  float dt = e->dt;
+  float p00, p01, p11, s, k0, k1, y;
+
+  if(!e->primed)
+  {
+    e->angle = accel_angle;
+    e->primed = 1;
+    return e->angle;
+  }
+
+  // predict
+  e->angle += gyro_step - e->bias*dt;
+  p11 = e->p11 + e->q_bias;
+  p01 = e->p01 - dt*e->p11;
+  p00 = e->p00 - dt*(e->p01 + p01) + e->q_angle;
+
+  // correct with the accelerometer
+  y = accel_angle - e->angle;
+  s = p00 + e->r_accel;
+  k0 = p00/s;
+  k1 = p01/s;
+  e->angle += k0*y;
+  e->bias += k1*y;
+  e->p00 = p00 - k0*p00;
+  e->p01 = p01 - k0*p01;
+  e->p11 = p11 - k1*p01;
+  return e->angle;
+}
+
+/*******************************************************************************
+ * tilt_estimator_t create_tilt_estimator(int type, float dt,
+ *                                        tilt_params_t params)
+ *
+ * initialized is 0 if the type or parameters are bad
+ ******************************************************************************/
+tilt_estimator_t create_tilt_estimator(int type, float dt, tilt_params_t params)
+{
+  tilt_estimator_t e;
+  float tau = params.time_constant;
+  float lpass_num[] = {dt/tau,0};
+  float lpass_den[] = {1, dt/tau-1};
+  float hpass_num[] = {1-dt/tau,dt/tau-1};
+  float hpass_den[] = {1,dt/tau-1};
+
+  memset(&e, 0, sizeof(tilt_estimator_t));
+  e.type = type;
+  e.dt = dt;
+  switch(type)
+  {
+    case TILT_COMPLEMENTARY:
+      if(tau <= 0) break;
+      e.lpass = create_daniel_filter(1,dt,lpass_num,lpass_den,1,0);
+      e.hpass = create_daniel_filter(1,dt,hpass_num,hpass_den,1,0);
+      if(!e.lpass.initialized || !e.hpass.initialized)
+      {
+        destroy_tilt_estimator(&e);
+        break;
+      }
+      e.update = update_complementary;
+      e.initialized = 1;
+      break;
+
+    case TILT_KALMAN:
+      if(params.q_angle < 0 || params.q_bias < 0 || params.r_accel <= 0) break;
+      e.q_angle = params.q_angle*dt;
+      e.q_bias = params.q_bias*dt;
+      e.r_accel = params.r_accel;
+      e.update = update_kalman;
+      e.initialized = 1;
+      reset_tilt_estimator(&e);
+      break;
+  }
+  if(!e.initialized)
+  {
+    printf("ERROR: bad %s estimator\n", tilt_estimator_name(type));
+  }
+  return e;
+}
+
+/*******************************************************************************
+ * int reset_tilt_estimator(tilt_estimator_t* e)
+ *
+ * Back to the state it was created in
+ ******************************************************************************/
+int reset_tilt_estimator(tilt_estimator_t* e)
+{
+  if(!e->initialized) return -1;
+  if(e->type == TILT_COMPLEMENTARY)
+  {
+    zero_filter(&e->lpass);
+    zero_filter(&e->hpass);
+    e->g_angle = 0;
+    return 0;
+  }
+  e->angle = 0;
+  e->bias = 0;
+  e->p00 = e->r_accel;
+  e->p01 = 0;
+  e->p11 = TILT_KALMAN_BIAS_VAR0;
+  e->primed = 0;
+  return 0;
+}
+
+/*******************************************************************************
+ * int destroy_tilt_estimator(tilt_estimator_t* e)
+ ******************************************************************************/
+int destroy_tilt_estimator(tilt_estimator_t* e)
+{
+  if(e->type == TILT_COMPLEMENTARY)
+  {
+    destroy_daniel_filter(&e->lpass);
+    destroy_daniel_filter(&e->hpass);
+  }
+  e->initialized = 0;
+  return 0;
+}
+
+/*******************************************************************************
+ * const char* tilt_estimator_name(int type)
+ ******************************************************************************/
+const char* tilt_estimator_name(int type)
+{
+  switch(type)
+  {
+    case TILT_COMPLEMENTARY: return "complementary";
+    case TILT_KALMAN:        return "kalman";
+  }
+  return "unknown";
+}
@@ -0,0 +1,81 @@
+/*******************************************************************************
+ * tilt_estimator.h
+ *
+ * Body angle estimators behind one interface.  Every update takes one IMU
+ * sample, as the angle the gyro turned through since the last one (rad) and
+ * the angle of the accelerometer's gravity vector (rad), and returns the
+ * tilt.  create_tilt_estimator picks the update function the way
+ * create_daniel_filter picks a kernel; tilt_estimator_update is just the
+ * indirect call.
+ *
+ *   TILT_COMPLEMENTARY  high passed integrated gyro plus low passed
+ *                       accelerometer, crossing over at time_constant, the
+ *                       filter balance_by_daniel has always used
+ *   TILT_KALMAN         two states, angle and gyro bias.  The gyro drives
+ *                       the prediction, the accelerometer angle corrects
+ *                       both, so a constant gyro offset is learned and
+ *                       removed instead of leaking into the angle.  Noise
+ *                       is given per second and scaled by dt, so the same
+ *                       numbers hold at any sample rate.
+ ******************************************************************************/
+
+#ifndef TILT_ESTIMATOR_H
+#define TILT_ESTIMATOR_H
+
+#include "daniel_filter.h"
+
+#define TILT_COMPLEMENTARY  0
+#define TILT_KALMAN         1
+
+typedef struct tilt_params_t
+{
+  float time_constant;  // s, complementary
+  float q_angle;        // rad^2/s, gyro angle random walk, Kalman
+  float q_bias;         // (rad/s)^2/s, gyro bias random walk, Kalman
+  float r_accel;        // rad^2, accelerometer angle variance, Kalman
+
+} tilt_params_t;
+
+typedef struct tilt_estimator_t
+{
+  float (*update)(struct tilt_estimator_t* e, float gyro_step,\
+                  float accel_angle);
+  int type;
+  float dt;
+
+  // complementary
+  daniel_filter_t lpass;
+  daniel_filter_t hpass;
+  float g_angle;        // integrated gyro
+
+  // Kalman, p is the symmetric covariance
+  float angle;          // rad
+  float bias;           // rad/s
+  float p00, p01, p11;
+  float q_angle;        // per sample
+  float q_bias;         // per sample
+  float r_accel;
+  int primed;           // angle taken from the first accelerometer sample
+
+  int initialized;
+
+} tilt_estimator_t;
+
+tilt_estimator_t create_tilt_estimator(int type, float dt, tilt_params_t params);
+int reset_tilt_estimator(tilt_estimator_t* e);
+int destroy_tilt_estimator(tilt_estimator_t* e);
+const char* tilt_estimator_name(int type);
+
+/*******************************************************************************
+ * float tilt_estimator_update(tilt_estimator_t* e, float gyro_step,
+ *                             float accel_angle)
+ *
+ * One IMU sample in, the tilt estimate out
+ ******************************************************************************/
+static inline float tilt_estimator_update(tilt_estimator_t* e,\
+                                          float gyro_step, float accel_angle)
+{
+  return e->update(e, gyro_step, accel_angle);
+}
+
+#endif // TILT_ESTIMATOR_H
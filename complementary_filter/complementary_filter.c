@@ -6,6 +6,7 @@
 
 #include <usefulincludes.h>
 #include <roboticscape.h>
+#include "state_bus.h"
 
 // Hash defines
 #define SAMPLE_FREQUENCY   100
@@ -27,6 +28,9 @@ float a_angle;
 float bbb_angle;
 d_filter_t lpass;
 d_filter_t hpass;
+state_sub_t main_sub;
+state_sub_t imu_sub;
+state_sub_t csv_sub;
 
 /*******************************************************************************
 * int main() 
@@ -51,7 +55,7 @@ int main()
 
   // Initialize DMP Mode on IMU
   imu_config_t imu_config = get_default_imu_config();
-  imu_config.enable_magnetometer=1;
+  imu_config.enable_magnetometer=0;  // never read here
   imu_config.dmp_sample_rate=SAMPLE_FREQUENCY;
   
   if(initialize_imu_dmp(&data,imu_config))
@@ -75,8 +79,11 @@ int main()
 
   printf("dt:  %f \n",1.0/( (float)SAMPLE_FREQUENCY ));
   printf("tau: %f \n",(float) TIME_CONSTANT);
-  // done initializing so set state to RUNNING
-	set_state(RUNNING);
+  // done initializing so set state to RUNNING, threads wake on changes
+  state_bus_subscribe(&main_sub, "main");
+  state_bus_subscribe(&imu_sub, "write_imu");
+  state_bus_subscribe(&csv_sub, "write_csv");
+	state_bus_set(RUNNING);
   
   // start writing to the screen
   pthread_t write_thread;
@@ -93,11 +100,12 @@ int main()
 	while(get_state()!=EXITING)
   {
     // We'll deal with everything in different threads, so just chill.
-		usleep(100000);
+		state_bus_sleep(&main_sub, 100000000);
 	}
 
   // Say goodbye
   printf("Goodbye Cruel World\n");
+  print_state_bus_stats();
   
   print_filter_details(&lpass);
 
@@ -118,8 +126,8 @@ int main()
 int on_pause_released()
 {
 	// toggle betewen paused and running modes
-	if(get_state()==RUNNING)   		set_state(PAUSED);
-	else if(get_state()==PAUSED)	set_state(RUNNING);
+	if(get_state()==RUNNING)   		state_bus_set(PAUSED);
+	else if(get_state()==PAUSED)	state_bus_set(RUNNING);
   return 0;
 }
 
@@ -142,7 +150,7 @@ int on_pause_pressed()
 		if(get_pause_button() == RELEASED) return 0;
 	}
 	printf("\nlong press detected, shutting down\n");
-	set_state(EXITING);
+	state_bus_set(EXITING);
 	return 0;
 }
 
@@ -160,7 +168,7 @@ void* write_imu(void* ptr)
     fflush(stdout);
     
     // always sleep at some point
-    usleep(1000000/WRITE_FREQUENCY);
+    state_bus_sleep(&imu_sub, 1000000000/WRITE_FREQUENCY);
   }
   return NULL;
 }
@@ -192,11 +200,22 @@ void* write_csv()
   fprintf(csv,"time,a_angle,g_angle,bbb_angle\n");
   float i = 0.0;
 
+  // rows stay on a fixed grid so the time column holds, a pause doesn't
+  // write an extra one and an exit doesn't wait out the period
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
   while(get_state()!=EXITING)
   {
     fprintf(csv,"%f,%f,%f,%f\n",i/WRITE_FREQUENCY,a_angle,g_angle,bbb_angle);
     i++;
-    usleep(1000000/WRITE_FREQUENCY);
+    next.tv_nsec += 1000000000/WRITE_FREQUENCY;
+    if(next.tv_nsec >= 1000000000)
+    {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000;
+    }
+    while(state_bus_wait(&csv_sub, &next) && get_state()!=EXITING);
   }
 
   fclose(csv);
@@ -5,17 +5,19 @@
 * Change this description and file name 
 *******************************************************************************/
 
-#include <usefulincludes.h>
-#include <roboticscape.h>
+#include "mip_hal.h"
+#include "state_bus.h"
 
 
 // Hash defines
+#define SIM_SECONDS        10   // make SIM=1 runs this long
 
 
 // function declarations
 int on_pause_pressed();
 int on_pause_released();
 int on_mode_released();
+int print_state(state_t state, int mode);
 void* custom_blink();
 void* write_state();
 
@@ -24,6 +26,9 @@ const int mode_delay[] = {2000000,1000000,750000,500000};
 int mode;
 int last_mode;
 state_t last_state;
+state_sub_t main_sub;
+state_sub_t blink_sub;
+state_sub_t write_sub;
 
 /*******************************************************************************
 * int main() 
@@ -47,8 +52,11 @@ int main()
 	set_pause_released_func(&on_pause_released);
   set_mode_released_func(&on_mode_released);
   
-	// done initializing so set state to RUNNING
-	set_state(RUNNING);
+	// done initializing so set state to RUNNING, threads wake on changes
+  state_bus_subscribe(&main_sub, "main");
+  state_bus_subscribe(&blink_sub, "custom_blink");
+  state_bus_subscribe(&write_sub, "write_state");
+	state_bus_set(RUNNING);
   
   // Initial mode set to 0
   mode = 0;
@@ -69,15 +77,22 @@ int main()
   printf("\n  STATE  |  MODE\n");
 	print_state(get_state(),mode);
 
+#ifdef MIP_SIM
+  // no buttons to press in the simulator, run for SIM_SECONDS then exit
+  sim_run_realtime(SIM_SECONDS);
+  state_bus_set(EXITING);
+#else
   // Keep looping until state changes to EXITING
 	while(get_state()!=EXITING)
   {
     // We'll deal with everything in different threads, so just chill.
-		usleep(100000);
+		state_bus_sleep(&main_sub, 100000000);
 	}
+#endif
 
   // Say goodbye
   printf("Goodbye Cruel World\n");
+  print_state_bus_stats();
 	
   // exit cleanly
 	cleanup_cape();
@@ -93,8 +108,8 @@ int main()
 int on_pause_released()
 {
 	// toggle betewen paused and running modes
-	if(get_state()==RUNNING)   		set_state(PAUSED);
-	else if(get_state()==PAUSED)	set_state(RUNNING);
+	if(get_state()==RUNNING)   		state_bus_set(PAUSED);
+	else if(get_state()==PAUSED)	state_bus_set(RUNNING);
   return 0;
 }
 
@@ -117,7 +132,7 @@ int on_pause_pressed()
 		if(get_pause_button() == RELEASED) return 0;
 	}
 	printf("\nlong press detected, shutting down\n");
-	set_state(EXITING);
+	state_bus_set(EXITING);
 	return 0;
 }
 
@@ -174,28 +189,28 @@ void* custom_blink(void* ptr)
       set_led(GREEN, ON);
       set_led(RED, OFF);
     }
-    usleep(mode_delay[mode]*1/6);
+    state_bus_sleep(&blink_sub, mode_delay[mode]*1000LL*1/6);
     
     if(get_state()==RUNNING)
     {
       set_led(GREEN, OFF);
       set_led(RED, ON);
     }
-    usleep(mode_delay[mode]*3/6);
+    state_bus_sleep(&blink_sub, mode_delay[mode]*1000LL*3/6);
     
     if(get_state()==RUNNING)
     {
       set_led(GREEN, ON);
       set_led(RED, OFF);
     }
-    usleep(mode_delay[mode]*1/6);
+    state_bus_sleep(&blink_sub, mode_delay[mode]*1000LL*1/6);
     
     if(get_state()==RUNNING)
     {
       set_led(GREEN, OFF);
       set_led(RED, ON);
     }
-    usleep(mode_delay[mode]*1/6);
+    state_bus_sleep(&blink_sub, mode_delay[mode]*1000LL*1/6);
   }
   return NULL;
 }
@@ -216,8 +231,8 @@ void* write_state(void* ptr)
       last_state = get_state();
     }
     
-    // always sleep at some point
-    usleep(100000);
+    // always sleep at some point, a state change prints at once
+    state_bus_sleep(&write_sub, 100000000);
   }
   return NULL;
 }
@@ -4,24 +4,23 @@
 * Assignment 6: Read the sensors and filter them with custom filters.
 *******************************************************************************/
 
-#include <usefulincludes.h>
-#include <roboticscape.h>
-#include "./filters_by_daniel.h"
+#include "mip_hal.h"
+#include "mip_log.h"
+#include "daniel_filter.h"
+#include "state_bus.h"
 
 // Hash defines
 #define SAMPLE_FREQUENCY   100
 #define WRITE_FREQUENCY    10
-#define FILENAME           "custom_filtered_angles.csv"
+#define FILENAME           "custom_filtered_angles.miplog"
 #define TIME_CONSTANT      1.0
+#define SIM_SECONDS        10   // make SIM=1 runs this long
 
 // function declarations
 int on_pause_pressed();
 int on_pause_released();
 int imu_callback();
 void* write_imu();
-void* write_csv();
-daniel_filter_t create_daniel_filter(int order, float dt, float* num, float* den);
-float step_filter(daniel_filter_t* filter, float new_input);
 
 // variable declarations
 imu_data_t data;
@@ -32,6 +31,9 @@ float bbb_angle;
 daniel_filter_t lpass;
 //d_filter_t hpass;
 daniel_filter_t hpass;
+mip_log_t log_file;
+state_sub_t main_sub;
+state_sub_t write_sub;
 
 /*******************************************************************************
 * int main() 
@@ -56,7 +58,7 @@ int main()
 
   // Initialize DMP Mode on IMU
   imu_config_t imu_config = get_default_imu_config();
-  imu_config.enable_magnetometer=1;
+  imu_config.enable_magnetometer=0;  // never read here
   imu_config.dmp_sample_rate=SAMPLE_FREQUENCY;
   
   if(initialize_imu_dmp(&data,imu_config))
@@ -70,51 +72,72 @@ int main()
   a_angle   = 0.0;
   bbb_angle = 0.0;
   
-  set_imu_interrupt_func(&imu_callback);
-
   // Initialize filters
   float dt = 1.0/(float)SAMPLE_FREQUENCY;
   float lpass_num[] = {dt/TIME_CONSTANT,0};
   float lpass_den[] = {1, dt/TIME_CONSTANT-1};
-  lpass = create_daniel_filter(1,dt,lpass_num,lpass_den);
+  lpass = create_daniel_filter(1,dt,lpass_num,lpass_den,1,0);
   
   float hpass_num[] = {1-dt/TIME_CONSTANT,dt/TIME_CONSTANT-1};
   float hpass_den[] = {1,dt/TIME_CONSTANT-1};
-  hpass  = create_daniel_filter(1,dt,hpass_num,hpass_den);
+  hpass  = create_daniel_filter(1,dt,hpass_num,hpass_den,1,0);
+  if(!lpass.initialized || !hpass.initialized)
+  {
+    printf("Could not create filters\n");
+    return -1;
+  }
+
+  // every IMU sample goes to the log, convert with log_to_csv
+  const char* log_names[] = {"a_angle","g_angle","bbb_angle"};
+  if(mip_log_open(&log_file,FILENAME,3,log_names))
+  {
+    printf("Could not open %s\n",FILENAME);
+    return -1;
+  }
+
+  set_imu_interrupt_func(&imu_callback);
 
   printf("dt:  %f \n",1.0/( (float)SAMPLE_FREQUENCY ));
   printf("tau: %f \n",(float) TIME_CONSTANT);
-  // done initializing so set state to RUNNING
-	set_state(RUNNING);
+
+  // done initializing so set state to RUNNING, threads wake on changes
+  state_bus_subscribe(&main_sub, "main");
+  state_bus_subscribe(&write_sub, "write_imu");
+	state_bus_set(RUNNING);
   
   // start writing to the screen
   pthread_t write_thread;
   pthread_create(&write_thread, NULL, write_imu, (void*) NULL);
 
-  // start writing to csv file
-  pthread_t csv_thread;
-  pthread_create(&csv_thread, NULL, write_csv, (void*) NULL);
-
   // print out the state stuff
   printf("\n  a_angle | g_angle | bbb_angle \n");
 
+#ifdef MIP_SIM
+  // no buttons to press in the simulator, run for SIM_SECONDS then exit
+  sim_run_realtime(SIM_SECONDS);
+  state_bus_set(EXITING);
+#else
   // Keep looping until state changes to EXITING
 	while(get_state()!=EXITING)
   {
     // We'll deal with everything in different threads, so just chill.
-		usleep(100000);
+		state_bus_sleep(&main_sub, 100000000);
 	}
+#endif
 
   // Say goodbye
   printf("Goodbye Cruel World\n");
+  print_state_bus_stats();
   
   // exit cleanly
   power_off_imu();
+  mip_log_close(&log_file);
+  destroy_daniel_filter(&lpass);
+  destroy_daniel_filter(&hpass);
   cleanup_cape();
   return 0;
 }
 
-
 /*******************************************************************************
 * int on_pause_released() 
 *	
@@ -123,8 +146,8 @@ int main()
 int on_pause_released()
 {
 	// toggle betewen paused and running modes
-	if(get_state()==RUNNING)   		set_state(PAUSED);
-	else if(get_state()==PAUSED)	set_state(RUNNING);
+	if(get_state()==RUNNING)   		state_bus_set(PAUSED);
+	else if(get_state()==PAUSED)	state_bus_set(RUNNING);
   return 0;
 }
 
@@ -147,7 +170,7 @@ int on_pause_pressed()
 		if(get_pause_button() == RELEASED) return 0;
 	}
 	printf("\nlong press detected, shutting down\n");
-	set_state(EXITING);
+	state_bus_set(EXITING);
 	return 0;
 }
 
@@ -165,7 +188,7 @@ void* write_imu(void* ptr)
     fflush(stdout);
     
     // always sleep at some point
-    usleep(1000000/WRITE_FREQUENCY);
+    state_bus_sleep(&write_sub, 1000000000/WRITE_FREQUENCY);
   }
   return NULL;
 }
@@ -181,105 +204,9 @@ int imu_callback()
   g_angle += data.gyro[0]/SAMPLE_FREQUENCY*DEG_TO_RAD;
   a_angle = atan2(-data.accel[2],data.accel[1]);
   //printf("%f\n",step_filter(&lpass,a_angle));
-  bbb_angle = -1*step_filter(&hpass,g_angle) + step_filter(&lpass,a_angle);
-  //bbb_angle = -1*step_filter(&hpass,1) + step_filter(&lpass,1);
-  return 0;
-}
-
-/*******************************************************************************
- * void* write_csv()
- *
- * Write the IMU data to a CSV file
- ******************************************************************************/
-void* write_csv()
-{
-  // Initialize file
-  FILE *csv; // pointer to file (stream)
-  csv = fopen(FILENAME,"w");
-  fprintf(csv,"time,a_angle,g_angle,bbb_angle\n");
-  float i = 0.0;
-
-  while(get_state()!=EXITING)
-  {
-    fprintf(csv,"%f,%f,%f,%f\n",i/WRITE_FREQUENCY,a_angle,g_angle,bbb_angle);
-    i++;
-    usleep(1000000/WRITE_FREQUENCY);
-  }
-
-  fclose(csv);
-  return NULL;
-}
-
-/*******************************************************************************
- * daniel_filter_t create_daniel_filter(int order, float dt, float* num, float* den)
- *
- * Create a filter.  Yay!
- ******************************************************************************/
-daniel_filter_t create_daniel_filter(int order, float dt, float* num, float* den)
-{
-  daniel_filter_t filter;
-  int i;
-  int n = 3-order;
-  filter.order = order;
-  filter.dt = dt;
-  filter.gain = 1;
-  for(i=0; i<n; i++)
-  {
-    filter.num[i] = 0;
-    filter.den[i] = 0;
-    filter.inputs[i]  = 0;
-    filter.outputs[i]  = 0;
-  }
-  for(i=n; i<4; i++)
-  {
-    filter.num[i] = num[i-n];
-    filter.den[i] = den[i-n];
-    filter.inputs[i]  = 0;
-    filter.outputs[i] = 0;
-  }
-  filter.step = 0;
-  filter.initialized = 1;
-  return filter;
-}
+  bbb_angle = step_filter(&hpass,g_angle) + step_filter(&lpass,a_angle);
 
-/*******************************************************************************
- * float step_filter(daniel_filter_t* filter, float new_input)
- *
- * Move forward one step in the filter
- ******************************************************************************/
-float step_filter(daniel_filter_t* filter, float new_input)
-{
-  float gain = filter->gain;
-  float new_output = 0;
-  int i;
-  int n = 3 - filter->order;
-  
-  // Advance inputs and outputs
-  for(i=n; i<3; i++)
-  {
-    filter->inputs[i] = filter->inputs[i+1];
-    filter->outputs[i] = filter->outputs[i+1];
-  }
-  filter->inputs[3] = new_input;
-  
-  // Calculate output
-  for(i=n; i<4; i++)
-  {
-    new_output += gain*filter->num[i]*filter->inputs[i];
-    //printf("%f\n",gain*filter->num[i]*filter->inputs[i]);
-  }
-  for(i=n+1; i<4; i++)
-  {
-    new_output -= filter->den[i]*filter->outputs[i];
-    //printf("%f\n",filter->den[i]*filter->outputs[i]);
-  }
-  
-  // Divide out a0
-  new_output = new_output/filter->den[n];
-  //printf("%f\n",filter->num[n+1]);
-
-  filter->outputs[3] = new_output;
-  
-  filter->step++;
-  return new_output;
+  float sample[] = {a_angle, g_angle, bbb_angle};
+  mip_log_push(&log_file,sample);
+  return 0;
 }
@@ -0,0 +1,44 @@
+/*******************************************************************************
+* log_to_csv.c
+*
+* Convert a binary telemetry log written by mip_log back into the CSV layout
+* the plotting scripts expect, e.g. time,a_angle,g_angle,bbb_angle
+*
+* usage: log_to_csv input.miplog [output.csv]
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "mip_log.h"
+
+#define MAX_NAME  256
+
+int main(int argc, char* argv[])
+{
+  char out_name[MAX_NAME];
+  char* dot;
+
+  if(argc < 2)
+  {
+    printf("usage: %s input.miplog [output.csv]\n", argv[0]);
+    return -1;
+  }
+
+  // default output name swaps the extension
+  if(argc > 2) snprintf(out_name, MAX_NAME, "%s", argv[2]);
+  else
+  {
+    snprintf(out_name, MAX_NAME-4, "%s", argv[1]);
+    dot = strrchr(out_name,'.');
+    if(dot != NULL) *dot = 0;
+    strcat(out_name,".csv");
+  }
+
+  if(mip_log_to_csv(argv[1], out_name))
+  {
+    printf("Could not convert %s\n", argv[1]);
+    return -1;
+  }
+  printf("%s -> %s\n", argv[1], out_name);
+  return 0;
+}
@@ -4,28 +4,28 @@
 * Assignment 4: Read the sensors
 *******************************************************************************/
 
-#include <usefulincludes.h>
-#include <roboticscape.h>
-
+#include "mip_hal.h"
+#include "mip_log.h"
+#include "state_bus.h"
 
 // Hash defines
 #define SAMPLE_FREQUENCY   20
 #define WRITE_FREQUENCY    10
-#define FILENAME           "angles.csv"
-#define TIME_CONSTANT      2.0
+#define FILENAME           "angles.miplog"
+#define SIM_SECONDS        10   // make SIM=1 runs this long
 
 // function declarations
 int on_pause_pressed();
 int on_pause_released();
 int imu_callback();
 void* write_imu();
-void* write_csv();
 
 // variable declarations
 imu_data_t data;
 float gyro_angle;
-d_filter_t low_pass;
-d_filter_t high_pass;
+mip_log_t log_file;
+state_sub_t main_sub;
+state_sub_t imu_sub;
 
 /*******************************************************************************
 * int main() 
@@ -50,7 +50,7 @@ int main()
 
   // Initialize DMP Mode on IMU
   imu_config_t imu_config = get_default_imu_config();
-  imu_config.enable_magnetometer=1;
+  imu_config.enable_magnetometer=0;  // never read here
   imu_config.dmp_sample_rate=SAMPLE_FREQUENCY;
   
   if(initialize_imu_dmp(&data,imu_config))
@@ -62,43 +62,52 @@ int main()
   // Initialize gyro_angle to 0
   gyro_angle = 0.0;
       
-  set_imu_interrupt_func(&imu_callback);
+  // every IMU sample goes to the log, convert with log_to_csv
+  const char* log_names[] = {"accel_angle","gyro_angle"};
+  if(mip_log_open(&log_file,FILENAME,2,log_names))
+  {
+    printf("Could not open %s\n",FILENAME);
+    return -1;
+  }
 
-  // Initialize filters
-  low_pass   = create_first_order_lowpass(dt, TIME_CONSTANT);
-  high_pass  = create_first_order_highpass(dt, TIME_CONSTANT);
+  set_imu_interrupt_func(&imu_callback);
 
-	// done initializing so set state to RUNNING
-	set_state(RUNNING);
+  // done initializing so set state to RUNNING, threads wake on changes
+  state_bus_subscribe(&main_sub, "main");
+  state_bus_subscribe(&imu_sub, "write_imu");
+	state_bus_set(RUNNING);
   
   // start writing to the screen
   pthread_t write_thread;
   pthread_create(&write_thread, NULL, write_imu, (void*) NULL);
 
-  // start writing to csv file
-  pthread_t csv_thread;
-  pthread_create(&csv_thread, NULL, write_csv, (void*) NULL);
-
   // print out the state stuff
   printf("\n  Accel X | Accel Y | Accel Z | Angle A | Angle G \n");
 
+#ifdef MIP_SIM
+  // no buttons to press in the simulator, run for SIM_SECONDS then exit
+  sim_run_realtime(SIM_SECONDS);
+  state_bus_set(EXITING);
+#else
   // Keep looping until state changes to EXITING
 	while(get_state()!=EXITING)
   {
     // We'll deal with everything in different threads, so just chill.
-		usleep(100000);
+		state_bus_sleep(&main_sub, 100000000);
 	}
+#endif
 
   // Say goodbye
   printf("Goodbye Cruel World\n");
+  print_state_bus_stats();
 	
   // exit cleanly
 	power_off_imu();
+  mip_log_close(&log_file);
   cleanup_cape();
   return 0;
 }
 
-
 /*******************************************************************************
 * int on_pause_released() 
 *	
@@ -107,8 +116,8 @@ int main()
 int on_pause_released()
 {
 	// toggle betewen paused and running modes
-	if(get_state()==RUNNING)   		set_state(PAUSED);
-	else if(get_state()==PAUSED)	set_state(RUNNING);
+	if(get_state()==RUNNING)   		state_bus_set(PAUSED);
+	else if(get_state()==PAUSED)	state_bus_set(RUNNING);
   return 0;
 }
 
@@ -131,7 +140,7 @@ int on_pause_pressed()
 		if(get_pause_button() == RELEASED) return 0;
 	}
 	printf("\nlong press detected, shutting down\n");
-	set_state(EXITING);
+	state_bus_set(EXITING);
 	return 0;
 }
 
@@ -149,7 +158,7 @@ void* write_imu(void* ptr)
     fflush(stdout);
     
     // always sleep at some point
-    usleep(1000000/WRITE_FREQUENCY);
+    state_bus_sleep(&imu_sub, 1000000000/WRITE_FREQUENCY);
   }
   return NULL;
 }
@@ -165,33 +174,8 @@ int imu_callback()
 //  printf("Callback\n"); 
 //  print_imu();
   gyro_angle += data.gyro[0]/SAMPLE_FREQUENCY*DEG_TO_RAD;
-  return 0;
-}
 
-/*******************************************************************************
- * void* write_csv()
- *
- * Write the IMU data to a CSV file
- ******************************************************************************/
-void* write_csv()
-{
-  // Initialize file
-  FILE *csv; // pointer to file (stream)
-  csv = fopen(FILENAME,"w");
-  fprintf(csv,"time,accel_angle,gyro_angle\n");
-  float i = 0.0;
-  float lp;
-  float hp;
-
-  while(get_state()!=EXITING)
-  {
-    lp = march_filter(&low_pass, u);
-    hp = march_filter(&high_pass, u);
-    fprintf(csv,"%f,%f,%f\n",i/WRITE_FREQUENCY,atan2(-data.accel[2],data.accel[1]),gyro_angle);
-    i++;
-    usleep(1000000/WRITE_FREQUENCY);
-  }
-
-  fclose(csv);
-  return NULL;
+  float sample[] = {atan2(-data.accel[2],data.accel[1]), gyro_angle};
+  mip_log_push(&log_file,sample);
+  return 0;
 }
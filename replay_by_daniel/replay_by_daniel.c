@@ -0,0 +1,552 @@
+/*******************************************************************************
+* replay_by_daniel.c
+*
+* Run the complementary filter offline over a recorded session (CSV from
+* write_csv or a .miplog from mip_log) using the same common/daniel_filter.c
+* as filters_by_daniel, optionally sweeping TIME_CONSTANT across all cores,
+* and compare against the recorded bbb_angle.  -q instead runs the float and
+* Q31 fixed point (make FIXED=1) estimator and controllers side by side over
+* the log and reports how far apart they drift.  -k runs the complementary
+* and Kalman tilt estimators (common/tilt_estimator.c) against each other.
+*
+* usage: replay_by_daniel [options] log
+*   -t tau            time constant for a single replay (default 1.0)
+*   -s from:to:step   sweep the time constant instead
+*   -r rate           sample rate in Hz (default from the timestamps)
+*   -j threads        sweep threads (default all cores)
+*   -o out.csv        write the replayed angle of a single replay
+*   -q                compare float against Q31 fixed point
+*   -k                compare the complementary and Kalman estimators
+*   -n qa:qb:r        Kalman noise for -k (default from balance_by_daniel.h)
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "mip_log.h"
+#include "daniel_filter.h"
+#include "biquad.h"
+#include "q31_filter.h"
+#include "c2d.h"
+#include "tilt_estimator.h"
+#include "mip_imu.h"
+#include "mip_safety.h"
+#include "balance_by_daniel.h"
+#include "./replay_by_daniel.h"
+
+// function declarations
+int load_log(const char* name, replay_log_t* log);
+int load_csv(const char* name, replay_log_t* log);
+int load_miplog(const char* name, replay_log_t* log);
+int append_sample(replay_log_t* log, size_t* cap, double t, float a, float g,\
+                  float ref, int has_ref);
+replay_result_t replay(replay_log_t* log, float tau, float* out);
+int compare_fixed(replay_log_t* log, float tau);
+int compare_estimators(replay_log_t* log, float tau, tilt_params_t params);
+void* sweep_worker(void* ptr);
+double wall_time();
+
+/*******************************************************************************
+ * int main()
+ ******************************************************************************/
+int main(int argc, char* argv[])
+{
+  replay_log_t log;
+  replay_sweep_t sweep;
+  pthread_t threads[MAX_THREADS];
+  float tau = DEFAULT_TIME_CONSTANT;
+  float from = 0, to = 0, step = 0;
+  double rate = 0;
+  int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  const char* out_name = NULL;
+  float* out = NULL;
+  FILE* csv;
+  int c, i, best;
+  int fixed = 0;
+  int estimators = 0;
+  tilt_params_t params = {DEFAULT_TIME_CONSTANT, KALMAN_Q_ANGLE,\
+                          KALMAN_Q_BIAS, KALMAN_R_ACCEL};
+  double start, wall;
+  replay_result_t r;
+
+  while((c = getopt(argc, argv, "t:s:r:j:o:qkn:")) != -1)
+  {
+    switch(c)
+    {
+      case 't': tau = atof(optarg); break;
+      case 's':
+        if(sscanf(optarg, "%f:%f:%f", &from, &to, &step) != 3 || step <= 0\
+           || to < from)
+        {
+          printf("bad sweep %s, expected from:to:step\n", optarg);
+          return -1;
+        }
+        break;
+      case 'r': rate = atof(optarg); break;
+      case 'j': nthreads = atoi(optarg); break;
+      case 'o': out_name = optarg; break;
+      case 'q': fixed = 1; break;
+      case 'k': estimators = 1; break;
+      case 'n':
+        if(sscanf(optarg, "%f:%f:%f", &params.q_angle, &params.q_bias,\
+                  &params.r_accel) != 3)
+        {
+          printf("bad noise %s, expected q_angle:q_bias:r_accel\n", optarg);
+          return -1;
+        }
+        break;
+      default: return -1;
+    }
+  }
+  if(optind >= argc)
+  {
+    printf("usage: %s [-t tau | -s from:to:step] [-r rate] [-j threads] "\
+           "[-o out.csv] [-q] [-k [-n qa:qb:r]] log\n", argv[0]);
+    return -1;
+  }
+  if(nthreads < 1) nthreads = 1;
+  if(nthreads > MAX_THREADS) nthreads = MAX_THREADS;
+
+  if(load_log(argv[optind], &log))
+  {
+    printf("Could not read %s\n", argv[optind]);
+    return -1;
+  }
+  if(rate > 0) log.rate = rate;
+  printf("%s: %zu samples at %.1f Hz, reference: %s\n", argv[optind], log.n,
+         log.rate, log.ref ? "bbb_angle" : "a_angle");
+
+  if(fixed) return compare_fixed(&log, tau);
+  if(estimators) return compare_estimators(&log, tau, params);
+
+  // single replay
+  if(step == 0)
+  {
+    if(out_name != NULL) out = malloc(log.n*sizeof(float));
+    start = wall_time();
+    r = replay(&log, tau, out);
+    wall = wall_time() - start;
+    printf("tau %6.3f  rmse %9.6f  max %9.6f  bias %9.6f  "\
+           "(%.1f Msamples/s)\n", r.tau, r.rmse, r.max_err, r.bias,
+           log.n/wall/1e6);
+    if(out != NULL)
+    {
+      csv = fopen(out_name,"w");
+      if(csv == NULL) return -1;
+      fprintf(csv,"time,a_angle,g_angle,bbb_angle,replay_angle\n");
+      for(i=0; i<log.n; i++)
+      {
+        fprintf(csv,"%f,%f,%f,%f,%f\n", log.time[i], log.a_angle[i],
+                log.g_angle[i], log.ref ? log.ref[i] : NAN, out[i]);
+      }
+      fclose(csv);
+    }
+    return 0;
+  }
+
+  // sweep, threads pull time constants off a shared counter
+  sweep.log = &log;
+  sweep.count = (int)((to-from)/step + 1.5);
+  if(sweep.count > MAX_SWEEP) sweep.count = MAX_SWEEP;
+  sweep.taus = malloc(sweep.count*sizeof(float));
+  sweep.results = malloc(sweep.count*sizeof(replay_result_t));
+  for(i=0; i<sweep.count; i++) sweep.taus[i] = from + i*step;
+  atomic_init(&sweep.next, 0);
+
+  start = wall_time();
+  for(i=0; i<nthreads; i++)
+  {
+    pthread_create(&threads[i], NULL, sweep_worker, &sweep);
+  }
+  for(i=0; i<nthreads; i++) pthread_join(threads[i], NULL);
+  wall = wall_time() - start;
+
+  best = 0;
+  printf("%8s %10s %10s %10s\n", "tau", "rmse", "max", "bias");
+  for(i=0; i<sweep.count; i++)
+  {
+    r = sweep.results[i];
+    if(r.rmse < sweep.results[best].rmse) best = i;
+    printf("%8.3f %10.6f %10.6f %10.6f\n", r.tau, r.rmse, r.max_err, r.bias);
+  }
+  printf("best tau %.3f (rmse %.6f)\n", sweep.results[best].tau,
+         sweep.results[best].rmse);
+  printf("%d replays on %d threads in %.3f s (%.1f Msamples/s)\n",
+         sweep.count, nthreads, wall, (double)sweep.count*log.n/wall/1e6);
+  return 0;
+}
+
+/*******************************************************************************
+ * replay_result_t replay(replay_log_t* log, float tau, float* out)
+ *
+ * Stream the log through the complementary filter built exactly as
+ * filters_by_daniel builds it.  Writes every angle to out unless NULL.
+ ******************************************************************************/
+replay_result_t replay(replay_log_t* log, float tau, float* out)
+{
+  replay_result_t r;
+  daniel_filter_t lpass, hpass;
+  float dt = 1.0/log->rate;
+  float lpass_num[] = {dt/tau,0};
+  float lpass_den[] = {1, dt/tau-1};
+  float hpass_num[] = {1-dt/tau,dt/tau-1};
+  float hpass_den[] = {1,dt/tau-1};
+  float* ref = log->ref ? log->ref : log->a_angle;
+  float angle;
+  double err, sq = 0, sum = 0, max = 0;
+  size_t i;
+
+  lpass = create_daniel_filter(1,dt,lpass_num,lpass_den,1,0);
+  hpass = create_daniel_filter(1,dt,hpass_num,hpass_den,1,0);
+
+  for(i=0; i<log->n; i++)
+  {
+    angle = step_filter(&hpass,log->g_angle[i])\
+            + step_filter(&lpass,log->a_angle[i]);
+    if(out != NULL) out[i] = angle;
+    err = angle - ref[i];
+    sq += err*err;
+    sum += err;
+    if(fabs(err) > max) max = fabs(err);
+  }
+
+  destroy_daniel_filter(&lpass);
+  destroy_daniel_filter(&hpass);
+
+  r.tau = tau;
+  r.rmse = sqrt(sq/log->n);
+  r.max_err = max;
+  r.bias = sum/log->n;
+  return r;
+}
+
+/*******************************************************************************
+ * int compare_fixed(replay_log_t* log, float tau)
+ *
+ * Run the angle estimate, D1 and D2 in float and in Q31 over the log, each
+ * chain on its own angle, and print the largest and rms difference of every
+ * stage.  The float high pass sees g_angle, the fixed one its increments, as
+ * in balance_by_daniel.  Both controllers run every sample on the error to a
+ * zero reference, which is only meant to exercise them with real signals.
+ ******************************************************************************/
+int compare_fixed(replay_log_t* log, float tau)
+{
+  daniel_filter_t lpass, hpass, d1, d2;
+  q31_filter_t lpass_q, hpass_q, d1_q, d2_q;
+  float dt = 1.0/log->rate;
+  float lpass_num[] = {dt/tau,0};
+  float lpass_den[] = {1, dt/tau-1};
+  float hpass_num[] = {1-dt/tau,dt/tau-1};
+  float hpass_den[] = {1,dt/tau-1};
+  float hpass_step_num[] = {0,0};
+  float d1_num[] = D1_NUM;
+  float d1_den[] = D1_DEN;
+  float d2_num[] = D2_NUM;
+  float d2_den[] = D2_DEN;
+  const char* names[] = {"angle", "D1", "D2"};
+  float f[3], q[3];
+  double err, sq[3] = {0,0,0}, max[3] = {0,0,0};
+  q31_t angle;
+  float g_last = 0;
+  size_t i;
+  int k;
+
+  if(remove_differentiator(1,hpass_num,hpass_step_num)) return -1;
+  lpass = create_daniel_filter(1,dt,lpass_num,lpass_den,1,0);
+  hpass = create_daniel_filter(1,dt,hpass_num,hpass_den,1,0);
+  d1 = create_daniel_filter(D1_ORDER,dt,d1_num,d1_den,D1_GAIN,D1_SAT);
+  d2 = create_daniel_filter(D2_ORDER,dt,d2_num,d2_den,D2_GAIN,D2_SAT);
+  lpass_q = create_q31_filter(1,dt,lpass_num,lpass_den,1,0);
+  hpass_q = create_q31_filter(1,dt,hpass_step_num,hpass_den,1,0);
+  d1_q = create_q31_filter(D1_ORDER,dt,d1_num,d1_den,D1_GAIN,D1_SAT);
+  d2_q = create_q31_filter(D2_ORDER,dt,d2_num,d2_den,D2_GAIN,D2_SAT);
+  if(!lpass_q.initialized || !hpass_q.initialized || !d1_q.initialized\
+     || !d2_q.initialized) return -1;
+
+  for(i=0; i<log->n; i++)
+  {
+    f[0] = step_filter(&hpass,log->g_angle[i])\
+           + step_filter(&lpass,log->a_angle[i]);
+    f[1] = step_filter(&d1,-f[0]);
+    f[2] = step_filter(&d2,-f[0]);
+
+    angle = q31_add(step_q31_filter(&hpass_q,\
+                      q31_from_float(log->g_angle[i] - g_last)),\
+                    step_q31_filter(&lpass_q,q31_from_float(log->a_angle[i])));
+    g_last = log->g_angle[i];
+    q[0] = q31_to_float(angle);
+    q[1] = q31_to_float(step_q31_filter(&d1_q,-angle));
+    q[2] = q31_to_float(step_q31_filter(&d2_q,-angle));
+
+    for(k=0; k<3; k++)
+    {
+      err = fabs(q[k] - f[k]);
+      sq[k] += err*err;
+      if(err > max[k]) max[k] = err;
+    }
+  }
+
+  printf("tau %.3f, Q%d signals, float vs fixed over %zu samples\n", tau,
+         Q31_SIGNAL_FRAC, log->n);
+  printf("%8s %12s %12s\n", "stage", "max", "rms");
+  for(k=0; k<3; k++)
+  {
+    printf("%8s %12.3g %12.3g\n", names[k], max[k], sqrt(sq[k]/log->n));
+  }
+
+  destroy_daniel_filter(&lpass);
+  destroy_daniel_filter(&hpass);
+  destroy_daniel_filter(&d1);
+  destroy_daniel_filter(&d2);
+  return 0;
+}
+
+/*******************************************************************************
+ * int compare_estimators(replay_log_t* log, float tau, tilt_params_t params)
+ *
+ * Both tilt estimators over the log, fed gyro increments and the
+ * accelerometer angle as imu_callback feeds them, each scored against the
+ * reference and against the other.  The log is then streamed again until
+ * there are enough updates to time one.
+ ******************************************************************************/
+int compare_estimators(replay_log_t* log, float tau, tilt_params_t params)
+{
+  tilt_estimator_t e[2];
+  const char* names[] = {"complementary", "kalman"};
+  float* ref = log->ref ? log->ref : log->a_angle;
+  float dt = 1.0/log->rate;
+  float angle[2], g_last;
+  double err, sq[2] = {0,0}, sum[2] = {0,0}, max[2] = {0,0}, diff_sq = 0;
+  double start, ns[2];
+  volatile float sink = 0;
+  size_t i, pass, passes;
+  int k;
+
+  params.time_constant = tau;
+  for(k=0; k<2; k++)
+  {
+    e[k] = create_tilt_estimator(k == 0 ? TILT_COMPLEMENTARY : TILT_KALMAN,\
+                                 dt, params);
+    if(!e[k].initialized) return -1;
+  }
+
+  g_last = 0;
+  for(i=0; i<log->n; i++)
+  {
+    for(k=0; k<2; k++)
+    {
+      angle[k] = tilt_estimator_update(&e[k], log->g_angle[i] - g_last,\
+                                       log->a_angle[i]);
+      err = angle[k] - ref[i];
+      sq[k] += err*err;
+      sum[k] += err;
+      if(fabs(err) > max[k]) max[k] = fabs(err);
+    }
+    g_last = log->g_angle[i];
+    diff_sq += (angle[1]-angle[0])*(angle[1]-angle[0]);
+  }
+
+  printf("tau %.3f, kalman q_angle %g q_bias %g r_accel %g, against %s\n",\
+         tau, params.q_angle, params.q_bias, params.r_accel,\
+         log->ref ? "bbb_angle" : "a_angle");
+  printf("%14s %10s %10s %10s\n", "estimator", "rmse", "max", "bias");
+  for(k=0; k<2; k++)
+  {
+    printf("%14s %10.6f %10.6f %10.6f\n", names[k], sqrt(sq[k]/log->n),\
+           max[k], sum[k]/log->n);
+  }
+  printf("rms difference %.6f rad, kalman gyro bias %.4f deg/s\n",\
+         sqrt(diff_sq/log->n), e[1].bias*180/M_PI);
+
+  // cost per update, the whole log over and over
+  passes = 1;
+  while(passes*log->n < 1000000) passes *= 2;
+  for(k=0; k<2; k++)
+  {
+    reset_tilt_estimator(&e[k]);
+    start = wall_time();
+    for(pass=0; pass<passes; pass++)
+    {
+      g_last = 0;
+      for(i=0; i<log->n; i++)
+      {
+        sink += tilt_estimator_update(&e[k], log->g_angle[i] - g_last,\
+                                      log->a_angle[i]);
+        g_last = log->g_angle[i];
+      }
+    }
+    ns[k] = (wall_time() - start)*1e9/((double)passes*log->n);
+    destroy_tilt_estimator(&e[k]);
+  }
+  printf("cost per update: complementary %.1f ns, kalman %.1f ns\n",\
+         ns[0], ns[1]);
+  return 0;
+}
+
+/*******************************************************************************
+ * void* sweep_worker(void* ptr)
+ *
+ * Replay time constants until the sweep runs out
+ ******************************************************************************/
+void* sweep_worker(void* ptr)
+{
+  replay_sweep_t* sweep = (replay_sweep_t*)ptr;
+  int i;
+  while((i = atomic_fetch_add(&sweep->next, 1)) < sweep->count)
+  {
+    sweep->results[i] = replay(sweep->log, sweep->taus[i], NULL);
+  }
+  return NULL;
+}
+
+/*******************************************************************************
+ * int load_log(const char* name, replay_log_t* log)
+ *
+ * Load a .miplog or CSV log into memory and estimate its sample rate
+ ******************************************************************************/
+int load_log(const char* name, replay_log_t* log)
+{
+  int ret;
+  memset(log, 0, sizeof(replay_log_t));
+  ret = load_miplog(name, log);
+  if(ret) ret = load_csv(name, log);
+  if(ret || log->n < 2) return -1;
+  log->rate = (log->n-1)/(log->time[log->n-1] - log->time[0]);
+  return 0;
+}
+
+/*******************************************************************************
+ * int append_sample(replay_log_t* log, size_t* cap, double t, float a,
+ *                   float g, float ref, int has_ref)
+ ******************************************************************************/
+int append_sample(replay_log_t* log, size_t* cap, double t, float a, float g,\
+                  float ref, int has_ref)
+{
+  if(log->n == *cap)
+  {
+    *cap = *cap ? 2*(*cap) : 1024;
+    log->time    = realloc(log->time, *cap*sizeof(double));
+    log->a_angle = realloc(log->a_angle, *cap*sizeof(float));
+    log->g_angle = realloc(log->g_angle, *cap*sizeof(float));
+    if(has_ref) log->ref = realloc(log->ref, *cap*sizeof(float));
+    if(!log->time || !log->a_angle || !log->g_angle || (has_ref && !log->ref))
+    {
+      return -1;
+    }
+  }
+  log->time[log->n]    = t;
+  log->a_angle[log->n] = a;
+  log->g_angle[log->n] = g;
+  if(has_ref) log->ref[log->n] = ref;
+  log->n++;
+  return 0;
+}
+
+/*******************************************************************************
+ * static int find_column(char names[][MIP_LOG_NAME_LEN], int n, ...)
+ *
+ * Index of the first column matching either name, -1 if none
+ ******************************************************************************/
+static int find_column(char names[][MIP_LOG_NAME_LEN], int n, const char* a,\
+                       const char* b)
+{
+  int i;
+  for(i=0; i<n; i++)
+  {
+    if(!strcmp(names[i],a) || (b && !strcmp(names[i],b))) return i;
+  }
+  return -1;
+}
+
+/*******************************************************************************
+ * int load_miplog(const char* name, replay_log_t* log)
+ ******************************************************************************/
+int load_miplog(const char* name, replay_log_t* log)
+{
+  char names[MIP_LOG_MAX_FIELDS][MIP_LOG_NAME_LEN];
+  float v[MIP_LOG_MAX_FIELDS];
+  int64_t t_ns;
+  int fields, a, g, ref;
+  size_t cap = 0;
+  FILE* in = mip_log_read_open(name, &fields, names);
+
+  if(in == NULL) return -1;
+  a   = find_column(names, fields, "a_angle", "accel_angle");
+  g   = find_column(names, fields, "g_angle", "gyro_angle");
+  ref = find_column(names, fields, "bbb_angle", NULL);
+  if(a < 0 || g < 0)
+  {
+    fclose(in);
+    return -1;
+  }
+  while(mip_log_read(in, fields, &t_ns, v) == 0)
+  {
+    if(append_sample(log, &cap, t_ns/1e9, v[a], v[g], ref<0 ? 0 : v[ref],\
+                     ref >= 0)) break;
+  }
+  fclose(in);
+  return 0;
+}
+
+/*******************************************************************************
+ * int load_csv(const char* name, replay_log_t* log)
+ *
+ * CSV with a header row, as written by write_csv or log_to_csv
+ ******************************************************************************/
+int load_csv(const char* name, replay_log_t* log)
+{
+  char line[MAX_LINE];
+  char names[MIP_LOG_MAX_FIELDS+1][MIP_LOG_NAME_LEN];
+  double col[MIP_LOG_MAX_FIELDS+1];
+  char *tok, *save;
+  int n = 0, i, t, a, g, ref;
+  size_t cap = 0;
+  FILE* in = fopen(name,"r");
+
+  if(in == NULL || fgets(line, MAX_LINE, in) == NULL) return -1;
+  for(tok = strtok_r(line, ",\r\n", &save); tok && n <= MIP_LOG_MAX_FIELDS;\
+      tok = strtok_r(NULL, ",\r\n", &save))
+  {
+    snprintf(names[n++], MIP_LOG_NAME_LEN, "%s", tok);
+  }
+  t   = find_column(names, n, "time", NULL);
+  a   = find_column(names, n, "a_angle", "accel_angle");
+  g   = find_column(names, n, "g_angle", "gyro_angle");
+  ref = find_column(names, n, "bbb_angle", NULL);
+  if(t < 0 || a < 0 || g < 0)
+  {
+    fclose(in);
+    return -1;
+  }
+
+  while(fgets(line, MAX_LINE, in) != NULL)
+  {
+    i = 0;
+    for(tok = strtok_r(line, ",\r\n", &save); tok && i < n;\
+        tok = strtok_r(NULL, ",\r\n", &save))
+    {
+      col[i++] = atof(tok);
+    }
+    if(i < n) continue;
+    if(append_sample(log, &cap, col[t], col[a], col[g], ref<0 ? 0 : col[ref],\
+                     ref >= 0)) break;
+  }
+  fclose(in);
+  return 0;
+}
+
+/*******************************************************************************
+ * double wall_time()
+ ******************************************************************************/
+double wall_time()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec/1e9;
+}
@@ -0,0 +1,44 @@
+/*******************************************************************************
+ * replay_by_daniel.h
+ *
+ * Configurations and definitions and stuff for "replay_by_daniel.c"
+ ******************************************************************************/
+
+// Defaults
+#define DEFAULT_TIME_CONSTANT   1.0
+#define MAX_LINE                1024
+#define MAX_THREADS             64
+#define MAX_SWEEP               100000
+
+// A recorded session, one array per column
+typedef struct replay_log_t
+{
+  size_t n;
+  double* time;
+  float* a_angle;
+  float* g_angle;
+  float* ref;           // recorded bbb_angle, NULL if the log has none
+  double rate;          // Hz, from the timestamps unless overridden
+
+} replay_log_t;
+
+// Comparison of one replay against the reference
+typedef struct replay_result_t
+{
+  float tau;
+  double rmse;
+  double max_err;
+  double bias;
+
+} replay_result_t;
+
+// Work shared by the sweep threads
+typedef struct replay_sweep_t
+{
+  replay_log_t* log;
+  float* taus;
+  replay_result_t* results;
+  int count;
+  atomic_int next;
+
+} replay_sweep_t;
@@ -0,0 +1,818 @@
+/*******************************************************************************
+* tune_by_daniel.c
+*
+* Tune D1 and D2 against the plant model instead of on the robot.  Every
+* trial is one closed loop run of balance_by_daniel's estimator, inner and
+* outer loop (same filters, rates and saturations from balance_by_daniel.h)
+* against its own mip_plant_t, so any number run at once.  Candidates are
+* scored on settling time, overshoot, control effort and tipping over across
+* a set of scenarios, and a Nelder-Mead search spreads every batch of
+* candidate x scenario trials over all cores.  The best gains are written as
+* a block to paste into balance_by_daniel.h.
+*
+* usage: tune_by_daniel [options]
+*   -i iterations     Nelder-Mead iterations (default 300)
+*   -r restarts       fresh simplexes around the best point (default 3)
+*   -t seconds        simulated time per scenario (default 8)
+*   -j threads        worker threads (default all cores)
+*   -o header         where to write the gains (default tuned_gains.h)
+*   -e                only score the gains in balance_by_daniel.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "mip_plant.h"
+#include "daniel_filter.h"
+#include "biquad.h"
+#include "q31_filter.h"
+#include "c2d.h"
+#include "mip_imu.h"
+#include "mip_safety.h"
+#include "balance_by_daniel.h"
+#include "./tune_by_daniel.h"
+
+#ifndef TWO_PI
+#define TWO_PI       (2.0*M_PI)
+#endif
+#ifndef DEG_TO_RAD
+#define DEG_TO_RAD   0.0174532925199
+#endif
+#ifndef RAD_TO_DEG
+#define RAD_TO_DEG   57.295779513
+#endif
+
+#if D1_ORDER != 2 || D2_ORDER != 1
+#error "tune_by_daniel searches a second order D1 and a first order D2"
+#endif
+
+// a macro from balance_by_daniel.h as it is written there
+#define HEADER_TEXT(...)   HEADER_STRING(__VA_ARGS__)
+#define HEADER_STRING(...) #__VA_ARGS__
+
+// function declarations
+tune_gains_t header_gains();
+int gains_to_params(const tune_gains_t* g, double* x);
+void params_to_gains(const double* x, tune_gains_t* g);
+int gains_feasible(const tune_gains_t* g);
+tune_score_t run_trial(const tune_gains_t* g, int scenario, float seconds);
+int start_pool(tune_pool_t* pool, int nthreads, float seconds);
+void stop_pool(tune_pool_t* pool);
+void run_jobs(tune_pool_t* pool);
+void* pool_worker(void* ptr);
+int evaluate(tune_pool_t* pool, double (*x)[TUNE_PARAMS], int n,\
+             tune_score_t* scores);
+int nelder_mead(tune_pool_t* pool, double* x, int iterations,\
+                tune_score_t* best);
+int write_header(const char* name, const tune_gains_t* g,\
+                 tune_score_t tuned, tune_score_t before);
+void print_score(const char* label, tune_score_t s);
+double wall_time();
+
+// Released from a tilt, and driven to a new wheel angle from upright
+static const tune_scenario_t scenarios[] =
+{
+  {"tilt +0.1",   0.1,  0.0},
+  {"tilt -0.1",  -0.1,  0.0},
+  {"tilt +0.25",  0.25, 0.0},
+  {"tilt -0.25", -0.25, 0.0},
+  {"drive +1",      0.0,  1.0},
+  {"drive -1",      0.0, -1.0},
+};
+#define SCENARIOS  (int)(sizeof(scenarios)/sizeof(tune_scenario_t))
+
+/*******************************************************************************
+ * int main()
+ ******************************************************************************/
+int main(int argc, char* argv[])
+{
+  tune_pool_t pool;
+  tune_gains_t gains;
+  tune_score_t before, tuned;
+  double x[TUNE_PARAMS];
+  float seconds = DEFAULT_SECONDS;
+  int iterations = DEFAULT_ITERATIONS;
+  int restarts = DEFAULT_RESTARTS;
+  int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  const char* header = DEFAULT_HEADER;
+  int score_only = 0;
+  int c, r, done;
+  tune_score_t last;
+  double start, wall;
+
+  while((c = getopt(argc, argv, "i:r:t:j:o:e")) != -1)
+  {
+    switch(c)
+    {
+      case 'i': iterations = atoi(optarg); break;
+      case 'r': restarts = atoi(optarg); break;
+      case 't': seconds = atof(optarg); break;
+      case 'j': nthreads = atoi(optarg); break;
+      case 'o': header = optarg; break;
+      case 'e': score_only = 1; break;
+      default:
+        printf("usage: %s [-i iterations] [-r restarts] [-t seconds] "\
+               "[-j threads] [-o header] [-e]\n", argv[0]);
+        return -1;
+    }
+  }
+  if(nthreads < 1) nthreads = 1;
+  if(nthreads > MAX_THREADS) nthreads = MAX_THREADS;
+  if(seconds <= 0) seconds = DEFAULT_SECONDS;
+
+  gains = header_gains();
+  if(gains_to_params(&gains, x))
+  {
+    printf("D1/D2 in balance_by_daniel.h are outside the search space\n");
+    return -1;
+  }
+  if(start_pool(&pool, nthreads, seconds)) return -1;
+
+  evaluate(&pool, &x, 1, &before);
+  print_score("balance_by_daniel.h", before);
+  if(score_only)
+  {
+    stop_pool(&pool);
+    return 0;
+  }
+
+  printf("%d scenarios x %.1f s, %d threads\n", SCENARIOS, seconds, nthreads);
+  pool.trials = 0;
+  start = wall_time();
+  // a collapsed simplex often sits on a plateau of the tip penalty, so
+  // start over around the best point while that keeps paying off
+  done = nelder_mead(&pool, x, iterations, &tuned);
+  for(r=0; r<restarts; r++)
+  {
+    last = tuned;
+    done += nelder_mead(&pool, x, iterations, &tuned);
+    if(tuned.cost >= last.cost*(1 - DEFAULT_TOLERANCE)) break;
+  }
+  wall = wall_time() - start;
+  stop_pool(&pool);
+
+  print_score("tuned", tuned);
+  printf("%d iterations, %llu trials in %.2f s: %.0f trials/s "\
+         "(%.0fx real time)\n", done, (unsigned long long)pool.trials, wall,
+         pool.trials/wall, pool.trials*seconds/wall);
+
+  params_to_gains(x, &gains);
+  if(tuned.cost >= before.cost)
+  {
+    printf("no improvement, %s not written\n", header);
+    return 0;
+  }
+  if(write_header(header, &gains, tuned, before)) return -1;
+  printf("wrote %s\n", header);
+  return 0;
+}
+
+/*******************************************************************************
+ * tune_gains_t header_gains()
+ *
+ * The controller balance_by_daniel is built with
+ ******************************************************************************/
+tune_gains_t header_gains()
+{
+  tune_gains_t g;
+  float d1_num[] = D1_NUM;
+  float d1_den[] = D1_DEN;
+  float d2_num[] = D2_NUM;
+  float d2_den[] = D2_DEN;
+
+  g.d1_gain = D1_GAIN;
+  memcpy(g.d1_num, d1_num, sizeof(g.d1_num));
+  memcpy(g.d1_den, d1_den, sizeof(g.d1_den));
+  g.d2_gain = D2_GAIN;
+  memcpy(g.d2_num, d2_num, sizeof(g.d2_num));
+  memcpy(g.d2_den, d2_den, sizeof(g.d2_den));
+  return g;
+}
+
+/*******************************************************************************
+ * int gains_to_params(const tune_gains_t* g, double* x)
+ *
+ * The search runs on continuous time rates instead of raw coefficients, which
+ * crowd toward 1 at these loop rates and would make the simplex steps
+ * meaningless.  D1 keeps its integrator and D2 its structure:
+ *
+ *   x[0]  ln|D1 gain|
+ *   x[1]  ln wn of the D1 zero pair, (1 + b1 + b2) = (wn dt)^2
+ *   x[2]  zeta of the D1 zero pair,  (2 + b1) = 2 zeta wn dt
+ *   x[3]  ln rate of the D1 pole,    p = 1 - rate dt
+ *   x[4]  ln|D2 gain|
+ *   x[5]  ln rate of the D2 zero
+ *   x[6]  ln rate of the D2 pole
+ *
+ * Gain signs stay as in the header.  Returns -1 if g doesn't fit this form.
+ ******************************************************************************/
+int gains_to_params(const tune_gains_t* g, double* x)
+{
+  double dt1 = 1.0/INNER_LOOP_FREQUENCY;
+  double dt2 = 1.0/OUTER_LOOP_FREQUENCY;
+  double b1 = g->d1_num[1]/g->d1_num[0];
+  double b2 = g->d1_num[2]/g->d1_num[0];
+  double u = 1 + b1 + b2;
+  double v = 2 + b1;
+  double p1 = g->d1_den[2]/g->d1_den[0];
+
+  // D1 needs its pole at z=1
+  if(fabs(g->d1_den[0] + g->d1_den[1] + g->d1_den[2]) > 1e-4*fabs(g->d1_den[0]))
+  {
+    return -1;
+  }
+  if(u <= 0 || v <= 0 || p1 >= 1 || g->d1_gain == 0 || g->d2_gain == 0)
+  {
+    return -1;
+  }
+  if(-g->d2_num[1]/g->d2_num[0] >= 1 || -g->d2_den[1]/g->d2_den[0] >= 1)
+  {
+    return -1;
+  }
+
+  x[0] = log(fabs(g->d1_gain*g->d1_num[0]/g->d1_den[0]));
+  x[1] = log(sqrt(u)/dt1);
+  x[2] = v/(2*sqrt(u));
+  x[3] = log((1-p1)/dt1);
+  x[4] = log(fabs(g->d2_gain*g->d2_num[0]/g->d2_den[0]));
+  x[5] = log((1 + g->d2_num[1]/g->d2_num[0])/dt2);
+  x[6] = log((1 + g->d2_den[1]/g->d2_den[0])/dt2);
+  return 0;
+}
+
+/*******************************************************************************
+ * void params_to_gains(const double* x, tune_gains_t* g)
+ *
+ * Inverse of gains_to_params, gain signs from balance_by_daniel.h
+ ******************************************************************************/
+void params_to_gains(const double* x, tune_gains_t* g)
+{
+  double dt1 = 1.0/INNER_LOOP_FREQUENCY;
+  double dt2 = 1.0/OUTER_LOOP_FREQUENCY;
+  double wdt = exp(x[1])*dt1;
+  double p1 = 1 - exp(x[3])*dt1;
+
+  g->d1_gain = (D1_GAIN < 0 ? -1 : 1)*exp(x[0]);
+  g->d1_num[0] = 1;
+  g->d1_num[1] = 2*x[2]*wdt - 2;
+  g->d1_num[2] = wdt*wdt - 2*x[2]*wdt + 1;
+  g->d1_den[0] = 1;
+  g->d1_den[1] = -(1 + p1);
+  g->d1_den[2] = p1;
+  g->d2_gain = (D2_GAIN < 0 ? -1 : 1)*exp(x[4]);
+  g->d2_num[0] = 1;
+  g->d2_num[1] = -(1 - exp(x[5])*dt2);
+  g->d2_den[0] = 1;
+  g->d2_den[1] = -(1 - exp(x[6])*dt2);
+}
+
+/*******************************************************************************
+ * int gains_feasible(const tune_gains_t* g)
+ *
+ * Controller poles inside the unit circle, apart from the integrator
+ ******************************************************************************/
+int gains_feasible(const tune_gains_t* g)
+{
+  if(fabs(g->d1_den[2]) >= 1) return 0;
+  if(fabs(g->d2_den[1]) >= 1) return 0;
+  return 1;
+}
+
+/*******************************************************************************
+ * static float trial_noise(uint32_t* rng, float rms)
+ *
+ * sim_noise from mip_sim.c on a per trial generator
+ ******************************************************************************/
+static float trial_noise(uint32_t* rng, float rms)
+{
+  float u1, u2;
+  *rng ^= *rng << 13;
+  *rng ^= *rng >> 17;
+  *rng ^= *rng << 5;
+  u1 = ((*rng >> 8) + 1.0f)/16777217.0f;
+  *rng ^= *rng << 13;
+  *rng ^= *rng >> 17;
+  *rng ^= *rng << 5;
+  u2 = (*rng >> 8)/16777216.0f;
+  return rms*sqrtf(-2.0f*logf(u1))*cosf(TWO_PI*u2);
+}
+
+/*******************************************************************************
+ * static int trial_encoder(double phi, int polarity)
+ *
+ * Encoder count for wheel angle phi, as sim_encoder_raw in mip_sim.c
+ ******************************************************************************/
+static int trial_encoder(double phi, int polarity)
+{
+  return (int)floor(phi*GEAR_RATIO*ENCODER_TICKS/TWO_PI*polarity);
+}
+
+/*******************************************************************************
+ * tune_score_t run_trial(const tune_gains_t* g, int scenario, float seconds)
+ *
+ * One closed loop run, everything on the stack so any number can run at
+ * once.  Follows run_simulation in balance_by_daniel.c with the DMP, the
+ * complementary estimator and the loop timing from the header: the body is
+ * held at theta0 and the loops run disarmed until supervise_mip's arming
+ * test passes on an inner loop tick after START_DELAY, which zeroes the
+ * controllers and encoders but leaves the estimator as far from converged as
+ * it is on the robot.  Once armed, the TIP_ANGLE, SATURATION_TIME and
+ * RUNAWAY_ANGLE limits are checked on every inner loop tick as on the robot,
+ * and a trip scores as tipping over.  Not modelled: IMU stalls, the watchdog,
+ * pauses and reloads, none of which depend on the gains.
+ *
+ * Scored on the true state from arming on.  The noise sequence depends only
+ * on the scenario so candidates are compared on identical disturbances.
+ ******************************************************************************/
+tune_score_t run_trial(const tune_gains_t* g, int scenario, float seconds)
+{
+  const tune_scenario_t* s = &scenarios[scenario];
+  tune_score_t score;
+  mip_plant_t plant;
+  controller_filter_t iloop, oloop;
+  daniel_filter_t lpass, hpass;
+  float d1_num[3], d1_den[3], d2_num[2], d2_den[2];
+  float dt = 1.0/(float)SAMPLE_FREQUENCY;
+  float lpass_num[] = {dt/TIME_CONSTANT,0};
+  float lpass_den[] = {1, dt/TIME_CONSTANT-1};
+  float hpass_num[] = {1-dt/TIME_CONSTANT,dt/TIME_CONSTANT-1};
+  float hpass_den[] = {1,dt/TIME_CONSTANT-1};
+  uint32_t rng = 2463534242u + 7919u*scenario;
+  uint64_t samples = (seconds + START_DELAY)*SAMPLE_FREQUENCY;
+  uint64_t i, armed_at = 0, ticks = 0;
+  safety_limit_t limits[SAFETY_LIMITS];
+  int armed = 0, held = 1, trip, outer;
+  int offset_l = 0, offset_r = 0;
+  float theta = 0, theta_r = 0, u = 0, g_angle = 0, a_angle, sensor_angle;
+  float phi = 0, phi_left, phi_right, accel_y, accel_z, gyro;
+  double t, err0, over = 0, sq = 0, settled = 0, phi0 = 0, wheel;
+
+  memset(&score, 0, sizeof(tune_score_t));
+  if(!gains_feasible(g))
+  {
+    score.cost = TUNE_INFEASIBLE;
+    score.tipped = 1;
+    return score;
+  }
+
+  memcpy(d1_num, g->d1_num, sizeof(d1_num));
+  memcpy(d1_den, g->d1_den, sizeof(d1_den));
+  memcpy(d2_num, g->d2_num, sizeof(d2_num));
+  memcpy(d2_den, g->d2_den, sizeof(d2_den));
+  iloop = create_controller_filter(D1_ORDER,1.0/INNER_LOOP_FREQUENCY,\
+                                   d1_num,d1_den,g->d1_gain,D1_SAT);
+  oloop = create_controller_filter(D2_ORDER,1.0/OUTER_LOOP_FREQUENCY,\
+                                   d2_num,d2_den,g->d2_gain,D2_SAT);
+  lpass = create_daniel_filter(1,dt,lpass_num,lpass_den,1,0);
+  hpass = create_daniel_filter(1,dt,hpass_num,hpass_den,1,0);
+  mip_plant_init(&plant, mip_plant_default_params(GEAR_RATIO, WHEEL_RADIUS),\
+                 s->theta0);
+
+  // as initialize_supervisor, the trial's IMU never stalls
+  safety_limit_init(&limits[SAFETY_TIP], "tip", TIP_ANGLE, 0,\
+                    INNER_LOOP_FREQUENCY);
+  safety_limit_init(&limits[SAFETY_SATURATION], "saturation",\
+                    SATURATION_TIME > 0 ? 0.999 : 0, SATURATION_TIME,\
+                    INNER_LOOP_FREQUENCY);
+  safety_limit_init(&limits[SAFETY_RUNAWAY], "runaway", RUNAWAY_ANGLE, 0,\
+                    INNER_LOOP_FREQUENCY);
+  safety_limit_init(&limits[SAFETY_IMU_STALL], "imu stall", 0, 0,\
+                    INNER_LOOP_FREQUENCY);
+
+  // the error each scenario starts out correcting, for overshoot
+  err0 = s->phi_r != 0 ? s->phi_r : -s->theta0;
+
+  for(i=0; i<samples; i++)
+  {
+    // sim_step, held like a hand holding the MiP until the motors enable
+    mip_plant_step(&plant, u, armed, dt);
+    if(held)
+    {
+      if(armed) held = 0;
+      else
+      {
+        plant.psi += s->theta0 - plant.theta;
+        plant.psi_dot -= plant.theta_dot;
+        plant.theta = s->theta0;
+        plant.theta_dot = 0.0;
+      }
+    }
+    sensor_angle = plant.theta - CAPE_MOUNT_ANGLE;
+    accel_y = MIP_GRAVITY*cos(sensor_angle) + trial_noise(&rng,TUNE_ACCEL_NOISE);
+    accel_z = -MIP_GRAVITY*sin(sensor_angle)\
+              + trial_noise(&rng,TUNE_ACCEL_NOISE);
+    gyro = plant.theta_dot*RAD_TO_DEG + trial_noise(&rng,TUNE_GYRO_NOISE);
+
+    // imu_callback
+    g_angle += gyro/SAMPLE_FREQUENCY*DEG_TO_RAD;
+    a_angle = atan2(-accel_z,accel_y);
+    theta = step_filter(&hpass,g_angle) + step_filter(&lpass,a_angle)\
+            + CAPE_MOUNT_ANGLE;
+
+    // inner_loop_step with supervise_mip, then outer_loop_step, on their
+    // rollovers or on the outer loop's phase of the inner loop ticks
+    outer = !OUTER_LOOP_PHASE_LOCKED\
+            && (i*OUTER_LOOP_FREQUENCY)/SAMPLE_FREQUENCY\
+               != ((i+1)*OUTER_LOOP_FREQUENCY)/SAMPLE_FREQUENCY;
+    if((i*INNER_LOOP_FREQUENCY)/SAMPLE_FREQUENCY \
+       != ((i+1)*INNER_LOOP_FREQUENCY)/SAMPLE_FREQUENCY)
+    {
+      u = step_controller_filter(&iloop,theta_r - theta);
+      ticks++;
+      if(armed)
+      {
+        trip  = safety_limit_check(&limits[SAFETY_TIP], theta);
+        trip |= safety_limit_check(&limits[SAFETY_SATURATION],\
+                                   D1_SAT > 0 ? u/D1_SAT : 0);
+        trip |= safety_limit_check(&limits[SAFETY_RUNAWAY], phi - s->phi_r);
+        if(trip)
+        {
+          // disarmed, the MiP falls over
+          score.tipped = 1;
+          break;
+        }
+      }
+      else if(ticks > (uint64_t)(START_DELAY*INNER_LOOP_FREQUENCY)\
+              && fabs(theta) < START_ANGLE)
+      {
+        // arm_mip, the motors get nothing until the next tick
+        zero_controller_filter(&iloop);
+        zero_controller_filter(&oloop);
+        offset_l = trial_encoder(mip_plant_phi(&plant),ENCODER_POLARITY_L);
+        offset_r = trial_encoder(mip_plant_phi(&plant),ENCODER_POLARITY_R);
+        armed = 1;
+        armed_at = i+1;
+        phi0 = mip_plant_phi(&plant);
+        u = 0;
+      }
+      if(OUTER_LOOP_PHASE_LOCKED && (ticks-1)\
+         % (INNER_LOOP_FREQUENCY/OUTER_LOOP_FREQUENCY) == OUTER_LOOP_PHASE)
+      {
+        outer = 1;
+      }
+    }
+    if(outer)
+    {
+      phi_right = ((trial_encoder(mip_plant_phi(&plant),ENCODER_POLARITY_R)\
+                   - offset_r)*TWO_PI)\
+                  /(ENCODER_POLARITY_R*GEAR_RATIO*ENCODER_TICKS);
+      phi_left  = ((trial_encoder(mip_plant_phi(&plant),ENCODER_POLARITY_L)\
+                   - offset_l)*TWO_PI)\
+                  /(ENCODER_POLARITY_L*GEAR_RATIO*ENCODER_TICKS);
+      phi = (phi_right + phi_left)/2.0;
+      theta_r = step_controller_filter(&oloop,s->phi_r - phi - theta);
+    }
+    if(!armed) continue;
+
+    // score on the true state
+    t = (double)(i+1-armed_at)/SAMPLE_FREQUENCY;
+    if(t > seconds) break;
+    if(fabs(plant.theta) > TIP_ANGLE)
+    {
+      score.tipped = 1;
+      break;
+    }
+    wheel = mip_plant_phi(&plant) - phi0;
+    if(fabs(plant.theta) > TUNE_THETA_BAND\
+       || fabs(wheel - s->phi_r) > TUNE_PHI_BAND) settled = t;
+    if(s->phi_r != 0)
+    {
+      if((wheel - s->phi_r)*err0 > over) over = (wheel - s->phi_r)*err0;
+    }
+    else if(plant.theta*err0 > over) over = plant.theta*err0;
+    sq += u*u;
+  }
+
+  // never armed counts as tipping right away
+  if(!armed) score.tipped = 1;
+  t = armed ? (double)(i-armed_at)/SAMPLE_FREQUENCY : 0;
+  score.settle = score.tipped ? seconds : settled;
+  score.overshoot = err0 != 0 ? over/(err0*err0) : 0;
+  score.effort = t > 0 ? sq/(t*SAMPLE_FREQUENCY) : 0;
+  score.cost = TUNE_W_SETTLE*score.settle + TUNE_W_OVERSHOOT*score.overshoot\
+               + TUNE_W_EFFORT*score.effort;
+  if(score.tipped) score.cost += TUNE_TIP_PENALTY*(2 - t/seconds);
+
+  destroy_controller_filter(&iloop);
+  destroy_controller_filter(&oloop);
+  destroy_daniel_filter(&lpass);
+  destroy_daniel_filter(&hpass);
+  return score;
+}
+
+/*******************************************************************************
+ * int start_pool(tune_pool_t* pool, int nthreads, float seconds)
+ *
+ * nthreads-1 workers, the thread calling evaluate makes up the last one
+ ******************************************************************************/
+int start_pool(tune_pool_t* pool, int nthreads, float seconds)
+{
+  int i;
+  memset(pool, 0, sizeof(tune_pool_t));
+  pool->nthreads = nthreads;
+  pool->seconds = seconds;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->go, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  atomic_init(&pool->next, 0);
+  for(i=1; i<nthreads; i++)
+  {
+    if(pthread_create(&pool->threads[i], NULL, pool_worker, pool))
+    {
+      printf("ERROR: failed to start worker %d\n", i);
+      pool->nthreads = i;
+      stop_pool(pool);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * void stop_pool(tune_pool_t* pool)
+ ******************************************************************************/
+void stop_pool(tune_pool_t* pool)
+{
+  int i;
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->go);
+  pthread_mutex_unlock(&pool->lock);
+  for(i=1; i<pool->nthreads; i++) pthread_join(pool->threads[i], NULL);
+}
+
+/*******************************************************************************
+ * void run_jobs(tune_pool_t* pool)
+ *
+ * Pull trials off the shared counter until the batch runs out
+ ******************************************************************************/
+void run_jobs(tune_pool_t* pool)
+{
+  int i;
+  tune_job_t* job;
+  while((i = atomic_fetch_add(&pool->next, 1)) < pool->njobs)
+  {
+    job = &pool->jobs[i];
+    job->score = run_trial(&job->gains, job->scenario, pool->seconds);
+  }
+}
+
+/*******************************************************************************
+ * void* pool_worker(void* ptr)
+ *
+ * Sleep until evaluate posts a new batch, help finish it, repeat
+ ******************************************************************************/
+void* pool_worker(void* ptr)
+{
+  tune_pool_t* pool = ptr;
+  int generation = 0;
+
+  while(1)
+  {
+    pthread_mutex_lock(&pool->lock);
+    while(generation == pool->generation && !pool->quit)
+    {
+      pthread_cond_wait(&pool->go, &pool->lock);
+    }
+    if(pool->quit)
+    {
+      pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+    generation = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    run_jobs(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    if(--pool->busy == 0) pthread_cond_signal(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+/*******************************************************************************
+ * int evaluate(tune_pool_t* pool, double (*x)[TUNE_PARAMS], int n,
+ *              tune_score_t* scores)
+ *
+ * Score n candidates, each averaged over every scenario.  All n*SCENARIOS
+ * trials go out as one batch.
+ ******************************************************************************/
+int evaluate(tune_pool_t* pool, double (*x)[TUNE_PARAMS], int n,\
+             tune_score_t* scores)
+{
+  tune_job_t* jobs = malloc(n*SCENARIOS*sizeof(tune_job_t));
+  tune_score_t* s;
+  int i, k;
+
+  if(jobs == NULL) return -1;
+  for(i=0; i<n; i++)
+  {
+    for(k=0; k<SCENARIOS; k++)
+    {
+      params_to_gains(x[i], &jobs[i*SCENARIOS+k].gains);
+      jobs[i*SCENARIOS+k].scenario = k;
+    }
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->jobs = jobs;
+  pool->njobs = n*SCENARIOS;
+  atomic_store(&pool->next, 0);
+  pool->busy = pool->nthreads-1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->go);
+  pthread_mutex_unlock(&pool->lock);
+
+  run_jobs(pool);
+
+  pthread_mutex_lock(&pool->lock);
+  while(pool->busy > 0) pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+  pool->trials += n*SCENARIOS;
+
+  for(i=0; i<n; i++)
+  {
+    memset(&scores[i], 0, sizeof(tune_score_t));
+    for(k=0; k<SCENARIOS; k++)
+    {
+      s = &jobs[i*SCENARIOS+k].score;
+      scores[i].cost      += s->cost/SCENARIOS;
+      scores[i].settle    += s->settle/SCENARIOS;
+      scores[i].overshoot += s->overshoot/SCENARIOS;
+      scores[i].effort    += s->effort/SCENARIOS;
+      scores[i].tipped    += s->tipped;
+    }
+  }
+  free(jobs);
+  return 0;
+}
+
+/*******************************************************************************
+ * int nelder_mead(tune_pool_t* pool, double* x, int iterations,
+ *                 tune_score_t* best)
+ *
+ * Minimize the cost starting from x, which is replaced by the best point.
+ * Each iteration scores the reflection, expansion and both contractions in
+ * one batch rather than one after another, trading some extra trials for
+ * a batch wide enough to keep every core busy.  Returns the iterations run.
+ ******************************************************************************/
+int nelder_mead(tune_pool_t* pool, double* x, int iterations,\
+                tune_score_t* best)
+{
+  double simplex[TUNE_PARAMS+1][TUNE_PARAMS];
+  double trial[4][TUNE_PARAMS];
+  double centroid[TUNE_PARAMS];
+  tune_score_t score[TUNE_PARAMS+1], tscore[4], stmp;
+  double tmp[TUNE_PARAMS];
+  int n = TUNE_PARAMS;
+  int i, j, k, it, accept;
+
+  // start around x, one step along each parameter
+  for(i=0; i<=n; i++)
+  {
+    memcpy(simplex[i], x, sizeof(simplex[i]));
+    if(i > 0) simplex[i][i-1] += TUNE_INITIAL_STEP;
+  }
+  evaluate(pool, simplex, n+1, score);
+
+  for(it=0; it<iterations; it++)
+  {
+    // order best to worst
+    for(i=1; i<=n; i++)
+    {
+      for(j=i; j>0 && score[j].cost < score[j-1].cost; j--)
+      {
+        memcpy(tmp, simplex[j], sizeof(tmp));
+        memcpy(simplex[j], simplex[j-1], sizeof(tmp));
+        memcpy(simplex[j-1], tmp, sizeof(tmp));
+        stmp = score[j]; score[j] = score[j-1]; score[j-1] = stmp;
+      }
+    }
+    if(score[n].cost - score[0].cost\
+       <= DEFAULT_TOLERANCE*(1 + fabs(score[0].cost))) break;
+
+    for(k=0; k<n; k++)
+    {
+      centroid[k] = 0;
+      for(i=0; i<n; i++) centroid[k] += simplex[i][k]/n;
+    }
+    for(k=0; k<n; k++)
+    {
+      trial[0][k] = centroid[k] + NM_REFLECT*(centroid[k]-simplex[n][k]);
+      trial[1][k] = centroid[k] + NM_EXPAND*(trial[0][k]-centroid[k]);
+      trial[2][k] = centroid[k] + NM_CONTRACT*(trial[0][k]-centroid[k]);
+      trial[3][k] = centroid[k] - NM_CONTRACT*(centroid[k]-simplex[n][k]);
+    }
+    evaluate(pool, trial, 4, tscore);
+
+    if(tscore[0].cost < score[0].cost)
+    {
+      accept = tscore[1].cost < tscore[0].cost ? 1 : 0;
+    }
+    else if(tscore[0].cost < score[n-1].cost) accept = 0;
+    else if(tscore[0].cost < score[n].cost)
+    {
+      accept = tscore[2].cost <= tscore[0].cost ? 2 : -1;
+    }
+    else accept = tscore[3].cost < score[n].cost ? 3 : -1;
+
+    if(accept >= 0)
+    {
+      memcpy(simplex[n], trial[accept], sizeof(simplex[n]));
+      score[n] = tscore[accept];
+      continue;
+    }
+
+    // shrink toward the best
+    for(i=1; i<=n; i++)
+    {
+      for(k=0; k<n; k++)
+      {
+        simplex[i][k] = simplex[0][k] + NM_SHRINK*(simplex[i][k]-simplex[0][k]);
+      }
+    }
+    evaluate(pool, simplex+1, n, score+1);
+  }
+
+  j = 0;
+  for(i=1; i<=n; i++) if(score[i].cost < score[j].cost) j = i;
+  memcpy(x, simplex[j], n*sizeof(double));
+  *best = score[j];
+  return it;
+}
+
+/*******************************************************************************
+ * int write_header(const char* name, const tune_gains_t* g,
+ *                  tune_score_t tuned, tune_score_t before)
+ *
+ * The controller block of balance_by_daniel.h with the tuned values
+ ******************************************************************************/
+int write_header(const char* name, const tune_gains_t* g,\
+                 tune_score_t tuned, tune_score_t before)
+{
+  FILE* f = fopen(name, "w");
+  if(f == NULL)
+  {
+    printf("ERROR: can't write %s\n", name);
+    return -1;
+  }
+  fprintf(f, "// Generated by tune_by_daniel, replaces the Inner and Outer "\
+             "Loop Controller\n// blocks in balance_by_daniel.h\n");
+  fprintf(f, "// cost %.4f (was %.4f): settle %.3f s, overshoot %.3f, "\
+             "effort %.4f, tipped %.0f\n\n", tuned.cost, before.cost,
+          tuned.settle, tuned.overshoot, tuned.effort, tuned.tipped);
+  // C2D_DISCRETE by number, so the file also works as a -c config; the
+  // continuous designs are balance_by_daniel.h's, unused but still needed
+  fprintf(f, "// Inner Loop Controller, the tuned coefficients as they are\n");
+  fprintf(f, "#define D1_C2D        0             // C2D_DISCRETE\n");
+  fprintf(f, "#define D1_S_GAIN     %s\n", HEADER_TEXT(D1_S_GAIN));
+  fprintf(f, "#define D1_S_ZEROS    %s\n", HEADER_TEXT(D1_S_ZEROS));
+  fprintf(f, "#define D1_S_POLES    %s\n", HEADER_TEXT(D1_S_POLES));
+  fprintf(f, "#define D1_S_PREWARP  %s\n", HEADER_TEXT(D1_S_PREWARP));
+  fprintf(f, "#define D1_GAIN    %.6f\n", g->d1_gain);
+  fprintf(f, "#define D1_ORDER   2\n");
+  fprintf(f, "#define D1_NUM     { %.8f, %.8f, %.8f }\n",\
+          g->d1_num[0], g->d1_num[1], g->d1_num[2]);
+  fprintf(f, "#define D1_DEN     { %.8f, %.8f, %.8f }\n",\
+          g->d1_den[0], g->d1_den[1], g->d1_den[2]);
+  fprintf(f, "#define D1_SAT     %g\n\n", (double)D1_SAT);
+  fprintf(f, "// Outer Loop Controller, the same way\n");
+  fprintf(f, "#define D2_C2D        0             // C2D_DISCRETE\n");
+  fprintf(f, "#define D2_S_GAIN     %s\n", HEADER_TEXT(D2_S_GAIN));
+  fprintf(f, "#define D2_S_ZEROS    %s\n", HEADER_TEXT(D2_S_ZEROS));
+  fprintf(f, "#define D2_S_POLES    %s\n", HEADER_TEXT(D2_S_POLES));
+  fprintf(f, "#define D2_S_PREWARP  %s\n", HEADER_TEXT(D2_S_PREWARP));
+  fprintf(f, "#define D2_GAIN    %.6f\n", g->d2_gain);
+  fprintf(f, "#define D2_ORDER   1\n");
+  fprintf(f, "#define D2_NUM     { %.8f, %.8f }\n", g->d2_num[0], g->d2_num[1]);
+  fprintf(f, "#define D2_DEN     { %.8f, %.8f }\n", g->d2_den[0], g->d2_den[1]);
+  fprintf(f, "#define D2_SAT     %g\n", (double)D2_SAT);
+  fclose(f);
+  return 0;
+}
+
+/*******************************************************************************
+ * void print_score(const char* label, tune_score_t s)
+ ******************************************************************************/
+void print_score(const char* label, tune_score_t s)
+{
+  printf("%-20s cost %9.4f  settle %6.3f s  overshoot %6.3f  "\
+         "effort %7.4f  tipped %.0f/%d\n", label, s.cost, s.settle,
+         s.overshoot, s.effort, s.tipped, SCENARIOS);
+}
+
+/*******************************************************************************
+ * double wall_time()
+ ******************************************************************************/
+double wall_time()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
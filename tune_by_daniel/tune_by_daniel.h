@@ -0,0 +1,94 @@
+/*******************************************************************************
+ * tune_by_daniel.h
+ *
+ * Configurations and definitions and stuff for "tune_by_daniel.c"
+ ******************************************************************************/
+
+// Defaults
+#define DEFAULT_SECONDS         8.0     // per scenario
+#define DEFAULT_ITERATIONS      300     // per restart
+#define DEFAULT_RESTARTS        3
+#define DEFAULT_TOLERANCE       1e-4    // stop when the simplex costs agree
+#define DEFAULT_HEADER          "tuned_gains.h"
+#define MAX_THREADS             64
+
+// Score, summed per scenario and averaged over the scenarios
+#define TUNE_THETA_BAND         0.02    // rad, settled body angle
+#define TUNE_PHI_BAND           0.2     // rad, settled wheel angle
+#define TUNE_W_SETTLE           1.0     // per second to settle
+#define TUNE_W_OVERSHOOT        2.0     // per fraction of the initial error
+#define TUNE_W_EFFORT           1.0     // per mean squared duty
+#define TUNE_TIP_PENALTY        100.0   // plus as much again scaled by how
+                                        // early in the run it tipped
+#define TUNE_INFEASIBLE         1e9     // unstable controller poles
+
+// Nelder-Mead, in the tune_params_t space
+#define TUNE_PARAMS             7
+#define TUNE_INITIAL_STEP       0.15
+#define NM_REFLECT              1.0
+#define NM_EXPAND               2.0
+#define NM_CONTRACT             0.5
+#define NM_SHRINK               0.5
+
+// sensors, the same noise the simulator adds
+#define TUNE_GYRO_NOISE         0.1     // deg/s rms
+#define TUNE_ACCEL_NOISE        0.05    // m/s^2 rms
+
+// One closed loop run
+typedef struct tune_scenario_t
+{
+  const char* name;
+  float theta0;         // released at this body angle
+  float phi_r;          // wheel angle reference
+
+} tune_scenario_t;
+
+// D1 and D2 as balance_by_daniel.h spells them
+typedef struct tune_gains_t
+{
+  float d1_gain;
+  float d1_num[3];
+  float d1_den[3];
+  float d2_gain;
+  float d2_num[2];
+  float d2_den[2];
+
+} tune_gains_t;
+
+typedef struct tune_score_t
+{
+  double cost;
+  double settle;        // s
+  double overshoot;     // fraction of the initial error
+  double effort;        // mean squared duty
+  double tipped;        // runs that fell over
+
+} tune_score_t;
+
+// One candidate in one scenario, what the pool hands out
+typedef struct tune_job_t
+{
+  tune_gains_t gains;
+  int scenario;
+  tune_score_t score;
+
+} tune_job_t;
+
+// Worker threads that stay up between batches
+typedef struct tune_pool_t
+{
+  pthread_t threads[MAX_THREADS];
+  int nthreads;         // including the caller
+  pthread_mutex_t lock;
+  pthread_cond_t go;
+  pthread_cond_t done;
+  int generation;
+  int busy;
+  int quit;
+  tune_job_t* jobs;
+  int njobs;
+  atomic_int next;
+  uint64_t trials;
+  float seconds;
+
+} tune_pool_t;